@@ -0,0 +1,288 @@
+#include "bench.h"
+#include "color.h"
+#include "export.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include "render.h"
+#include "series.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Inputs shared by every benchmark, built once before any is timed
+typedef struct {
+  State *state;
+  Point3D *points;        // BENCH_MAX_POINTS of the default trajectory
+  unsigned char *colors;  // Rainbow colors of them
+  RenderConfig config;
+  Image img;
+  float *depth;
+  const char *seriesPath; // x(t) as text, one value per line
+  double seriesMB;
+  const BenchGl *gl;
+  const char *glSkip;     // Why the GL benchmarks cannot run, or NULL
+} BenchData;
+
+typedef struct Bench Bench;
+
+// One benchmark: run does one timed repetition and returns the work done
+// in `unit`, 0 on failure
+struct Bench {
+  const char *name;
+  const char *unit;
+  int size;               // Points per repetition
+  int mode;               // Color mode, where one is used
+  const char *path;       // Output file, where one is written
+  double (*run)(const Bench *b, BenchData *d);
+  int gl;                 // Draws through the viewer's OpenGL
+};
+
+static double runCompute(const Bench *b, BenchData *d) {
+  computeLorenzPoints(d->state);
+  return LORENZ_POINTS;
+}
+
+/*
+ *  computeLorenzPoints' loop into a buffer of any size, to see where the
+ *  stores stop fitting in cache
+ */
+static double runIntegrate(const Bench *b, BenchData *d) {
+  double x = 1.0, y = 1.0, z = 1.0;
+  for (int i = 0; i < b->size; i++) {
+    lorenzStep(10.0, 8.0 / 3.0, 28.0, LORENZ_DT, &x, &y, &z);
+    d->points[i] = (Point3D){x, y, z};
+  }
+  return b->size;
+}
+
+static double runColor(const Bench *b, BenchData *d) {
+  colorFill(b->mode, b->size, d->colors);
+  return b->size;
+}
+
+static double runRaster(const Bench *b, BenchData *d) {
+  renderFrame(&d->config, d->points, b->size, d->colors, 30.0, d->config.ph,
+              &d->img, d->depth);
+  return b->size;
+}
+
+static double runDraw(const Bench *b, BenchData *d) {
+  d->gl->draw(d->points, b->size);
+  return b->size;
+}
+
+static double runExport(const Bench *b, BenchData *d) {
+  long long bytes = exportPoints(b->path, d->points, d->colors, b->size);
+  remove(b->path);
+  return bytes / 1e6;
+}
+
+static double runImport(const Bench *b, BenchData *d) {
+  int count = 0;
+  double *series = loadSeries(d->seriesPath, &count);
+  free(series);
+  return series && count == b->size ? d->seriesMB : 0;
+}
+
+static const Bench benches[] = {
+    {"computeLorenzPoints", "steps/s", LORENZ_POINTS, 0, NULL, runCompute},
+    {"integrate", "steps/s", 10000, 0, NULL, runIntegrate},
+    {"integrate", "steps/s", 100000, 0, NULL, runIntegrate},
+    {"integrate", "steps/s", 1000000, 0, NULL, runIntegrate},
+    {"integrate", "steps/s", BENCH_MAX_POINTS, 0, NULL, runIntegrate},
+    // The fade run overwrites the rainbow colors the later runs draw and
+    // write; the rainbow run restores them
+    {"color fade", "points/s", 1000000, COLOR_FADE, NULL, runColor},
+    {"color rainbow", "points/s", BENCH_MAX_POINTS, COLOR_RAINBOW, NULL,
+     runColor},
+    {"raster", "points/s", LORENZ_POINTS, 0, NULL, runRaster},
+    {"raster", "points/s", 1000000, 0, NULL, runRaster},
+    {"gl draw", "points/s", LORENZ_POINTS, 0, NULL, runDraw, 1},
+    {"gl draw", "points/s", 1000000, 0, NULL, runDraw, 1},
+    {"export ply", "MB/s", 1000000, 0, "bench_export.ply", runExport},
+    {"export obj", "MB/s", 1000000, 0, "bench_export.obj", runExport},
+    {"export glb", "MB/s", 1000000, 0, "bench_export.glb", runExport},
+    {"import series", "MB/s", 1000000, 0, NULL, runImport},
+};
+
+static int compareDouble(const void *a, const void *b) {
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+/*
+ *  Order statistics, mean and sample deviation of the timed runs; sorts
+ *  `seconds` in place
+ */
+void benchSummarize(double *seconds, int reps, BenchSummary *summary) {
+  qsort(seconds, reps, sizeof(double), compareDouble);
+  summary->min = seconds[0];
+  summary->max = seconds[reps - 1];
+  summary->median = reps % 2 ? seconds[reps / 2]
+                             : 0.5 * (seconds[reps / 2 - 1] +
+                                      seconds[reps / 2]);
+  summary->mean = 0;
+  for (int i = 0; i < reps; i++)
+    summary->mean += seconds[i] / reps;
+  double var = 0;
+  for (int i = 0; i < reps; i++)
+    var += (seconds[i] - summary->mean) * (seconds[i] - summary->mean);
+  summary->stddev = reps > 1 ? sqrt(var / (reps - 1)) : 0;
+}
+
+static void freeData(BenchData *d) {
+  free(d->state);
+  free(d->points);
+  free(d->colors);
+  free(d->depth);
+  imageFree(&d->img);
+  if (d->seriesPath)
+    remove(d->seriesPath);
+  if (d->gl && !d->glSkip)
+    d->gl->close();
+}
+
+/*
+ *  The trajectory, its colors, a frame to raster into, the series file to
+ *  import and a GL window if there is a display; returns 0 on failure
+ */
+static int initData(BenchData *d, const BenchGl *gl) {
+  memset(d, 0, sizeof(*d));
+  d->gl = gl;
+  d->glSkip = gl ? gl->open() : "built without OpenGL";
+  renderDefaultConfig(&d->config);
+  d->config.width = 640;
+  d->config.height = 360;
+  d->state = calloc(1, sizeof(State));
+  d->points = malloc(BENCH_MAX_POINTS * sizeof(Point3D));
+  d->colors = malloc(3 * (size_t)BENCH_MAX_POINTS);
+  d->depth = malloc((size_t)d->config.width * d->config.height *
+                    sizeof(float));
+  if (!d->state || !d->points || !d->colors || !d->depth ||
+      !imageInit(&d->img, d->config.width, d->config.height))
+    return 0;
+  d->state->s = 10.0;
+  d->state->b = 8.0 / 3.0;
+  d->state->r = 28.0;
+  Bench fill = {NULL, NULL, BENCH_MAX_POINTS, COLOR_RAINBOW};
+  runIntegrate(&fill, d);
+  runColor(&fill, d);
+
+  FILE *file = fopen("bench_series.txt", "w");
+  if (!file)
+    return 0;
+  d->seriesPath = "bench_series.txt";
+  for (int i = 0; i < 1000000; i++)
+    fprintf(file, "%.9f\n", d->points[i].x);
+  d->seriesMB = ftell(file) / 1e6;
+  return fclose(file) == 0;
+}
+
+static void writeJson(FILE *file, const char *label, int reps,
+                      const BenchSummary *summaries, const double *work,
+                      const char *glSkip) {
+  time_t now = time(NULL);
+  char date[32];
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  fprintf(file,
+          "{\n  \"label\": \"%s\",\n  \"date\": \"%s\",\n"
+          "  \"threads\": %d,\n  \"warmup\": %d,\n  \"reps\": %d,\n"
+          "  \"results\": [",
+          label, date, parallelThreads(), BENCH_WARMUP, reps);
+  int count = sizeof(benches) / sizeof(benches[0]);
+  for (int k = 0; k < count; k++) {
+    const Bench *b = &benches[k];
+    const BenchSummary *s = &summaries[k];
+    if (b->gl && glSkip) {
+      fprintf(file,
+              "%s\n    {\"name\": \"%s\", \"size\": %d, \"unit\": \"%s\", "
+              "\"skipped\": \"%s\"}",
+              k ? "," : "", b->name, b->size, b->unit, glSkip);
+      continue;
+    }
+    fprintf(file,
+            "%s\n    {\"name\": \"%s\", \"size\": %d, \"unit\": \"%s\", "
+            "\"throughput\": %.6g,\n     \"seconds\": {\"min\": %.6g, "
+            "\"median\": %.6g, \"mean\": %.6g, \"stddev\": %.6g, "
+            "\"max\": %.6g}}",
+            k ? "," : "", b->name, b->size, b->unit, work[k] / s->median,
+            s->min, s->median, s->mean, s->stddev, s->max);
+  }
+  fprintf(file, "\n  ]\n}\n");
+}
+
+/*
+ *  bench [file.json [reps [label]]]: every benchmark, warmed up, then
+ *  timed `reps` times; throughput is from the median run. The GL draws are
+ *  skipped, with the reason recorded, when there is no display
+ */
+int benchCommand(int argc, char *argv[], const BenchGl *gl) {
+  const char *path = argc > 1 ? argv[1] : "bench.json";
+  int reps = argc > 2 ? atoi(argv[2]) : BENCH_REPS;
+  const char *label = argc > 3 ? argv[3] : "";
+  if (reps < 1 || strpbrk(label, "\"\\")) {
+    fprintf(stderr, "bench: need reps >= 1 and a label without quotes\n");
+    return 1;
+  }
+  int count = sizeof(benches) / sizeof(benches[0]);
+  BenchData d;
+  BenchSummary summaries[sizeof(benches) / sizeof(benches[0])];
+  double work[sizeof(benches) / sizeof(benches[0])];
+  int ready = initData(&d, gl);
+  double *seconds = malloc(reps * sizeof(double));
+  if (!ready || !seconds) {
+    fprintf(stderr, "bench: cannot set up the inputs\n");
+    free(seconds);
+    freeData(&d);
+    return 1;
+  }
+
+  printf("%-20s %8s %10s %9s %14s\n", "benchmark", "size", "median ms",
+         "sd %", "throughput");
+  int ok = 1;
+  for (int k = 0; k < count && ok; k++) {
+    const Bench *b = &benches[k];
+    if (b->gl && d.glSkip) {
+      printf("%-20s %8d skipped: %s\n", b->name, b->size, d.glSkip);
+      continue;
+    }
+    for (int i = 0; i < BENCH_WARMUP; i++)
+      b->run(b, &d);
+    for (int i = 0; i < reps && ok; i++) {
+      double t0 = wallTime();
+      work[k] = b->run(b, &d);
+      seconds[i] = wallTime() - t0;
+      ok = work[k] > 0;
+    }
+    if (!ok) {
+      fprintf(stderr, "bench: %s failed\n", b->name);
+      break;
+    }
+    benchSummarize(seconds, reps, &summaries[k]);
+    const BenchSummary *s = &summaries[k];
+    printf("%-20s %8d %10.3f %8.1f%% %10.4g %s\n", b->name, b->size,
+           1e3 * s->median, 100 * s->stddev / s->mean,
+           work[k] / s->median, b->unit);
+  }
+  free(seconds);
+  const char *glSkip = d.glSkip;
+  freeData(&d);
+  if (!ok)
+    return 1;
+
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    fprintf(stderr, "bench: cannot write %s\n", path);
+    return 1;
+  }
+  writeJson(file, label, reps, summaries, work, glSkip);
+  if (fclose(file)) {
+    fprintf(stderr, "bench: cannot write %s\n", path);
+    return 1;
+  }
+  printf("Wrote %s (threads=%d, %d warmup + %d timed runs each)\n", path,
+         parallelThreads(), BENCH_WARMUP, reps);
+  return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "state.h"
+
+// Untimed runs before each benchmark, and timed runs by default
+#define BENCH_WARMUP 2
+#define BENCH_REPS 10
+
+// Largest trajectory any benchmark uses
+#define BENCH_MAX_POINTS 4000000
+
+// Where a benchmark spent its timed runs, in seconds
+typedef struct {
+  double min, median, mean, stddev, max;
+} BenchSummary;
+
+// The viewer's OpenGL drawing, which only main.c can reach: open makes a
+// hidden window and returns NULL, or why there can be none; draw submits
+// `count` points through drawTrajectory and waits for GL to finish
+typedef struct {
+  const char *(*open)(void);
+  void (*draw)(const Point3D *points, int count);
+  void (*close)(void);
+} BenchGl;
+
+void benchSummarize(double *seconds, int reps, BenchSummary *summary);
+int benchCommand(int argc, char *argv[], const BenchGl *gl);
+
+#endif // BENCH_H
@@ -0,0 +1,465 @@
+#include "butterfly.h"
+#include "parallel.h"
+#include "rng.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUTTERFLY_SPINUP 1000          // Steps onto the attractor
+#define BUTTERFLY_CHECK 100            // Steps between cancellation checks
+#define BUTTERFLY_STATS_SEED 0x6266ULL // First seed of the background runs
+#define BUTTERFLY_FIT_RUNS 8           // Ensembles averaged for the growth rate
+
+struct ButterflyStats {
+  int bins;
+  pthread_t thread;     // Hands queued runs to the background pool
+  int started;
+  atomic_int cancel;    // Raised to abandon the runs in progress
+
+  // Everything below is guarded by lock
+  pthread_mutex_t lock;
+  pthread_cond_t wake;  // Runs queued or shutting down
+  pthread_cond_t idle;  // A run finished
+  ButterflyConfig config;
+  int nextRun;          // Next run to hand out
+  int runCount;
+  int finished;         // Runs added to the histogram
+  int busy;             // Runs being worked on
+  int quit;
+  long long *counts;    // Divergence times in bins over [0, steps * dt)
+  long long never;      // Copies still within threshold at the end
+};
+
+void butterflyDefaultConfig(ButterflyConfig *config, double s, double b,
+                            double r) {
+  config->s = s;
+  config->b = b;
+  config->r = r;
+  config->eps = 1e-6;
+  config->threshold = 1.0;
+  config->dt = 0.01;
+  config->copies = BUTTERFLY_VIEW_COPIES;
+  config->steps = 3000;
+}
+
+/*
+ *  Samples per member when every stride-th state is kept, including t = 0
+ */
+int butterflySamples(const ButterflyConfig *config, int stride) {
+  return config->steps / stride + 1;
+}
+
+/*
+ *  Advance n members one RK4 step; one iteration per member with no
+ *  dependence between them, so the loop vectorizes across the ensemble
+ */
+static void stepLanes(const ButterflyConfig *c, int n, double *restrict x,
+                      double *restrict y, double *restrict z) {
+  double s = c->s, b = c->b, r = c->r, h = c->dt;
+  for (int j = 0; j < n; j++) {
+    double x0 = x[j], y0 = y[j], z0 = z[j];
+    double ax = s * (y0 - x0), ay = x0 * (r - z0) - y0, az = x0 * y0 - b * z0;
+    double x1 = x0 + 0.5 * h * ax, y1 = y0 + 0.5 * h * ay,
+           z1 = z0 + 0.5 * h * az;
+    double bx = s * (y1 - x1), by = x1 * (r - z1) - y1, bz = x1 * y1 - b * z1;
+    double x2 = x0 + 0.5 * h * bx, y2 = y0 + 0.5 * h * by,
+           z2 = z0 + 0.5 * h * bz;
+    double cx = s * (y2 - x2), cy = x2 * (r - z2) - y2, cz = x2 * y2 - b * z2;
+    double x3 = x0 + h * cx, y3 = y0 + h * cy, z3 = z0 + h * cz;
+    double dx = s * (y3 - x3), dy = x3 * (r - z3) - y3, dz = x3 * y3 - b * z3;
+    x[j] = x0 + h / 6 * (ax + 2 * (bx + cx) + dx);
+    y[j] = y0 + h / 6 * (ay + 2 * (by + cy) + dy);
+    z[j] = z0 + h / 6 * (az + 2 * (bz + cz) + dz);
+  }
+}
+
+/*
+ *  Squared distance of every copy from the reference, member 0
+ */
+static void separationLanes(int copies, const double *restrict x,
+                            const double *restrict y,
+                            const double *restrict z, double *restrict d2) {
+  double x0 = x[0], y0 = y[0], z0 = z[0];
+  for (int j = 0; j < copies; j++) {
+    double dx = x[j + 1] - x0, dy = y[j + 1] - y0, dz = z[j + 1] - z0;
+    d2[j] = dx * dx + dy * dy + dz * dz;
+  }
+}
+
+/*
+ *  Integrate one ensemble; the reference starts on the attractor at a
+ *  point chosen by the seed. Returns 0 on allocation failure or when
+ *  cancel is raised partway through.
+ */
+static int runEnsemble(const ButterflyConfig *c, uint64_t seed, int stride,
+                       Point3D *paths, double *logSeparation,
+                       double *divergence, atomic_int *cancel) {
+  int n = c->copies + 1, samples = butterflySamples(c, stride);
+  double *x = malloc(n * sizeof(double));
+  double *y = malloc(n * sizeof(double));
+  double *z = malloc(n * sizeof(double));
+  double *d2 = malloc(4 * n * sizeof(double));
+  if (!x || !y || !z || !d2) {
+    free(x);
+    free(y);
+    free(z);
+    free(d2);
+    return 0;
+  }
+
+  x[0] = -15.0 + 30.0 * philoxUniform(seed, 0, 0);
+  y[0] = -20.0 + 40.0 * philoxUniform(seed, 0, 1);
+  z[0] = 5.0 + 40.0 * philoxUniform(seed, 0, 2);
+  for (int k = 0; k < BUTTERFLY_SPINUP; k++)
+    stepLanes(c, 1, x, y, z);
+
+  // Random directions: normalized triples of standard normals
+  philoxNormals(seed, 1, 0, c->copies, d2);
+  for (int j = 0; j < c->copies; j++) {
+    double u = d2[j], v = d2[c->copies + j], w = d2[2 * c->copies + j];
+    double scale = c->eps / sqrt(u * u + v * v + w * w);
+    x[j + 1] = x[0] + scale * u;
+    y[j + 1] = y[0] + scale * v;
+    z[j + 1] = z[0] + scale * w;
+    if (divergence)
+      divergence[j] = -1.0;
+  }
+
+  double t2 = c->threshold * c->threshold;
+  int ok = 1;
+  for (int k = 0; k <= c->steps; k++) {
+    if (k > 0) {
+      if (cancel && k % BUTTERFLY_CHECK == 0 &&
+          atomic_load_explicit(cancel, memory_order_relaxed)) {
+        ok = 0;
+        break;
+      }
+      stepLanes(c, n, x, y, z);
+    }
+    int sample = k % stride == 0 && k / stride < samples ? k / stride : -1;
+    if (paths && sample >= 0)
+      for (int j = 0; j < n; j++) {
+        Point3D p = {x[j], y[j], z[j]};
+        paths[(size_t)j * samples + sample] = p;
+      }
+    if (!divergence && !(logSeparation && sample >= 0))
+      continue;
+    separationLanes(c->copies, x, y, z, d2);
+    if (divergence)
+      for (int j = 0; j < c->copies; j++)
+        if (divergence[j] < 0 && d2[j] >= t2)
+          divergence[j] = k * c->dt;
+    if (logSeparation && sample >= 0) {
+      double sum = 0.0;
+      for (int j = 0; j < c->copies; j++)
+        sum += log10(d2[j] > 0 ? d2[j] : 1e-300);
+      logSeparation[sample] = 0.5 * sum / c->copies;
+    }
+  }
+  free(x);
+  free(y);
+  free(z);
+  free(d2);
+  return ok;
+}
+
+/*
+ *  Reference plus copies for config->steps steps. Optional outputs: paths
+ *  holds butterflySamples() states per member, member after member;
+ *  logSeparation the mean log10 distance of the copies from the reference
+ *  at each sample; divergence the first time each copy is threshold away
+ *  (-1 if never). Returns 0 on allocation failure.
+ */
+int butterflyEnsemble(const ButterflyConfig *config, uint64_t seed, int stride,
+                      Point3D *paths, double *logSeparation,
+                      double *divergence) {
+  if (config->copies < 1 || config->steps < 1 || stride < 1)
+    return 0;
+  return runEnsemble(config, seed, stride, paths, logSeparation, divergence,
+                     NULL);
+}
+
+/*
+ *  Queued runs, one at a time, until none are left; every worker does the
+ *  same whatever share of the items it was given
+ */
+static void runQueued(void *ctx, int begin, int end, int thread) {
+  ButterflyStats *st = ctx;
+  double *divergence = NULL;
+  int capacity = 0;
+  long long *counts = malloc(st->bins * sizeof(long long));
+  for (;;) {
+    pthread_mutex_lock(&st->lock);
+    if (st->nextRun >= st->runCount) {
+      pthread_mutex_unlock(&st->lock);
+      break;
+    }
+    int run = st->nextRun++;
+    ButterflyConfig c = st->config;
+    st->busy++;
+    pthread_mutex_unlock(&st->lock);
+
+    if (capacity < c.copies) {
+      free(divergence);
+      divergence = malloc(c.copies * sizeof(double));
+      capacity = divergence ? c.copies : 0;
+    }
+    long long never = 0;
+    int ok = counts && divergence &&
+             runEnsemble(&c, BUTTERFLY_STATS_SEED + run, c.steps, NULL, NULL,
+                         divergence, &st->cancel);
+    if (ok) {
+      double horizon = c.steps * c.dt;
+      memset(counts, 0, st->bins * sizeof(long long));
+      for (int j = 0; j < c.copies; j++) {
+        int bin = (int)(divergence[j] / horizon * st->bins);
+        if (divergence[j] < 0)
+          never++;
+        else
+          counts[bin < st->bins ? bin : st->bins - 1]++;
+      }
+    }
+
+    pthread_mutex_lock(&st->lock);
+    if (!atomic_load(&st->cancel)) {
+      for (int i = 0; ok && i < st->bins; i++)
+        st->counts[i] += counts[i];
+      st->never += ok ? never : 0;
+      st->finished++;
+    }
+    st->busy--;
+    pthread_cond_broadcast(&st->idle);
+    pthread_mutex_unlock(&st->lock);
+  }
+  free(divergence);
+  free(counts);
+}
+
+/*
+ *  Background thread: while runs are queued, work through them on the
+ *  background share of the threads, leaving the rest to the viewer's own
+ *  parallelFor calls
+ */
+static void *workerMain(void *arg) {
+  ButterflyStats *st = arg;
+  pthread_mutex_lock(&st->lock);
+  for (;;) {
+    while (!st->quit && st->nextRun >= st->runCount)
+      pthread_cond_wait(&st->wake, &st->lock);
+    if (st->quit)
+      break;
+    pthread_mutex_unlock(&st->lock);
+    parallelForBackground(parallelBackgroundThreads(), runQueued, st);
+    pthread_mutex_lock(&st->lock);
+  }
+  pthread_mutex_unlock(&st->lock);
+  return NULL;
+}
+
+/*
+ *  Stop handing out runs and wait for the ones being worked on to be
+ *  dropped; called with the lock held
+ */
+static void cancelRuns(ButterflyStats *st) {
+  atomic_store(&st->cancel, 1);
+  st->nextRun = st->runCount;
+  while (st->busy > 0)
+    pthread_cond_wait(&st->idle, &st->lock);
+  atomic_store(&st->cancel, 0);
+}
+
+/*
+ *  Start the background thread that feeds the background pool; returns
+ *  NULL if nothing could be allocated or started
+ */
+ButterflyStats *butterflyStatsCreate(int bins) {
+  ButterflyStats *st = calloc(1, sizeof(ButterflyStats));
+  if (!st)
+    return NULL;
+  st->bins = bins > 0 ? bins : 1;
+  pthread_mutex_init(&st->lock, NULL);
+  pthread_cond_init(&st->wake, NULL);
+  pthread_cond_init(&st->idle, NULL);
+  atomic_init(&st->cancel, 0);
+  st->counts = calloc(st->bins, sizeof(long long));
+  if (!st->counts) {
+    butterflyStatsDestroy(st);
+    return NULL;
+  }
+
+  st->started = pthread_create(&st->thread, NULL, workerMain, st) == 0;
+  if (!st->started) {
+    butterflyStatsDestroy(st);
+    return NULL;
+  }
+  return st;
+}
+
+void butterflyStatsDestroy(ButterflyStats *stats) {
+  if (!stats)
+    return;
+  if (stats->started) {
+    pthread_mutex_lock(&stats->lock);
+    cancelRuns(stats);
+    stats->quit = 1;
+    pthread_cond_broadcast(&stats->wake);
+    pthread_mutex_unlock(&stats->lock);
+    pthread_join(stats->thread, NULL);
+  }
+  pthread_mutex_destroy(&stats->lock);
+  pthread_cond_destroy(&stats->wake);
+  pthread_cond_destroy(&stats->idle);
+  free(stats->counts);
+  free(stats);
+}
+
+/*
+ *  Abandon the runs in progress, clear the histogram and queue `runs` new
+ *  ensembles with independent seeds
+ */
+void butterflyStatsStart(ButterflyStats *stats, const ButterflyConfig *config,
+                         int runs) {
+  pthread_mutex_lock(&stats->lock);
+  cancelRuns(stats);
+  memset(stats->counts, 0, stats->bins * sizeof(long long));
+  stats->never = 0;
+  stats->finished = 0;
+  stats->config = *config;
+  stats->runCount = runs;
+  stats->nextRun = 0;
+  pthread_cond_broadcast(&stats->wake);
+  pthread_mutex_unlock(&stats->lock);
+}
+
+void butterflyStatsStop(ButterflyStats *stats) {
+  pthread_mutex_lock(&stats->lock);
+  cancelRuns(stats);
+  pthread_mutex_unlock(&stats->lock);
+}
+
+/*
+ *  Copy the histogram so far (bins entries) and the count of copies that
+ *  never diverged; returns the runs it covers
+ */
+int butterflyStatsRead(ButterflyStats *stats, long long *counts,
+                       long long *never) {
+  pthread_mutex_lock(&stats->lock);
+  memcpy(counts, stats->counts, stats->bins * sizeof(long long));
+  *never = stats->never;
+  int finished = stats->finished;
+  pthread_mutex_unlock(&stats->lock);
+  return finished;
+}
+
+/*
+ *  butterfly [copies [runs [eps [file.csv]]]]: time one ensemble, estimate
+ *  the separation growth rate from it and histogram the divergence times
+ *  of many ensembles in the background workers
+ */
+int butterflyCommand(int argc, char *argv[]) {
+  ButterflyConfig c;
+  butterflyDefaultConfig(&c, 10.0, 8.0 / 3.0, 28.0);
+  c.copies = argc > 1 ? atoi(argv[1]) : BUTTERFLY_VIEW_COPIES;
+  int runs = argc > 2 ? atoi(argv[2]) : 64;
+  c.eps = argc > 3 ? atof(argv[3]) : c.eps;
+  const char *path = argc > 4 ? argv[4] : NULL;
+  if (c.copies < 1 || runs < 1 || !(c.eps > 0)) {
+    fprintf(stderr, "butterfly: need copies >= 1, runs >= 1, eps > 0\n");
+    return 1;
+  }
+
+  // Mean log separation averaged over a few references
+  int samples = butterflySamples(&c, 1);
+  double *logSep = calloc(samples, sizeof(double));
+  double *one = malloc(samples * sizeof(double));
+  double t0 = wallTime();
+  int ok = logSep && one;
+  for (int i = 0; ok && i < BUTTERFLY_FIT_RUNS; i++) {
+    ok = butterflyEnsemble(&c, BUTTERFLY_STATS_SEED + i, 1, NULL, one, NULL);
+    for (int k = 0; ok && k < samples; k++)
+      logSep[k] += one[k] / BUTTERFLY_FIT_RUNS;
+  }
+  free(one);
+  if (!ok) {
+    fprintf(stderr, "butterfly: cannot allocate %d copies\n", c.copies);
+    free(logSep);
+    return 1;
+  }
+  double t = (wallTime() - t0) / BUTTERFLY_FIT_RUNS;
+  printf("Butterfly: %d copies at eps=%g, threshold %g, dt=%g, %d steps: "
+         "%.3f s per ensemble (%.3e member-steps/s)\n",
+         c.copies, c.eps, c.threshold, c.dt, c.steps, t,
+         (c.copies + 1.0) * c.steps / t);
+
+  // Least squares slope of the mean log separation while it grows
+  // exponentially, a decade clear of both eps and the threshold
+  double lo = log10(c.eps) + 1, hi = log10(c.threshold) - 1;
+  double sw = 0, st = 0, sv = 0, stt = 0, stv = 0;
+  for (int k = 0; k < samples && logSep[k] < hi; k++)
+    if (logSep[k] > lo) {
+      double tk = k * c.dt;
+      sw++;
+      st += tk;
+      sv += logSep[k];
+      stt += tk * tk;
+      stv += tk * logSep[k];
+    }
+  free(logSep);
+  if (sw > 2)
+    printf("Separation growth rate %.3f (largest Lyapunov exponent ~0.906)\n",
+           (sw * stv - st * sv) / (sw * stt - st * st) * log(10.0));
+
+  ButterflyStats *stats = butterflyStatsCreate(BUTTERFLY_VIEW_BINS);
+  long long *counts = malloc(BUTTERFLY_VIEW_BINS * sizeof(long long));
+  if (!stats || !counts) {
+    fprintf(stderr, "butterfly: cannot start the workers\n");
+    butterflyStatsDestroy(stats);
+    free(counts);
+    return 1;
+  }
+  // Nothing else runs, so the statistics may use every thread
+  parallelSetBackgroundThreads(parallelThreads());
+  t0 = wallTime();
+  butterflyStatsStart(stats, &c, runs);
+  pthread_mutex_lock(&stats->lock);
+  while (stats->finished < runs)
+    pthread_cond_wait(&stats->idle, &stats->lock);
+  pthread_mutex_unlock(&stats->lock);
+  t = wallTime() - t0;
+
+  long long never, total = 0;
+  butterflyStatsRead(stats, counts, &never);
+  double horizon = c.steps * c.dt, width = horizon / BUTTERFLY_VIEW_BINS;
+  double mean = 0, median = -1;
+  for (int i = 0; i < BUTTERFLY_VIEW_BINS; i++) {
+    total += counts[i];
+    mean += counts[i] * (i + 0.5) * width;
+  }
+  for (long long i = 0, seen = 0; i < BUTTERFLY_VIEW_BINS && median < 0; i++)
+    if ((seen += counts[i]) * 2 >= total + never)
+      median = (i + 0.5) * width;
+  printf("%d runs on %d threads: %.3f s (%.3e member-steps/s)\n", runs,
+         parallelThreads(), t, (double)runs * (c.copies + 1) * c.steps / t);
+  printf("Divergence time: mean %.2f, median %.2f, %lld of %lld copies "
+         "never diverged; ln(threshold/eps)/0.906 = %.2f\n",
+         total ? mean / total : 0.0, median, never, total + never,
+         log(c.threshold / c.eps) / 0.906);
+
+  if (path) {
+    FILE *file = fopen(path, "w");
+    ok = file != NULL;
+    if (file) {
+      fprintf(file, "t,count\n");
+      for (int i = 0; i < BUTTERFLY_VIEW_BINS; i++)
+        fprintf(file, "%g,%lld\n", (i + 0.5) * width, counts[i]);
+      ok = fclose(file) == 0;
+    }
+    printf("%s %s\n", ok ? "Histogram ->" : "Cannot write", path);
+  }
+  butterflyStatsDestroy(stats);
+  free(counts);
+  return ok ? 0 : 1;
+}
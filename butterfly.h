@@ -0,0 +1,44 @@
+#ifndef BUTTERFLY_H
+#define BUTTERFLY_H
+
+#include "state.h"
+#include <stdint.h>
+
+// Viewer ensemble: copies, sampling stride, divergence histogram bins and
+// background runs behind the histogram
+#define BUTTERFLY_VIEW_COPIES 1024
+#define BUTTERFLY_VIEW_STRIDE 5
+#define BUTTERFLY_VIEW_BINS 60
+#define BUTTERFLY_VIEW_RUNS 1024
+
+// A reference trajectory and K copies displaced from it by eps in random
+// directions, integrated together until they have spread over the attractor
+typedef struct {
+  double s, b, r;
+  double eps;       // Initial displacement of every copy
+  double threshold; // Separation at which a copy counts as diverged
+  double dt;        // RK4 step
+  int copies;       // K; member 0 of an ensemble is the reference
+  int steps;        // Steps per ensemble
+} ButterflyConfig;
+
+// Histogram of divergence times over many seeds, filled in the background
+// on the background share of the threads
+typedef struct ButterflyStats ButterflyStats;
+
+void butterflyDefaultConfig(ButterflyConfig *config, double s, double b,
+                            double r);
+int butterflySamples(const ButterflyConfig *config, int stride);
+int butterflyEnsemble(const ButterflyConfig *config, uint64_t seed, int stride,
+                      Point3D *paths, double *logSeparation,
+                      double *divergence);
+ButterflyStats *butterflyStatsCreate(int bins);
+void butterflyStatsDestroy(ButterflyStats *stats);
+void butterflyStatsStart(ButterflyStats *stats, const ButterflyConfig *config,
+                         int runs);
+void butterflyStatsStop(ButterflyStats *stats);
+int butterflyStatsRead(ButterflyStats *stats, long long *counts,
+                       long long *never);
+int butterflyCommand(int argc, char *argv[]);
+
+#endif // BUTTERFLY_H
@@ -0,0 +1,415 @@
+#include "chaosmap.h"
+#include "image.h"
+#include "parallel.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHAOS_COARSE 16       // Pixel stride of the first refinement pass
+#define CHAOS_LANES 64        // Parameter points integrated together
+#define CHAOS_DT 0.01         // RK4 step
+#define CHAOS_TRANSIENT 1000  // Steps discarded before measuring
+#define CHAOS_MEASURE 3000    // Steps averaged into the exponent
+#define CHAOS_RENORM 10       // Steps between tangent renormalizations
+#define CHAOS_ZERO 0.02       // Exponents below this count as regular
+
+struct ChaosMap {
+  int width;
+  int height;
+  double rmin, rmax, smin, smax;
+  double b;
+  float *field;         // Exponent per pixel, rows top to bottom
+  atomic_uchar *done;   // Set once the matching field entry is final
+  pthread_t thread;     // Hands queued tasks to the background pool
+  int started;
+
+  // Everything below is guarded by lock
+  pthread_mutex_t lock;
+  pthread_cond_t wake;  // Work queued or shutting down
+  pthread_cond_t idle;  // A task finished
+  int running;          // Pass in progress (tasks left or being worked on)
+  int nextTask;         // Next (level, row) task to hand out
+  int taskCount;
+  int busy;             // Tasks being worked on
+  int finished;         // Pixels completed in this pass
+  int rendered;         // Value of finished at the last render
+  int quit;
+  atomic_int cancel;    // Raised to abandon the current pass
+};
+
+/*
+ *  Largest Lyapunov exponent at n parameter points by the Benettin method:
+ *  RK4 on the state and one tangent vector, renormalized every few steps.
+ *  Returns 0 if the pass was cancelled partway through.
+ */
+static int lyapunovLanes(ChaosMap *map, int n, const double *restrict rs,
+                         const double *restrict ss, double *restrict lambda) {
+  double x[CHAOS_LANES], y[CHAOS_LANES], z[CHAOS_LANES];
+  double u[CHAOS_LANES], v[CHAOS_LANES], w[CHAOS_LANES];
+  double sum[CHAOS_LANES];
+  double b = map->b, h = CHAOS_DT;
+  for (int j = 0; j < n; j++) {
+    x[j] = y[j] = z[j] = 1.0;
+    u[j] = v[j] = w[j] = sqrt(1.0 / 3);
+    sum[j] = 0;
+  }
+
+  for (int k = 0; k < CHAOS_TRANSIENT + CHAOS_MEASURE; k += CHAOS_RENORM) {
+    if (atomic_load_explicit(&map->cancel, memory_order_relaxed))
+      return 0;
+    for (int m = 0; m < CHAOS_RENORM; m++)
+      for (int j = 0; j < n; j++) {
+        double s = ss[j], r = rs[j];
+        double x0 = x[j], y0 = y[j], z0 = z[j];
+        double u0 = u[j], v0 = v[j], w0 = w[j];
+        // Each stage evaluates f(x) and J(x) * (u, v, w)
+        double ax = s * (y0 - x0), ay = x0 * (r - z0) - y0, az = x0 * y0 - b * z0;
+        double au = s * (v0 - u0), av = (r - z0) * u0 - v0 - x0 * w0,
+               aw = y0 * u0 + x0 * v0 - b * w0;
+        double x1 = x0 + 0.5 * h * ax, y1 = y0 + 0.5 * h * ay,
+               z1 = z0 + 0.5 * h * az;
+        double u1 = u0 + 0.5 * h * au, v1 = v0 + 0.5 * h * av,
+               w1 = w0 + 0.5 * h * aw;
+        double bx = s * (y1 - x1), by = x1 * (r - z1) - y1, bz = x1 * y1 - b * z1;
+        double bu = s * (v1 - u1), bv = (r - z1) * u1 - v1 - x1 * w1,
+               bw = y1 * u1 + x1 * v1 - b * w1;
+        double x2 = x0 + 0.5 * h * bx, y2 = y0 + 0.5 * h * by,
+               z2 = z0 + 0.5 * h * bz;
+        double u2 = u0 + 0.5 * h * bu, v2 = v0 + 0.5 * h * bv,
+               w2 = w0 + 0.5 * h * bw;
+        double cx = s * (y2 - x2), cy = x2 * (r - z2) - y2, cz = x2 * y2 - b * z2;
+        double cu = s * (v2 - u2), cv = (r - z2) * u2 - v2 - x2 * w2,
+               cw = y2 * u2 + x2 * v2 - b * w2;
+        double x3 = x0 + h * cx, y3 = y0 + h * cy, z3 = z0 + h * cz;
+        double u3 = u0 + h * cu, v3 = v0 + h * cv, w3 = w0 + h * cw;
+        double dx = s * (y3 - x3), dy = x3 * (r - z3) - y3, dz = x3 * y3 - b * z3;
+        double du = s * (v3 - u3), dv = (r - z3) * u3 - v3 - x3 * w3,
+               dw = y3 * u3 + x3 * v3 - b * w3;
+        x[j] = x0 + h / 6 * (ax + 2 * (bx + cx) + dx);
+        y[j] = y0 + h / 6 * (ay + 2 * (by + cy) + dy);
+        z[j] = z0 + h / 6 * (az + 2 * (bz + cz) + dz);
+        u[j] = u0 + h / 6 * (au + 2 * (bu + cu) + du);
+        v[j] = v0 + h / 6 * (av + 2 * (bv + cv) + dv);
+        w[j] = w0 + h / 6 * (aw + 2 * (bw + cw) + dw);
+      }
+    // Separate loop so the log does not stop the one above vectorizing
+    int measuring = k >= CHAOS_TRANSIENT;
+    for (int j = 0; j < n; j++) {
+      double norm = sqrt(u[j] * u[j] + v[j] * v[j] + w[j] * w[j]);
+      if (measuring)
+        sum[j] += log(norm);
+      u[j] /= norm;
+      v[j] /= norm;
+      w[j] /= norm;
+    }
+  }
+  for (int j = 0; j < n; j++)
+    lambda[j] = sum[j] / (CHAOS_MEASURE * CHAOS_DT);
+  return 1;
+}
+
+/*
+ *  Map task index to a refinement pass (pixel stride) and grid row
+ */
+static void taskRow(const ChaosMap *map, int task, int *step, int *row) {
+  for (int st = CHAOS_COARSE;; st /= 2) {
+    int rows = (map->height + st - 1) / st;
+    if (task < rows || st == 1) {
+      *step = st;
+      *row = task * st;
+      return;
+    }
+    task -= rows;
+  }
+}
+
+static int countTasks(int height) {
+  int tasks = 0;
+  for (int st = CHAOS_COARSE; st >= 1; st /= 2)
+    tasks += (height + st - 1) / st;
+  return tasks;
+}
+
+/*
+ *  Compute the pixels of one row that this pass adds: every stride-th column,
+ *  minus those a coarser pass already covered. Returns the number finished.
+ */
+static int rowTask(ChaosMap *map, int step, int row) {
+  double rs[CHAOS_LANES], ss[CHAOS_LANES], lambda[CHAOS_LANES];
+  int cols[CHAOS_LANES];
+  int coarserRow = step < CHAOS_COARSE && row % (2 * step) == 0;
+  double s = map->smax - (row + 0.5) * (map->smax - map->smin) / map->height;
+  int finished = 0, n = 0;
+
+  for (int i = 0; i < map->width || n > 0; i += step) {
+    if (i < map->width) {
+      if (coarserRow && i % (2 * step) == 0)
+        continue;
+      cols[n] = i;
+      rs[n] = map->rmin + (i + 0.5) * (map->rmax - map->rmin) / map->width;
+      ss[n] = s;
+      if (++n < CHAOS_LANES)
+        continue;
+    }
+    if (!lyapunovLanes(map, n, rs, ss, lambda))
+      break;
+    for (int j = 0; j < n; j++) {
+      size_t p = (size_t)row * map->width + cols[j];
+      map->field[p] = (float)lambda[j];
+      atomic_store_explicit(&map->done[p], 1, memory_order_release);
+    }
+    finished += n;
+    n = 0;
+  }
+  return finished;
+}
+
+/*
+ *  Queued tasks, one at a time, until none are left; every worker does the
+ *  same whatever share of the items it was given
+ */
+static void runTasks(void *ctx, int begin, int end, int thread) {
+  ChaosMap *map = ctx;
+  for (;;) {
+    pthread_mutex_lock(&map->lock);
+    if (map->nextTask >= map->taskCount) {
+      pthread_mutex_unlock(&map->lock);
+      return;
+    }
+    int step, row;
+    taskRow(map, map->nextTask++, &step, &row);
+    map->busy++;
+    pthread_mutex_unlock(&map->lock);
+    int finished = rowTask(map, step, row);
+    pthread_mutex_lock(&map->lock);
+    map->finished += finished;
+    if (--map->busy == 0 && map->nextTask >= map->taskCount)
+      map->running = 0;
+    pthread_cond_broadcast(&map->idle);
+    pthread_mutex_unlock(&map->lock);
+  }
+}
+
+/*
+ *  Background thread: while tasks are queued, work through them on the
+ *  background share of the threads, leaving the rest to the viewer's own
+ *  parallelFor calls
+ */
+static void *workerMain(void *arg) {
+  ChaosMap *map = arg;
+  pthread_mutex_lock(&map->lock);
+  for (;;) {
+    while (!map->quit && map->nextTask >= map->taskCount)
+      pthread_cond_wait(&map->wake, &map->lock);
+    if (map->quit)
+      break;
+    pthread_mutex_unlock(&map->lock);
+    parallelForBackground(parallelBackgroundThreads(), runTasks, map);
+    pthread_mutex_lock(&map->lock);
+  }
+  pthread_mutex_unlock(&map->lock);
+  return NULL;
+}
+
+/*
+ *  Stop handing out tasks and wait for the ones being worked on to be
+ *  dropped; called with the lock held
+ */
+static void cancelPass(ChaosMap *map) {
+  atomic_store(&map->cancel, 1);
+  map->nextTask = map->taskCount;
+  while (map->busy > 0)
+    pthread_cond_wait(&map->idle, &map->lock);
+  atomic_store(&map->cancel, 0);
+  map->running = 0;
+}
+
+/*
+ *  Start the background thread that feeds the background pool; r maps to
+ *  columns and s to rows. Returns NULL if nothing could be allocated or
+ *  started.
+ */
+ChaosMap *chaosMapCreate(int width, int height, double rmin, double rmax,
+                         double smin, double smax) {
+  ChaosMap *map = calloc(1, sizeof(ChaosMap));
+  if (!map)
+    return NULL;
+  map->width = width;
+  map->height = height;
+  map->rmin = rmin;
+  map->rmax = rmax;
+  map->smin = smin;
+  map->smax = smax;
+  pthread_mutex_init(&map->lock, NULL);
+  pthread_cond_init(&map->wake, NULL);
+  pthread_cond_init(&map->idle, NULL);
+  atomic_init(&map->cancel, 0);
+  map->field = malloc((size_t)width * height * sizeof(float));
+  map->done = calloc((size_t)width * height, sizeof(atomic_uchar));
+  if (!map->field || !map->done) {
+    chaosMapDestroy(map);
+    return NULL;
+  }
+
+  map->started = pthread_create(&map->thread, NULL, workerMain, map) == 0;
+  if (!map->started) {
+    chaosMapDestroy(map);
+    return NULL;
+  }
+  return map;
+}
+
+void chaosMapDestroy(ChaosMap *map) {
+  if (!map)
+    return;
+  if (map->started) {
+    pthread_mutex_lock(&map->lock);
+    cancelPass(map);
+    map->quit = 1;
+    pthread_cond_broadcast(&map->wake);
+    pthread_mutex_unlock(&map->lock);
+    pthread_join(map->thread, NULL);
+  }
+  pthread_mutex_destroy(&map->lock);
+  pthread_cond_destroy(&map->wake);
+  pthread_cond_destroy(&map->idle);
+  free(map->field);
+  free((void *)map->done);
+  free(map);
+}
+
+/*
+ *  Abandon any pass in progress and start over for a new b
+ */
+void chaosMapStart(ChaosMap *map, double b) {
+  pthread_mutex_lock(&map->lock);
+  cancelPass(map);
+  size_t size = (size_t)map->width * map->height;
+  for (size_t p = 0; p < size; p++)
+    atomic_store_explicit(&map->done[p], 0, memory_order_relaxed);
+  map->b = b;
+  map->taskCount = countTasks(map->height);
+  map->nextTask = 0;
+  map->finished = 0;
+  map->rendered = -1;
+  map->running = 1;
+  pthread_cond_broadcast(&map->wake);
+  pthread_mutex_unlock(&map->lock);
+}
+
+/*
+ *  Regular motion (exponent near or below zero) in the dark end of the
+ *  colormap, chaos in the bright end
+ */
+static void exponentColor(float lambda, unsigned char rgb[3]) {
+  if (isnan(lambda))
+    rgb[0] = rgb[1] = rgb[2] = 0;
+  else if (lambda < CHAOS_ZERO)
+    colormap(0.25 * exp(fmin(lambda, 0.0)), rgb);
+  else
+    colormap(0.4 + 0.6 * tanh(lambda / 1.5), rgb);
+}
+
+/*
+ *  Paint every pixel from the finest finished sample covering it; returns 1
+ *  if the image changed since the last call
+ */
+int chaosMapRender(ChaosMap *map, Image *img) {
+  pthread_mutex_lock(&map->lock);
+  int finished = map->finished;
+  int changed = finished != map->rendered;
+  map->rendered = finished;
+  pthread_mutex_unlock(&map->lock);
+  if (!changed || img->width != map->width || img->height != map->height)
+    return 0;
+
+  for (int j = 0; j < map->height; j++)
+    for (int i = 0; i < map->width; i++) {
+      unsigned char *rgb = img->rgb + ((size_t)j * map->width + i) * 3;
+      rgb[0] = rgb[1] = rgb[2] = 40;
+      for (int st = 1; st <= CHAOS_COARSE; st *= 2) {
+        size_t p = (size_t)(j - j % st) * map->width + (i - i % st);
+        if (atomic_load_explicit(&map->done[p], memory_order_acquire)) {
+          exponentColor(map->field[p], rgb);
+          break;
+        }
+      }
+    }
+  return 1;
+}
+
+/*
+ *  Fraction of the current pass completed
+ */
+double chaosMapProgress(const ChaosMap *map) {
+  ChaosMap *m = (ChaosMap *)map;
+  pthread_mutex_lock(&m->lock);
+  double done = m->running ? (double)m->finished / (m->width * m->height) : 1;
+  pthread_mutex_unlock(&m->lock);
+  return done;
+}
+
+/*
+ *  Parameters under image coordinates u (left to right) and v (bottom to
+ *  top), both in [0, 1]
+ */
+void chaosMapParams(const ChaosMap *map, double u, double v, double *r,
+                    double *s) {
+  *r = map->rmin + u * (map->rmax - map->rmin);
+  *s = map->smin + v * (map->smax - map->smin);
+}
+
+void chaosMapPosition(const ChaosMap *map, double r, double s, double *u,
+                      double *v) {
+  *u = (r - map->rmin) / (map->rmax - map->rmin);
+  *v = (s - map->smin) / (map->smax - map->smin);
+}
+
+/*
+ *  chaosmap [size [b [file.ppm]]]: compute a full map in the background
+ *  and export it
+ */
+int chaosMapCommand(int argc, char *argv[]) {
+  int size = argc > 1 ? atoi(argv[1]) : 256;
+  double b = argc > 2 ? atof(argv[2]) : 2.6666;
+  const char *path = argc > 3 ? argv[3] : "chaosmap.ppm";
+  if (size < 1) {
+    fprintf(stderr, "chaosmap: need size >= 1\n");
+    return 1;
+  }
+
+  Image img;
+  ChaosMap *map = chaosMapCreate(size, size, CHAOS_RMIN, CHAOS_RMAX, CHAOS_SMIN,
+                                 CHAOS_SMAX);
+  if (!map || !imageInit(&img, size, size)) {
+    fprintf(stderr, "chaosmap: cannot allocate %dx%d map\n", size, size);
+    chaosMapDestroy(map);
+    return 1;
+  }
+
+  // Nothing else runs, so the map may use every thread
+  parallelSetBackgroundThreads(parallelThreads());
+  double t0 = wallTime();
+  chaosMapStart(map, b);
+  pthread_mutex_lock(&map->lock);
+  while (map->running)
+    pthread_cond_wait(&map->idle, &map->lock);
+  pthread_mutex_unlock(&map->lock);
+  double t = wallTime() - t0;
+
+  int chaotic = 0;
+  for (int p = 0; p < size * size; p++)
+    chaotic += map->field[p] >= CHAOS_ZERO;
+  chaosMapRender(map, &img);
+  int ok = imageWritePPM(&img, path);
+  printf("Chaos map %dx%d over r in [%g, %g], s in [%g, %g], b=%g, "
+         "threads=%d: %.3f s (%.3e points/s), %.1f%% chaotic%s%s\n",
+         size, size, CHAOS_RMIN, CHAOS_RMAX, CHAOS_SMIN, CHAOS_SMAX, b,
+         parallelThreads(), t, size * (double)size / t,
+         100.0 * chaotic / (size * size), ok ? " -> " : "", ok ? path : "");
+  chaosMapDestroy(map);
+  imageFree(&img);
+  return ok ? 0 : 1;
+}
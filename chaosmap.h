@@ -0,0 +1,29 @@
+#ifndef CHAOSMAP_H
+#define CHAOSMAP_H
+
+#include "image.h"
+
+// Largest Lyapunov exponent over the (r, s) plane, refined coarse to fine
+// in the background on the background share of the threads; r runs left
+// to right, s bottom to top
+typedef struct ChaosMap ChaosMap;
+
+// Default parameter window
+#define CHAOS_RMIN 0.0
+#define CHAOS_RMAX 120.0
+#define CHAOS_SMIN 0.5
+#define CHAOS_SMAX 30.0
+
+ChaosMap *chaosMapCreate(int width, int height, double rmin, double rmax,
+                         double smin, double smax);
+void chaosMapDestroy(ChaosMap *map);
+void chaosMapStart(ChaosMap *map, double b);
+int chaosMapRender(ChaosMap *map, Image *img);
+double chaosMapProgress(const ChaosMap *map);
+void chaosMapParams(const ChaosMap *map, double u, double v, double *r,
+                    double *s);
+void chaosMapPosition(const ChaosMap *map, double r, double s, double *u,
+                      double *v);
+int chaosMapCommand(int argc, char *argv[]);
+
+#endif // CHAOSMAP_H
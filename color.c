@@ -0,0 +1,60 @@
+#include "color.h"
+#include <math.h>
+
+/*
+ *  Color of point `index` of `total` in the given mode
+ */
+void colorAt(int mode, int index, int total, float rgb[3]) {
+  float ratio = total > 0 ? (float)index / total : 0.0f;
+  switch (mode) {
+  case COLOR_RAINBOW: {
+    float hue = ratio * 360.0f;
+    float x = 1.0f - fabsf(fmodf(hue / 60.0f, 2.0f) - 1.0f);
+    float r = 0, g = 0, b = 0;
+    if (hue < 60) {
+      r = 1;
+      g = x;
+    } else if (hue < 120) {
+      r = x;
+      g = 1;
+    } else if (hue < 180) {
+      g = 1;
+      b = x;
+    } else if (hue < 240) {
+      g = x;
+      b = 1;
+    } else if (hue < 300) {
+      r = x;
+      b = 1;
+    } else {
+      r = 1;
+      b = x;
+    }
+    rgb[0] = r;
+    rgb[1] = g;
+    rgb[2] = b;
+  } break;
+  case COLOR_FADE:
+    rgb[0] = ratio;
+    rgb[1] = 0.2f;
+    rgb[2] = 1.0f - ratio;
+    break;
+  default:
+    rgb[0] = 0.0f;
+    rgb[1] = 1.0f;
+    rgb[2] = 1.0f;
+    break;
+  }
+}
+
+/*
+ *  8-bit colors of indices 0..total-1, 3 bytes each, for vertex arrays
+ */
+void colorFill(int mode, int total, unsigned char *rgb) {
+  for (int i = 0; i < total; i++) {
+    float c[3];
+    colorAt(mode, i, total, c);
+    for (int k = 0; k < 3; k++)
+      rgb[3 * i + k] = (unsigned char)(255.0f * c[k] + 0.5f);
+  }
+}
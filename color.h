@@ -0,0 +1,13 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+// Trajectory color modes, cycled with c/C
+#define COLOR_SINGLE 0  // Cyan
+#define COLOR_RAINBOW 1 // Hue around the color wheel along the trajectory
+#define COLOR_FADE 2    // Blue to red along the trajectory
+#define COLOR_MODES 3
+
+void colorAt(int mode, int index, int total, float rgb[3]);
+void colorFill(int mode, int total, unsigned char *rgb);
+
+#endif // COLOR_H
@@ -0,0 +1,474 @@
+#include "embed.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include "series.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EMBED_LEAF 8            // Points per k-d tree leaf
+#define EMBED_SUBTREES 16       // Subtrees built in parallel
+#define EMBED_QUERY_BLOCK 4096  // Neighbour queries per parallel task
+
+// k-d tree over delay vectors. Nodes are implicit: the node of tree range
+// [lo, hi) splits at mid = (lo + hi) / 2 on axis[mid], with the smaller
+// coordinates in [lo, mid) and the larger in (mid, hi).
+typedef struct {
+  int n;
+  int dim;
+  int *index;          // Series index of each tree position
+  double *coords;      // Vectors in tree order, dim per point
+  unsigned char *axis; // Split axis of the node at each position
+} KdTree;
+
+typedef struct {
+  const double *series;
+  int n;
+  int maxLag;
+  int bins;
+  const unsigned char *level; // Series quantized to bins levels
+  double *ami;
+} AmiJob;
+
+typedef struct {
+  const KdTree *tree;
+  const double *series;
+  const FnnConfig *config;
+  double sigma;   // Deviation of the series, the scale for atol
+  int *falses;    // Per query block
+  int *valid;
+} FnnJob;
+
+typedef struct {
+  KdTree *tree;
+  const int *ranges; // lo, hi pairs
+} BuildJob;
+
+/*
+ *  Delay coordinates (s_i, s_i+lag, s_i+2lag) for display; returns the
+ *  number of points written, n - 2 lag
+ */
+int embedPoints(const double *series, int n, int lag, Point3D *points) {
+  int count = n - 2 * lag;
+  if (lag < 1 || count < 1)
+    return 0;
+  for (int i = 0; i < count; i++)
+    points[i] = (Point3D){series[i], series[i + lag], series[i + 2 * lag]};
+  return count;
+}
+
+static void amiRange(void *ctx, int begin, int end, int thread) {
+  AmiJob *job = ctx;
+  int bins = job->bins;
+  int *joint = malloc((bins * bins + 2 * bins) * sizeof(int));
+  if (!joint) {
+    for (int lag = begin; lag < end; lag++)
+      job->ami[lag] = NAN;
+    return;
+  }
+  int *first = joint + bins * bins, *second = first + bins;
+  for (int lag = begin; lag < end; lag++) {
+    memset(joint, 0, (bins * bins + 2 * bins) * sizeof(int));
+    const unsigned char *a = job->level, *b = job->level + lag;
+    int pairs = job->n - lag;
+    for (int i = 0; i < pairs; i++)
+      joint[a[i] * bins + b[i]]++;
+    for (int i = 0; i < bins; i++)
+      for (int j = 0; j < bins; j++) {
+        first[i] += joint[i * bins + j];
+        second[j] += joint[i * bins + j];
+      }
+    double sum = 0;
+    for (int i = 0; i < bins; i++)
+      for (int j = 0; j < bins; j++) {
+        int c = joint[i * bins + j];
+        if (c)
+          sum += c * log2((double)c * pairs / ((double)first[i] * second[j]));
+      }
+    job->ami[lag] = sum / pairs;
+  }
+  free(joint);
+}
+
+/*
+ *  Mutual information in bits between s_i and s_i+lag for lag = 0..maxLag,
+ *  from a bins x bins histogram of the series range (bins <= 256); the
+ *  lags are spread across threads. Returns 0 on bad arguments or failure.
+ */
+int embedMutualInformation(const double *series, int n, int maxLag, int bins,
+                           double *ami) {
+  if (maxLag < 0 || maxLag >= n || bins < 2 || bins > 256)
+    return 0;
+  unsigned char *level = malloc(n);
+  if (!level)
+    return 0;
+  double lo = series[0], hi = series[0];
+  for (int i = 1; i < n; i++) {
+    lo = fmin(lo, series[i]);
+    hi = fmax(hi, series[i]);
+  }
+  double scale = hi > lo ? bins / (hi - lo) : 0.0;
+  for (int i = 0; i < n; i++) {
+    int k = (int)((series[i] - lo) * scale);
+    level[i] = k < bins ? k : bins - 1;
+  }
+  AmiJob job = {series, n, maxLag, bins, level, ami};
+  parallelFor(maxLag + 1, amiRange, &job);
+  free(level);
+  int ok = 1;
+  for (int lag = 0; lag <= maxLag; lag++)
+    ok &= !isnan(ami[lag]);
+  return ok;
+}
+
+/*
+ *  Index of the first local minimum, or of the smallest value if the
+ *  values only fall
+ */
+int embedFirstMinimum(const double *values, int count) {
+  for (int k = 1; k + 1 < count; k++)
+    if (values[k] < values[k - 1] && values[k] <= values[k + 1])
+      return k;
+  int best = 0;
+  for (int k = 1; k < count; k++)
+    if (values[k] < values[best])
+      best = k;
+  return best;
+}
+
+/*
+ *  Smallest dimension whose false neighbour fraction is below threshold
+ */
+int embedChooseDimension(const double *fraction, int maxDim,
+                         double threshold) {
+  for (int d = 1; d <= maxDim; d++)
+    if (fraction[d - 1] < threshold)
+      return d;
+  return maxDim;
+}
+
+static void swapPoints(KdTree *t, int a, int b) {
+  double *pa = t->coords + (size_t)a * t->dim, *pb = t->coords + (size_t)b * t->dim;
+  for (int k = 0; k < t->dim; k++) {
+    double c = pa[k];
+    pa[k] = pb[k];
+    pb[k] = c;
+  }
+  int i = t->index[a];
+  t->index[a] = t->index[b];
+  t->index[b] = i;
+}
+
+/*
+ *  Wirth's selection: afterwards position k holds the value it would have
+ *  sorted on `axis`, with no larger value before it and no smaller after
+ */
+static void selectPoint(KdTree *t, int lo, int hi, int k, int axis) {
+  const double *c = t->coords + axis;
+  int dim = t->dim, l = lo, r = hi - 1;
+  while (l < r) {
+    double x = c[(size_t)k * dim];
+    int i = l, j = r;
+    do {
+      while (c[(size_t)i * dim] < x)
+        i++;
+      while (x < c[(size_t)j * dim])
+        j--;
+      if (i <= j)
+        swapPoints(t, i++, j--);
+    } while (i <= j);
+    if (j < k)
+      l = i;
+    if (k < i)
+      r = j;
+  }
+}
+
+/*
+ *  Split the range at its median on the axis of widest spread
+ */
+static int splitNode(KdTree *t, int lo, int hi) {
+  double min[EMBED_MAX_DIM], max[EMBED_MAX_DIM];
+  int dim = t->dim, axis = 0;
+  for (int k = 0; k < dim; k++)
+    min[k] = max[k] = t->coords[(size_t)lo * dim + k];
+  for (int p = lo + 1; p < hi; p++)
+    for (int k = 0; k < dim; k++) {
+      double v = t->coords[(size_t)p * dim + k];
+      min[k] = fmin(min[k], v);
+      max[k] = fmax(max[k], v);
+    }
+  for (int k = 1; k < dim; k++)
+    if (max[k] - min[k] > max[axis] - min[axis])
+      axis = k;
+  int mid = (lo + hi) / 2;
+  selectPoint(t, lo, hi, mid, axis);
+  t->axis[mid] = axis;
+  return mid;
+}
+
+static void buildNode(KdTree *t, int lo, int hi) {
+  if (hi - lo <= EMBED_LEAF)
+    return;
+  int mid = splitNode(t, lo, hi);
+  buildNode(t, lo, mid);
+  buildNode(t, mid + 1, hi);
+}
+
+static void buildRange(void *ctx, int begin, int end, int thread) {
+  BuildJob *job = ctx;
+  for (int k = begin; k < end; k++)
+    buildNode(job->tree, job->ranges[2 * k], job->ranges[2 * k + 1]);
+}
+
+/*
+ *  Tree over the dim-dimensional delay vectors starting at 0..m-1. The top
+ *  levels are split serially, the EMBED_SUBTREES subtrees below in parallel.
+ */
+static int kdBuild(KdTree *t, const double *series, int m, int dim, int lag) {
+  t->n = m;
+  t->dim = dim;
+  t->index = malloc(m * sizeof(int));
+  t->coords = malloc((size_t)m * dim * sizeof(double));
+  t->axis = malloc(m);
+  if (!t->index || !t->coords || !t->axis)
+    return 0;
+  for (int i = 0; i < m; i++) {
+    t->index[i] = i;
+    for (int k = 0; k < dim; k++)
+      t->coords[(size_t)i * dim + k] = series[i + k * lag];
+  }
+
+  int ranges[2 * EMBED_SUBTREES], count = 1;
+  ranges[0] = 0;
+  ranges[1] = m;
+  while (2 * count <= EMBED_SUBTREES) {
+    int next[2 * EMBED_SUBTREES], nexts = 0;
+    for (int k = 0; k < count; k++) {
+      int lo = ranges[2 * k], hi = ranges[2 * k + 1];
+      if (hi - lo <= EMBED_LEAF)
+        continue;
+      int mid = splitNode(t, lo, hi);
+      next[2 * nexts] = lo;
+      next[2 * nexts++ + 1] = mid;
+      next[2 * nexts] = mid + 1;
+      next[2 * nexts++ + 1] = hi;
+    }
+    memcpy(ranges, next, 2 * nexts * sizeof(int));
+    count = nexts;
+  }
+  BuildJob job = {t, ranges};
+  parallelFor(count, buildRange, &job);
+  return 1;
+}
+
+static void kdFree(KdTree *t) {
+  free(t->index);
+  free(t->coords);
+  free(t->axis);
+}
+
+/*
+ *  Nearest neighbour of q among the points more than theiler samples from
+ *  `self` in time; best2 and best hold the squared distance and position
+ */
+static void kdNearest(const KdTree *t, int lo, int hi, const double *q,
+                      int self, int theiler, double *best2, int *best) {
+  int dim = t->dim;
+  if (hi - lo <= EMBED_LEAF) {
+    for (int p = lo; p < hi; p++) {
+      if (abs(t->index[p] - self) <= theiler)
+        continue;
+      const double *c = t->coords + (size_t)p * dim;
+      double d2 = 0;
+      for (int k = 0; k < dim; k++)
+        d2 += (c[k] - q[k]) * (c[k] - q[k]);
+      if (d2 < *best2) {
+        *best2 = d2;
+        *best = p;
+      }
+    }
+    return;
+  }
+  int mid = (lo + hi) / 2, axis = t->axis[mid];
+  const double *c = t->coords + (size_t)mid * dim;
+  if (abs(t->index[mid] - self) > theiler) {
+    double d2 = 0;
+    for (int k = 0; k < dim; k++)
+      d2 += (c[k] - q[k]) * (c[k] - q[k]);
+    if (d2 < *best2) {
+      *best2 = d2;
+      *best = mid;
+    }
+  }
+  double diff = q[axis] - c[axis];
+  if (diff < 0) {
+    kdNearest(t, lo, mid, q, self, theiler, best2, best);
+    if (diff * diff < *best2)
+      kdNearest(t, mid + 1, hi, q, self, theiler, best2, best);
+  } else {
+    kdNearest(t, mid + 1, hi, q, self, theiler, best2, best);
+    if (diff * diff < *best2)
+      kdNearest(t, lo, mid, q, self, theiler, best2, best);
+  }
+}
+
+/*
+ *  Queries go in tree order so consecutive searches touch the same leaves
+ */
+static void fnnRange(void *ctx, int begin, int end, int thread) {
+  FnnJob *job = ctx;
+  const KdTree *t = job->tree;
+  int dim = t->dim, lag = job->config->lag;
+  double rtol = job->config->rtol, atol = job->config->atol * job->sigma;
+  for (int block = begin; block < end; block++) {
+    int falses = 0, valid = 0;
+    int p1 = (block + 1) * EMBED_QUERY_BLOCK < t->n
+                 ? (block + 1) * EMBED_QUERY_BLOCK
+                 : t->n;
+    for (int p = block * EMBED_QUERY_BLOCK; p < p1; p++) {
+      const double *q = t->coords + (size_t)p * dim;
+      int self = t->index[p], best = -1;
+      double best2 = INFINITY;
+      kdNearest(t, 0, t->n, q, self, job->config->theiler, &best2, &best);
+      if (best < 0 || best2 == 0)
+        continue;
+      double extra = job->series[self + dim * lag] -
+                     job->series[t->index[best] + dim * lag];
+      valid++;
+      falses += fabs(extra) > rtol * sqrt(best2) ||
+                sqrt(best2 + extra * extra) > atol;
+    }
+    job->falses[block] = falses;
+    job->valid[block] = valid;
+  }
+}
+
+/*
+ *  Fraction of false nearest neighbours for dimensions 1..maxDim: a
+ *  neighbour in d dimensions is false if the (d+1)th coordinate tears it
+ *  away. Each dimension builds a k-d tree and runs every query in parallel.
+ *  Returns 0 on bad arguments or allocation failure.
+ */
+int embedFalseNeighbours(const double *series, int n, const FnnConfig *config,
+                         double *fraction) {
+  if (config->maxDim < 1 || config->maxDim > EMBED_MAX_DIM ||
+      config->lag < 1 || config->theiler < 0 ||
+      n - config->maxDim * config->lag <= 2 * config->theiler + 2)
+    return 0;
+  double mean = 0, var = 0;
+  for (int i = 0; i < n; i++)
+    mean += series[i];
+  mean /= n;
+  for (int i = 0; i < n; i++)
+    var += (series[i] - mean) * (series[i] - mean);
+
+  int ok = 1;
+  for (int d = 1; ok && d <= config->maxDim; d++) {
+    int m = n - d * config->lag;
+    int blocks = (m + EMBED_QUERY_BLOCK - 1) / EMBED_QUERY_BLOCK;
+    KdTree tree = {0, 0, NULL, NULL, NULL};
+    FnnJob job = {&tree, series, config, sqrt(var / n), NULL, NULL};
+    job.falses = malloc(blocks * sizeof(int));
+    job.valid = malloc(blocks * sizeof(int));
+    ok = job.falses && job.valid && kdBuild(&tree, series, m, d, config->lag);
+    if (ok) {
+      parallelFor(blocks, fnnRange, &job);
+      long long falses = 0, valid = 0;
+      for (int k = 0; k < blocks; k++) {
+        falses += job.falses[k];
+        valid += job.valid[k];
+      }
+      fraction[d - 1] = valid ? (double)falses / valid : 0.0;
+    }
+    kdFree(&tree);
+    free(job.falses);
+    free(job.valid);
+  }
+  return ok;
+}
+
+/*
+ *  embed [samples|file [maxLag [maxDim]]]: choose the delay from the first
+ *  minimum of the mutual information and the dimension from false nearest
+ *  neighbours, for x(t) sampled every 0.01 unless a file is given
+ */
+int embedCommand(int argc, char *argv[]) {
+  int count = 1000000;
+  int maxLag = argc > 2 ? atoi(argv[2]) : 100;
+  int maxDim = argc > 3 ? atoi(argv[3]) : 8;
+  double *series = NULL;
+  if (maxLag < 1 || maxDim < 1 || maxDim > EMBED_MAX_DIM) {
+    fprintf(stderr, "embed: need maxLag >= 1 and 1 <= maxDim <= %d\n",
+            EMBED_MAX_DIM);
+    return 1;
+  }
+  if (argc > 1 && (series = loadSeries(argv[1], &count)))
+    printf("Loaded %d samples from %s\n", count, argv[1]);
+  else {
+    if (argc > 1)
+      count = atoi(argv[1]);
+    if (count < 1) {
+      fprintf(stderr, "embed: cannot read %s\n", argv[1]);
+      return 1;
+    }
+    series = malloc(count * sizeof(double));
+    if (series) {
+      double x = 1, y = 1, z = 1;
+      for (int i = 0; i < 10000; i++)
+        lorenzStep(10.0, 8.0 / 3.0, 28.0, LORENZ_DT, &x, &y, &z);
+      for (int i = 0; i < count; i++) {
+        for (int k = 0; k < 10; k++)
+          lorenzStep(10.0, 8.0 / 3.0, 28.0, LORENZ_DT, &x, &y, &z);
+        series[i] = x;
+      }
+      printf("Synthetic x(t): %d samples every %g\n", count, 10 * LORENZ_DT);
+    }
+  }
+  double *ami = malloc((maxLag + 1) * sizeof(double));
+  double *fraction = malloc(maxDim * sizeof(double));
+  if (!series || !ami || !fraction) {
+    fprintf(stderr, "embed: out of memory\n");
+    free(series);
+    free(ami);
+    free(fraction);
+    return 1;
+  }
+
+  double t0 = wallTime();
+  int ok = maxLag < count && embedMutualInformation(series, count, maxLag, 64,
+                                                    ami);
+  double t = wallTime() - t0;
+  FnnConfig config = {maxDim, 1, 1, 15.0, 2.0};
+  if (ok) {
+    config.lag = config.theiler = embedFirstMinimum(ami, maxLag + 1);
+    if (config.lag < 1)
+      config.lag = config.theiler = 1;
+    printf("Mutual information, 64 bins, lags 0..%d: %.3f s, threads=%d\n",
+           maxLag, t, parallelThreads());
+    printf("  I(0)=%.4f bits, first minimum I(%d)=%.4f bits -> lag %d\n",
+           ami[0], config.lag, ami[config.lag], config.lag);
+
+    t0 = wallTime();
+    ok = embedFalseNeighbours(series, count, &config, fraction);
+    t = wallTime() - t0;
+  }
+  if (ok) {
+    printf("False nearest neighbours (rtol %g, atol %g, Theiler %d): %.3f s "
+           "(%.3e queries/s)\n",
+           config.rtol, config.atol, config.theiler, t,
+           ((double)count * maxDim - config.lag * maxDim * (maxDim + 1) / 2) /
+               t);
+    for (int d = 1; d <= maxDim; d++)
+      printf("  d=%-2d %8.4f%%\n", d, 100 * fraction[d - 1]);
+    printf("Suggested embedding: lag %d, dimension %d\n", config.lag,
+           embedChooseDimension(fraction, maxDim, 0.01));
+  } else
+    fprintf(stderr, "embed: series too short for lag %d and dimension %d\n",
+            config.lag, maxDim);
+  free(series);
+  free(ami);
+  free(fraction);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+#ifndef EMBED_H
+#define EMBED_H
+
+#include "state.h"
+
+// Delay embedding of a scalar series s: v_i = (s_i, s_i+lag, s_i+2lag, ...)
+#define EMBED_MAX_DIM 16
+
+// Kennel's false nearest neighbour test
+typedef struct {
+  int maxDim;     // Dimensions 1..maxDim are tested
+  int lag;        // Delay in samples
+  int theiler;    // Neighbours closer than this in time are skipped
+  double rtol;    // False if the added distance exceeds rtol * R_d
+  double atol;    // False if R_d+1 exceeds atol * the series deviation
+} FnnConfig;
+
+int embedPoints(const double *series, int n, int lag, Point3D *points);
+int embedMutualInformation(const double *series, int n, int maxLag, int bins,
+                           double *ami);
+int embedFirstMinimum(const double *values, int count);
+int embedFalseNeighbours(const double *series, int n, const FnnConfig *config,
+                         double *fraction);
+int embedChooseDimension(const double *fraction, int maxDim,
+                         double threshold);
+int embedCommand(int argc, char *argv[]);
+
+#endif // EMBED_H
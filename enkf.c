@@ -0,0 +1,323 @@
+#include "enkf.h"
+#include "lorenz.h"
+#include "mat3.h"
+#include "parallel.h"
+#include "rng.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ENKF_LANES 256   // Members stepped together in the forecast
+#define ENKF_BLOCK 4096  // Members per analysis block (fixed reduction order)
+#define ENKF_SPINUP 2000 // Truth steps skipped before the first cycle
+#define ENKF_INIT_SIGMA 2.0
+#define ENKF_INIT_COUNTER 0xFFFFFFFFull
+
+typedef struct {
+  const EnkfConfig *config;
+  int members;
+  int cycle;
+  double *x;
+  double *y;
+  double *z;
+  double *partial;   // Per analysis block: 3 sums, then 6 anomaly products
+  double mean[3];    // Forecast ensemble mean
+  double gain[3][3]; // Kalman gain
+  double obs[3];     // Observation of the truth
+} Filter;
+
+/*
+ *  Forecast: lanes advance together so the Euler step vectorizes
+ */
+static void forecastRange(void *ctx, int begin, int end, int thread) {
+  const Filter *f = ctx;
+  const EnkfConfig *c = f->config;
+  int first = begin * ENKF_LANES;
+  int last = end * ENKF_LANES < f->members ? end * ENKF_LANES : f->members;
+
+  for (int base = first; base < last; base += ENKF_LANES) {
+    int count = last - base < ENKF_LANES ? last - base : ENKF_LANES;
+    double *restrict x = f->x + base;
+    double *restrict y = f->y + base;
+    double *restrict z = f->z + base;
+    for (int k = 0; k < c->obsSteps; k++)
+      for (int j = 0; j < count; j++)
+        lorenzStep(c->s, c->b, c->r, LORENZ_DT, &x[j], &y[j], &z[j]);
+  }
+}
+
+static inline int blockCount(const Filter *f, int block) {
+  int first = block * ENKF_BLOCK;
+  return f->members - first < ENKF_BLOCK ? f->members - first : ENKF_BLOCK;
+}
+
+/*
+ *  Analysis pass 1: member sums per block
+ */
+static void sumRange(void *ctx, int begin, int end, int thread) {
+  Filter *f = ctx;
+  for (int block = begin; block < end; block++) {
+    int first = block * ENKF_BLOCK, count = blockCount(f, block);
+    double sx = 0, sy = 0, sz = 0;
+    for (int j = first; j < first + count; j++) {
+      sx += f->x[j];
+      sy += f->y[j];
+      sz += f->z[j];
+    }
+    double *p = f->partial + 9 * block;
+    p[0] = sx;
+    p[1] = sy;
+    p[2] = sz;
+  }
+}
+
+/*
+ *  Analysis pass 2: anomaly outer products per block
+ */
+static void covarianceRange(void *ctx, int begin, int end, int thread) {
+  Filter *f = ctx;
+  for (int block = begin; block < end; block++) {
+    int first = block * ENKF_BLOCK, count = blockCount(f, block);
+    double xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;
+    for (int j = first; j < first + count; j++) {
+      double ax = f->x[j] - f->mean[0];
+      double ay = f->y[j] - f->mean[1];
+      double az = f->z[j] - f->mean[2];
+      xx += ax * ax;
+      xy += ax * ay;
+      xz += ax * az;
+      yy += ay * ay;
+      yz += ay * az;
+      zz += az * az;
+    }
+    double *p = f->partial + 9 * block + 3;
+    p[0] = xx;
+    p[1] = xy;
+    p[2] = xz;
+    p[3] = yy;
+    p[4] = yz;
+    p[5] = zz;
+  }
+}
+
+/*
+ *  Analysis pass 3: inflate each member and update it against its own
+ *  perturbed observation
+ */
+static void updateRange(void *ctx, int begin, int end, int thread) {
+  Filter *f = ctx;
+  const EnkfConfig *c = f->config;
+  double noise[4 * RNG_BATCH];
+
+  for (int block = begin; block < end; block++) {
+    int first = block * ENKF_BLOCK, count = blockCount(f, block);
+    for (int base = first; base < first + count; base += RNG_BATCH) {
+      int lanes = first + count - base < RNG_BATCH ? first + count - base
+                                                   : RNG_BATCH;
+      philoxNormals(c->seed, (uint32_t)base, (uint64_t)f->cycle, lanes,
+                    noise);
+      for (int j = 0; j < lanes; j++) {
+        int m = base + j;
+        double u[3] = {f->mean[0] + c->inflation * (f->x[m] - f->mean[0]),
+                       f->mean[1] + c->inflation * (f->y[m] - f->mean[1]),
+                       f->mean[2] + c->inflation * (f->z[m] - f->mean[2])};
+        double d[3], inc[3];
+        for (int i = 0; i < 3; i++)
+          d[i] = f->obs[i] + c->obsSigma * noise[i * lanes + j] - u[i];
+        mat3Vec(f->gain, d, inc);
+        f->x[m] = u[0] + inc[0];
+        f->y[m] = u[1] + inc[1];
+        f->z[m] = u[2] + inc[2];
+      }
+    }
+  }
+}
+
+/*
+ *  Mean and inflated covariance from the block partials, then the gain
+ *  K = P (P + R)^-1 with R = obsSigma^2 I; returns 0 if P + R is singular
+ */
+static int computeGain(Filter *f) {
+  int blocks = (f->members + ENKF_BLOCK - 1) / ENKF_BLOCK;
+  double sum[9] = {0};
+
+  parallelFor(blocks, sumRange, f);
+  for (int b = 0; b < blocks; b++)
+    for (int i = 0; i < 3; i++)
+      sum[i] += f->partial[9 * b + i];
+  for (int i = 0; i < 3; i++)
+    f->mean[i] = sum[i] / f->members;
+
+  parallelFor(blocks, covarianceRange, f);
+  for (int b = 0; b < blocks; b++)
+    for (int i = 3; i < 9; i++)
+      sum[i] += f->partial[9 * b + i];
+
+  double scale = f->config->inflation * f->config->inflation /
+                 (f->members > 1 ? f->members - 1 : 1);
+  double P[3][3] = {{sum[3], sum[4], sum[5]},
+                    {sum[4], sum[6], sum[7]},
+                    {sum[5], sum[7], sum[8]}};
+  double S[3][3], Sinv[3][3];
+  double R = f->config->obsSigma * f->config->obsSigma;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++) {
+      P[i][j] *= scale;
+      S[i][j] = P[i][j] + (i == j ? R : 0.0);
+    }
+  if (!mat3Invert(S, Sinv))
+    return 0;
+  mat3Mul(P, Sinv, f->gain);
+  return 1;
+}
+
+static double meanError(const Filter *f, const Point3D *truth) {
+  double sx = 0, sy = 0, sz = 0;
+  for (int m = 0; m < f->members; m++) {
+    sx += f->x[m];
+    sy += f->y[m];
+    sz += f->z[m];
+  }
+  double ex = sx / f->members - truth->x;
+  double ey = sy / f->members - truth->y;
+  double ez = sz / f->members - truth->z;
+  return sqrt((ex * ex + ey * ey + ez * ez) / 3.0);
+}
+
+static double ensembleSpread(const Filter *f) {
+  double sx = 0, sy = 0, sz = 0, ss = 0;
+  for (int m = 0; m < f->members; m++) {
+    sx += f->x[m];
+    sy += f->y[m];
+    sz += f->z[m];
+  }
+  sx /= f->members;
+  sy /= f->members;
+  sz /= f->members;
+  for (int m = 0; m < f->members; m++)
+    ss += (f->x[m] - sx) * (f->x[m] - sx) + (f->y[m] - sy) * (f->y[m] - sy) +
+          (f->z[m] - sz) * (f->z[m] - sz);
+  return sqrt(ss / (3.0 * (f->members > 1 ? f->members - 1 : 1)));
+}
+
+/*
+ *  Run `cycles` forecast/analysis cycles against the truth trajectory of
+ *  computeLorenzPoints; returns 0 on failure
+ */
+int enkfRun(const EnkfConfig *config, int members, int cycles,
+            EnkfResult *result) {
+  State *truth = malloc(sizeof(State));
+  Filter f = {config, members, 0};
+  f.x = malloc(3 * (size_t)members * sizeof(double));
+  f.partial =
+      malloc(9 * (size_t)((members + ENKF_BLOCK - 1) / ENKF_BLOCK) *
+             sizeof(double));
+  if (!truth || !f.x || !f.partial || members < 2 || config->obsSteps < 1) {
+    free(truth);
+    free(f.x);
+    free(f.partial);
+    return 0;
+  }
+  f.y = f.x + members;
+  f.z = f.y + members;
+
+  truth->s = config->s;
+  truth->b = config->b;
+  truth->r = config->r;
+  computeLorenzPoints(truth);
+  int maxCycles = (LORENZ_POINTS - ENKF_SPINUP) / config->obsSteps;
+  if (cycles > maxCycles)
+    cycles = maxCycles;
+
+  // Initial ensemble scattered around the truth
+  double noise[4 * RNG_BATCH];
+  const Point3D *t0 = &truth->points[ENKF_SPINUP - 1];
+  for (int base = 0; base < members; base += RNG_BATCH) {
+    int lanes = members - base < RNG_BATCH ? members - base : RNG_BATCH;
+    philoxNormals(config->seed, (uint32_t)base, ENKF_INIT_COUNTER, lanes,
+                  noise);
+    for (int j = 0; j < lanes; j++) {
+      f.x[base + j] = t0->x + ENKF_INIT_SIGMA * noise[j];
+      f.y[base + j] = t0->y + ENKF_INIT_SIGMA * noise[lanes + j];
+      f.z[base + j] = t0->z + ENKF_INIT_SIGMA * noise[2 * lanes + j];
+    }
+  }
+
+  int burnIn = cycles / 5, ok = 1;
+  double rmse = 0, forecastRmse = 0, spread = 0;
+  double forecastTime = 0, analysisTime = 0;
+  for (int c = 0; c < cycles && ok; c++) {
+    const Point3D *t =
+        &truth->points[ENKF_SPINUP - 1 + (c + 1) * config->obsSteps];
+    f.cycle = c;
+
+    double start = wallTime();
+    parallelFor((members + ENKF_LANES - 1) / ENKF_LANES, forecastRange, &f);
+    double mid = wallTime();
+
+    double obsNoise[4];
+    philoxNormals(config->seed + 1, 0, (uint64_t)c, 1, obsNoise);
+    f.obs[0] = t->x + config->obsSigma * obsNoise[0];
+    f.obs[1] = t->y + config->obsSigma * obsNoise[1];
+    f.obs[2] = t->z + config->obsSigma * obsNoise[2];
+    ok = computeGain(&f);
+    if (ok)
+      parallelFor((members + ENKF_BLOCK - 1) / ENKF_BLOCK, updateRange, &f);
+    double end = wallTime();
+
+    forecastTime += mid - start;
+    analysisTime += end - mid;
+    if (c >= burnIn) {
+      double ef = sqrt(((f.mean[0] - t->x) * (f.mean[0] - t->x) +
+                        (f.mean[1] - t->y) * (f.mean[1] - t->y) +
+                        (f.mean[2] - t->z) * (f.mean[2] - t->z)) /
+                       3.0);
+      forecastRmse += ef;
+      rmse += meanError(&f, t);
+      spread += ensembleSpread(&f);
+    }
+  }
+
+  int scored = cycles - burnIn > 0 ? cycles - burnIn : 1;
+  result->rmse = rmse / scored;
+  result->forecastRmse = forecastRmse / scored;
+  result->spread = spread / scored;
+  result->forecastTime = forecastTime / (cycles > 0 ? cycles : 1);
+  result->analysisTime = analysisTime / (cycles > 0 ? cycles : 1);
+  free(truth);
+  free(f.x);
+  free(f.partial);
+  return ok;
+}
+
+/*
+ *  enkf [cycles [members]]: RMSE and time per cycle for one ensemble size,
+ *  or a sweep over 10 to 100k members
+ */
+int enkfBenchmark(int argc, char *argv[]) {
+  EnkfConfig config = {10.0, 2.6666, 28.0, 1.0, 100, 1.02, 2024};
+  int cycles = argc > 1 ? atoi(argv[1]) : 100;
+  int sizes[] = {10, 100, 1000, 10000, 100000};
+  int count = sizeof(sizes) / sizeof(sizes[0]);
+  if (argc > 2) {
+    sizes[0] = atoi(argv[2]);
+    count = 1;
+  }
+
+  printf("EnKF on Lorenz-63: obs every %d steps (dt=%g), sigma_obs=%.2f, "
+         "inflation=%.2f, %d cycles, threads=%d\n",
+         config.obsSteps, LORENZ_DT, config.obsSigma, config.inflation, cycles,
+         parallelThreads());
+  printf("%10s %10s %10s %10s %14s %14s\n", "members", "rmse", "fc rmse",
+         "spread", "forecast s/cyc", "analysis s/cyc");
+  for (int i = 0; i < count; i++) {
+    EnkfResult r;
+    if (!enkfRun(&config, sizes[i], cycles, &r)) {
+      fprintf(stderr, "enkf: run with %d members failed\n", sizes[i]);
+      return 1;
+    }
+    printf("%10d %10.4f %10.4f %10.4f %14.3e %14.3e\n", sizes[i], r.rmse,
+           r.forecastRmse, r.spread, r.forecastTime, r.analysisTime);
+  }
+  return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef ENKF_H
+#define ENKF_H
+
+#include <stdint.h>
+
+// Twin experiment: truth from computeLorenzPoints, every component observed
+typedef struct {
+  double s;
+  double b;
+  double r;
+  double obsSigma;  // Observation noise standard deviation
+  int obsSteps;     // Model steps between observations
+  double inflation; // Multiplicative inflation of the forecast anomalies
+  uint64_t seed;
+} EnkfConfig;
+
+typedef struct {
+  double rmse;         // Analysis mean error, averaged after burn-in
+  double forecastRmse; // Forecast mean error, averaged after burn-in
+  double spread;       // Analysis ensemble spread, averaged after burn-in
+  double forecastTime; // Wall seconds per cycle spent in the forecast
+  double analysisTime; // Wall seconds per cycle spent in the analysis
+} EnkfResult;
+
+int enkfRun(const EnkfConfig *config, int members, int cycles,
+            EnkfResult *result);
+int enkfBenchmark(int argc, char *argv[]);
+
+#endif // ENKF_H
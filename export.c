@@ -0,0 +1,693 @@
+#include "export.h"
+#include "color.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include "trace.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPORT_BLOCK_BYTES (1 << 20) // Largest single write
+#define EXPORT_BATCH 16              // Blocks encoded in parallel per round
+#define EXPORT_BOUND_BLOCK 65536     // Vertices bounded by one task
+
+// What is being written: a point cloud, or a tube's rings and faces
+typedef struct {
+  const Point3D *points;       // Point cloud positions, or NULL for a tube
+  const float *vertex;         // Tube positions
+  const float *normal;         // Tube normals, NULL for a point cloud
+  const unsigned char *color;  // RGB per point or per ring, may be NULL
+  int repeat;                  // Vertices sharing each color
+  int sides;                   // Vertices per tube ring
+  long long vertices;
+  long long faces;             // Triangles, 0 for a point cloud
+} ExportMesh;
+
+// Encode items [begin, end) into out; returns the bytes written
+typedef size_t (*Encoder)(const ExportMesh *mesh, long long begin,
+                          long long end, char *out);
+
+// Output file and two batches of blocks: one being encoded while the
+// other is written
+typedef struct {
+  FILE *file;
+  char *buffer[2];   // EXPORT_BATCH blocks of EXPORT_BLOCK_BYTES each
+  size_t *length[2]; // Bytes encoded into each block
+  int blocks[2];     // Blocks in each batch
+  pthread_t thread;  // Writing batch `flushing`
+  int pending;       // The thread is running
+  int flushing;
+  long long bytes;   // Written so far
+  int ok;
+} Writer;
+
+// One round of encoding: `count` items from `first`, `perBlock` to a block
+typedef struct {
+  const ExportMesh *mesh;
+  Encoder encode;
+  char *buffer;
+  size_t *length;
+  long long first, count, perBlock;
+} Batch;
+
+static inline void position(const ExportMesh *m, long long i, float p[3]) {
+  if (m->points) {
+    p[0] = (float)m->points[i].x;
+    p[1] = (float)m->points[i].y;
+    p[2] = (float)m->points[i].z;
+  } else
+    memcpy(p, m->vertex + 3 * i, 3 * sizeof(float));
+}
+
+static inline const unsigned char *colorOf(const ExportMesh *m, long long i) {
+  return m->color + 3 * (m->repeat == 1 ? i : i / m->repeat);
+}
+
+/*
+ *  Corners of triangle f: rings i and i + 1, sides j and j + 1, two
+ *  triangles per quad wound outward as in the viewer's strips
+ */
+static inline void corners(const ExportMesh *m, long long f, uint32_t v[3]) {
+  long long quad = f / 2, i = quad / m->sides;
+  uint32_t j = quad % m->sides, k = (j + 1) % m->sides;
+  uint32_t a = i * m->sides + j, b = i * m->sides + k;
+  uint32_t c = a + m->sides, d = b + m->sides;
+  if (f % 2 == 0) {
+    v[0] = a;
+    v[1] = b;
+    v[2] = c;
+  } else {
+    v[0] = c;
+    v[1] = b;
+    v[2] = d;
+  }
+}
+
+//
+//  Little endian binary
+//
+static inline char *putUint(char *out, uint32_t u) {
+  out[0] = (char)u;
+  out[1] = (char)(u >> 8);
+  out[2] = (char)(u >> 16);
+  out[3] = (char)(u >> 24);
+  return out + 4;
+}
+
+static inline char *putFloat(char *out, float f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return putUint(out, u);
+}
+
+/*
+ *  Fixed six decimals without going through printf, which dominates text
+ *  output otherwise
+ */
+static char *putDecimal(char *out, double v) {
+  if (!(fabs(v) < 1e12))
+    return out + sprintf(out, "%.9g", v);
+  long long q = llround(v * 1e6);
+  if (q < 0) {
+    *out++ = '-';
+    q = -q;
+  }
+  long long whole = q / 1000000;
+  int frac = q % 1000000;
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = '0' + whole % 10;
+    whole /= 10;
+  } while (whole);
+  while (n)
+    *out++ = digits[--n];
+  *out++ = '.';
+  for (int k = 5; k >= 0; k--) {
+    out[k] = '0' + frac % 10;
+    frac /= 10;
+  }
+  return out + 6;
+}
+
+static char *putInt(char *out, unsigned long long u) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  while (n)
+    *out++ = digits[--n];
+  return out;
+}
+
+//
+//  Encoders for each section of each format
+//
+static size_t plyVertex(const ExportMesh *m, long long begin, long long end,
+                        char *out) {
+  char *o = out;
+  for (long long i = begin; i < end; i++) {
+    float p[3];
+    position(m, i, p);
+    for (int k = 0; k < 3; k++)
+      o = putFloat(o, p[k]);
+    if (m->normal)
+      for (int k = 0; k < 3; k++)
+        o = putFloat(o, m->normal[3 * i + k]);
+    if (m->color) {
+      memcpy(o, colorOf(m, i), 3);
+      o += 3;
+    }
+  }
+  return o - out;
+}
+
+static size_t plyFace(const ExportMesh *m, long long begin, long long end,
+                      char *out) {
+  char *o = out;
+  for (long long f = begin; f < end; f++) {
+    uint32_t v[3];
+    corners(m, f, v);
+    *o++ = 3;
+    for (int k = 0; k < 3; k++)
+      o = putUint(o, v[k]);
+  }
+  return o - out;
+}
+
+static size_t objVertex(const ExportMesh *m, long long begin, long long end,
+                        char *out) {
+  char *o = out;
+  for (long long i = begin; i < end; i++) {
+    float p[3];
+    position(m, i, p);
+    *o++ = 'v';
+    for (int k = 0; k < 3; k++) {
+      *o++ = ' ';
+      o = putDecimal(o, p[k]);
+    }
+    if (m->color)
+      for (int k = 0; k < 3; k++) {
+        *o++ = ' ';
+        o = putDecimal(o, colorOf(m, i)[k] / 255.0);
+      }
+    *o++ = '\n';
+  }
+  return o - out;
+}
+
+static size_t objNormal(const ExportMesh *m, long long begin, long long end,
+                        char *out) {
+  char *o = out;
+  for (long long i = begin; i < end; i++) {
+    *o++ = 'v';
+    *o++ = 'n';
+    for (int k = 0; k < 3; k++) {
+      *o++ = ' ';
+      o = putDecimal(o, m->normal[3 * i + k]);
+    }
+    *o++ = '\n';
+  }
+  return o - out;
+}
+
+static size_t objFace(const ExportMesh *m, long long begin, long long end,
+                      char *out) {
+  char *o = out;
+  for (long long f = begin; f < end; f++) {
+    uint32_t v[3];
+    corners(m, f, v);
+    *o++ = 'f';
+    for (int k = 0; k < 3; k++) {
+      *o++ = ' ';
+      o = putInt(o, v[k] + 1ULL);
+      *o++ = '/';
+      *o++ = '/';
+      o = putInt(o, v[k] + 1ULL);
+    }
+    *o++ = '\n';
+  }
+  return o - out;
+}
+
+static size_t glbPosition(const ExportMesh *m, long long begin,
+                          long long end, char *out) {
+  char *o = out;
+  for (long long i = begin; i < end; i++) {
+    float p[3];
+    position(m, i, p);
+    for (int k = 0; k < 3; k++)
+      o = putFloat(o, p[k]);
+  }
+  return o - out;
+}
+
+static size_t glbNormal(const ExportMesh *m, long long begin, long long end,
+                        char *out) {
+  char *o = out;
+  for (long long i = 3 * begin; i < 3 * end; i++)
+    o = putFloat(o, m->normal[i]);
+  return o - out;
+}
+
+// Vertex attributes must be 4-byte aligned, so colors carry an alpha
+static size_t glbColor(const ExportMesh *m, long long begin, long long end,
+                       char *out) {
+  char *o = out;
+  for (long long i = begin; i < end; i++) {
+    memcpy(o, colorOf(m, i), 3);
+    o[3] = (char)255;
+    o += 4;
+  }
+  return o - out;
+}
+
+static size_t glbIndex(const ExportMesh *m, long long begin, long long end,
+                       char *out) {
+  char *o = out;
+  for (long long f = begin; f < end; f++) {
+    uint32_t v[3];
+    corners(m, f, v);
+    for (int k = 0; k < 3; k++)
+      o = putUint(o, v[k]);
+  }
+  return o - out;
+}
+
+//
+//  Streaming: items are encoded a batch of blocks at a time across the
+//  worker threads, and each block goes to the file in one large write
+//  while the next batch is encoded, so memory stays at two batches
+//  whatever the size of the export
+//
+static void encodeBlocks(void *ctx, int begin, int end, int thread) {
+  const Batch *b = ctx;
+  for (int k = begin; k < end; k++) {
+    long long i0 = b->first + k * b->perBlock;
+    long long i1 = i0 + b->perBlock;
+    if (i1 > b->first + b->count)
+      i1 = b->first + b->count;
+    b->length[k] = b->encode(b->mesh, i0, i1,
+                             b->buffer + (size_t)k * EXPORT_BLOCK_BYTES);
+  }
+}
+
+static void *flushBatch(void *arg) {
+  Writer *w = arg;
+  int side = w->flushing;
+  for (int k = 0; k < w->blocks[side] && w->ok; k++) {
+    size_t size = w->length[side][k];
+    if (fwrite(w->buffer[side] + (size_t)k * EXPORT_BLOCK_BYTES, 1, size,
+               w->file) != size)
+      w->ok = 0;
+    w->bytes += size;
+  }
+  return NULL;
+}
+
+/*
+ *  Wait for the batch being written, if any
+ */
+static void drain(Writer *w) {
+  if (w->pending)
+    pthread_join(w->thread, NULL);
+  w->pending = 0;
+}
+
+static void writeBytes(Writer *w, const void *data, size_t size) {
+  drain(w);
+  if (w->ok && fwrite(data, 1, size, w->file) != size)
+    w->ok = 0;
+  w->bytes += size;
+}
+
+static void writeSection(Writer *w, const ExportMesh *m, Encoder encode,
+                         long long count, int itemBytes) {
+  Batch b = {m, encode, NULL, NULL, 0, 0, EXPORT_BLOCK_BYTES / itemBytes};
+  long long perBatch = b.perBlock * EXPORT_BATCH;
+  int side = !w->flushing; // The other batch may still be on its way
+  for (b.first = 0; b.first < count; b.first += perBatch) {
+    b.count = count - b.first < perBatch ? count - b.first : perBatch;
+    b.buffer = w->buffer[side];
+    b.length = w->length[side];
+    w->blocks[side] = (int)((b.count + b.perBlock - 1) / b.perBlock);
+    parallelFor(w->blocks[side], encodeBlocks, &b);
+    drain(w);
+    if (!w->ok)
+      return;
+    w->flushing = side;
+    w->pending = !pthread_create(&w->thread, NULL, flushBatch, w);
+    if (!w->pending)
+      flushBatch(w);
+    side ^= 1;
+  }
+}
+
+static int openWriter(Writer *w, const char *path) {
+  memset(w, 0, sizeof(*w));
+  w->file = fopen(path, "wb");
+  w->ok = w->file != NULL;
+  for (int k = 0; k < 2; k++) {
+    w->buffer[k] = malloc((size_t)EXPORT_BATCH * EXPORT_BLOCK_BYTES);
+    w->length[k] = malloc(EXPORT_BATCH * sizeof(size_t));
+    w->ok = w->ok && w->buffer[k] && w->length[k];
+  }
+  // Blocks are already large; stdio copying them again would only cost
+  if (w->file)
+    setvbuf(w->file, NULL, _IONBF, 0);
+  return w->ok;
+}
+
+static int closeWriter(Writer *w) {
+  drain(w);
+  if (w->file && fclose(w->file) != 0)
+    w->ok = 0;
+  for (int k = 0; k < 2; k++) {
+    free(w->buffer[k]);
+    free(w->length[k]);
+  }
+  return w->ok;
+}
+
+//
+//  Formats
+//
+static void writePly(Writer *w, const ExportMesh *m) {
+  char header[512];
+  int n = sprintf(header,
+                  "ply\nformat binary_little_endian 1.0\n"
+                  "comment Lorenz attractor\nelement vertex %lld\n"
+                  "property float x\nproperty float y\nproperty float z\n",
+                  m->vertices);
+  if (m->normal)
+    n += sprintf(header + n, "property float nx\nproperty float ny\n"
+                             "property float nz\n");
+  if (m->color)
+    n += sprintf(header + n, "property uchar red\nproperty uchar green\n"
+                             "property uchar blue\n");
+  if (m->faces)
+    n += sprintf(header + n,
+                 "element face %lld\n"
+                 "property list uchar uint vertex_indices\n",
+                 m->faces);
+  n += sprintf(header + n, "end_header\n");
+  writeBytes(w, header, n);
+  writeSection(w, m, plyVertex, m->vertices, 27);
+  writeSection(w, m, plyFace, m->faces, 13);
+}
+
+static void writeObj(Writer *w, const ExportMesh *m) {
+  char header[128];
+  int n = sprintf(header, "# Lorenz attractor: %lld vertices, %lld faces\n",
+                  m->vertices, m->faces);
+  writeBytes(w, header, n);
+  writeSection(w, m, objVertex, m->vertices, 160);
+  if (m->normal)
+    writeSection(w, m, objNormal, m->vertices, 80);
+  writeSection(w, m, objFace, m->faces, 80);
+}
+
+// Per-thread bounds of the positions, which glTF requires up front
+typedef struct {
+  const ExportMesh *mesh;
+  float *bounds; // min and max, 6 per thread
+} BoundsTask;
+
+static void boundBlocks(void *ctx, int begin, int end, int thread) {
+  const BoundsTask *t = ctx;
+  float *b = t->bounds + 6 * thread;
+  long long i1 = (long long)end * EXPORT_BOUND_BLOCK;
+  if (i1 > t->mesh->vertices)
+    i1 = t->mesh->vertices;
+  for (long long i = (long long)begin * EXPORT_BOUND_BLOCK; i < i1; i++) {
+    float p[3];
+    position(t->mesh, i, p);
+    for (int k = 0; k < 3; k++) {
+      b[k] = p[k] < b[k] ? p[k] : b[k];
+      b[3 + k] = p[k] > b[3 + k] ? p[k] : b[3 + k];
+    }
+  }
+}
+
+static int writeGlb(Writer *w, const ExportMesh *m) {
+  int threads = parallelThreads();
+  float *bounds = malloc(6 * threads * sizeof(float));
+  if (!bounds)
+    return 0;
+  for (int t = 0; t < threads; t++)
+    for (int k = 0; k < 3; k++) {
+      bounds[6 * t + k] = INFINITY;
+      bounds[6 * t + 3 + k] = -INFINITY;
+    }
+  BoundsTask bt = {m, bounds};
+  parallelFor((int)((m->vertices + EXPORT_BOUND_BLOCK - 1) /
+                    EXPORT_BOUND_BLOCK),
+              boundBlocks, &bt);
+  for (int t = 1; t < threads; t++)
+    for (int k = 0; k < 3; k++) {
+      bounds[k] = fminf(bounds[k], bounds[6 * t + k]);
+      bounds[3 + k] = fmaxf(bounds[3 + k], bounds[6 * t + 3 + k]);
+    }
+
+  // Buffer sections, each a multiple of 4 bytes
+  long long size[4] = {12 * m->vertices, m->normal ? 12 * m->vertices : 0,
+                       m->color ? 4 * m->vertices : 0, 12 * m->faces};
+  long long offset[4], bin = 0;
+  for (int k = 0; k < 4; k++) {
+    offset[k] = bin;
+    bin += size[k];
+  }
+
+  char json[4096];
+  int n = sprintf(json,
+                  "{\"asset\":{\"version\":\"2.0\",\"generator\":"
+                  "\"lorenz-graphics\"},\"scene\":0,\"scenes\":[{\"nodes\":"
+                  "[0]}],\"nodes\":[{\"mesh\":0}],\"meshes\":[{\"primitives\""
+                  ":[{\"attributes\":{\"POSITION\":0");
+  int accessor = 1;
+  if (m->normal)
+    n += sprintf(json + n, ",\"NORMAL\":%d", accessor++);
+  if (m->color)
+    n += sprintf(json + n, ",\"COLOR_0\":%d", accessor++);
+  n += sprintf(json + n, "}");
+  if (m->faces)
+    n += sprintf(json + n, ",\"indices\":%d", accessor);
+  n += sprintf(json + n, ",\"mode\":%d}]}],\"buffers\":[{\"byteLength\":%lld}]"
+               ",\"bufferViews\":[",
+               m->faces ? 4 : 0, bin);
+  static const char *const views[4] = {"\"target\":34962",
+                                       "\"target\":34962",
+                                       "\"target\":34962",
+                                       "\"target\":34963"};
+  static const char *const accessors[4] = {
+      "\"componentType\":5126,\"type\":\"VEC3\"",
+      "\"componentType\":5126,\"type\":\"VEC3\"",
+      "\"componentType\":5121,\"normalized\":true,\"type\":\"VEC4\"",
+      "\"componentType\":5125,\"type\":\"SCALAR\""};
+  int view = 0;
+  for (int k = 0; k < 4; k++)
+    if (size[k])
+      n += sprintf(json + n,
+                   "%s{\"buffer\":0,\"byteOffset\":%lld,\"byteLength\":%lld,"
+                   "%s}",
+                   view++ ? "," : "", offset[k], size[k], views[k]);
+  n += sprintf(json + n, "],\"accessors\":[");
+  view = 0;
+  for (int k = 0; k < 4; k++)
+    if (size[k]) {
+      n += sprintf(json + n, "%s{\"bufferView\":%d,\"count\":%lld,%s",
+                   view ? "," : "", view, k == 3 ? 3 * m->faces : m->vertices,
+                   accessors[k]);
+      if (k == 0)
+        n += sprintf(json + n, ",\"min\":[%.9g,%.9g,%.9g],"
+                               "\"max\":[%.9g,%.9g,%.9g]",
+                     bounds[0], bounds[1], bounds[2], bounds[3], bounds[4],
+                     bounds[5]);
+      n += sprintf(json + n, "}");
+      view++;
+    }
+  n += sprintf(json + n, "]}");
+  while (n % 4)
+    json[n++] = ' ';
+  free(bounds);
+
+  // The container records its length in 32 bits
+  long long total = 12 + 8 + n + 8 + bin;
+  if (total > UINT32_MAX)
+    return 0;
+  char head[20], *o = head;
+  o = putUint(o, 0x46546C67); // "glTF"
+  o = putUint(o, 2);
+  o = putUint(o, (uint32_t)total);
+  o = putUint(o, n);
+  o = putUint(o, 0x4E4F534A); // "JSON"
+  writeBytes(w, head, sizeof(head));
+  writeBytes(w, json, n);
+  o = putUint(head, (uint32_t)bin);
+  putUint(o, 0x004E4942); // "BIN"
+  writeBytes(w, head, 8);
+  writeSection(w, m, glbPosition, m->vertices, 12);
+  if (m->normal)
+    writeSection(w, m, glbNormal, m->vertices, 12);
+  if (m->color)
+    writeSection(w, m, glbColor, m->vertices, 4);
+  writeSection(w, m, glbIndex, m->faces, 12);
+  return 1;
+}
+
+/*
+ *  Format from the file extension, -1 if not one of ours
+ */
+int exportFormat(const char *path) {
+  const char *dot = strrchr(path, '.');
+  if (!dot)
+    return -1;
+  if (!strcmp(dot, ".ply"))
+    return EXPORT_PLY;
+  if (!strcmp(dot, ".obj"))
+    return EXPORT_OBJ;
+  if (!strcmp(dot, ".glb"))
+    return EXPORT_GLB;
+  return -1;
+}
+
+/*
+ *  Write the mesh in the format of the path; returns the bytes written, 0
+ *  on failure (leaving no file behind)
+ */
+static long long writeMesh(const char *path, const ExportMesh *m) {
+  int format = exportFormat(path);
+  // Face corners are 32-bit indices in every format
+  if (format < 0 || m->vertices > UINT32_MAX)
+    return 0;
+  double span = traceBegin();
+  Writer w;
+  if (openWriter(&w, path)) {
+    if (format == EXPORT_PLY)
+      writePly(&w, m);
+    else if (format == EXPORT_OBJ)
+      writeObj(&w, m);
+    else if (!writeGlb(&w, m))
+      w.ok = 0;
+  }
+  int ok = closeWriter(&w);
+  traceEnd("export", span);
+  if (ok)
+    return w.bytes;
+  remove(path);
+  return 0;
+}
+
+/*
+ *  Write points as a point cloud, with an RGB triple each if colors is not
+ *  NULL; returns the bytes written, 0 on failure
+ */
+long long exportPoints(const char *path, const Point3D *points,
+                 const unsigned char *colors, long long count) {
+  ExportMesh m = {.points = points, .color = colors, .repeat = 1,
+                  .vertices = count};
+  return writeMesh(path, &m);
+}
+
+/*
+ *  Write a tube mesh with normals, faces and optionally an RGB triple per
+ *  ring; returns the bytes written, 0 on failure
+ */
+long long exportTube(const char *path, const TubeMesh *tube,
+               const unsigned char *ringColors) {
+  if (!tube->vertex)
+    return 0;
+  ExportMesh m = {.vertex = tube->vertex, .normal = tube->normal,
+                  .color = ringColors, .repeat = tube->sides,
+                  .sides = tube->sides,
+                  .vertices = (long long)tube->points * tube->sides,
+                  .faces = 2LL * (tube->points - 1) * tube->sides};
+  return writeMesh(path, &m);
+}
+
+/*
+ *  export file [points [sides]]: write a colored trajectory (or a tube
+ *  around it when sides > 0) and compare with a plain write of as many
+ *  bytes to the same place
+ */
+int exportCommand(int argc, char *argv[]) {
+  if (argc < 2 || exportFormat(argv[1]) < 0) {
+    fprintf(stderr, "export: need a .ply, .obj or .glb file\n");
+    return 1;
+  }
+  const char *path = argv[1];
+  long long n = argc > 2 ? atoll(argv[2]) : 1000000;
+  int sides = argc > 3 ? atoi(argv[3]) : 0;
+  if (n < 2 || n > INT32_MAX || (sides && sides < 3)) {
+    fprintf(stderr, "export: need 2 <= points < 2^31 and sides >= 3\n");
+    return 1;
+  }
+  Point3D *points = malloc(n * sizeof(Point3D));
+  unsigned char *colors = malloc(3 * n);
+  if (!points || !colors) {
+    fprintf(stderr, "export: cannot allocate %lld points\n", n);
+    free(points);
+    free(colors);
+    return 1;
+  }
+  double x = 1.0, y = 1.0, z = 1.0;
+  for (long long i = 0; i < n; i++) {
+    lorenzStep(10.0, 8.0 / 3.0, 28.0, LORENZ_DT, &x, &y, &z);
+    points[i] = (Point3D){x, y, z};
+  }
+  colorFill(COLOR_RAINBOW, (int)n, colors);
+
+  TubeMesh tube;
+  tubeInit(&tube, sides ? sides : 3, 0.25);
+  if (sides && tubeUpdate(&tube, points, (int)n) < 0) {
+    fprintf(stderr, "export: cannot build the tube\n");
+    free(points);
+    free(colors);
+    return 1;
+  }
+  double t0 = wallTime();
+  long long bytes = sides ? exportTube(path, &tube, colors)
+                          : exportPoints(path, points, colors, n);
+  double seconds = wallTime() - t0;
+  long long vertices = sides ? n * sides : n;
+  long long faces = sides ? 2 * (n - 1) * sides : 0;
+  tubeFree(&tube);
+  free(points);
+  free(colors);
+  if (!bytes) {
+    fprintf(stderr, "export: cannot write %s\n", path);
+    return 1;
+  }
+
+  // Baseline: the same number of bytes with nothing to encode
+  char raw[4096];
+  snprintf(raw, sizeof(raw), "%s.raw", path);
+  char *zeros = calloc(EXPORT_BLOCK_BYTES, 1);
+  FILE *file = zeros ? fopen(raw, "wb") : NULL;
+  double plain = 0;
+  if (file) {
+    setvbuf(file, NULL, _IONBF, 0);
+    t0 = wallTime();
+    for (long long left = bytes; left > 0; left -= EXPORT_BLOCK_BYTES)
+      fwrite(zeros, 1,
+             left < EXPORT_BLOCK_BYTES ? left : EXPORT_BLOCK_BYTES, file);
+    fclose(file);
+    plain = wallTime() - t0;
+    remove(raw);
+  }
+  free(zeros);
+
+  printf("Export: %s, %lld vertices, %lld faces, %.1f MB in %.3f s "
+         "(%.0f MB/s), threads=%d\n",
+         path, vertices, faces, bytes / 1048576.0, seconds,
+         bytes / 1048576.0 / seconds, parallelThreads());
+  if (plain > 0)
+    printf("Plain write of the same size: %.3f s (%.0f MB/s)\n", plain,
+           bytes / 1048576.0 / plain);
+  return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "state.h"
+#include "tube.h"
+
+// File formats, chosen by extension
+#define EXPORT_PLY 0 // .ply, binary little endian
+#define EXPORT_OBJ 1 // .obj, text with per-vertex colors
+#define EXPORT_GLB 2 // .glb, binary glTF 2.0
+
+// Viewer export file when $LORENZ_EXPORT is not set
+#define EXPORT_VIEW_PATH "lorenz.ply"
+
+int exportFormat(const char *path);
+long long exportPoints(const char *path, const Point3D *points,
+                       const unsigned char *colors, long long count);
+long long exportTube(const char *path, const TubeMesh *tube,
+                     const unsigned char *ringColors);
+int exportCommand(int argc, char *argv[]);
+
+#endif // EXPORT_H
@@ -0,0 +1,445 @@
+#include "fit.h"
+#include "lorenz.h"
+#include "mat3.h"
+#include "parallel.h"
+#include "rng.h"
+#include "series.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Linearization of one shooting segment around (u_j, p)
+typedef struct {
+  double D[3][3];   // Observation part of the diagonal block
+  double B[3][3];   // Coupling between u_j and the parameters
+  double C[3][3];   // Parameter block contribution
+  double gu[3];     // Gradient with respect to u_j
+  double gp[3];     // Gradient with respect to the parameters
+  double Phi[3][3]; // d(segment end)/d(u_j)
+  double Psi[3][3]; // d(segment end)/d(s, b, r)
+  double c[3];      // Continuity defect, segment end minus u_{j+1}
+  double obsCost;   // Sum of squared x residuals
+} Segment;
+
+typedef struct {
+  const double *data;
+  int count;
+  const FitConfig *config;
+  int segments;
+  double *u;       // Segment start states, 3 per segment
+  const double *p; // (s, b, r)
+  Segment *seg;
+} Problem;
+
+/*
+ *  Euler step of the state together with its 3x6 sensitivity matrix
+ *  G = [d/du0 | d/dp], sharing the right-hand side terms with the Jacobian
+ */
+static inline void tangentStep(const double p[3], double v[3],
+                               double G[3][6]) {
+  double s = p[0], b = p[1], r = p[2], dt = LORENZ_DT;
+  double x = v[0], y = v[1], z = v[2];
+  double ymx = y - x, rmz = r - z;
+  for (int c = 0; c < 6; c++) {
+    double g0 = G[0][c], g1 = G[1][c], g2 = G[2][c];
+    G[0][c] = g0 + dt * (s * (g1 - g0));
+    G[1][c] = g1 + dt * (rmz * g0 - g1 - x * g2);
+    G[2][c] = g2 + dt * (y * g0 + x * g1 - b * g2);
+  }
+  G[0][3] += dt * ymx;
+  G[2][4] -= dt * z;
+  G[1][5] += dt * x;
+  v[0] += dt * (s * ymx);
+  v[1] += dt * (x * rmz - y);
+  v[2] += dt * (x * y - b * z);
+}
+
+/*
+ *  Integrate each segment with sensitivities and accumulate its blocks of
+ *  the Gauss-Newton normal equations
+ */
+static void linearizeRange(void *ctx, int begin, int end, int thread) {
+  const Problem *pr = ctx;
+  int L = pr->config->segment, steps = pr->config->sampleSteps;
+
+  for (int j = begin; j < end; j++) {
+    Segment *sg = &pr->seg[j];
+    int first = j * L;
+    int len = pr->count - first < L ? pr->count - first : L;
+    double v[3] = {pr->u[3 * j], pr->u[3 * j + 1], pr->u[3 * j + 2]};
+    double G[3][6] = {{1, 0, 0, 0, 0, 0}, {0, 1, 0, 0, 0, 0},
+                      {0, 0, 1, 0, 0, 0}};
+    memset(sg, 0, sizeof(*sg));
+
+    for (int k = 0; k < len; k++) {
+      if (k > 0)
+        for (int n = 0; n < steps; n++)
+          tangentStep(pr->p, v, G);
+      double e = v[0] - pr->data[first + k];
+      const double *a = G[0];
+      for (int i = 0; i < 3; i++) {
+        for (int m = 0; m < 3; m++) {
+          sg->D[i][m] += a[i] * a[m];
+          sg->B[i][m] += a[i] * a[3 + m];
+          sg->C[i][m] += a[3 + i] * a[3 + m];
+        }
+        sg->gu[i] += a[i] * e;
+        sg->gp[i] += a[3 + i] * e;
+      }
+      sg->obsCost += e * e;
+    }
+
+    // Continuity with the next segment, weighted into the same blocks
+    if (j + 1 < pr->segments) {
+      double w2 = pr->config->weight * pr->config->weight;
+      for (int n = 0; n < steps; n++)
+        tangentStep(pr->p, v, G);
+      for (int i = 0; i < 3; i++) {
+        sg->c[i] = v[i] - pr->u[3 * (j + 1) + i];
+        for (int m = 0; m < 3; m++) {
+          sg->Phi[i][m] = G[i][m];
+          sg->Psi[i][m] = G[i][3 + m];
+        }
+      }
+      for (int i = 0; i < 3; i++)
+        for (int m = 0; m < 3; m++)
+          for (int k = 0; k < 3; k++) {
+            sg->D[i][m] += w2 * sg->Phi[k][i] * sg->Phi[k][m];
+            sg->B[i][m] += w2 * sg->Phi[k][i] * sg->Psi[k][m];
+            sg->C[i][m] += w2 * sg->Psi[k][i] * sg->Psi[k][m];
+          }
+      for (int i = 0; i < 3; i++)
+        for (int k = 0; k < 3; k++) {
+          sg->gu[i] += w2 * sg->Phi[k][i] * sg->c[k];
+          sg->gp[i] += w2 * sg->Psi[k][i] * sg->c[k];
+        }
+    }
+  }
+}
+
+/*
+ *  Cost 0.5 * (|x residuals|^2 + w^2 |defects|^2), summed in segment order
+ */
+static double problemCost(const Problem *pr, double *obs, double *jump) {
+  double o = 0, d = 0;
+  for (int j = 0; j < pr->segments; j++) {
+    const Segment *sg = &pr->seg[j];
+    o += sg->obsCost;
+    d += sg->c[0] * sg->c[0] + sg->c[1] * sg->c[1] + sg->c[2] * sg->c[2];
+  }
+  if (obs)
+    *obs = o;
+  if (jump)
+    *jump = d;
+  return 0.5 * (o + pr->config->weight * pr->config->weight * d);
+}
+
+/*
+ *  Solve the damped normal equations [T B; B^T C] [du; dp] = -[gu; gp].
+ *  T is block tridiagonal in the segments, so block Thomas on the right-hand
+ *  sides [gu | B] followed by the 3x3 Schur complement for dp is O(segments).
+ *  Work arrays: dinv (9 per segment) and y (12 per segment)
+ */
+static int solveStep(const Problem *pr, double lambda, double *dinv,
+                     double *y, double *du, double dp[3]) {
+  int M = pr->segments;
+  double w2 = pr->config->weight * pr->config->weight;
+  double C[3][3] = {{0}}, gp[3] = {0};
+
+  for (int j = 0; j < M; j++) {
+    const Segment *sg = &pr->seg[j];
+    double D[3][3], R[3][4];
+    for (int i = 0; i < 3; i++) {
+      for (int m = 0; m < 3; m++) {
+        D[i][m] = sg->D[i][m];
+        R[i][1 + m] = sg->B[i][m];
+        C[i][m] += sg->C[i][m];
+      }
+      R[i][0] = sg->gu[i];
+      gp[i] += sg->gp[i];
+    }
+    const Segment *pv = j > 0 ? &pr->seg[j - 1] : NULL;
+    if (pv) {
+      // Terms of the previous segment's defect that involve u_j
+      for (int i = 0; i < 3; i++) {
+        D[i][i] += w2;
+        R[i][0] -= w2 * pv->c[i];
+        for (int m = 0; m < 3; m++)
+          R[i][1 + m] -= w2 * pv->Psi[i][m];
+      }
+    }
+    for (int i = 0; i < 3; i++)
+      D[i][i] = D[i][i] * (1.0 + lambda) + 1e-12;
+    if (pv) {
+      // Eliminate the sub-diagonal block E^T with E = -w2 Phi_{j-1}^T:
+      // D -= E^T Dinv_{j-1} E, R -= E^T Dinv_{j-1} Y_{j-1}
+      double (*pinv)[3] = (double (*)[3])(dinv + 9 * (j - 1));
+      double (*py)[4] = (double (*)[4])(y + 12 * (j - 1));
+      double EtDinv[3][3];
+      for (int i = 0; i < 3; i++)
+        for (int m = 0; m < 3; m++)
+          EtDinv[i][m] = -w2 * (pv->Phi[i][0] * pinv[0][m] +
+                                pv->Phi[i][1] * pinv[1][m] +
+                                pv->Phi[i][2] * pinv[2][m]);
+      for (int i = 0; i < 3; i++) {
+        for (int m = 0; m < 3; m++)
+          D[i][m] -= -w2 * (EtDinv[i][0] * pv->Phi[m][0] +
+                            EtDinv[i][1] * pv->Phi[m][1] +
+                            EtDinv[i][2] * pv->Phi[m][2]);
+        for (int m = 0; m < 4; m++)
+          R[i][m] -= EtDinv[i][0] * py[0][m] + EtDinv[i][1] * py[1][m] +
+                     EtDinv[i][2] * py[2][m];
+      }
+    }
+    if (!mat3Invert(D, (double (*)[3])(dinv + 9 * j)))
+      return 0;
+    memcpy(y + 12 * j, R, sizeof(R));
+  }
+
+  // Back substitution: X_j = Dinv_j (Y_j - E_j X_{j+1}), X = T^-1 [gu | B]
+  double next[3][4] = {{0}};
+  double BtW[3] = {0}, BtZ[3][3] = {{0}};
+  for (int j = M - 1; j >= 0; j--) {
+    double (*pinv)[3] = (double (*)[3])(dinv + 9 * j);
+    double (*py)[4] = (double (*)[4])(y + 12 * j);
+    double rhs[3][4], X[3][4];
+    for (int i = 0; i < 3; i++)
+      for (int m = 0; m < 4; m++) {
+        rhs[i][m] = py[i][m];
+        if (j + 1 < M)
+          // E_j = -w2 Phi_j^T
+          rhs[i][m] += w2 * (pr->seg[j].Phi[0][i] * next[0][m] +
+                             pr->seg[j].Phi[1][i] * next[1][m] +
+                             pr->seg[j].Phi[2][i] * next[2][m]);
+      }
+    for (int i = 0; i < 3; i++)
+      for (int m = 0; m < 4; m++)
+        X[i][m] = pinv[i][0] * rhs[0][m] + pinv[i][1] * rhs[1][m] +
+                  pinv[i][2] * rhs[2][m];
+    memcpy(next, X, sizeof(X));
+    // Keep X in y for the final du = -w - Z dp
+    memcpy(py, X, sizeof(X));
+
+    // Accumulate B_j^T w_j and B_j^T Z_j with the full B_j column
+    const Segment *sg = &pr->seg[j];
+    double Bj[3][3];
+    for (int i = 0; i < 3; i++)
+      for (int m = 0; m < 3; m++)
+        Bj[i][m] = sg->B[i][m] -
+                   (j > 0 ? w2 * pr->seg[j - 1].Psi[i][m] : 0.0);
+    for (int m = 0; m < 3; m++) {
+      for (int i = 0; i < 3; i++) {
+        BtW[m] += Bj[i][m] * X[i][0];
+        for (int k = 0; k < 3; k++)
+          BtZ[m][k] += Bj[i][m] * X[i][1 + k];
+      }
+    }
+  }
+
+  // Schur complement (C - B^T Z) dp = -gp + B^T w
+  double S[3][3], Sinv[3][3], rhs[3];
+  for (int i = 0; i < 3; i++) {
+    C[i][i] = C[i][i] * (1.0 + lambda) + 1e-12;
+    for (int m = 0; m < 3; m++)
+      S[i][m] = C[i][m] - BtZ[i][m];
+    rhs[i] = -gp[i] + BtW[i];
+  }
+  if (!mat3Invert(S, Sinv))
+    return 0;
+  mat3Vec(Sinv, rhs, dp);
+  for (int j = 0; j < M; j++) {
+    double (*X)[4] = (double (*)[4])(y + 12 * j);
+    for (int i = 0; i < 3; i++)
+      du[3 * j + i] = -X[i][0] - (X[i][1] * dp[0] + X[i][2] * dp[1] +
+                                  X[i][3] * dp[2]);
+  }
+  return 1;
+}
+
+/*
+ *  Initial segment states: x from the data, y from the slope of x through
+ *  dx/dt = s (y - x), z at the r - 1 level of the nontrivial fixed points
+ */
+static void initialStates(const double *data, int count, int L, int M,
+                          double dtSample, const double p[3], double *u) {
+  for (int j = 0; j < M; j++) {
+    int i = j * L;
+    int lo = i > 0 ? i - 1 : i, hi = i + 1 < count ? i + 1 : i;
+    double slope = hi > lo ? (data[hi] - data[lo]) / ((hi - lo) * dtSample)
+                           : 0.0;
+    u[3 * j] = data[i];
+    u[3 * j + 1] = data[i] + slope / p[0];
+    u[3 * j + 2] = p[2] - 1.0;
+  }
+}
+
+/*
+ *  Levenberg-Marquardt over all segment states and (s, b, r); segments are
+ *  linearized in parallel, the sparse solve is linear in the segment count.
+ *  Returns 0 on allocation or numerical failure
+ */
+int fitLorenz(const double *x, int count, const FitConfig *config,
+              const double guess[3], FitResult *result) {
+  int L = config->segment > 1 ? config->segment : 2;
+  int M = (count + L - 1) / L;
+  FitConfig cfg = *config;
+  cfg.segment = L;
+  if (count < 2 * L)
+    return 0;
+
+  double t0 = wallTime();
+  double *u = malloc(3 * (size_t)M * sizeof(double));
+  double *trialU = malloc(3 * (size_t)M * sizeof(double));
+  double *du = malloc(3 * (size_t)M * sizeof(double));
+  double *dinv = malloc(9 * (size_t)M * sizeof(double));
+  double *y = malloc(12 * (size_t)M * sizeof(double));
+  Segment *seg = malloc((size_t)M * sizeof(Segment));
+  Segment *trialSeg = malloc((size_t)M * sizeof(Segment));
+  int ok = u && trialU && du && dinv && y && seg && trialSeg;
+
+  double p[3] = {guess[0], guess[1], guess[2]}, trialP[3];
+  Problem pr = {x, count, &cfg, M, u, p, seg};
+  Problem trial = {x, count, &cfg, M, trialU, trialP, trialSeg};
+  double cost = 0, lambda = 1e-3;
+  int iter = 0;
+
+  if (ok) {
+    initialStates(x, count, L, M, cfg.sampleSteps * LORENZ_DT, p, u);
+    parallelFor(M, linearizeRange, &pr);
+    cost = problemCost(&pr, NULL, NULL);
+  }
+  while (ok && iter < cfg.maxIter) {
+    double dp[3];
+    if (!solveStep(&pr, lambda, dinv, y, du, dp)) {
+      ok = 0;
+      break;
+    }
+    for (int i = 0; i < 3 * M; i++)
+      trialU[i] = u[i] + du[i];
+    for (int i = 0; i < 3; i++)
+      trialP[i] = p[i] + dp[i];
+    parallelFor(M, linearizeRange, &trial);
+    double trialCost = problemCost(&trial, NULL, NULL);
+    iter++;
+
+    if (isfinite(trialCost) && trialCost < cost) {
+      // Accept: the trial linearization becomes the current one
+      double decrease = (cost - trialCost) / cost;
+      double change = fabs(dp[0] / p[0]) + fabs(dp[1] / p[1]) +
+                      fabs(dp[2] / p[2]);
+      double *tu = u;
+      Segment *ts = seg;
+      u = pr.u = trial.u = trialU;
+      trialU = tu;
+      trial.u = trialU;
+      seg = pr.seg = trialSeg;
+      trialSeg = trial.seg = ts;
+      memcpy(p, trialP, sizeof(p));
+      cost = trialCost;
+      lambda = lambda / 3 > 1e-12 ? lambda / 3 : 1e-12;
+      if (decrease < cfg.tolerance || change < cfg.tolerance)
+        break;
+    } else {
+      lambda *= 4;
+      if (lambda > 1e12)
+        break;
+    }
+  }
+
+  if (ok) {
+    double obs, jump;
+    problemCost(&pr, &obs, &jump);
+    result->s = p[0];
+    result->b = p[1];
+    result->r = p[2];
+    result->iterations = iter;
+    result->cost = cost;
+    result->rmsObs = sqrt(obs / count);
+    result->rmsJump = M > 1 ? sqrt(jump / (3.0 * (M - 1))) : 0.0;
+    result->seconds = wallTime() - t0;
+  }
+  free(u);
+  free(trialU);
+  free(du);
+  free(dinv);
+  free(y);
+  free(seg);
+  free(trialSeg);
+  return ok;
+}
+
+/*
+ *  Synthetic x(t) from the classic parameters with Gaussian noise
+ */
+static double *syntheticSeries(int count, int sampleSteps, double noise) {
+  double *data = malloc((size_t)count * sizeof(double));
+  if (!data)
+    return NULL;
+  double x = 1.0, y = 1.0, z = 1.0;
+  for (int i = 0; i < 2000; i++)
+    lorenzStep(10.0, 8.0 / 3.0, 28.0, LORENZ_DT, &x, &y, &z);
+  double n[4];
+  for (int i = 0; i < count; i++) {
+    for (int k = 0; k < sampleSteps; k++)
+      lorenzStep(10.0, 8.0 / 3.0, 28.0, LORENZ_DT, &x, &y, &z);
+    philoxNormals(7, 0, (uint64_t)i, 1, n);
+    data[i] = x + noise * n[0];
+  }
+  return data;
+}
+
+/*
+ *  fit [samples|file [segment [noise [sampleSteps]]]]: recover (s, b, r)
+ *  from x(t), synthetic (true 10, 8/3, 28) unless a file is given
+ */
+int fitBenchmark(int argc, char *argv[]) {
+  FitConfig config = {10, 10, 10.0, 100, 1e-10};
+  int count = 100000;
+  double noise = argc > 3 ? atof(argv[3]) : 0.0;
+  double *data = NULL;
+  if (argc > 2)
+    config.segment = atoi(argv[2]);
+  if (argc > 4)
+    config.sampleSteps = atoi(argv[4]);
+  if (config.sampleSteps < 1)
+    config.sampleSteps = 1;
+
+  if (argc > 1 && (data = loadSeries(argv[1], &count)))
+    printf("Loaded %d samples from %s\n", count, argv[1]);
+  else {
+    if (argc > 1)
+      count = atoi(argv[1]);
+    if (count < 1) {
+      fprintf(stderr, "fit: cannot read %s\n", argv[1]);
+      return 1;
+    }
+    data = syntheticSeries(count, config.sampleSteps, noise);
+    printf("Synthetic x(t): %d samples, noise %.3g, truth s=10 b=%.4f "
+           "r=28\n",
+           count, noise, 8.0 / 3.0);
+  }
+  if (!data) {
+    fprintf(stderr, "fit: out of memory\n");
+    return 1;
+  }
+
+  const double guess[3] = {8.0, 2.0, 24.0};
+  FitResult r;
+  printf("Multiple shooting: %d segments of %d samples, %d steps/sample, "
+         "threads=%d\n",
+         (count + config.segment - 1) / config.segment, config.segment,
+         config.sampleSteps, parallelThreads());
+  int ok = fitLorenz(data, count, &config, guess, &r);
+  free(data);
+  if (!ok) {
+    fprintf(stderr, "fit: failed (too few samples or singular system)\n");
+    return 1;
+  }
+  printf("  guess      s=%.6f b=%.6f r=%.6f\n", guess[0], guess[1], guess[2]);
+  printf("  recovered  s=%.6f b=%.6f r=%.6f\n", r.s, r.b, r.r);
+  printf("  %d iterations, %.3f s, cost %.4e, rms x residual %.3e, rms "
+         "defect %.3e\n",
+         r.iterations, r.seconds, r.cost, r.rmsObs, r.rmsJump);
+  return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef FIT_H
+#define FIT_H
+
+// Recover (s, b, r) from an observed x(t) series by multiple shooting
+typedef struct {
+  int segment;      // Samples per shooting segment
+  int sampleSteps;  // Euler steps of LORENZ_DT between samples
+  double weight;    // Weight of the continuity residuals
+  int maxIter;      // Levenberg-Marquardt iteration limit
+  double tolerance; // Stop once the relative cost decrease or parameter
+                    // change falls below this
+} FitConfig;
+
+typedef struct {
+  double s;
+  double b;
+  double r;
+  int iterations;
+  double cost;       // Final least-squares cost
+  double rmsObs;     // RMS of the x residuals
+  double rmsJump;    // RMS of the continuity defects between segments
+  double seconds;    // Wall time
+} FitResult;
+
+int fitLorenz(const double *x, int count, const FitConfig *config,
+              const double guess[3], FitResult *result);
+int fitBenchmark(int argc, char *argv[]);
+
+#endif // FIT_H
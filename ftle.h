@@ -0,0 +1,30 @@
+#ifndef FTLE_H
+#define FTLE_H
+
+// Planes the initial-condition slice can lie in
+#define FTLE_XY 0
+#define FTLE_XZ 1
+#define FTLE_YZ 2
+
+// Finite-time Lyapunov exponent field over a 2D slice of initial conditions
+typedef struct {
+  double s;
+  double b;
+  double r;
+  int plane;     // FTLE_XY, FTLE_XZ or FTLE_YZ
+  double offset; // Coordinate normal to the plane
+  double umin;   // Extent along the first in-plane axis
+  double umax;
+  double vmin;   // Extent along the second in-plane axis
+  double vmax;
+  int width;     // Grid columns (first axis)
+  int height;    // Grid rows (second axis, top row at vmax)
+  double T;      // Integration time
+} FtleConfig;
+
+void ftleDefaultConfig(FtleConfig *config, double s, double b, double r,
+                       int plane, int size);
+int computeFtle(const FtleConfig *config, float *field);
+int ftleCommand(int argc, char *argv[]);
+
+#endif // FTLE_H
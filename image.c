@@ -0,0 +1,135 @@
+#include "image.h"
+#include "trace.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ *  Allocate a black image; returns 0 on failure
+ */
+int imageInit(Image *img, int width, int height) {
+  img->width = width;
+  img->height = height;
+  img->rgb = calloc((size_t)width * height, 3);
+  return img->rgb != NULL;
+}
+
+void imageFree(Image *img) {
+  free(img->rgb);
+  img->rgb = NULL;
+  img->width = img->height = 0;
+}
+
+/*
+ *  Binary PPM (P6); returns 0 on I/O failure
+ */
+int imageWritePPM(const Image *img, const char *path) {
+  double span = traceBegin();
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return 0;
+  fprintf(file, "P6\n%d %d\n255\n", img->width, img->height);
+  size_t size = (size_t)img->width * img->height * 3;
+  int ok = fwrite(img->rgb, 1, size, file) == size;
+  ok = fclose(file) == 0 && ok;
+  traceEnd("write PPM", span);
+  return ok;
+}
+
+/*
+ *  Dark blue through red to pale yellow for t in [0, 1]
+ */
+void colormap(double t, unsigned char rgb[3]) {
+  static const float stops[5][3] = {{0.02f, 0.02f, 0.15f},
+                                    {0.25f, 0.05f, 0.55f},
+                                    {0.80f, 0.15f, 0.35f},
+                                    {0.98f, 0.55f, 0.10f},
+                                    {0.99f, 0.98f, 0.75f}};
+  if (!(t > 0))
+    t = 0;
+  if (t > 1)
+    t = 1;
+  double f = t * 4;
+  int i = f >= 4 ? 3 : (int)f;
+  f -= i;
+  for (int c = 0; c < 3; c++)
+    rgb[c] = (unsigned char)(255 * ((1 - f) * stops[i][c] +
+                                    f * stops[i + 1][c]) + 0.5);
+}
+
+static int compareFloat(const void *a, const void *b) {
+  float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+/*
+ *  Color a scalar field, stretched between its 1st and 99th percentiles
+ *  (estimated from a subsample) so isolated spikes do not wash it out
+ */
+void scalarFieldToImage(const float *field, int width, int height,
+                        Image *img) {
+  enum { SAMPLES = 4096 };
+  float sample[SAMPLES];
+  size_t n = (size_t)width * height;
+  size_t stride = n / SAMPLES > 0 ? n / SAMPLES : 1;
+  int count = 0;
+  for (size_t i = 0; i < n && count < SAMPLES; i += stride)
+    if (isfinite(field[i]))
+      sample[count++] = field[i];
+  qsort(sample, count, sizeof(float), compareFloat);
+
+  float lo = count ? sample[count / 100] : 0;
+  float hi = count ? sample[count - 1 - count / 100] : 1;
+  if (!(hi > lo))
+    hi = lo + 1;
+  for (size_t i = 0; i < n; i++)
+    colormap(isfinite(field[i]) ? (field[i] - lo) / (hi - lo) : 0,
+             img->rgb + 3 * i);
+}
+
+// 5x7 glyphs, one byte per row with bit 4 leftmost; enough for parameter
+// labels, anything else draws as a space
+static const char glyphChars[] = "0123456789.-=:,rsbt";
+static const unsigned char glyphs[][7] = {
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, // 0
+    {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 1
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, // 2
+    {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, // 3
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, // 4
+    {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, // 5
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, // 6
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, // 8
+    {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, // 9
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}, // .
+    {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, // -
+    {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}, // =
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}, // :
+    {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08}, // ,
+    {0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10}, // r
+    {0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E}, // s
+    {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E}, // b
+    {0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06}, // t
+};
+
+/*
+ *  Draw text with its top left corner at (x, y), 6 pixels per character;
+ *  pixels outside the image are dropped
+ */
+void imageText(Image *img, int x, int y, const char *text,
+               const unsigned char rgb[3]) {
+  for (; *text; text++, x += IMAGE_GLYPH_WIDTH) {
+    const char *c = strchr(glyphChars, *text);
+    if (!c)
+      continue;
+    const unsigned char *rows = glyphs[c - glyphChars];
+    for (int j = 0; j < 7; j++)
+      for (int i = 0; i < 5; i++) {
+        int px = x + i, py = y + j;
+        if ((rows[j] >> (4 - i) & 1) && px >= 0 && px < img->width &&
+            py >= 0 && py < img->height)
+          memcpy(img->rgb + 3 * ((size_t)py * img->width + px), rgb, 3);
+      }
+  }
+}
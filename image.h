@@ -0,0 +1,24 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+// Advance and height of imageText characters
+#define IMAGE_GLYPH_WIDTH 6
+#define IMAGE_GLYPH_HEIGHT 7
+
+// 8-bit RGB raster, rows top to bottom
+typedef struct {
+  int width;
+  int height;
+  unsigned char *rgb;
+} Image;
+
+int imageInit(Image *img, int width, int height);
+void imageFree(Image *img);
+int imageWritePPM(const Image *img, const char *path);
+void colormap(double t, unsigned char rgb[3]);
+void scalarFieldToImage(const float *field, int width, int height,
+                        Image *img);
+void imageText(Image *img, int x, int y, const char *text,
+               const unsigned char rgb[3]);
+
+#endif // IMAGE_H
@@ -0,0 +1,186 @@
+#include "instrument.h"
+#include "parallel.h"
+#include "trace.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INSTRUMENT_SLOTS 64 // Threads with a slot of their own
+
+// Running totals of one thread, written only by that thread; a cache line
+// of its own keeps threads from contending for it
+typedef struct {
+  _Alignas(64) atomic_llong nanos[INSTRUMENT_STAGES];
+  atomic_llong calls[INSTRUMENT_STAGES];
+} Slot;
+
+static Slot slots[INSTRUMENT_SLOTS + 1]; // The last is shared by the rest
+static atomic_int slotCount;
+static _Thread_local Slot *mySlot;
+
+// Per-frame history, touched only by the thread that closes frames
+static float history[INSTRUMENT_STAGES][INSTRUMENT_HISTORY];
+static long long frames;
+static long long lastNanos[INSTRUMENT_STAGES];
+static double lastFrame;
+
+static const char *const names[INSTRUMENT_STAGES] = {
+    "integrate", "color", "draw", "HUD", "swap", "frame"};
+
+/*
+ *  Monotonic clock in seconds, the same one as wallTime
+ */
+double instrumentNow(void) { return wallTime(); }
+
+static Slot *threadSlot(void) {
+  if (!mySlot) {
+    int k = atomic_fetch_add_explicit(&slotCount, 1, memory_order_relaxed);
+    mySlot = &slots[k < INSTRUMENT_SLOTS ? k : INSTRUMENT_SLOTS];
+  }
+  return mySlot;
+}
+
+/*
+ *  Charge the time since `start` to a stage of the calling thread without
+ *  locking, and trace it as a span; returns the current time so
+ *  consecutive stages can chain
+ */
+double instrumentAdd(int stage, double start) {
+  double now = instrumentNow();
+  if (traceEnabled)
+    traceSpan(names[stage], start, now);
+  Slot *slot = threadSlot();
+  long long ns = (long long)((now - start) * 1e9);
+  if (slot == &slots[INSTRUMENT_SLOTS]) {
+    atomic_fetch_add_explicit(&slot->nanos[stage], ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->calls[stage], 1, memory_order_relaxed);
+  } else {
+    // Sole writer: a plain load and store, still atomic for the readers
+    atomic_store_explicit(
+        &slot->nanos[stage],
+        atomic_load_explicit(&slot->nanos[stage], memory_order_relaxed) + ns,
+        memory_order_relaxed);
+    atomic_store_explicit(
+        &slot->calls[stage],
+        atomic_load_explicit(&slot->calls[stage], memory_order_relaxed) + 1,
+        memory_order_relaxed);
+  }
+  return now;
+}
+
+/*
+ *  A stage's total over the registered per-thread slots and the shared
+ *  overflow slot
+ */
+static long long stageNanos(int stage) {
+  int used = atomic_load_explicit(&slotCount, memory_order_relaxed);
+  if (used > INSTRUMENT_SLOTS)
+    used = INSTRUMENT_SLOTS;
+  long long sum = atomic_load_explicit(&slots[INSTRUMENT_SLOTS].nanos[stage],
+                                       memory_order_relaxed);
+  for (int k = 0; k < used; k++)
+    sum += atomic_load_explicit(&slots[k].nanos[stage], memory_order_relaxed);
+  return sum;
+}
+
+/*
+ *  Close a frame at time `now`: what every thread charged to each stage
+ *  since the last call becomes that frame's entry in the history
+ */
+void instrumentFrame(double now) {
+  int slot = frames % INSTRUMENT_HISTORY;
+  for (int s = 0; s < INSTRUMENT_FRAME; s++) {
+    long long total = stageNanos(s);
+    history[s][slot] = (float)((total - lastNanos[s]) * 1e-6);
+    lastNanos[s] = total;
+  }
+  history[INSTRUMENT_FRAME][slot] =
+      lastFrame > 0 ? (float)(1e3 * (now - lastFrame)) : 0.0f;
+  lastFrame = now;
+  frames++;
+}
+
+const char *instrumentName(int stage) { return names[stage]; }
+
+static int compareFloat(const void *a, const void *b) {
+  float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+/*
+ *  Fill ms with the stage's time in the recorded frames, oldest first;
+ *  returns how many (at most INSTRUMENT_HISTORY)
+ */
+int instrumentHistory(int stage, float *ms) {
+  int n = frames < INSTRUMENT_HISTORY ? (int)frames : INSTRUMENT_HISTORY;
+  for (int i = 0; i < n; i++)
+    ms[i] = history[stage][(frames - n + i) % INSTRUMENT_HISTORY];
+  return n;
+}
+
+/*
+ *  Last value, mean and percentiles of a stage over the recorded frames;
+ *  returns 0 before the first frame
+ */
+int instrumentSummary(int stage, InstrumentSummary *summary) {
+  float ms[INSTRUMENT_HISTORY] = {0};
+  int n = instrumentHistory(stage, ms);
+  memset(summary, 0, sizeof(*summary));
+  if (n == 0)
+    return 0;
+  summary->last = ms[n - 1];
+  for (int i = 0; i < n; i++)
+    summary->mean += ms[i] / n;
+  qsort(ms, n, sizeof(float), compareFloat);
+  summary->p50 = ms[n / 2];
+  summary->p99 = ms[(99 * (n - 1) + 50) / 100];
+  return 1;
+}
+
+// Spans charged by every worker in the command below
+typedef struct {
+  int spans;
+  double *seconds; // Per worker
+} SpanTask;
+
+static void chargeSpans(void *ctx, int begin, int end, int thread) {
+  const SpanTask *t = ctx;
+  for (int w = begin; w < end; w++) {
+    double t0 = instrumentNow(), start = t0;
+    for (int i = 0; i < t->spans; i++)
+      start = instrumentAdd(INSTRUMENT_INTEGRATE, start);
+    t->seconds[w] = instrumentNow() - t0;
+  }
+}
+
+/*
+ *  instrument [spans]: cost of timing a stage, charged from every worker
+ *  thread at once, and a check that no span is lost
+ */
+int instrumentCommand(int argc, char *argv[]) {
+  int spans = argc > 1 ? atoi(argv[1]) : 1000000;
+  int threads = parallelThreads();
+  SpanTask t = {spans, calloc(threads, sizeof(double))};
+  if (spans < 1 || !t.seconds) {
+    fprintf(stderr, "instrument: need spans >= 1\n");
+    free(t.seconds);
+    return 1;
+  }
+  long long before = 0;
+  for (int k = 0; k <= INSTRUMENT_SLOTS; k++)
+    before += atomic_load(&slots[k].calls[INSTRUMENT_INTEGRATE]);
+  parallelFor(threads, chargeSpans, &t);
+  long long after = 0;
+  double worst = 0;
+  for (int k = 0; k <= INSTRUMENT_SLOTS; k++)
+    after += atomic_load(&slots[k].calls[INSTRUMENT_INTEGRATE]);
+  for (int w = 0; w < threads; w++)
+    worst = t.seconds[w] > worst ? t.seconds[w] : worst;
+  printf("Instrument: %d threads x %d spans, %.1f ns per span (slowest "
+         "thread), %lld of %lld counted\n",
+         threads, spans, 1e9 * worst / spans, after - before,
+         (long long)threads * spans);
+  free(t.seconds);
+  return after - before == (long long)threads * spans ? 0 : 1;
+}
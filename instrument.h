@@ -0,0 +1,32 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+// Timed stages of a viewer frame
+#define INSTRUMENT_INTEGRATE 0 // Simulation ticks and recomputes
+#define INSTRUMENT_COLOR 1     // Rebuilding color arrays
+#define INSTRUMENT_DRAW 2      // Submitting vertices (includes color)
+#define INSTRUMENT_HUD 3       // Text and panels
+#define INSTRUMENT_SWAP 4      // Flush and buffer swap
+#define INSTRUMENT_FRAME 5     // Whole frame, display to display
+#define INSTRUMENT_STAGES 6
+
+// Frames kept for the statistics and the graph
+#define INSTRUMENT_HISTORY 240
+
+// Statistics of one stage over the recent frames, in milliseconds
+typedef struct {
+  double last;
+  double mean;
+  double p50;
+  double p99;
+} InstrumentSummary;
+
+double instrumentNow(void);
+double instrumentAdd(int stage, double start);
+void instrumentFrame(double now);
+const char *instrumentName(int stage);
+int instrumentSummary(int stage, InstrumentSummary *summary);
+int instrumentHistory(int stage, float *ms);
+int instrumentCommand(int argc, char *argv[]);
+
+#endif // INSTRUMENT_H
@@ -1,18 +1,61 @@
 #include "lorenz.h"
+#include "parallel.h"
+#include "trace.h"
+#include <math.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 void computeLorenzPoints(State *state) {
   if (!state) return;
+  double span = traceBegin();
 
   double x = 1.0;
   double y = 1.0;
   double z = 1.0;
-  double dt = 0.001;
 
   for (int i = 0; i < LORENZ_POINTS; i++) {
-    double dx = state->s * (y - x);
-    double dy = x * (state->r - z) - y;
-    double dz = x * y - state->b * z;
+    lorenzStep(state->s, state->b, state->r, LORENZ_DT, &x, &y, &z);
+
+    state->points[i].x = x;
+    state->points[i].y = y;
+    state->points[i].z = z;
+  }
+  traceEnd("computeLorenzPoints", span);
+}
+
+/*
+ *  Fill state->points exactly like computeLorenzPoints and, in the same loop,
+ *  the forward sensitivities d(x,y,z)/ds, /db and /dr at every point:
+ *  S' = J S + df/dp, with the Jacobian J sharing the right-hand side terms
+ */
+void computeLorenzSensitivities(State *state, Point3D *ds, Point3D *db,
+                                Point3D *dr) {
+  if (!state || !ds || !db || !dr) return;
+
+  double s = state->s, b = state->b, r = state->r, dt = LORENZ_DT;
+  double x = 1.0, y = 1.0, z = 1.0;
+  Point3D Ss = {0, 0, 0}, Sb = {0, 0, 0}, Sr = {0, 0, 0};
+
+  for (int i = 0; i < LORENZ_POINTS; i++) {
+    // Shared terms: J = [[-s, s, 0], [r - z, -1, -x], [y, x, -b]]
+    double ymx = y - x, rmz = r - z;
+    double dx = s * ymx;
+    double dy = x * rmz - y;
+    double dz = x * y - b * z;
+
+    Point3D ns = {Ss.x + dt * (s * (Ss.y - Ss.x) + ymx),
+                  Ss.y + dt * (rmz * Ss.x - Ss.y - x * Ss.z),
+                  Ss.z + dt * (y * Ss.x + x * Ss.y - b * Ss.z)};
+    Point3D nb = {Sb.x + dt * (s * (Sb.y - Sb.x)),
+                  Sb.y + dt * (rmz * Sb.x - Sb.y - x * Sb.z),
+                  Sb.z + dt * (y * Sb.x + x * Sb.y - b * Sb.z - z)};
+    Point3D nr = {Sr.x + dt * (s * (Sr.y - Sr.x)),
+                  Sr.y + dt * (rmz * Sr.x - Sr.y - x * Sr.z + x),
+                  Sr.z + dt * (y * Sr.x + x * Sr.y - b * Sr.z)};
+    Ss = ns;
+    Sb = nb;
+    Sr = nr;
     x += dt * dx;
     y += dt * dy;
     z += dt * dz;
@@ -20,5 +63,92 @@ void computeLorenzPoints(State *state) {
     state->points[i].x = x;
     state->points[i].y = y;
     state->points[i].z = z;
+    ds[i] = Ss;
+    db[i] = Sb;
+    dr[i] = Sr;
+  }
+}
+
+/*
+ *  Central difference of computeLorenzPoints at point i for one parameter
+ */
+static Point3D finiteDifference(State *probe, double *param, double h,
+                                int i) {
+  double saved = *param;
+  *param = saved + h;
+  computeLorenzPoints(probe);
+  Point3D plus = probe->points[i];
+  *param = saved - h;
+  computeLorenzPoints(probe);
+  Point3D minus = probe->points[i];
+  *param = saved;
+  Point3D d = {(plus.x - minus.x) / (2 * h), (plus.y - minus.y) / (2 * h),
+               (plus.z - minus.z) / (2 * h)};
+  return d;
+}
+
+static double relativeError(Point3D a, Point3D ref) {
+  double e = sqrt((a.x - ref.x) * (a.x - ref.x) +
+                  (a.y - ref.y) * (a.y - ref.y) +
+                  (a.z - ref.z) * (a.z - ref.z));
+  double n = sqrt(ref.x * ref.x + ref.y * ref.y + ref.z * ref.z);
+  return e / (n > 1e-12 ? n : 1e-12);
+}
+
+/*
+ *  sensitivity [index]: compare the fused pass against central differences
+ *  (2*3+1 = 7 trajectory passes) and time both
+ */
+int sensitivityBenchmark(int argc, char *argv[]) {
+  int index = argc > 1 ? atoi(argv[1]) : 2000;
+  State *state = malloc(sizeof(State));
+  State *probe = malloc(sizeof(State));
+  Point3D *sens = malloc(3 * LORENZ_POINTS * sizeof(Point3D));
+  if (!state || !probe || !sens) {
+    fprintf(stderr, "sensitivity: out of memory\n");
+    free(state);
+    free(probe);
+    free(sens);
+    return 1;
+  }
+  if (index < 0 || index >= LORENZ_POINTS)
+    index = LORENZ_POINTS - 1;
+  state->s = probe->s = 10.0;
+  state->b = probe->b = 2.6666;
+  state->r = probe->r = 28.0;
+
+  // Untimed passes first so page faults are not counted
+  computeLorenzSensitivities(state, sens, sens + LORENZ_POINTS,
+                             sens + 2 * LORENZ_POINTS);
+  computeLorenzPoints(probe);
+
+  double t0 = wallTime();
+  computeLorenzSensitivities(state, sens, sens + LORENZ_POINTS,
+                             sens + 2 * LORENZ_POINTS);
+  double tFused = wallTime() - t0;
+
+  const double h = 1e-6;
+  t0 = wallTime();
+  computeLorenzPoints(probe);
+  Point3D fd[3] = {finiteDifference(probe, &probe->s, h, index),
+                   finiteDifference(probe, &probe->b, h, index),
+                   finiteDifference(probe, &probe->r, h, index)};
+  double tFd = wallTime() - t0;
+
+  const char *names[3] = {"s", "b", "r"};
+  printf("Sensitivities at point %d (t=%.3f):\n", index,
+         (index + 1) * LORENZ_DT);
+  for (int p = 0; p < 3; p++) {
+    Point3D a = sens[p * LORENZ_POINTS + index];
+    printf("  d/d%s fused (%11.4e %11.4e %11.4e)  finite diff (%11.4e "
+           "%11.4e %11.4e)  rel err %.2e\n",
+           names[p], a.x, a.y, a.z, fd[p].x, fd[p].y, fd[p].z,
+           relativeError(a, fd[p]));
   }
+  printf("  fused pass: %.4f s, finite differences (7 passes): %.4f s\n",
+         tFused, tFd);
+  free(state);
+  free(probe);
+  free(sens);
+  return 0;
 }
\ No newline at end of file
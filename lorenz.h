@@ -3,6 +3,23 @@
 
 #include "state.h"
 
+// Time step used for every Lorenz-63 trajectory
+#define LORENZ_DT 0.001
+
+// One forward Euler step of the Lorenz-63 equations
+static inline void lorenzStep(double s, double b, double r, double dt,
+                              double *x, double *y, double *z) {
+  double dx = s * (*y - *x);
+  double dy = *x * (r - *z) - *y;
+  double dz = *x * *y - b * *z;
+  *x += dt * dx;
+  *y += dt * dy;
+  *z += dt * dz;
+}
+
 void computeLorenzPoints(State *state);
+void computeLorenzSensitivities(State *state, Point3D *ds, Point3D *db,
+                                Point3D *dr);
+int sensitivityBenchmark(int argc, char *argv[]);
 
 #endif // LORENZ_H
@@ -0,0 +1,194 @@
+#include "lorenz96.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Below this many variables a step is not worth splitting across threads
+#define L96_PARALLEL_MIN 16384
+#define L96_SPINUP_STEPS 2000
+
+// One RK4 stage over a range of variables
+typedef struct {
+  Lorenz96 *model;
+  const double *k; // Previous stage derivative, NULL for the first stage
+  double h;        // Offset of the stage input along k
+  double *out;     // Stage derivative, NULL for the final combining stage
+} Stage;
+
+/*
+ *  Stage input at cyclic index j, used for the wrap-around edges
+ */
+static double stageInput(const Stage *st, int j) {
+  int n = st->model->n;
+  j = (j + n) % n;
+  return st->k ? st->model->x[j] + st->h * st->k[j] : st->model->x[j];
+}
+
+/*
+ *  Evaluate one stage for variables [begin, end); the interior loops have
+ *  unit-stride loads only so the compiler can vectorize them
+ */
+static void stageRange(void *ctx, int begin, int end, int thread) {
+  const Stage *st = ctx;
+  const Lorenz96 *m = st->model;
+  const double *restrict x = m->x;
+  const double *restrict k = st->k;
+  const double *restrict k1 = m->k1;
+  const double *restrict k2 = m->k2;
+  const double *restrict k3 = m->k3;
+  double *restrict out = st->out;
+  double *restrict xn = m->xn;
+  double F = m->F, h = st->h, dt6 = m->dt / 6.0;
+  int lo = begin < 2 ? 2 : begin;
+  int hi = end > m->n - 1 ? m->n - 1 : end;
+
+  for (int i = begin; i < end; i++) {
+    // Cyclic boundary, handled with scalar wrap-around
+    if (i == lo && lo < hi)
+      i = hi;
+    double d = (stageInput(st, i + 1) - stageInput(st, i - 2)) *
+                   stageInput(st, i - 1) -
+               stageInput(st, i) + F;
+    if (out)
+      out[i] = d;
+    else
+      xn[i] = x[i] + dt6 * (k1[i] + 2.0 * (k2[i] + k3[i]) + d);
+  }
+
+  if (!k) {
+    for (int i = lo; i < hi; i++)
+      out[i] = (x[i + 1] - x[i - 2]) * x[i - 1] - x[i] + F;
+  } else if (out) {
+    for (int i = lo; i < hi; i++)
+      out[i] = ((x[i + 1] + h * k[i + 1]) - (x[i - 2] + h * k[i - 2])) *
+                   (x[i - 1] + h * k[i - 1]) -
+               (x[i] + h * k[i]) + F;
+  } else {
+    for (int i = lo; i < hi; i++) {
+      double d = ((x[i + 1] + h * k[i + 1]) - (x[i - 2] + h * k[i - 2])) *
+                     (x[i - 1] + h * k[i - 1]) -
+                 (x[i] + h * k[i]) + F;
+      xn[i] = x[i] + dt6 * (k1[i] + 2.0 * (k2[i] + k3[i]) + d);
+    }
+  }
+}
+
+static void runStage(Lorenz96 *model, const double *k, double h, double *out) {
+  Stage st = {model, k, h, out};
+  if (model->n >= L96_PARALLEL_MIN)
+    parallelFor(model->n, stageRange, &st);
+  else
+    stageRange(&st, 0, model->n, 0);
+}
+
+/*
+ *  Allocate the model and start from the usual x_i = F with one perturbed
+ *  variable; returns 0 on allocation failure
+ */
+int lorenz96Init(Lorenz96 *model, int n, double F, double dt) {
+  if (n < 4)
+    n = 4;
+  model->n = n;
+  model->F = F;
+  model->dt = dt;
+  model->x = malloc(n * sizeof(double));
+  model->xn = malloc(n * sizeof(double));
+  model->k1 = malloc(n * sizeof(double));
+  model->k2 = malloc(n * sizeof(double));
+  model->k3 = malloc(n * sizeof(double));
+  if (!model->x || !model->xn || !model->k1 || !model->k2 || !model->k3) {
+    lorenz96Free(model);
+    return 0;
+  }
+  for (int i = 0; i < n; i++)
+    model->x[i] = F;
+  model->x[0] += 0.01;
+  return 1;
+}
+
+void lorenz96Free(Lorenz96 *model) {
+  free(model->x);
+  free(model->xn);
+  free(model->k1);
+  free(model->k2);
+  free(model->k3);
+  model->x = model->xn = model->k1 = model->k2 = model->k3 = NULL;
+}
+
+/*
+ *  Advance one classical RK4 step; the last stage writes straight into xn
+ */
+void lorenz96Step(Lorenz96 *model) {
+  double dt = model->dt;
+  runStage(model, NULL, 0.0, model->k1);
+  runStage(model, model->k1, 0.5 * dt, model->k2);
+  runStage(model, model->k2, 0.5 * dt, model->k3);
+  runStage(model, model->k3, dt, NULL);
+  double *tmp = model->x;
+  model->x = model->xn;
+  model->xn = tmp;
+}
+
+/*
+ *  Fill state->points with the projection (x_p, x_p+1, x_p+2) of a
+ *  Lorenz-96 trajectory, p = state->l96Proj
+ */
+void computeLorenz96Points(State *state) {
+  if (!state) return;
+
+  Lorenz96 model;
+  if (!lorenz96Init(&model, state->l96N, state->l96F, 0.01))
+    return;
+  int n = model.n;
+  int p = ((state->l96Proj % n) + n) % n;
+
+  for (int i = 0; i < L96_SPINUP_STEPS; i++)
+    lorenz96Step(&model);
+  for (int i = 0; i < LORENZ_POINTS; i++) {
+    lorenz96Step(&model);
+    state->points[i].x = model.x[p];
+    state->points[i].y = model.x[(p + 1) % n];
+    state->points[i].z = model.x[(p + 2) % n];
+  }
+  lorenz96Free(&model);
+}
+
+/*
+ *  Time one model size and print variable-updates per second
+ */
+static int benchmarkSize(int n, int steps) {
+  Lorenz96 model;
+  if (!lorenz96Init(&model, n, 8.0, 0.01)) {
+    fprintf(stderr, "Lorenz-96: cannot allocate N=%d\n", n);
+    return 1;
+  }
+  lorenz96Step(&model); // Warm up pages and the thread pool
+  double t0 = wallTime();
+  for (int i = 0; i < steps; i++)
+    lorenz96Step(&model);
+  double t = wallTime() - t0;
+  printf("Lorenz-96 N=%-8d steps=%-8d threads=%-3d %8.3f s  %.3e "
+         "variable-updates/s\n",
+         model.n, steps, model.n >= L96_PARALLEL_MIN ? parallelThreads() : 1,
+         t, (double)model.n * steps / t);
+  lorenz96Free(&model);
+  return 0;
+}
+
+/*
+ *  lorenz96 [N [steps]]: benchmark one size, or sweep N = 40 to 1e6
+ */
+int lorenz96Benchmark(int argc, char *argv[]) {
+  if (argc > 1) {
+    int n = atoi(argv[1]);
+    int steps = argc > 2 ? atoi(argv[2]) : 1000;
+    return benchmarkSize(n, steps > 0 ? steps : 1);
+  }
+  const int sizes[] = {40, 1000, 10000, 100000, 1000000};
+  int err = 0;
+  for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+    int steps = (int)(2e7 / sizes[i]);
+    err |= benchmarkSize(sizes[i], steps < 20 ? 20 : steps);
+  }
+  return err;
+}
@@ -0,0 +1,24 @@
+#ifndef LORENZ96_H
+#define LORENZ96_H
+
+#include "state.h"
+
+// N-variable Lorenz-96 model, dx_i/dt = (x_{i+1} - x_{i-2}) x_{i-1} - x_i + F
+typedef struct {
+  int n;      // Number of variables
+  double F;   // Forcing
+  double dt;  // RK4 time step
+  double *x;  // Current state
+  double *xn; // Next state (swapped with x after each step)
+  double *k1; // RK4 stage derivatives
+  double *k2;
+  double *k3;
+} Lorenz96;
+
+int lorenz96Init(Lorenz96 *model, int n, double F, double dt);
+void lorenz96Free(Lorenz96 *model);
+void lorenz96Step(Lorenz96 *model);
+void computeLorenz96Points(State *state);
+int lorenz96Benchmark(int argc, char *argv[]);
+
+#endif // LORENZ96_H
@@ -10,17 +10,94 @@
  *  r/R    Increase/decrease r parameter (rho)
  *  s/S    Increase/decrease s parameter (sigma)
  *  b/B    Increase/decrease b parameter (beta)
+ *  n/N    Increase/decrease noise amplitude (stochastic Lorenz)
+ *  g      Draw a new noise path
+ *  v      Cycle view (attractor/FTLE map/chaos map)
+ *  o      Cycle FTLE slice plane
+ *  u      Toggle unstable periodic orbit overlay
+ *  w      Toggle power spectrum panel
+ *  e      Toggle delay embedding of x(t) (or of $LORENZ_SERIES)
+ *  d/D    Increase/decrease embedding lag
+ *  m      Cycle Ulam overlay (off/invariant density/almost-invariant sets)
+ *  h      Toggle butterfly-effect ensemble (1024 perturbed copies)
+ *  a      Toggle particle cloud (1M points, or $LORENZ_PARTICLES)
+ *  j      Toggle live comet trail
+ *  t      Toggle swept tube around the trajectory
+ *  x      Export the trajectory or tube to $LORENZ_EXPORT (.ply/.obj/.glb)
+ *  i      Toggle frame timing overlay
+ *  T      Write the timing trace to $LORENZ_TRACE (Chrome trace JSON)
+ *  click  Pick r and s from the chaos map
+ *  l      Cycle system (Lorenz-63/Lorenz-96/coupled network)
+ *  p/P    Shift Lorenz-96 projection variables
+ *  f/F    Increase/decrease Lorenz-96 forcing
+ *  k/K    Increase/decrease network coupling
  *  arrows Change view angle
  *  0      Reset view angle
  *  ESC    Exit
+ *
+ *  Headless commands (./hw2 <command> [args]):
+ *  lorenz96 [N [steps]]   Lorenz-96 throughput benchmark
+ *  sde [members [steps [sigma [heun]]]]  Stochastic ensemble benchmark
+ *  enkf [cycles [members]]  Ensemble Kalman filter twin experiment
+ *  sensitivity [index]      Parameter sensitivities vs finite differences
+ *  fit [samples|file [segment [noise [sampleSteps]]]]  Parameter estimation
+ *  ftle [size [T [xy|xz|yz [file.ppm]]]]  Export an FTLE map
+ *  chaosmap [size [b [file.ppm]]]  Export a Lyapunov exponent map over (r, s)
+ *  upo [time [eps [loops]]]  Catalogue unstable periodic orbits
+ *  symbolic [steps [maxWord]]  L/R itinerary word statistics and entropies
+ *  spectrum [samples [size [file.csv]]]  Welch power spectra of x, y, z
+ *  recurrence [N [eps [file.ppm]]]  Recurrence plot and quantification
+ *  embed [samples|file [maxLag [maxDim]]]  Choose a delay embedding of x(t)
+ *  ulam [h [tau [points [file.csv]]]]  Transfer operator on boxes of side h
+ *  network [N|edges.txt [k [steps]]]  Coupled Lorenz network stepping
+ *  butterfly [copies [runs [eps [file.csv]]]]  Divergence time statistics
+ *  particles [count [steps [frames]]]  Particle cloud frame time
+ *  trail [points [steps [frames]]]  Comet trail frame time over a long run
+ *  clock [frames [fps [hitch]]]  Fixed-timestep scheduler under frame hitches
+ *  tube [points [sides]]  Tube mesh build and incremental update time
+ *  export file [points [sides]]  Stream a trajectory or tube to PLY/OBJ/GLB
+ *  render file.y4m|file.ppm [frames [width [height [tilt]]]]  Turntable
+ *  sheet [cells [tile [file.ppm]]]  Contact sheet of attractors over r and s
+ *  instrument [spans]  Cost of the per-thread stage timers
+ *  trace [runs]  Cost of trace spans ($LORENZ_TRACE also traces commands)
+ *  bench [file.json [reps [label]]]  Benchmark suite with JSON results
  */
 
+#include "bench.h"
+#include "butterfly.h"
+#include "chaosmap.h"
+#include "color.h"
+#include "embed.h"
+#include "enkf.h"
+#include "export.h"
+#include "fit.h"
+#include "ftle.h"
+#include "image.h"
+#include "instrument.h"
 #include "lorenz.h"
+#include "lorenz96.h"
+#include "network.h"
+#include "parallel.h"
+#include "particles.h"
+#include "recurrence.h"
+#include "render.h"
+#include "sde.h"
+#include "series.h"
+#include "sheet.h"
+#include "simclock.h"
+#include "spectrum.h"
 #include "state.h"
+#include "symbolic.h"
+#include "trail.h"
+#include "trace.h"
+#include "tube.h"
+#include "ulam.h"
+#include "upo.h"
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef USEGLEW
 #include <GL/glew.h>
@@ -38,6 +115,34 @@
 #define MIN_SPEED 1.0
 #define SPEED_STEP 1.0
 
+// FTLE view resolution and integration time
+#define FTLE_VIEW_SIZE 512
+#define FTLE_VIEW_TIME 1.0
+
+// Chaos map resolution
+#define CHAOS_VIEW_SIZE 256
+
+// Periodic orbits drawn by the overlay and samples per orbit
+#define UPO_VIEW_ORBITS 12
+#define UPO_VIEW_POINTS 400
+
+// Spectrum panel: window length, trajectory samples per 0.01 time units and
+// highest frequency shown
+#define SPECTRUM_VIEW_SIZE 1024
+#define SPECTRUM_VIEW_DT 0.01
+#define SPECTRUM_VIEW_FMAX 5.0
+
+// Embedding view: longest lag tried by the mutual information and highest
+// dimension tested for false neighbours
+#define EMBED_VIEW_MAXLAG 400
+#define EMBED_VIEW_DIM 5
+
+// Box side of the Ulam overlay
+#define ULAM_VIEW_BOX 1.0
+
+// Half height of images drawn by drawImage, in window units
+#define IMAGE_HALF_HEIGHT 0.9
+
 // Global pointer to the application state
 State *appState = NULL;
 
@@ -79,106 +184,669 @@ void ErrCheck(const char *where) {
 void reshape(int width, int height);
 
 /*
- *  Set color based on current color mode and point index
- */
-void setPointColor(int pointIndex, int totalPoints) {
-  switch (appState->colorMode) {
-  case 0: // Single color - cyan
-    glColor3f(0.0f, 1.0f, 1.0f);
-    break;
-  case 1: // Rainbow mode
-  {
-    float hue = (float)pointIndex / totalPoints * 360.0f;
-    float c = 1.0f, x = c * (1.0f - fabs(fmod(hue / 60.0f, 2.0f) - 1.0f)),
-          m = 0.0f;
-    float r = 0, g = 0, b = 0;
-    if (hue < 60) {
-      r = c;
-      g = x;
-    } else if (hue < 120) {
-      r = x;
-      g = c;
-    } else if (hue < 180) {
-      g = c;
-      b = x;
-    } else if (hue < 240) {
-      g = x;
-      b = c;
-    } else if (hue < 300) {
-      r = x;
-      b = c;
-    } else {
-      r = c;
-      b = x;
+ *  Recompute the FTLE map shown in the FTLE view
+ */
+void updateFtleImage() {
+  Image *img = &appState->ftleImage;
+  if (!img->rgb && !imageInit(img, FTLE_VIEW_SIZE, FTLE_VIEW_SIZE))
+    return;
+  float *field = malloc(FTLE_VIEW_SIZE * FTLE_VIEW_SIZE * sizeof(float));
+  if (!field)
+    return;
+  FtleConfig config;
+  ftleDefaultConfig(&config, appState->s, appState->b, appState->r,
+                    appState->ftlePlane, FTLE_VIEW_SIZE);
+  config.T = FTLE_VIEW_TIME;
+  if (computeFtle(&config, field))
+    scalarFieldToImage(field, FTLE_VIEW_SIZE, FTLE_VIEW_SIZE, img);
+  free(field);
+}
+
+/*
+ *  Start the chaos map on first use and restart it whenever b changes
+ */
+void updateChaosMap() {
+  if (!appState->chaosMap) {
+    if (!imageInit(&appState->chaosImage, CHAOS_VIEW_SIZE, CHAOS_VIEW_SIZE))
+      return;
+    appState->chaosMap =
+        chaosMapCreate(CHAOS_VIEW_SIZE, CHAOS_VIEW_SIZE, CHAOS_RMIN,
+                       CHAOS_RMAX, CHAOS_SMIN, CHAOS_SMAX);
+    if (!appState->chaosMap)
+      return;
+  } else if (appState->chaosB == appState->b)
+    return;
+  appState->chaosB = appState->b;
+  chaosMapStart(appState->chaosMap, appState->b);
+}
+
+/*
+ *  Search the current trajectory for periodic orbits and trace the shortest
+ */
+void updateUpos() {
+  UpoConfig config;
+  UpoCatalogue catalogue = {0, 0, NULL};
+  appState->upoCount = appState->upoFound = appState->upoCandidates = 0;
+  if (!appState->upoPaths) {
+    appState->upoPaths =
+        malloc(UPO_VIEW_ORBITS * UPO_VIEW_POINTS * sizeof(Point3D));
+    if (!appState->upoPaths)
+      return;
+  }
+  upoDefaultConfig(&config, appState->s, appState->b, appState->r);
+  int tried = upoSearch(&config, appState->points, LORENZ_POINTS, LORENZ_DT,
+                        &catalogue);
+  if (tried < 0)
+    return;
+  appState->upoCandidates = tried;
+  appState->upoFound = catalogue.count;
+  for (int i = 0; i < catalogue.count && i < UPO_VIEW_ORBITS; i++)
+    upoTrace(&config, &catalogue.orbits[i],
+             appState->upoPaths + i * UPO_VIEW_POINTS, UPO_VIEW_POINTS);
+  appState->upoCount =
+      catalogue.count < UPO_VIEW_ORBITS ? catalogue.count : UPO_VIEW_ORBITS;
+  upoFree(&catalogue);
+}
+
+/*
+ *  Welch spectra of the current trajectory, resampled to SPECTRUM_VIEW_DT
+ */
+void updateSpectrum() {
+  Spectrum sp;
+  if (!spectrumInit(&sp, SPECTRUM_VIEW_SIZE, SPECTRUM_VIEW_SIZE / 2,
+                    SPECTRUM_VIEW_DT))
+    return;
+  int bins = (int)(SPECTRUM_VIEW_FMAX * SPECTRUM_VIEW_SIZE * SPECTRUM_VIEW_DT);
+  double *psd = malloc((SPECTRUM_VIEW_SIZE / 2 + 1) * sizeof(double));
+  if (!appState->spectrumPsd)
+    appState->spectrumPsd = malloc(3 * bins * sizeof(double));
+  if (psd && appState->spectrumPsd) {
+    // Lorenz-96 points are already 0.01 apart
+    int stride =
+        appState->system == 1 ? 1 : (int)(SPECTRUM_VIEW_DT / LORENZ_DT + 0.5);
+    spectrumPushPoints(&sp, appState->points, LORENZ_POINTS, stride);
+    for (int c = 0; c < 3; c++) {
+      spectrumDensity(&sp, c, psd);
+      memcpy(appState->spectrumPsd + c * bins, psd, bins * sizeof(double));
     }
-    glColor3f(r + m, g + m, b + m);
-  } break;
-  case 2: // Fade mode - blue to red
-  {
-    float ratio = (float)pointIndex / totalPoints;
-    glColor3f(ratio, 0.2f, 1.0f - ratio);
-  } break;
+    appState->spectrumBins = bins;
   }
+  free(psd);
+  spectrumFree(&sp);
 }
 
 /*
- *  Update animation
+ *  Delay reconstruction of x(t) from the current trajectory, or of the
+ *  loaded series; without a manual lag the first minimum of the mutual
+ *  information is used
+ */
+void updateEmbedding() {
+  const double *series = appState->embedSeries;
+  int n = appState->embedLength;
+  double *x = NULL;
+  if (!series) {
+    x = malloc(LORENZ_POINTS * sizeof(double));
+    if (!x)
+      return;
+    for (int i = 0; i < LORENZ_POINTS; i++)
+      x[i] = appState->points[i].x;
+    series = x;
+    n = LORENZ_POINTS;
+  }
+  if (!appState->embedPoints)
+    appState->embedPoints = malloc(LORENZ_POINTS * sizeof(Point3D));
+  double ami[EMBED_VIEW_MAXLAG + 1], fraction[EMBED_VIEW_DIM];
+  int lag = appState->embedLag;
+  int maxLag = n > EMBED_VIEW_MAXLAG ? EMBED_VIEW_MAXLAG : n - 1;
+  if (!lag && embedMutualInformation(series, n, maxLag, 64, ami))
+    lag = embedFirstMinimum(ami, maxLag + 1);
+  if (lag < 1)
+    lag = 1;
+  FnnConfig config = {EMBED_VIEW_DIM, lag, lag, 15.0, 2.0};
+  appState->embedDim =
+      embedFalseNeighbours(series, n, &config, fraction)
+          ? embedChooseDimension(fraction, EMBED_VIEW_DIM, 0.01)
+          : 0;
+  appState->embedUsedLag = lag;
+  appState->embedCount =
+      appState->embedPoints ? embedPoints(series, n, lag, appState->embedPoints)
+                            : 0;
+  free(x);
+}
+
+/*
+ *  Transfer operator on boxes covering the attractor at the current
+ *  parameters, keeping box centers and the two leading eigenvectors
+ */
+void updateUlam() {
+  UlamConfig config;
+  UlamOperator op;
+  UlamSpectrum spec;
+  appState->ulamBoxes = 0;
+  ulamDefaultConfig(&config, appState->s, appState->b, appState->r,
+                    ULAM_VIEW_BOX);
+  int solved = ulamBuild(&config, &op) ? ulamEigen(&op, 5000, 1e-8, &spec)
+                                       : 0;
+  // Draw nothing rather than a spectrum that has not converged
+  if (solved < 1) {
+    if (solved < 0)
+      ulamSpectrumFree(&spec);
+    ulamFree(&op);
+    return;
+  }
+  int n = op.boxes;
+  Point3D *centers = realloc(appState->ulamCenters, n * sizeof(Point3D));
+  if (centers)
+    appState->ulamCenters = centers;
+  float *density = realloc(appState->ulamDensity, n * sizeof(float));
+  if (density)
+    appState->ulamDensity = density;
+  float *second = realloc(appState->ulamSecond, n * sizeof(float));
+  if (second)
+    appState->ulamSecond = second;
+  if (centers && density && second) {
+    for (int i = 0; i < n; i++) {
+      centers[i] = ulamBoxCenter(&op, i);
+      density[i] = spec.density[i];
+      second[i] = spec.second[i];
+    }
+    appState->ulamBoxes = n;
+    appState->ulamLambda2 = spec.lambda2;
+  }
+  ulamSpectrumFree(&spec);
+  ulamFree(&op);
+}
+
+/*
+ *  Integrate the viewer ensemble for the current parameters and seed, and
+ *  restart the background divergence histogram for them
+ */
+void updateButterfly() {
+  ButterflyConfig config;
+  butterflyDefaultConfig(&config, appState->s, appState->b, appState->r);
+  int samples = butterflySamples(&config, BUTTERFLY_VIEW_STRIDE);
+  if (!appState->butterflyPaths) {
+    appState->butterflyPaths =
+        malloc((size_t)(config.copies + 1) * samples * sizeof(Point3D));
+    appState->butterflySeparation = malloc(samples * sizeof(double));
+    appState->butterflyDivergence = malloc(config.copies * sizeof(double));
+    if (!appState->butterflyPaths || !appState->butterflySeparation ||
+        !appState->butterflyDivergence) {
+      free(appState->butterflyPaths);
+      free(appState->butterflySeparation);
+      free(appState->butterflyDivergence);
+      appState->butterflyPaths = NULL;
+      appState->butterflySeparation = NULL;
+      appState->butterflyDivergence = NULL;
+      return;
+    }
+  }
+  butterflyEnsemble(&config, appState->seed, BUTTERFLY_VIEW_STRIDE,
+                    appState->butterflyPaths, appState->butterflySeparation,
+                    appState->butterflyDivergence);
+  if (!appState->butterflyStats)
+    appState->butterflyStats = butterflyStatsCreate(BUTTERFLY_VIEW_BINS);
+  if (appState->butterflyStats)
+    butterflyStatsStart(appState->butterflyStats, &config,
+                        BUTTERFLY_VIEW_RUNS);
+}
+
+/*
+ *  Bring the tube up to date with the trajectory it is drawn around,
+ *  rebuilding only the chunks that changed
+ */
+void updateTube() {
+  const Point3D *points = appState->points;
+  int total = LORENZ_POINTS;
+  if (appState->embedShow && appState->embedPoints) {
+    points = appState->embedPoints;
+    total = appState->embedCount;
+  }
+  if (!appState->tube) {
+    appState->tube = malloc(sizeof(TubeMesh));
+    if (!appState->tube)
+      return;
+    tubeInit(appState->tube, TUBE_VIEW_SIDES, 0);
+  }
+  // A new radius invalidates every ring
+  double radius = appState->dim * TUBE_VIEW_RADIUS;
+  if (radius != appState->tube->radius) {
+    tubeFree(appState->tube);
+    appState->tube->radius = radius;
+  }
+  double t0 = wallTime();
+  if (tubeUpdate(appState->tube, points, total) < 0)
+    tubeFree(appState->tube);
+  appState->tubeMillis = 1e3 * (wallTime() - t0);
+}
+
+/*
+ *  Write what is drawn in place of the trajectory line, the tube when it
+ *  is shown, colored by the current color mode
+ */
+void exportView() {
+  const Point3D *points = appState->points;
+  int total = LORENZ_POINTS;
+  if (appState->embedShow && appState->embedPoints) {
+    points = appState->embedPoints;
+    total = appState->embedCount;
+  }
+  const TubeMesh *tube = appState->tube;
+  int tubed = appState->tubeShow && tube && tube->points == total;
+  unsigned char *colors = malloc(3 * (size_t)total);
+  long long bytes = 0;
+  if (colors) {
+    double span = traceBegin();
+    colorFill(appState->colorMode, total, colors);
+    traceEnd("export colors", span);
+    bytes = tubed ? exportTube(appState->exportPath, tube, colors)
+                  : exportPoints(appState->exportPath, points, colors, total);
+    free(colors);
+  }
+  if (bytes)
+    snprintf(appState->exportMessage, sizeof(appState->exportMessage),
+             "Exported %s to %s (%.1f MB)", tubed ? "tube" : "points",
+             appState->exportPath, bytes / 1048576.0);
+  else
+    snprintf(appState->exportMessage, sizeof(appState->exportMessage),
+             "Cannot export to %s", appState->exportPath);
+}
+
+/*
+ *  Run a view update as a span of the trace
+ */
+void traceUpdate(const char *name, void (*update)(void)) {
+  double span = traceBegin();
+  update();
+  traceEnd(name, span);
+}
+
+/*
+ *  Recompute the trajectory of the active system and the current view
+ */
+void recompute() {
+  double t0 = instrumentNow();
+  if (appState->system == 1)
+    computeLorenz96Points(appState);
+  else if (appState->system == 2)
+    computeNetworkPoints(appState);
+  else if (appState->noise > 0)
+    computeStochasticLorenzPoints(appState);
+  else
+    computeLorenzPoints(appState);
+  if (appState->viewMode == VIEW_FTLE)
+    traceUpdate("FTLE map", updateFtleImage);
+  if (appState->viewMode == VIEW_CHAOS)
+    traceUpdate("chaos map", updateChaosMap);
+  if (appState->upoShow && appState->system == 0)
+    traceUpdate("periodic orbits", updateUpos);
+  if (appState->spectrumShow)
+    traceUpdate("spectrum", updateSpectrum);
+  if (appState->embedShow)
+    traceUpdate("embedding", updateEmbedding);
+  if (appState->ulamShow && appState->system == 0)
+    traceUpdate("Ulam", updateUlam);
+  if (appState->butterflyShow && appState->system == 0)
+    traceUpdate("butterfly", updateButterfly);
+  else if (appState->butterflyStats)
+    butterflyStatsStop(appState->butterflyStats);
+  if (appState->tubeShow)
+    traceUpdate("tube", updateTube);
+  instrumentAdd(INSTRUMENT_INTEGRATE, t0);
+}
+
+/*
+ *  One fixed simulation tick: reveal more of the trajectory and advance
+ *  the comet trail; both are cheap enough to catch up tick by tick
+ */
+void simulateTick() {
+  if (appState->animate) {
+    appState->animProgress += LORENZ_POINTS * SIM_TICK / appState->animSpeed;
+    if (appState->animProgress >= LORENZ_POINTS)
+      appState->animProgress = 0;
+  }
+  if (appState->trailShow && appState->system == 0 && appState->trail.vertex)
+    trailAdvance(&appState->trail, appState->s, appState->b, appState->r,
+                 TRAIL_VIEW_DT, TRAIL_VIEW_STEPS);
+}
+
+/*
+ *  Run the ticks due since the last frame, then place the animation
+ *  between the last tick and the next by the time left over. The particle
+ *  cloud costs too much to repeat per tick: it advances once per frame,
+ *  over all the ticks run, with a step that long, so a slow frame does not
+ *  make the next one slower.
  */
 void updateAnimation() {
-  if (!appState->animate)
+  int ticks =
+      simClockUpdate(&appState->clock, glutGet(GLUT_ELAPSED_TIME) / 1000.0);
+  double t0 = instrumentNow();
+  for (int i = 0; i < ticks; i++)
+    simulateTick();
+  if (ticks > 0 && appState->particleShow && appState->system == 0 &&
+      appState->particles) {
+    double start = wallTime();
+    appState->particleStep = PARTICLE_VIEW_DT * ticks;
+    particlesAdvance(appState->particles, appState->s, appState->b,
+                     appState->r, appState->particleStep, PARTICLE_VIEW_STEPS);
+    appState->particleMillis = 1e3 * (wallTime() - start);
+  }
+  instrumentAdd(INSTRUMENT_INTEGRATE, t0);
+
+  double rate = LORENZ_POINTS * SIM_TICK / appState->animSpeed;
+  double shown =
+      appState->animProgress + simClockAlpha(&appState->clock) * rate;
+  appState->drawProgress = shown < LORENZ_POINTS ? shown : LORENZ_POINTS;
+  appState->currentPoints = (int)appState->drawProgress;
+}
+
+/*
+ *  Draw the traced periodic orbits as closed loops, one color each
+ */
+void drawUpos() {
+  glLineWidth(2.5f);
+  for (int k = 0; k < appState->upoCount; k++) {
+    unsigned char rgb[3];
+    colormap(0.35 + 0.65 * (k + 1) / appState->upoCount, rgb);
+    glColor3ub(rgb[0], rgb[1], rgb[2]);
+    const Point3D *path = appState->upoPaths + k * UPO_VIEW_POINTS;
+    glBegin(GL_LINE_LOOP);
+    for (int i = 0; i < UPO_VIEW_POINTS; i++)
+      glVertex3d(path[i].x, path[i].y, path[i].z);
+    glEnd();
+  }
+}
+
+/*
+ *  Draw the Ulam boxes as points: invariant density on a log scale over
+ *  three decades, or the second eigenvector with its sign as the hue
+ */
+void drawUlam() {
+  float top = 0, spread = 0;
+  for (int i = 0; i < appState->ulamBoxes; i++) {
+    top = fmaxf(top, appState->ulamDensity[i]);
+    spread = fmaxf(spread, fabsf(appState->ulamSecond[i]));
+  }
+  if (spread == 0)
+    spread = 1;
+  glPointSize(4.0f);
+  glBegin(GL_POINTS);
+  for (int i = 0; i < appState->ulamBoxes; i++) {
+    unsigned char rgb[3];
+    if (appState->ulamShow == 1) {
+      if (appState->ulamDensity[i] <= 0)
+        continue;
+      colormap(1 + log10(appState->ulamDensity[i] / top) / 3, rgb);
+    } else
+      colormap(0.5 + 0.5 * appState->ulamSecond[i] / spread, rgb);
+    glColor3ub(rgb[0], rgb[1], rgb[2]);
+    const Point3D *p = &appState->ulamCenters[i];
+    glVertex3d(p->x, p->y, p->z);
+  }
+  glEnd();
+  glPointSize(1.0f);
+}
+
+/*
+ *  Draw the recorded network units, one color each, as far as the
+ *  animation has got
+ */
+void drawNetwork() {
+  if (!appState->netPaths)
     return;
+  int steps = NETWORK_VIEW_STEPS;
+  if (appState->animate)
+    steps = (int)((double)appState->currentPoints * NETWORK_VIEW_STEPS /
+                  LORENZ_POINTS);
+  glLineWidth(1.5f);
+  for (int u = 0; u < NETWORK_VIEW_UNITS; u++) {
+    unsigned char rgb[3];
+    colormap((u + 0.5) / NETWORK_VIEW_UNITS, rgb);
+    glColor3ub(rgb[0], rgb[1], rgb[2]);
+    const Point3D *path = appState->netPaths + u * NETWORK_VIEW_STEPS;
+    glBegin(GL_LINE_STRIP);
+    for (int t = 0; t < steps; t++)
+      glVertex3d(path[t].x, path[t].y, path[t].z);
+    glEnd();
+  }
+}
 
-  unsigned int currentTime = glutGet(GLUT_ELAPSED_TIME);
-  if (appState->lastTime == 0)
-    appState->lastTime = currentTime;
+/*
+ *  Draw the ensemble as far as the animation has got: copies colored by
+ *  when they diverged, the reference on top in white
+ */
+void drawButterfly() {
+  if (!appState->butterflyPaths)
+    return;
+  ButterflyConfig config;
+  butterflyDefaultConfig(&config, appState->s, appState->b, appState->r);
+  int samples = butterflySamples(&config, BUTTERFLY_VIEW_STRIDE);
+  int shown = samples;
+  if (appState->animate)
+    shown = (int)((double)appState->currentPoints * samples / LORENZ_POINTS);
+  double horizon = config.steps * config.dt;
 
-  double elapsed = (currentTime - appState->lastTime) / 1000.0;
-  double progress = elapsed / appState->animSpeed;
-  appState->currentPoints = (int)(progress * LORENZ_POINTS);
+  glLineWidth(1.0f);
+  for (int j = config.copies; j >= 0; j--) {
+    const Point3D *path = appState->butterflyPaths + (size_t)j * samples;
+    if (j > 0) {
+      unsigned char rgb[3];
+      double t = appState->butterflyDivergence[j - 1];
+      colormap(t < 0 ? 1.0 : 0.15 + 0.85 * t / horizon, rgb);
+      glColor3ub(rgb[0], rgb[1], rgb[2]);
+    } else {
+      glColor3f(1, 1, 1);
+      glLineWidth(2.5f);
+    }
+    glBegin(GL_LINE_STRIP);
+    for (int i = 0; i < shown; i++)
+      glVertex3dv(&path[i].x);
+    glEnd();
+  }
+  glLineWidth(1.0f);
+}
 
-  if (appState->currentPoints >= LORENZ_POINTS) {
-    appState->currentPoints = LORENZ_POINTS;
-    appState->lastTime = currentTime;
+/*
+ *  Draw the first `count` of `total` points as one line strip from vertex
+ *  arrays, colored along the whole trajectory by the color mode, plus a
+ *  fraction `tip` of the segment after the last one
+ */
+void drawTrajectory(const Point3D *points, int count, int total,
+                    double tip) {
+  static unsigned char *colors = NULL;
+  static int colorMode = -1, colorTotal = 0;
+  if (appState->colorMode != colorMode || total != colorTotal) {
+    double t0 = instrumentNow();
+    unsigned char *grown = realloc(colors, 3 * (size_t)total);
+    if (!grown)
+      return;
+    colors = grown;
+    colorFill(appState->colorMode, total, colors);
+    colorMode = appState->colorMode;
+    colorTotal = total;
+    instrumentAdd(INSTRUMENT_COLOR, t0);
+  }
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(3, GL_DOUBLE, sizeof(Point3D), points);
+  glColorPointer(3, GL_UNSIGNED_BYTE, 0, colors);
+  glDrawArrays(GL_LINE_STRIP, 0, count);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+  if (tip > 0 && count > 0 && count < total) {
+    const Point3D *a = &points[count - 1], *b = &points[count];
+    glColor3ubv(colors + 3 * (size_t)(count - 1));
+    glBegin(GL_LINES);
+    glVertex3d(a->x, a->y, a->z);
+    glVertex3d(a->x + tip * (b->x - a->x), a->y + tip * (b->y - a->y),
+               a->z + tip * (b->z - a->z));
+    glEnd();
   }
-  glutPostRedisplay();
 }
 
 /*
- *  Display the scene
+ *  Draw the first `count` rings of the tube, one lit triangle strip per
+ *  side, colored ring by ring like the trajectory
  */
-void display() {
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void drawTube(int count) {
+  static unsigned char *colors = NULL;
+  static int colorMode = -1, colorRings = 0, colorSides = 0;
+  const TubeMesh *tube = appState->tube;
+  if (!tube || !tube->vertex)
+    return;
+  int n = tube->points, sides = tube->sides;
+  if (appState->colorMode != colorMode || n != colorRings ||
+      sides != colorSides) {
+    double t0 = instrumentNow();
+    unsigned char *grown = realloc(colors, 3 * (size_t)n * sides);
+    if (!grown)
+      return;
+    colors = grown;
+    for (int i = 0; i < n; i++) {
+      float rgb[3];
+      colorAt(appState->colorMode, i, n, rgb);
+      for (int j = 0; j < sides; j++)
+        for (int k = 0; k < 3; k++)
+          colors[3 * ((size_t)i * sides + j) + k] =
+              (unsigned char)(255.0f * rgb[k] + 0.5f);
+    }
+    colorMode = appState->colorMode;
+    colorRings = n;
+    colorSides = sides;
+    instrumentAdd(INSTRUMENT_COLOR, t0);
+  }
+  if (count > n)
+    count = n;
+
+  float light[] = {0.3f, 0.5f, 1.0f, 0.0f};
+  glEnable(GL_LIGHTING);
+  glEnable(GL_LIGHT0);
+  glEnable(GL_COLOR_MATERIAL);
+  glPushMatrix();
+  glLoadIdentity();
+  glLightfv(GL_LIGHT0, GL_POSITION, light);
+  glPopMatrix();
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, tube->vertex);
+  glNormalPointer(GL_FLOAT, 0, tube->normal);
+  glColorPointer(3, GL_UNSIGNED_BYTE, 0, colors);
+  for (int j = 0; j < sides; j++)
+    glDrawElements(GL_TRIANGLE_STRIP, 2 * count, GL_UNSIGNED_INT,
+                   tube->index + 2 * (size_t)n * j);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisable(GL_COLOR_MATERIAL);
+  glDisable(GL_LIGHT0);
+  glDisable(GL_LIGHTING);
+}
+
+/*
+ *  Draw the particle cloud as points straight from its vertex arrays
+ */
+void drawParticles() {
+  const ParticleCloud *cloud = appState->particles;
+  if (!cloud)
+    return;
+  glPointSize(1.0f);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, cloud->vertex);
+  glColorPointer(3, GL_UNSIGNED_BYTE, 0, cloud->color);
+  glDrawArrays(GL_POINTS, 0, cloud->count);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+/*
+ *  Draw the comet tail from the ring, fading from the color mode at the
+ *  head to black at the oldest point
+ */
+void drawTrail() {
+  static unsigned char *colors = NULL;
+  static int colorMode = -1;
+  const Trail *trail = &appState->trail;
+  int count, cap = trail->capacity;
+  if (!trail->vertex)
+    return;
+  if (appState->colorMode != colorMode) {
+    double t0 = instrumentNow();
+    unsigned char *grown = realloc(colors, 3 * (size_t)cap);
+    if (!grown)
+      return;
+    colors = grown;
+    for (int i = 0; i < cap; i++) {
+      float rgb[3], fade = (i + 1.0f) / cap;
+      colorAt(appState->colorMode, i, cap, rgb);
+      for (int k = 0; k < 3; k++)
+        colors[3 * i + k] = (unsigned char)(255.0f * fade * rgb[k] + 0.5f);
+    }
+    colorMode = appState->colorMode;
+    instrumentAdd(INSTRUMENT_COLOR, t0);
+  }
+
+  // Newest point always gets the brightest color, even while filling up
+  const float *points = trailPoints(trail, &count);
+  glLineWidth(2.0f);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, points);
+  glColorPointer(3, GL_UNSIGNED_BYTE, 0, colors + 3 * (size_t)(cap - count));
+  glDrawArrays(GL_LINE_STRIP, 0, count);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+/*
+ *  Draw the trajectory and the axes
+ */
+void drawAttractor() {
   glEnable(GL_DEPTH_TEST);
   glLoadIdentity();
   glRotated(appState->ph, 1, 0, 0);
   glRotated(appState->th, 0, 1, 0);
 
-  if (LORENZ_POINTS > 0) {
+  // The delay reconstruction replaces the trajectory when shown
+  const Point3D *points = appState->points;
+  int total = LORENZ_POINTS;
+  if (appState->embedShow && appState->embedPoints) {
+    points = appState->embedPoints;
+    total = appState->embedCount;
+  }
+  if (appState->system == 2 && !appState->embedShow)
+    drawNetwork();
+  else if (appState->butterflyShow && appState->system == 0 &&
+           !appState->embedShow)
+    drawButterfly();
+  else if (appState->particleShow && appState->system == 0 &&
+           !appState->embedShow)
+    drawParticles();
+  else if (appState->trailShow && appState->system == 0 &&
+           !appState->embedShow)
+    drawTrail();
+  else if (total > 0) {
     glLineWidth(1.5f);
-    int pointsToDraw =
-        appState->animate ? appState->currentPoints : LORENZ_POINTS;
-    if (pointsToDraw > 0) {
-      if (appState->colorMode == 0) {
-        setPointColor(0, LORENZ_POINTS);
-        glBegin(GL_LINE_STRIP);
-        for (int i = 0; i < pointsToDraw; i++)
-          glVertex3d(appState->points[i].x, appState->points[i].y,
-                     appState->points[i].z);
-        glEnd();
-      } else {
-        glBegin(GL_LINES);
-        for (int i = 0; i < pointsToDraw - 1; i++) {
-          setPointColor(i, LORENZ_POINTS);
-          glVertex3d(appState->points[i].x, appState->points[i].y,
-                     appState->points[i].z);
-          glVertex3d(appState->points[i + 1].x, appState->points[i + 1].y,
-                     appState->points[i + 1].z);
-        }
-        glEnd();
-      }
+    int pointsToDraw = appState->animate ? appState->currentPoints : total;
+    double tip = appState->animate ? appState->drawProgress - pointsToDraw : 0;
+    if (pointsToDraw >= total) {
+      pointsToDraw = total;
+      tip = 0;
     }
+    if (pointsToDraw > 0 && appState->tubeShow && appState->tube &&
+        appState->tube->points == total)
+      drawTube(pointsToDraw);
+    else if (pointsToDraw > 0)
+      drawTrajectory(points, pointsToDraw, total, tip);
   }
 
+  if (appState->upoShow && appState->system == 0 && !appState->embedShow)
+    drawUpos();
+  if (appState->ulamShow && appState->system == 0 && !appState->embedShow)
+    drawUlam();
+
   glColor3f(0.8f, 0.8f, 0.8f);
   glLineWidth(1.0f);
   glBegin(GL_LINES);
@@ -197,10 +865,319 @@ void display() {
   Print("Y");
   glRasterPos3d(0, 0, 42);
   Print("Z");
+}
+
+/*
+ *  Switch to window units: y in [-1, 1], x in [-asp, asp]
+ */
+void pushOverlay() {
+  glDisable(GL_DEPTH_TEST);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(-appState->asp, +appState->asp, -1, +1, -1, +1);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+}
+
+void popOverlay() {
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+}
+
+/*
+ *  Draw an image centered in the window as a texture, keeping its aspect
+ */
+void drawImage(const Image *img) {
+  static GLuint texture = 0;
+  if (!img->rgb)
+    return;
+  if (!texture)
+    glGenTextures(1, &texture);
+
+  pushOverlay();
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, img->width, img->height, 0, GL_RGB,
+               GL_UNSIGNED_BYTE, img->rgb);
+  glEnable(GL_TEXTURE_2D);
+  glColor3f(1, 1, 1);
+
+  // Rows are stored top to bottom
+  double h = IMAGE_HALF_HEIGHT, w = h * img->width / img->height;
+  glBegin(GL_QUADS);
+  glTexCoord2d(0, 1);
+  glVertex2d(-w, -h);
+  glTexCoord2d(1, 1);
+  glVertex2d(+w, -h);
+  glTexCoord2d(1, 0);
+  glVertex2d(+w, +h);
+  glTexCoord2d(0, 0);
+  glVertex2d(-w, +h);
+  glEnd();
+  glDisable(GL_TEXTURE_2D);
+  popOverlay();
+}
+
+/*
+ *  Cross at (u, v) in [0, 1] across an image placed by drawImage
+ */
+void drawImageMarker(const Image *img, double u, double v) {
+  if (u < 0 || u > 1 || v < 0 || v > 1)
+    return;
+  double h = IMAGE_HALF_HEIGHT, w = h * img->width / img->height;
+  double x = -w + 2 * w * u, y = -h + 2 * h * v, d = 0.03;
+  pushOverlay();
+  glColor3f(0, 1, 1);
+  glBegin(GL_LINES);
+  glVertex2d(x - d, y);
+  glVertex2d(x + d, y);
+  glVertex2d(x, y - d);
+  glVertex2d(x, y + d);
+  glEnd();
+  popOverlay();
+}
+
+/*
+ *  Log-scale spectra of x, y and z in a panel at the lower right, spanning
+ *  six decades below the largest value shown
+ */
+void drawSpectrum() {
+  int bins = appState->spectrumBins;
+  const double *psd = appState->spectrumPsd;
+  if (bins < 2 || !psd)
+    return;
+  // Scale to the largest bin drawn; the DC bins are left out
+  double top = 0;
+  for (int c = 0; c < 3; c++)
+    for (int k = 1; k < bins; k++)
+      if (psd[c * bins + k] > top)
+        top = psd[c * bins + k];
+  if (!(top > 0))
+    return;
+
+  double x0 = appState->asp - 0.95, x1 = appState->asp - 0.05;
+  double y0 = -0.95, y1 = -0.45;
+  pushOverlay();
+  glColor3f(0.5f, 0.5f, 0.5f);
+  glBegin(GL_LINE_LOOP);
+  glVertex2d(x0, y0);
+  glVertex2d(x1, y0);
+  glVertex2d(x1, y1);
+  glVertex2d(x0, y1);
+  glEnd();
 
+  static const float colors[3][3] = {
+      {1.0f, 0.4f, 0.3f}, {0.4f, 1.0f, 0.4f}, {0.4f, 0.6f, 1.0f}};
+  for (int c = 0; c < 3; c++) {
+    glColor3fv(colors[c]);
+    glBegin(GL_LINE_STRIP);
+    for (int k = 1; k < bins; k++) {
+      double v = psd[c * bins + k] > 0 ? log10(psd[c * bins + k] / top) : -6;
+      if (v < -6)
+        v = -6;
+      glVertex2d(x0 + (x1 - x0) * (k - 1) / (bins - 2),
+                 y1 + (y1 - y0) * v / 6);
+    }
+    glEnd();
+  }
+  glColor3f(1, 1, 1);
+  glRasterPos2d(x0, y1 + 0.02);
+  Print("PSD x/y/z, f = 0..%g, 6 decades", SPECTRUM_VIEW_FMAX);
+  popOverlay();
+}
+
+/*
+ *  Network sync error against time in a panel at the upper right, on a log
+ *  scale from 1e-8 to 1e2
+ */
+void drawSyncError() {
+  const double *err = appState->netError;
+  if (!err)
+    return;
+  double x0 = appState->asp - 0.95, x1 = appState->asp - 0.05;
+  double y0 = 0.45, y1 = 0.95;
+  pushOverlay();
+  glColor3f(0.5f, 0.5f, 0.5f);
+  glBegin(GL_LINE_LOOP);
+  glVertex2d(x0, y0);
+  glVertex2d(x1, y0);
+  glVertex2d(x1, y1);
+  glVertex2d(x0, y1);
+  glEnd();
+
+  glColor3f(1.0f, 0.8f, 0.3f);
+  glBegin(GL_LINE_STRIP);
+  for (int t = 0; t < NETWORK_VIEW_STEPS; t++) {
+    double v = err[t] > 0 ? log10(err[t]) : -8;
+    v = v < -8 ? -8 : v > 2 ? 2 : v;
+    glVertex2d(x0 + (x1 - x0) * t / (NETWORK_VIEW_STEPS - 1),
+               y0 + (y1 - y0) * (v + 8) / 10);
+  }
+  glEnd();
+  glColor3f(1, 1, 1);
+  glRasterPos2d(x0, y0 - 0.05);
+  Print("Sync error, t = 0..%g, 1e-8..1e2",
+        NETWORK_VIEW_STEPS * NETWORK_VIEW_DT);
+  popOverlay();
+}
+
+/*
+ *  Frame times of the recent frames in a panel at the upper left, against
+ *  a 60 fps line, with statistics of each stage below it
+ */
+void drawInstrument() {
+  float ms[INSTRUMENT_HISTORY];
+  int n = instrumentHistory(INSTRUMENT_FRAME, ms);
+  double x0 = -appState->asp + 0.05, x1 = -appState->asp + 0.95;
+  double y0 = 0.55, y1 = 0.95, top = 50.0; // ms at the top of the graph
+  pushOverlay();
+  glColor3f(0.5f, 0.5f, 0.5f);
+  glBegin(GL_LINE_LOOP);
+  glVertex2d(x0, y0);
+  glVertex2d(x1, y0);
+  glVertex2d(x1, y1);
+  glVertex2d(x0, y1);
+  glEnd();
+  glColor3f(0.3f, 0.6f, 0.3f);
+  glBegin(GL_LINES);
+  glVertex2d(x0, y0 + (y1 - y0) * (1000.0 / 60) / top);
+  glVertex2d(x1, y0 + (y1 - y0) * (1000.0 / 60) / top);
+  glEnd();
+  glColor3f(1.0f, 0.8f, 0.3f);
+  glBegin(GL_LINE_STRIP);
+  for (int i = 0; i < n; i++)
+    glVertex2d(x0 + (x1 - x0) * i / (INSTRUMENT_HISTORY - 1),
+               y0 + (y1 - y0) * (ms[i] < top ? ms[i] : top) / top);
+  glEnd();
+
+  glColor3f(1, 1, 1);
+  glRasterPos2d(x0, y0 - 0.05);
+  Print("Frame time, last %d frames, 0..%g ms (green: 60 fps)", n, top);
+  for (int s = 0; s < INSTRUMENT_STAGES; s++) {
+    InstrumentSummary sum;
+    instrumentSummary(s, &sum);
+    glRasterPos2d(x0, y0 - 0.1 - 0.05 * s);
+    Print("%-9s mean %6.2f  p50 %6.2f  p99 %6.2f ms", instrumentName(s),
+          sum.mean, sum.p50, sum.p99);
+  }
+  popOverlay();
+}
+
+/*
+ *  Mean log separation of the copies against time in a panel at the upper
+ *  right, and below it the divergence time histogram accumulated so far
+ */
+void drawDivergence() {
+  ButterflyConfig config;
+  long long counts[BUTTERFLY_VIEW_BINS], never, top = 1;
+  if (!appState->butterflySeparation || !appState->butterflyStats)
+    return;
+  butterflyDefaultConfig(&config, appState->s, appState->b, appState->r);
+  int samples = butterflySamples(&config, BUTTERFLY_VIEW_STRIDE);
+  int runs = butterflyStatsRead(appState->butterflyStats, counts, &never);
+  for (int i = 0; i < BUTTERFLY_VIEW_BINS; i++)
+    if (counts[i] > top)
+      top = counts[i];
+
+  double x0 = appState->asp - 0.95, x1 = appState->asp - 0.05;
+  pushOverlay();
+  glColor3f(0.5f, 0.5f, 0.5f);
+  for (int p = 0; p < 2; p++) {
+    double y0 = p ? -0.15 : 0.45, y1 = y0 + 0.5;
+    glBegin(GL_LINE_LOOP);
+    glVertex2d(x0, y0);
+    glVertex2d(x1, y0);
+    glVertex2d(x1, y1);
+    glVertex2d(x0, y1);
+    glEnd();
+  }
+
+  // Separation from 1e-8 to 1e2, with the divergence threshold dashed
+  glBegin(GL_LINES);
+  for (double x = x0; x < x1; x += 0.04) {
+    glVertex2d(x, 0.45 + 0.5 * 0.8);
+    glVertex2d(x + 0.02, 0.45 + 0.5 * 0.8);
+  }
+  glEnd();
+  glColor3f(1.0f, 0.8f, 0.3f);
+  glBegin(GL_LINE_STRIP);
+  for (int i = 0; i < samples; i++) {
+    double v = appState->butterflySeparation[i];
+    v = v < -8 ? -8 : v > 2 ? 2 : v;
+    glVertex2d(x0 + (x1 - x0) * i / (samples - 1), 0.45 + 0.5 * (v + 8) / 10);
+  }
+  glEnd();
+
+  glColor3f(0.4f, 0.7f, 1.0f);
+  glBegin(GL_QUADS);
+  for (int i = 0; i < BUTTERFLY_VIEW_BINS; i++) {
+    double u0 = x0 + (x1 - x0) * i / BUTTERFLY_VIEW_BINS;
+    double u1 = x0 + (x1 - x0) * (i + 1) / BUTTERFLY_VIEW_BINS;
+    double h = 0.5 * counts[i] / top;
+    glVertex2d(u0, -0.15);
+    glVertex2d(u1, -0.15);
+    glVertex2d(u1, -0.15 + h);
+    glVertex2d(u0, -0.15 + h);
+  }
+  glEnd();
+
+  glColor3f(1, 1, 1);
+  glRasterPos2d(x0, 0.40);
+  Print("Mean separation, t = 0..%g, 1e-8..1e2", config.steps * config.dt);
+  glRasterPos2d(x0, -0.20);
+  Print("Divergence times, %d runs, %lld never", runs, never);
+  popOverlay();
+}
+
+/*
+ *  Display the scene
+ */
+void display() {
+  updateAnimation();
+  double t0 = instrumentNow();
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  if (appState->viewMode == VIEW_FTLE)
+    drawImage(&appState->ftleImage);
+  else if (appState->viewMode == VIEW_CHAOS && appState->chaosMap) {
+    double u, v;
+    chaosMapRender(appState->chaosMap, &appState->chaosImage);
+    drawImage(&appState->chaosImage);
+    chaosMapPosition(appState->chaosMap, appState->r, appState->s, &u, &v);
+    drawImageMarker(&appState->chaosImage, u, v);
+  } else {
+    drawAttractor();
+    if (appState->spectrumShow)
+      drawSpectrum();
+    if (appState->system == 2)
+      drawSyncError();
+    if (appState->butterflyShow && appState->system == 0)
+      drawDivergence();
+  }
+  t0 = instrumentAdd(INSTRUMENT_DRAW, t0);
+
+  if (appState->instrumentShow)
+    drawInstrument();
   glColor3f(1, 1, 1);
   glWindowPos2i(5, 5);
-  Print("Lorenz Attractor - View: %d,%d", appState->th, appState->ph);
+  if (appState->viewMode == VIEW_FTLE)
+    Print("FTLE map - %s slice, T=%.1f (o=cycle slice)",
+          appState->ftlePlane == FTLE_XY   ? "xy"
+          : appState->ftlePlane == FTLE_XZ ? "xz"
+                                           : "yz",
+          FTLE_VIEW_TIME);
+  else if (appState->viewMode == VIEW_CHAOS)
+    Print("Chaos map - largest Lyapunov exponent, r=%g..%g across, "
+          "s=%g..%g up, %.0f%% refined (click to pick r, s)",
+          CHAOS_RMIN, CHAOS_RMAX, CHAOS_SMIN, CHAOS_SMAX,
+          appState->chaosMap ? 100 * chaosMapProgress(appState->chaosMap) : 0);
+  else
+    Print("Lorenz Attractor - View: %d,%d", appState->th, appState->ph);
   glWindowPos2i(5, 25);
   Print("Animation: %s | Speed: %.1fs | Color: %s",
         appState->animate ? "ON" : "OFF", appState->animSpeed,
@@ -212,15 +1189,116 @@ void display() {
     Print("Progress: %d/%d points", appState->currentPoints, LORENZ_POINTS);
   }
   glWindowPos2i(5, 65);
-  Print("Params: s=%.1f b=%.2f r=%.1f", appState->s, appState->b, appState->r);
+  if (appState->system == 1)
+    Print("Lorenz-96: N=%d F=%.1f projection=x%d,x%d,x%d", appState->l96N,
+          appState->l96F, appState->l96Proj,
+          (appState->l96Proj + 1) % appState->l96N,
+          (appState->l96Proj + 2) % appState->l96N);
+  else if (appState->system == 2)
+    Print("Network: N=%d links=%lld k=%.2f s=%.1f b=%.2f r=%.1f, "
+          "sync error %.3g at t=%g",
+          appState->netN, (long long)appState->netRowStart[appState->netN],
+          appState->netCoupling, appState->s, appState->b, appState->r,
+          appState->netError ? appState->netError[NETWORK_VIEW_STEPS - 1]
+                             : 0.0,
+          NETWORK_VIEW_STEPS * NETWORK_VIEW_DT);
+  else
+    Print("Params: s=%.1f b=%.2f r=%.1f noise=%.1f", appState->s,
+          appState->b, appState->r, appState->noise);
   glWindowPos2i(5, 85);
   Print("Controls: s/S,b/B,r/R=params, SPACE=anim, c=cycle color, +/-=speed, "
         "z/Z=zoom, arrows=rotate, 0=reset view");
+  glWindowPos2i(5, 105);
+  Print("Systems: l=Lorenz-63/96/network, p/P=L96 projection, "
+        "f/F=L96 forcing, k/K=coupling, n/N=noise, g=new noise path");
+  glWindowPos2i(5, 125);
+  Print("Views: v=cycle attractor/FTLE map/chaos map, u=periodic orbits, "
+        "w=spectrum, e=delay embedding (d/D=lag), m=Ulam operator, "
+        "h=butterfly, a=particles, j=comet, t=tube, x=export, i=timing,"
+        " T=trace");
+  if (appState->upoShow) {
+    glWindowPos2i(5, 145);
+    if (appState->system == 0)
+      Print("Periodic orbits: %d distinct from %d close returns, shortest %d "
+            "shown",
+            appState->upoFound, appState->upoCandidates, appState->upoCount);
+    else
+      Print("Periodic orbits: Lorenz-63 only");
+  }
+  if (appState->embedShow) {
+    glWindowPos2i(5, 165);
+    Print("Delay embedding of %s: lag %d samples%s, false neighbours suggest "
+          "dimension %d",
+          appState->embedSeries ? "loaded series" : "x(t)",
+          appState->embedUsedLag, appState->embedLag ? "" : " (auto)",
+          appState->embedDim);
+  }
+  if (appState->ulamShow) {
+    glWindowPos2i(5, 185);
+    if (appState->system == 0)
+      Print("Ulam operator: %d boxes of side %g, tau=0.2, lambda2=%.4f, "
+            "showing %s",
+            appState->ulamBoxes, ULAM_VIEW_BOX, appState->ulamLambda2,
+            appState->ulamShow == 1 ? "invariant density"
+                                    : "almost-invariant sets");
+    else
+      Print("Ulam operator: Lorenz-63 only");
+  }
+  if (appState->exportMessage[0]) {
+    glWindowPos2i(5, 285);
+    Print("%s", appState->exportMessage);
+  }
+  if (appState->traceMessage[0]) {
+    glWindowPos2i(5, 305);
+    Print("%s", appState->traceMessage);
+  }
+  if (appState->tubeShow) {
+    glWindowPos2i(5, 265);
+    if (appState->tube && appState->tube->vertex)
+      Print("Tube: %d rings x %d sides, %d of %d chunks rebuilt in %.1f ms",
+            appState->tube->points, appState->tube->sides,
+            appState->tube->rebuilt, appState->tube->chunks,
+            appState->tubeMillis);
+    else
+      Print("Tube: cannot allocate");
+  }
+  if (appState->trailShow) {
+    glWindowPos2i(5, 245);
+    if (appState->system == 0)
+      Print("Comet trail: t=%.1f, %d RK4 steps of %g per frame, last %d "
+            "points kept",
+            appState->trail.steps * TRAIL_VIEW_DT, TRAIL_VIEW_STEPS,
+            TRAIL_VIEW_DT, appState->trail.capacity);
+    else
+      Print("Comet trail: Lorenz-63 only");
+  }
+  if (appState->particleShow) {
+    glWindowPos2i(5, 225);
+    if (appState->system == 0 && appState->particles)
+      Print("Particles: %d, %d RK4 steps of %g per frame in %.1f ms, "
+            "colored by starting x",
+            appState->particles->count, PARTICLE_VIEW_STEPS,
+            appState->particleStep, appState->particleMillis);
+    else
+      Print("Particles: %s", appState->system == 0 ? "cannot allocate"
+                                                   : "Lorenz-63 only");
+  }
+  if (appState->butterflyShow) {
+    glWindowPos2i(5, 205);
+    if (appState->system == 0)
+      Print("Butterfly ensemble: %d copies displaced by 1e-6, colored by when "
+            "they get 1 away (g=new reference)",
+            BUTTERFLY_VIEW_COPIES);
+    else
+      Print("Butterfly ensemble: Lorenz-63 only");
+  }
+
+  t0 = instrumentAdd(INSTRUMENT_HUD, t0);
 
-  updateAnimation();
   ErrCheck("display");
   glFlush();
   glutSwapBuffers();
+  instrumentFrame(instrumentAdd(INSTRUMENT_SWAP, t0));
 }
 
 /*
@@ -238,15 +1316,26 @@ void key(unsigned char ch, int x, int y) {
   case ' ': // Toggle animation
     appState->animate = !appState->animate;
     if (appState->animate) {
-      appState->lastTime = glutGet(GLUT_ELAPSED_TIME);
-      appState->currentPoints = 0;
+      appState->animProgress = 0;
+      simClockReset(&appState->clock);
     }
     break;
   case 'c':
-    appState->colorMode = (appState->colorMode + 1) % 3;
+    appState->colorMode = (appState->colorMode + 1) % COLOR_MODES;
+    if (appState->particles) {
+      double t0 = instrumentNow();
+      particlesColor(appState->particles, appState->colorMode);
+      instrumentAdd(INSTRUMENT_COLOR, t0);
+    }
     break;
   case 'C': // Cycle color mode
-    appState->colorMode = (appState->colorMode - 1) % 3;
+    appState->colorMode =
+        (appState->colorMode + COLOR_MODES - 1) % COLOR_MODES;
+    if (appState->particles) {
+      double t0 = instrumentNow();
+      particlesColor(appState->particles, appState->colorMode);
+      instrumentAdd(INSTRUMENT_COLOR, t0);
+    }
     break;
   case '+':
   case '=': // Increase speed
@@ -261,40 +1350,203 @@ void key(unsigned char ch, int x, int y) {
   // Lorenz parameter controls
   case 's':
     appState->s += 0.5;
-    computeLorenzPoints(appState);
+    recompute();
     break;
   case 'S':
     appState->s -= 0.5;
-    computeLorenzPoints(appState);
+    recompute();
     break;
   case 'b':
     appState->b += 0.1;
-    computeLorenzPoints(appState);
+    recompute();
     break;
   case 'B':
     appState->b -= 0.1;
-    computeLorenzPoints(appState);
+    recompute();
     break;
   case 'r':
     appState->r += 1.0;
-    computeLorenzPoints(appState);
+    recompute();
     break;
   case 'R':
     appState->r -= 1.0;
-    computeLorenzPoints(appState);
+    recompute();
+    break;
+  // Stochastic forcing
+  case 'n':
+    appState->noise += 0.5;
+    recompute();
+    break;
+  case 'N':
+    appState->noise -= 0.5;
+    if (appState->noise < 0)
+      appState->noise = 0;
+    recompute();
+    break;
+  case 'g':
+    appState->seed++;
+    recompute();
+    break;
+  // Lorenz-96 controls
+  case 'l':
+    appState->system = (appState->system + 1) % 3;
+    appState->dim = appState->system == 1 ? 20.0 : 60.0;
+    recompute();
+    reshape(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+    break;
+  case 'a':
+    appState->particleShow = !appState->particleShow;
+    if (appState->particleShow && !appState->particles) {
+      ParticleCloud *cloud = malloc(sizeof(ParticleCloud));
+      if (cloud && particlesInit(cloud, appState->particleCount,
+                                 appState->colorMode, appState->seed))
+        appState->particles = cloud;
+      else
+        free(cloud);
+    }
+    break;
+  case 'j':
+    appState->trailShow = !appState->trailShow;
+    if (appState->trailShow && !appState->trail.vertex) {
+      const Point3D *p = &appState->points[LORENZ_POINTS - 1];
+      trailInit(&appState->trail, TRAIL_VIEW_POINTS, p->x, p->y, p->z);
+    }
+    break;
+  case 'x':
+    exportView();
+    break;
+  case 'i':
+    appState->instrumentShow = !appState->instrumentShow;
+    break;
+  case 'T':
+    if (!tracePath())
+      snprintf(appState->traceMessage, sizeof(appState->traceMessage),
+               "Set LORENZ_TRACE=file.json to record a trace");
+    else {
+      long long spans = traceFlush();
+      if (spans < 0)
+        snprintf(appState->traceMessage, sizeof(appState->traceMessage),
+                 "Cannot write trace to %s", tracePath());
+      else
+        snprintf(appState->traceMessage, sizeof(appState->traceMessage),
+                 "Trace: %lld spans written to %s", spans, tracePath());
+    }
+    break;
+  case 't':
+    appState->tubeShow = !appState->tubeShow;
+    if (appState->tubeShow)
+      updateTube();
+    break;
+  case 'h':
+    appState->butterflyShow = !appState->butterflyShow;
+    if (appState->butterflyShow && appState->system == 0)
+      updateButterfly();
+    else if (appState->butterflyStats)
+      butterflyStatsStop(appState->butterflyStats);
+    break;
+  // Network controls
+  case 'k':
+    appState->netCoupling += 1.0;
+    recompute();
+    break;
+  case 'K':
+    appState->netCoupling -= 1.0;
+    if (appState->netCoupling < 0)
+      appState->netCoupling = 0;
+    recompute();
+    break;
+  case 'p':
+    appState->l96Proj = (appState->l96Proj + 1) % appState->l96N;
+    recompute();
+    break;
+  case 'P':
+    appState->l96Proj =
+        (appState->l96Proj + appState->l96N - 1) % appState->l96N;
+    recompute();
+    break;
+  case 'f':
+    appState->l96F += 0.5;
+    recompute();
+    break;
+  case 'F':
+    appState->l96F -= 0.5;
+    recompute();
+    break;
+  // Views
+  case 'v':
+    appState->viewMode = (appState->viewMode + 1) % VIEW_COUNT;
+    recompute();
+    break;
+  case 'o':
+    appState->ftlePlane = (appState->ftlePlane + 1) % 3;
+    recompute();
+    break;
+  case 'u':
+    appState->upoShow = !appState->upoShow;
+    recompute();
+    break;
+  case 'w':
+    appState->spectrumShow = !appState->spectrumShow;
+    recompute();
+    break;
+  case 'e':
+    appState->embedShow = !appState->embedShow;
+    appState->embedLag = 0;
+    recompute();
+    break;
+  case 'd':
+    appState->embedLag =
+        appState->embedUsedLag + 1 + appState->embedUsedLag / 10;
+    recompute();
+    break;
+  case 'D':
+    appState->embedLag =
+        appState->embedUsedLag - 1 - appState->embedUsedLag / 10;
+    if (appState->embedLag < 1)
+      appState->embedLag = 1;
+    recompute();
+    break;
+  case 'm':
+    appState->ulamShow = (appState->ulamShow + 1) % 3;
+    recompute();
     break;
   case 'z':
     appState->dim -= 2.0;
     reshape(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+    // The tube keeps its thickness on screen
+    if (appState->tubeShow)
+      updateTube();
     break;
   case 'Z':
     appState->dim += 2.0;
     reshape(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+    if (appState->tubeShow)
+      updateTube();
     break;
   }
   glutPostRedisplay();
 }
 
+/*
+ *  GLUT calls this routine when a mouse button is pressed or released
+ */
+void mouse(int button, int buttonState, int x, int y) {
+  if (button != GLUT_LEFT_BUTTON || buttonState != GLUT_DOWN ||
+      appState->viewMode != VIEW_CHAOS || !appState->chaosMap)
+    return;
+  const Image *img = &appState->chaosImage;
+  double h = IMAGE_HALF_HEIGHT, w = h * img->width / img->height;
+  int width = glutGet(GLUT_WINDOW_WIDTH), height = glutGet(GLUT_WINDOW_HEIGHT);
+  double wx = (2.0 * x / width - 1) * appState->asp;
+  double wy = 1 - 2.0 * y / height;
+  double u = (wx + w) / (2 * w), v = (wy + h) / (2 * h);
+  if (u < 0 || u > 1 || v < 0 || v > 1)
+    return;
+  chaosMapParams(appState->chaosMap, u, v, &appState->r, &appState->s);
+  recompute();
+  glutPostRedisplay();
+}
+
 /*
  *  GLUT calls this routine when an arrow key is pressed
  */
@@ -331,15 +1583,143 @@ void reshape(int width, int height) {
  */
 void idle() { glutPostRedisplay(); }
 
+static int benchWindow = 0;
+
+/*
+ *  A hidden window set up like the viewer's, drawing the rainbow trajectory
+ *  seen from the default angle, for the bench command; returns NULL, or why
+ *  there is no window
+ */
+static const char *benchGlOpen(void) {
+#if !defined(_WIN32) && !defined(__APPLE__)
+  // glutInit exits when it cannot reach the X server
+  const char *display = getenv("DISPLAY");
+  if (!display || !*display)
+    return "no display (DISPLAY is unset; run under Xvfb)";
+#endif
+  static State state = {.colorMode = COLOR_RAINBOW, .th = 0, .ph = 15,
+                        .dim = 60.0};
+  appState = &state;
+  int argc = 1;
+  char *argv[] = {"hw2", NULL};
+  glutInit(&argc, argv);
+  glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH | GLUT_MULTISAMPLE);
+  glutInitWindowSize(640, 360);
+  benchWindow = glutCreateWindow("bench");
+  glutHideWindow();
+#ifdef USEGLEW
+  if (glewInit() != GLEW_OK)
+    return "cannot initialize GLEW";
+#endif
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_LINE_SMOOTH);
+  glEnable(GL_MULTISAMPLE);
+  glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+  glDrawBuffer(GL_BACK);
+  reshape(640, 360);
+  glRotated(state.ph, 1, 0, 0);
+  glRotated(state.th, 0, 1, 0);
+  return NULL;
+}
+
+/*
+ *  One frame of `count` points through the viewer's drawTrajectory, waiting
+ *  until GL has drawn it
+ */
+static void benchGlDraw(const Point3D *points, int count) {
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  drawTrajectory(points, count, count, 0);
+  glFinish();
+}
+
+static void benchGlClose(void) {
+  glutDestroyWindow(benchWindow);
+  appState = NULL;
+}
+
+/*
+ *  Run a headless command given on the command line
+ */
+int runCommand(int argc, char *argv[]) {
+  if (!strcmp(argv[0], "lorenz96"))
+    return lorenz96Benchmark(argc, argv);
+  if (!strcmp(argv[0], "sde"))
+    return sdeBenchmark(argc, argv);
+  if (!strcmp(argv[0], "enkf"))
+    return enkfBenchmark(argc, argv);
+  if (!strcmp(argv[0], "sensitivity"))
+    return sensitivityBenchmark(argc, argv);
+  if (!strcmp(argv[0], "fit"))
+    return fitBenchmark(argc, argv);
+  if (!strcmp(argv[0], "ftle"))
+    return ftleCommand(argc, argv);
+  if (!strcmp(argv[0], "chaosmap"))
+    return chaosMapCommand(argc, argv);
+  if (!strcmp(argv[0], "upo"))
+    return upoCommand(argc, argv);
+  if (!strcmp(argv[0], "symbolic"))
+    return symbolicCommand(argc, argv);
+  if (!strcmp(argv[0], "spectrum"))
+    return spectrumCommand(argc, argv);
+  if (!strcmp(argv[0], "recurrence"))
+    return recurrenceCommand(argc, argv);
+  if (!strcmp(argv[0], "embed"))
+    return embedCommand(argc, argv);
+  if (!strcmp(argv[0], "ulam"))
+    return ulamCommand(argc, argv);
+  if (!strcmp(argv[0], "network"))
+    return networkCommand(argc, argv);
+  if (!strcmp(argv[0], "butterfly"))
+    return butterflyCommand(argc, argv);
+  if (!strcmp(argv[0], "particles"))
+    return particlesCommand(argc, argv);
+  if (!strcmp(argv[0], "trail"))
+    return trailCommand(argc, argv);
+  if (!strcmp(argv[0], "clock"))
+    return simClockCommand(argc, argv);
+  if (!strcmp(argv[0], "tube"))
+    return tubeCommand(argc, argv);
+  if (!strcmp(argv[0], "export"))
+    return exportCommand(argc, argv);
+  if (!strcmp(argv[0], "render"))
+    return renderCommand(argc, argv);
+  if (!strcmp(argv[0], "sheet"))
+    return sheetCommand(argc, argv);
+  if (!strcmp(argv[0], "instrument"))
+    return instrumentCommand(argc, argv);
+  if (!strcmp(argv[0], "trace"))
+    return traceCommand(argc, argv);
+  if (!strcmp(argv[0], "bench")) {
+    BenchGl gl = {benchGlOpen, benchGlDraw, benchGlClose};
+    return benchCommand(argc, argv, &gl);
+  }
+  Fatal("Unknown command: %s\n", argv[0]);
+  return 1;
+}
+
 /*
  *  Start up GLUT and tell it what to do
  */
 int main(int argc, char *argv[]) {
+  // Timing spans for chrome://tracing or Perfetto, written at exit and on T
+  const char *tracePathEnv = getenv("LORENZ_TRACE");
+  if (tracePathEnv && !traceStart(tracePathEnv))
+    Fatal("Cannot write trace %s\n", tracePathEnv);
+  if (argc > 1)
+    return runCommand(argc - 1, argv + 1);
+
   // Initialize state using a designated initializer list
   State state = {
       .s = 10.0,
       .b = 2.6666,
       .r = 28.0,
+      .system = 0,
+      .l96N = 40,
+      .l96Proj = 0,
+      .l96F = 8.0,
+      .netCoupling = 1.0,
+      .noise = 0.0,
+      .seed = 1,
       .th = 0,
       .ph = 15,
       .dim = 60.0,
@@ -348,9 +1728,35 @@ int main(int argc, char *argv[]) {
       .colorMode = 2,
       .animSpeed = 20.0,
       .currentPoints = 0,
-      .lastTime = 0,
   };
   appState = &state;
+  // A scalar series to embed in place of x(t)
+  const char *seriesPath = getenv("LORENZ_SERIES");
+  if (seriesPath &&
+      !(state.embedSeries = loadSeries(seriesPath, &state.embedLength)))
+    Fatal("Cannot read series %s\n", seriesPath);
+  if (state.embedLength > LORENZ_POINTS)
+    state.embedLength = LORENZ_POINTS;
+  // Network graph from an edge list, or a generated small world
+  const char *edgesPath = getenv("LORENZ_NETWORK");
+  if (!edgesPath)
+    state.netN = NETWORK_VIEW_SIZE;
+  if (!(edgesPath ? networkLoadEdges(edgesPath, &state.netN,
+                                     &state.netRowStart, &state.netCol)
+                  : networkSmallWorld(state.netN, NETWORK_SEED,
+                                      &state.netRowStart, &state.netCol)))
+    Fatal("Cannot build network %s\n", edgesPath ? edgesPath : "graph");
+  // Particle cloud size
+  const char *particles = getenv("LORENZ_PARTICLES");
+  state.particleCount = particles ? atoi(particles) : PARTICLE_VIEW_COUNT;
+  if (state.particleCount < 1 || state.particleCount > PARTICLE_MAX_COUNT)
+    Fatal("LORENZ_PARTICLES must be 1..%d\n", PARTICLE_MAX_COUNT);
+  // Export file for x, format by extension
+  state.exportPath = getenv("LORENZ_EXPORT");
+  if (!state.exportPath)
+    state.exportPath = EXPORT_VIEW_PATH;
+  if (exportFormat(state.exportPath) < 0)
+    Fatal("LORENZ_EXPORT must end in .ply, .obj or .glb\n");
   computeLorenzPoints(appState); // compute initial lorenz and update state
 
   // Initialize GLUT
@@ -375,10 +1781,14 @@ int main(int argc, char *argv[]) {
   glutReshapeFunc(reshape);
   glutSpecialFunc(special);
   glutKeyboardFunc(key);
+  glutMouseFunc(mouse);
   glutIdleFunc(idle);
 
-  // Initialize animation timing
-  appState->lastTime = glutGet(GLUT_ELAPSED_TIME);
+  // Fixed-timestep animation clock; $LORENZ_REPLAY ticks per frame make
+  // runs repeat exactly whatever the frame rate
+  const char *replay = getenv("LORENZ_REPLAY");
+  simClockInit(&state.clock, SIM_TICK, SIM_MAX_CATCHUP,
+               replay ? atoi(replay) : 0);
 
   //  Pass control to GLUT so it can interact with the user
   glutMainLoop();
@@ -0,0 +1,42 @@
+#ifndef MAT3_H
+#define MAT3_H
+
+// Small dense 3x3 helpers, row-major double[3][3]
+
+// C = A * B (C may alias neither)
+static inline void mat3Mul(const double a[3][3], const double b[3][3],
+                           double c[3][3]) {
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      c[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+}
+
+// y = A * x
+static inline void mat3Vec(const double a[3][3], const double x[3],
+                           double y[3]) {
+  for (int i = 0; i < 3; i++)
+    y[i] = a[i][0] * x[0] + a[i][1] * x[1] + a[i][2] * x[2];
+}
+
+// Inverse by cofactors; returns 0 when A is singular
+static inline int mat3Invert(const double a[3][3], double inv[3][3]) {
+  double c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+  double c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+  double c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+  double det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+  if (det == 0.0)
+    return 0;
+  double id = 1.0 / det;
+  inv[0][0] = c00 * id;
+  inv[1][0] = c01 * id;
+  inv[2][0] = c02 * id;
+  inv[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * id;
+  inv[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * id;
+  inv[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * id;
+  inv[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * id;
+  inv[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * id;
+  inv[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * id;
+  return 1;
+}
+
+#endif // MAT3_H
@@ -0,0 +1,562 @@
+#include "network.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include "rng.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Below this many units a step is not worth splitting across threads
+#define NETWORK_PARALLEL_MIN 16384
+#define NETWORK_CHUNK 256        // Units whose coupling is gathered at once
+#define NETWORK_BLOCK 65536      // Units per partial sum of the sync error
+
+// One RK4 stage over a range of units
+typedef struct {
+  Network *net;
+  const double *ky, *kz;      // Previous stage derivative, NULL for the first
+  double h;                   // Offset of the stage input along k
+  const double *in;           // Stage input of x, gathered for the coupling
+  double *ox, *oy, *oz;       // Stage derivative, NULL for the final stage
+  double *next;               // Next stage input of x, x + hNext * ox
+  double hNext;
+} NetStage;
+
+/*
+ *  Build an undirected CSR adjacency from m edges (a[e], b[e]); self loops
+ *  are dropped and repeated edges kept once, returns 0 on failure
+ */
+static int buildGraph(int n, long long m, const int *a, const int *b,
+                      int **rowStart, int **col) {
+  int *start = calloc(n + 1, sizeof(int));
+  int *fill = malloc(n * sizeof(int));
+  long long links = 0;
+  if (!start || !fill) {
+    free(start);
+    free(fill);
+    return 0;
+  }
+  for (long long e = 0; e < m; e++)
+    if (a[e] != b[e]) {
+      start[a[e] + 1]++;
+      start[b[e] + 1]++;
+      links += 2;
+    }
+  if (links > 2147483647LL) {
+    free(start);
+    free(fill);
+    return 0;
+  }
+  for (int i = 0; i < n; i++)
+    start[i + 1] += start[i];
+  int *adj = malloc((links ? links : 1) * sizeof(int));
+  if (!adj) {
+    free(start);
+    free(fill);
+    return 0;
+  }
+  memcpy(fill, start, n * sizeof(int));
+  for (long long e = 0; e < m; e++)
+    if (a[e] != b[e]) {
+      adj[fill[a[e]]++] = b[e];
+      adj[fill[b[e]]++] = a[e];
+    }
+
+  // Sort each row by insertion (rows are short) and squeeze out repeats
+  int out = 0;
+  for (int i = 0; i < n; i++) {
+    int e0 = start[i], e1 = start[i + 1];
+    for (int e = e0 + 1; e < e1; e++) {
+      int v = adj[e], f = e;
+      while (f > e0 && adj[f - 1] > v) {
+        adj[f] = adj[f - 1];
+        f--;
+      }
+      adj[f] = v;
+    }
+    start[i] = out;
+    for (int e = e0; e < e1; e++)
+      if (e == e0 || adj[e] != adj[e - 1])
+        adj[out++] = adj[e];
+  }
+  start[n] = out;
+  free(fill);
+  *rowStart = start;
+  *col = adj;
+  return 1;
+}
+
+/*
+ *  Ring of n units linked to their two nearest neighbours on each side,
+ *  plus one random shortcut per unit (Newman-Watts small world)
+ */
+int networkSmallWorld(int n, uint64_t seed, int **rowStart, int **col) {
+  if (n < 2)
+    return 0;
+  long long m = 3LL * n;
+  int *a = malloc(m * sizeof(int));
+  int *b = malloc(m * sizeof(int));
+  if (!a || !b) {
+    free(a);
+    free(b);
+    return 0;
+  }
+  for (int i = 0; i < n; i++) {
+    int far = (int)(philoxUniform(seed, (uint32_t)i, 0) * n);
+    a[3 * i] = a[3 * i + 1] = a[3 * i + 2] = i;
+    b[3 * i] = (i + 1) % n;
+    b[3 * i + 1] = (i + 2) % n;
+    b[3 * i + 2] = far < n ? far : n - 1;
+  }
+  int ok = buildGraph(n, m, a, b, rowStart, col);
+  free(a);
+  free(b);
+  return ok;
+}
+
+/*
+ *  Read an edge list with one "i j" pair of 0-based unit numbers per line;
+ *  other lines are skipped and n is one past the largest unit seen
+ */
+int networkLoadEdges(const char *path, int *n, int **rowStart, int **col) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return 0;
+
+  long long capacity = 1 << 16, m = 0;
+  int *a = malloc(capacity * sizeof(int));
+  int *b = malloc(capacity * sizeof(int));
+  int units = 0, ok = a && b;
+  char line[256];
+  while (ok && fgets(line, sizeof(line), file)) {
+    long i, j;
+    if (sscanf(line, "%ld %ld", &i, &j) != 2 || i < 0 || j < 0 ||
+        i >= 2147483647L || j >= 2147483647L)
+      continue;
+    if (m == capacity) {
+      capacity *= 2;
+      int *ga = realloc(a, capacity * sizeof(int));
+      if (ga)
+        a = ga;
+      int *gb = realloc(b, capacity * sizeof(int));
+      if (gb)
+        b = gb;
+      if (!ga || !gb) {
+        ok = 0;
+        break;
+      }
+    }
+    a[m] = (int)i;
+    b[m] = (int)j;
+    m++;
+    if (i >= units)
+      units = (int)i + 1;
+    if (j >= units)
+      units = (int)j + 1;
+  }
+  fclose(file);
+  ok = ok && units > 0 && buildGraph(units, m, a, b, rowStart, col);
+  free(a);
+  free(b);
+  if (ok)
+    *n = units;
+  return ok;
+}
+
+// Copy of the graph and starting states, written by the thread that owns
+// each range of units
+typedef struct {
+  Network *net;
+  const int *rowStart;
+  const int *col;
+} Touch;
+
+/*
+ *  First touch: every page of the per-unit arrays is written first by the
+ *  thread whose stage range covers it, so on NUMA machines it is placed on
+ *  that thread's node; parallelFor partitions n the same way every call
+ */
+static void touchRange(void *ctx, int begin, int end, int thread) {
+  const Touch *t = ctx;
+  Network *net = t->net;
+  if (begin == 0)
+    net->rowStart[0] = 0;
+  for (int i = begin; i < end; i++) {
+    net->rowStart[i + 1] = t->rowStart[i + 1];
+    for (int e = t->rowStart[i]; e < t->rowStart[i + 1]; e++)
+      net->col[e] = t->col[e];
+    // Scattered over the attractor's neighbourhood
+    net->x[i] = -15.0 + 30.0 * philoxUniform(NETWORK_SEED, (uint32_t)i, 0);
+    net->y[i] = -20.0 + 40.0 * philoxUniform(NETWORK_SEED, (uint32_t)i, 1);
+    net->z[i] = 5.0 + 40.0 * philoxUniform(NETWORK_SEED, (uint32_t)i, 2);
+    net->xn[i] = net->yn[i] = net->zn[i] = 0.0;
+    net->xs[0][i] = net->xs[1][i] = 0.0;
+    for (int k = 0; k < 3; k++)
+      net->kx[k][i] = net->ky[k][i] = net->kz[k][i] = 0.0;
+  }
+}
+
+static void runParallel(const Network *net, ParallelFn fn, void *ctx) {
+  if (net->n >= NETWORK_PARALLEL_MIN)
+    parallelFor(net->n, fn, ctx);
+  else
+    fn(ctx, 0, net->n, 0);
+}
+
+/*
+ *  Allocate the network, copy the graph into it and scatter the units;
+ *  returns 0 on allocation failure
+ */
+int networkInit(Network *net, int n, const int *rowStart, const int *col,
+                double s, double b, double r, double coupling, double dt) {
+  memset(net, 0, sizeof(*net));
+  if (n < 1)
+    return 0;
+  net->n = n;
+  net->links = rowStart[n];
+  net->s = s;
+  net->b = b;
+  net->r = r;
+  net->coupling = coupling;
+  net->dt = dt;
+
+  // malloc only reserves address space, touchRange decides the placement
+  int ok = 1;
+  net->rowStart = malloc((n + 1) * sizeof(int));
+  net->col = malloc((net->links ? net->links : 1) * sizeof(int));
+  double **arrays[] = {&net->x,     &net->y,     &net->z,     &net->xn,
+                       &net->yn,    &net->zn,    &net->kx[0], &net->kx[1],
+                       &net->kx[2], &net->ky[0], &net->ky[1], &net->ky[2],
+                       &net->kz[0], &net->kz[1], &net->kz[2], &net->xs[0],
+                       &net->xs[1]};
+  for (int i = 0; i < (int)(sizeof(arrays) / sizeof(arrays[0])); i++)
+    ok &= (*arrays[i] = malloc(n * sizeof(double))) != NULL;
+  if (!ok || !net->rowStart || !net->col) {
+    networkFree(net);
+    return 0;
+  }
+  Touch t = {net, rowStart, col};
+  runParallel(net, touchRange, &t);
+  return 1;
+}
+
+void networkFree(Network *net) {
+  free(net->rowStart);
+  free(net->col);
+  free(net->x);
+  free(net->y);
+  free(net->z);
+  free(net->xn);
+  free(net->yn);
+  free(net->zn);
+  free(net->xs[0]);
+  free(net->xs[1]);
+  for (int k = 0; k < 3; k++) {
+    free(net->kx[k]);
+    free(net->ky[k]);
+    free(net->kz[k]);
+  }
+  memset(net, 0, sizeof(*net));
+}
+
+/*
+ *  Evaluate one stage for units [begin, end); the coupling is gathered
+ *  through the CSR rows a chunk at a time, from a single array of stage
+ *  inputs so a far neighbour costs one cache miss, and the local Lorenz
+ *  terms stay in unit-stride loops the compiler can vectorize
+ */
+static void stageRange(void *ctx, int begin, int end, int thread) {
+  const NetStage *st = ctx;
+  const Network *net = st->net;
+  const int *restrict rowStart = net->rowStart;
+  const int *restrict col = net->col;
+  const double *restrict x = net->x;
+  const double *restrict y = net->y;
+  const double *restrict z = net->z;
+  const double *restrict in = st->in;
+  const double *restrict ky = st->ky;
+  const double *restrict kz = st->kz;
+  double *restrict ox = st->ox;
+  double *restrict oy = st->oy;
+  double *restrict oz = st->oz;
+  double *restrict next = st->next;
+  double s = net->s, b = net->b, r = net->r, h = st->h, hNext = st->hNext;
+  double k = net->coupling, dt6 = net->dt / 6.0;
+  double coupled[NETWORK_CHUNK];
+
+  for (int c0 = begin; c0 < end; c0 += NETWORK_CHUNK) {
+    int c1 = end - c0 < NETWORK_CHUNK ? end : c0 + NETWORK_CHUNK;
+
+    // k sum_j (x_j - x_i) at the stage input
+    for (int i = c0; i < c1; i++) {
+      double sum = 0.0;
+      int e0 = rowStart[i], e1 = rowStart[i + 1];
+      for (int e = e0; e < e1; e++)
+        sum += in[col[e]];
+      coupled[i - c0] = k * (sum - (e1 - e0) * in[i]);
+    }
+
+    if (!ky) {
+      for (int i = c0; i < c1; i++) {
+        double dx = s * (y[i] - x[i]) + coupled[i - c0];
+        ox[i] = dx;
+        oy[i] = x[i] * (r - z[i]) - y[i];
+        oz[i] = x[i] * y[i] - b * z[i];
+        next[i] = x[i] + hNext * dx;
+      }
+    } else if (ox) {
+      for (int i = c0; i < c1; i++) {
+        double xi = in[i];
+        double yi = y[i] + h * ky[i];
+        double zi = z[i] + h * kz[i];
+        double dx = s * (yi - xi) + coupled[i - c0];
+        ox[i] = dx;
+        oy[i] = xi * (r - zi) - yi;
+        oz[i] = xi * yi - b * zi;
+        next[i] = x[i] + hNext * dx;
+      }
+    } else {
+      const double *restrict k1x = net->kx[0], *restrict k2x = net->kx[1];
+      const double *restrict k3x = net->kx[2];
+      const double *restrict k1y = net->ky[0], *restrict k2y = net->ky[1];
+      const double *restrict k1z = net->kz[0], *restrict k2z = net->kz[1];
+      double *restrict xn = net->xn;
+      double *restrict yn = net->yn;
+      double *restrict zn = net->zn;
+      for (int i = c0; i < c1; i++) {
+        double xi = in[i];
+        double yi = y[i] + h * ky[i];
+        double zi = z[i] + h * kz[i];
+        double dx = s * (yi - xi) + coupled[i - c0];
+        double dy = xi * (r - zi) - yi;
+        double dz = xi * yi - b * zi;
+        xn[i] = x[i] + dt6 * (k1x[i] + 2.0 * (k2x[i] + k3x[i]) + dx);
+        yn[i] = y[i] + dt6 * (k1y[i] + 2.0 * (k2y[i] + ky[i]) + dy);
+        zn[i] = z[i] + dt6 * (k1z[i] + 2.0 * (k2z[i] + kz[i]) + dz);
+      }
+    }
+  }
+}
+
+/*
+ *  Run stage `to` (-1 for the final one) from the derivative of stage
+ *  `from` (-1 for none); x inputs alternate between the two xs buffers so
+ *  no stage overwrites the values its neighbours still read
+ */
+static void runStage(Network *net, int from, double h, int to,
+                     double hNext) {
+  NetStage st = {net, NULL, NULL, h, net->x, NULL, NULL, NULL, NULL, hNext};
+  if (from >= 0) {
+    st.ky = net->ky[from];
+    st.kz = net->kz[from];
+    st.in = net->xs[from & 1];
+  }
+  if (to >= 0) {
+    st.ox = net->kx[to];
+    st.oy = net->ky[to];
+    st.oz = net->kz[to];
+    st.next = net->xs[to & 1];
+  }
+  runParallel(net, stageRange, &st);
+}
+
+/*
+ *  Advance one classical RK4 step; the last stage writes straight into
+ *  the next state
+ */
+void networkStep(Network *net) {
+  double dt = net->dt, *tmp;
+  runStage(net, -1, 0.0, 0, 0.5 * dt);
+  runStage(net, 0, 0.5 * dt, 1, 0.5 * dt);
+  runStage(net, 1, 0.5 * dt, 2, dt);
+  runStage(net, 2, dt, -1, 0.0);
+  tmp = net->x, net->x = net->xn, net->xn = tmp;
+  tmp = net->y, net->y = net->yn, net->yn = tmp;
+  tmp = net->z, net->z = net->zn, net->zn = tmp;
+}
+
+// Partial sums of the sync error, one slot per fixed block
+typedef struct {
+  const Network *net;
+  double mean[3];
+  double *sums; // 3 per block for the mean pass, 1 for the deviation pass
+} SyncSums;
+
+static void meanBlocks(void *ctx, int begin, int end, int thread) {
+  SyncSums *ss = ctx;
+  const Network *net = ss->net;
+  for (int blk = begin; blk < end; blk++) {
+    int i0 = blk * NETWORK_BLOCK;
+    int i1 = net->n - i0 < NETWORK_BLOCK ? net->n : i0 + NETWORK_BLOCK;
+    double sx = 0.0, sy = 0.0, sz = 0.0;
+    for (int i = i0; i < i1; i++) {
+      sx += net->x[i];
+      sy += net->y[i];
+      sz += net->z[i];
+    }
+    ss->sums[3 * blk] = sx;
+    ss->sums[3 * blk + 1] = sy;
+    ss->sums[3 * blk + 2] = sz;
+  }
+}
+
+static void deviationBlocks(void *ctx, int begin, int end, int thread) {
+  SyncSums *ss = ctx;
+  const Network *net = ss->net;
+  double mx = ss->mean[0], my = ss->mean[1], mz = ss->mean[2];
+  for (int blk = begin; blk < end; blk++) {
+    int i0 = blk * NETWORK_BLOCK;
+    int i1 = net->n - i0 < NETWORK_BLOCK ? net->n : i0 + NETWORK_BLOCK;
+    double sum = 0.0;
+    for (int i = i0; i < i1; i++) {
+      double dx = net->x[i] - mx, dy = net->y[i] - my, dz = net->z[i] - mz;
+      sum += dx * dx + dy * dy + dz * dz;
+    }
+    ss->sums[blk] = sum;
+  }
+}
+
+/*
+ *  Synchronization error: root mean square distance of the units from the
+ *  network mean, 0 when all units move together; summed in fixed blocks
+ *  so the result does not depend on the thread count
+ */
+double networkSyncError(const Network *net) {
+  int blocks = (net->n + NETWORK_BLOCK - 1) / NETWORK_BLOCK;
+  SyncSums ss = {net, {0.0, 0.0, 0.0}, malloc(3 * blocks * sizeof(double))};
+  if (!ss.sums)
+    return NAN;
+  if (blocks > 1)
+    parallelFor(blocks, meanBlocks, &ss);
+  else
+    meanBlocks(&ss, 0, blocks, 0);
+  for (int blk = 0; blk < blocks; blk++)
+    for (int c = 0; c < 3; c++)
+      ss.mean[c] += ss.sums[3 * blk + c];
+  for (int c = 0; c < 3; c++)
+    ss.mean[c] /= net->n;
+
+  if (blocks > 1)
+    parallelFor(blocks, deviationBlocks, &ss);
+  else
+    deviationBlocks(&ss, 0, blocks, 0);
+  double sum = 0.0;
+  for (int blk = 0; blk < blocks; blk++)
+    sum += ss.sums[blk];
+  free(ss.sums);
+  return sqrt(sum / net->n);
+}
+
+/*
+ *  Run the viewer network from its scattered start: record the sync error
+ *  and NETWORK_VIEW_UNITS evenly spaced units each step, and fill
+ *  state->points with the first of them, interpolated to LORENZ_DT steps
+ *  so the other views see an ordinary trajectory
+ */
+void computeNetworkPoints(State *state) {
+  if (!state || !state->netRowStart) return;
+  if (!state->netPaths) {
+    state->netPaths =
+        malloc(NETWORK_VIEW_UNITS * NETWORK_VIEW_STEPS * sizeof(Point3D));
+    state->netError = malloc(NETWORK_VIEW_STEPS * sizeof(double));
+    if (!state->netPaths || !state->netError) {
+      free(state->netPaths);
+      free(state->netError);
+      state->netPaths = NULL;
+      state->netError = NULL;
+      return;
+    }
+  }
+
+  Network net;
+  if (!networkInit(&net, state->netN, state->netRowStart, state->netCol,
+                   state->s, state->b, state->r, state->netCoupling,
+                   NETWORK_VIEW_DT))
+    return;
+  for (int t = 0; t < NETWORK_VIEW_STEPS; t++) {
+    networkStep(&net);
+    state->netError[t] = networkSyncError(&net);
+    for (int u = 0; u < NETWORK_VIEW_UNITS; u++) {
+      int i = (int)((long long)u * net.n / NETWORK_VIEW_UNITS);
+      Point3D p = {net.x[i], net.y[i], net.z[i]};
+      state->netPaths[u * NETWORK_VIEW_STEPS + t] = p;
+    }
+  }
+  networkFree(&net);
+
+  const Point3D *path = state->netPaths;
+  for (int i = 0; i < LORENZ_POINTS; i++) {
+    double pos = i * LORENZ_DT / NETWORK_VIEW_DT;
+    int t = (int)pos;
+    double f = pos - t;
+    if (t >= NETWORK_VIEW_STEPS - 1) {
+      t = NETWORK_VIEW_STEPS - 2;
+      f = 1.0;
+    }
+    state->points[i].x = path[t].x + f * (path[t + 1].x - path[t].x);
+    state->points[i].y = path[t].y + f * (path[t + 1].y - path[t].y);
+    state->points[i].z = path[t].z + f * (path[t + 1].z - path[t].z);
+  }
+}
+
+/*
+ *  network [N|edges.txt [coupling [steps]]]: step a small-world network of
+ *  N units (default 1e6) or a graph read from an edge list, printing the
+ *  sync error over time and the stepping rate
+ */
+int networkCommand(int argc, char *argv[]) {
+  const char *arg = argc > 1 ? argv[1] : "1000000";
+  double coupling = argc > 2 ? atof(argv[2]) : 1.0;
+  int steps = argc > 3 ? atoi(argv[3]) : 1000;
+  if (steps < 1)
+    steps = 1;
+
+  char *end;
+  long units = strtol(arg, &end, 10);
+  int n = 0, *rowStart, *col;
+  double t0 = wallTime();
+  if (*end == '\0') {
+    n = units > 2147483646L ? 2147483646 : (int)units;
+    if (!networkSmallWorld(n, NETWORK_SEED, &rowStart, &col)) {
+      fprintf(stderr, "Network: cannot build a small world of N=%ld\n", units);
+      return 1;
+    }
+  } else if (!networkLoadEdges(arg, &n, &rowStart, &col)) {
+    fprintf(stderr, "Network: cannot read edge list %s\n", arg);
+    return 1;
+  }
+
+  Network net;
+  int ok = networkInit(&net, n, rowStart, col, 10.0, 8.0 / 3.0, 28.0,
+                       coupling, 0.01);
+  free(rowStart);
+  free(col);
+  if (!ok) {
+    fprintf(stderr, "Network: cannot allocate N=%d\n", n);
+    return 1;
+  }
+  double mb = (17.0 * sizeof(double) * n +
+               sizeof(int) * ((double)n + 1 + net.links)) / 1048576.0;
+  printf("Network: N=%d links=%lld (mean degree %.2f) k=%g dt=%g  %.1f MB, "
+         "built in %.2f s\n",
+         net.n, net.links, (double)net.links / net.n, coupling, net.dt, mb,
+         wallTime() - t0);
+  printf("%10s %14s\n", "t", "sync error");
+  printf("%10.2f %14.6e\n", 0.0, networkSyncError(&net));
+
+  int every = steps < 10 ? 1 : steps / 10;
+  double stepping = 0.0;
+  for (int i = 1; i <= steps; i++) {
+    t0 = wallTime();
+    networkStep(&net);
+    stepping += wallTime() - t0;
+    if (i % every == 0 || i == steps)
+      printf("%10.2f %14.6e\n", i * net.dt, networkSyncError(&net));
+  }
+  printf("%d steps on %d threads: %.3f s, %.2f ms/step, %.3e unit-steps/s\n",
+         steps, net.n >= NETWORK_PARALLEL_MIN ? parallelThreads() : 1,
+         stepping, 1e3 * stepping / steps, (double)net.n * steps / stepping);
+  networkFree(&net);
+  return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include "state.h"
+
+// Viewer network: generated size, units drawn, steps kept and their spacing
+#define NETWORK_VIEW_SIZE 1000
+#define NETWORK_VIEW_UNITS 8
+#define NETWORK_VIEW_STEPS 5000
+#define NETWORK_VIEW_DT 0.01
+
+// Philox seed of generated graphs and of the scattered initial states
+#define NETWORK_SEED 0x6e6574ULL
+
+// N Lorenz units diffusively coupled in x over an undirected graph:
+// dx_i/dt = s (y_i - x_i) + k sum_j A_ij (x_j - x_i), y and z as usual
+typedef struct {
+  int n;            // Units
+  long long links;  // Adjacency entries (each undirected edge twice)
+  double s, b, r;
+  double coupling;  // k
+  double dt;        // RK4 time step
+  int *rowStart;    // Neighbours of unit i: col[rowStart[i] .. rowStart[i+1])
+  int *col;
+  double *x, *y, *z;    // Unit states, one array per variable
+  double *xn, *yn, *zn; // Next state (swapped with x, y, z after each step)
+  double *kx[3];        // RK4 stage derivatives k1..k3
+  double *ky[3];
+  double *kz[3];
+  double *xs[2];        // Stage inputs of x, alternating between stages
+} Network;
+
+int networkSmallWorld(int n, uint64_t seed, int **rowStart, int **col);
+int networkLoadEdges(const char *path, int *n, int **rowStart, int **col);
+int networkInit(Network *net, int n, const int *rowStart, const int *col,
+                double s, double b, double r, double coupling, double dt);
+void networkFree(Network *net);
+void networkStep(Network *net);
+double networkSyncError(const Network *net);
+void computeNetworkPoints(State *state);
+int networkCommand(int argc, char *argv[]);
+
+#endif // NETWORK_H
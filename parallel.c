@@ -0,0 +1,219 @@
+#include "parallel.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define MAX_THREADS 256
+#define BACKGROUND_SHARE 4 // Background jobs get one thread in this many
+
+// Persistent worker pool; the calling thread always runs chunk 0 itself.
+// One job at a time; callers that find the pool busy run serially.
+typedef struct {
+  pthread_t workers[MAX_THREADS];
+  int workerCount; // Workers started so far (excluding the caller)
+  pthread_mutex_t callLock;
+  pthread_mutex_t jobLock;
+  pthread_cond_t jobReady;
+  pthread_cond_t jobDone;
+  unsigned long jobGeneration;
+  int jobPending;
+  int jobN;
+  int jobThreads;
+  ParallelFn jobFn;
+  void *jobCtx;
+} Pool;
+
+#define POOL_INIT                                                            \
+  {.callLock = PTHREAD_MUTEX_INITIALIZER,                                    \
+   .jobLock = PTHREAD_MUTEX_INITIALIZER,                                     \
+   .jobReady = PTHREAD_COND_INITIALIZER,                                     \
+   .jobDone = PTHREAD_COND_INITIALIZER}
+
+// parallelFor's pool, and a separate one for long-running background jobs
+// so they never hold the other while the viewer needs it
+static Pool foreground = POOL_INIT;
+static Pool background = POOL_INIT;
+
+static int threadCount = 0;     // Threads in all, 0 until first queried
+static int backgroundCount = 0; // Share for background jobs, 0 for default
+static atomic_int lent;         // Threads background jobs are using now
+
+// Set while running inside a job so nested calls do not deadlock
+static __thread int insideJob = 0;
+
+/*
+ *  Static contiguous partition, identical for every call with the same n
+ */
+static void runChunk(Pool *pool, int t) {
+  int begin = (int)((long long)pool->jobN * t / pool->jobThreads);
+  int end = (int)((long long)pool->jobN * (t + 1) / pool->jobThreads);
+  if (begin < end)
+    pool->jobFn(pool->jobCtx, begin, end, t);
+}
+
+static void *workerMain(void *arg) {
+  Pool *pool = (size_t)arg % 2 ? &background : &foreground;
+  int t = (int)((size_t)arg / 2);
+  unsigned long seen = 0;
+  insideJob = 1;
+  pthread_mutex_lock(&pool->jobLock);
+  for (;;) {
+    while (pool->jobGeneration == seen)
+      pthread_cond_wait(&pool->jobReady, &pool->jobLock);
+    seen = pool->jobGeneration;
+    if (t >= pool->jobThreads)
+      continue;
+    pthread_mutex_unlock(&pool->jobLock);
+    runChunk(pool, t);
+    pthread_mutex_lock(&pool->jobLock);
+    if (--pool->jobPending == 0)
+      pthread_cond_signal(&pool->jobDone);
+  }
+  return NULL;
+}
+
+/*
+ *  Run a job on a pool whose callLock the caller holds, with up to
+ *  `threads` threads counting the caller; releases callLock
+ */
+static void runJob(Pool *pool, int n, int threads, ParallelFn fn, void *ctx) {
+  // Grow the pool on demand
+  while (pool->workerCount < threads - 1) {
+    size_t arg = (size_t)(pool->workerCount + 1) * 2 + (pool == &background);
+    if (pthread_create(&pool->workers[pool->workerCount], NULL, workerMain,
+                       (void *)arg) != 0)
+      break;
+    pool->workerCount++;
+  }
+  if (threads > pool->workerCount + 1)
+    threads = pool->workerCount + 1;
+
+  pthread_mutex_lock(&pool->jobLock);
+  pool->jobFn = fn;
+  pool->jobCtx = ctx;
+  pool->jobN = n;
+  pool->jobThreads = threads;
+  pool->jobPending = threads - 1;
+  pool->jobGeneration++;
+  pthread_cond_broadcast(&pool->jobReady);
+  pthread_mutex_unlock(&pool->jobLock);
+
+  insideJob = 1;
+  runChunk(pool, 0);
+  insideJob = 0;
+
+  pthread_mutex_lock(&pool->jobLock);
+  while (pool->jobPending > 0)
+    pthread_cond_wait(&pool->jobDone, &pool->jobLock);
+  pthread_mutex_unlock(&pool->jobLock);
+  pthread_mutex_unlock(&pool->callLock);
+}
+
+/*
+ *  Number of threads used by parallelFor, from LORENZ_THREADS or the CPU count
+ */
+int parallelThreads(void) {
+  if (threadCount > 0)
+    return threadCount;
+  const char *env = getenv("LORENZ_THREADS");
+  int count = env ? atoi(env) : 0;
+  if (count <= 0) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    count = (int)info.dwNumberOfProcessors;
+#else
+    count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  }
+  parallelSetThreads(count);
+  return threadCount;
+}
+
+void parallelSetThreads(int count) {
+  if (count < 1)
+    count = 1;
+  if (count > MAX_THREADS)
+    count = MAX_THREADS;
+  pthread_mutex_lock(&foreground.callLock);
+  threadCount = count;
+  pthread_mutex_unlock(&foreground.callLock);
+}
+
+/*
+ *  Threads a background job runs on: one in BACKGROUND_SHARE of them
+ *  unless set, and always at least one
+ */
+int parallelBackgroundThreads(void) {
+  int threads = parallelThreads();
+  int count =
+      backgroundCount > 0 ? backgroundCount : threads / BACKGROUND_SHARE;
+  return count < 1 ? 1 : count > threads ? threads : count;
+}
+
+/*
+ *  Give background jobs `count` threads, for commands that have nothing
+ *  else to run; 0 restores the default share
+ */
+void parallelSetBackgroundThreads(int count) {
+  pthread_mutex_lock(&background.callLock);
+  backgroundCount = count > 0 ? count : 0;
+  pthread_mutex_unlock(&background.callLock);
+}
+
+/*
+ *  Split [0, n) into one contiguous chunk per thread and wait for all of
+ *  them, on the threads background jobs are not using
+ */
+void parallelFor(int n, ParallelFn fn, void *ctx) {
+  if (n <= 0)
+    return;
+  int threads = parallelThreads() - atomic_load(&lent);
+  if (threads > n)
+    threads = n;
+  if (threads <= 1 || insideJob ||
+      pthread_mutex_trylock(&foreground.callLock) != 0) {
+    fn(ctx, 0, n, 0);
+    return;
+  }
+  runJob(&foreground, n, threads, fn, ctx);
+}
+
+/*
+ *  parallelFor for a long-running job off the viewer's thread: it runs on
+ *  its own pool with parallelBackgroundThreads() threads, which parallelFor
+ *  leaves alone until it returns. A second background job at the same time
+ *  runs serially on its caller's thread.
+ */
+void parallelForBackground(int n, ParallelFn fn, void *ctx) {
+  if (n <= 0)
+    return;
+  int threads = parallelBackgroundThreads();
+  if (threads > n)
+    threads = n;
+  if (threads == 1 || insideJob ||
+      pthread_mutex_trylock(&background.callLock) != 0) {
+    atomic_fetch_add(&lent, 1);
+    fn(ctx, 0, n, 0);
+    atomic_fetch_sub(&lent, 1);
+    return;
+  }
+  atomic_fetch_add(&lent, threads);
+  runJob(&background, n, threads, fn, ctx);
+  atomic_fetch_sub(&lent, threads);
+}
+
+/*
+ *  Monotonic wall clock in seconds
+ */
+double wallTime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,15 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Work callback, processes items [begin, end) as worker number `thread`
+typedef void (*ParallelFn)(void *ctx, int begin, int end, int thread);
+
+int parallelThreads(void);
+void parallelSetThreads(int count);
+int parallelBackgroundThreads(void);
+void parallelSetBackgroundThreads(int count);
+void parallelFor(int n, ParallelFn fn, void *ctx);
+void parallelForBackground(int n, ParallelFn fn, void *ctx);
+double wallTime(void);
+
+#endif // PARALLEL_H
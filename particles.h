@@ -0,0 +1,33 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <stdint.h>
+
+// Viewer cloud: default size ($LORENZ_PARTICLES overrides, up to the
+// maximum) and RK4 steps advanced per frame, each PARTICLE_VIEW_DT long for
+// every simulation tick the frame ran
+#define PARTICLE_VIEW_COUNT 1000000
+#define PARTICLE_MAX_COUNT 10000000
+#define PARTICLE_VIEW_STEPS 2
+#define PARTICLE_VIEW_DT 0.005
+
+// Particles carried by the Lorenz-63 flow, in single precision: states one
+// array per coordinate for the stepping kernel, and a copy of the positions
+// interleaved for drawing as a vertex array
+typedef struct ParticleCloud {
+  int count;
+  float *x, *y, *z;
+  float *vertex;        // x, y, z per particle
+  unsigned char *color; // RGB per particle, by its starting x
+  float *x0;            // Starting x, kept to recolor
+} ParticleCloud;
+
+int particlesInit(ParticleCloud *cloud, int count, int colorMode,
+                  uint64_t seed);
+void particlesFree(ParticleCloud *cloud);
+void particlesColor(ParticleCloud *cloud, int colorMode);
+void particlesAdvance(ParticleCloud *cloud, double s, double b, double r,
+                      double dt, int steps);
+int particlesCommand(int argc, char *argv[]);
+
+#endif // PARTICLES_H
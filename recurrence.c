@@ -0,0 +1,486 @@
+#include "recurrence.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RECURRENCE_BANDS 64  // Row bands, balanced by pair count
+#define RECURRENCE_ROWS 64   // Rows per tile
+#define RECURRENCE_COLS 2048 // Columns per tile, a multiple of 64
+
+// Statistics of complete lines in one direction
+typedef struct {
+  long long lines; // Lines at least minLine long
+  long long cells; // Points on those lines
+  int longest;
+} LineStats;
+
+// Run touching the top or bottom row of a band, joined up after the bands
+typedef struct {
+  int index; // Diagonal offset j - i, or column j
+  int length;
+  int full; // Spans the whole band
+} EdgeRun;
+
+typedef struct {
+  EdgeRun *runs;
+  int count;
+  int capacity;
+} RunList;
+
+// Only the upper triangle j >= i + theiler is computed; each band covers
+// a range of its rows
+typedef struct {
+  int row0;
+  int row1;
+  long long recurrent;
+  LineStats diag, vert, horiz; // Lines that start and end inside the band
+  RunList head[2];             // Runs touching row0: diagonal, vertical
+  RunList tail[2];             // Runs still open after row1 - 1
+  uint64_t *pixels;            // Plot rows pixelRow0.. hit by this band
+  int pixelRow0;
+  int pixelRows;
+  int failed;
+} Band;
+
+typedef struct {
+  const float *x, *y, *z; // Padded to whole 64-bit words with far points
+  int n;
+  int words; // Words per bit row, with at least one padding bit
+  const RecurrenceConfig *config;
+  float eps2;
+  int imageSize;
+  const uint16_t *pixelOf; // Plot column of each point
+  Band *bands;
+} RecurrenceJob;
+
+static void addLine(LineStats *stats, int length, int minLine) {
+  if (length < minLine)
+    return;
+  stats->lines++;
+  stats->cells += length;
+  if (length > stats->longest)
+    stats->longest = length;
+}
+
+static int pushRun(RunList *list, int index, int length, int full) {
+  if (list->count == list->capacity) {
+    int capacity = list->capacity ? 2 * list->capacity : 256;
+    EdgeRun *runs = realloc(list->runs, capacity * sizeof(EdgeRun));
+    if (!runs)
+      return 0;
+    list->runs = runs;
+    list->capacity = capacity;
+  }
+  list->runs[list->count++] = (EdgeRun){index, length, full};
+  return 1;
+}
+
+/*
+ *  Squared distances from point (xi, yi, zi) to n points as 0/1 bytes; the
+ *  loop vectorizes four floats at a time
+ */
+static void thresholdRow(const float *restrict x, const float *restrict y,
+                         const float *restrict z, float xi, float yi, float zi,
+                         float eps2, int n, unsigned char *restrict out) {
+  for (int j = 0; j < n; j++) {
+    float dx = x[j] - xi, dy = y[j] - yi, dz = z[j] - zi;
+    out[j] = dx * dx + dy * dy + dz * dz < eps2;
+  }
+}
+
+/*
+ *  Pack 0/1 bytes into bits, eight at a time: the multiply gathers the low
+ *  bit of each byte into the top byte in order
+ */
+static void packBits(const unsigned char *bytes, int words, uint64_t *out) {
+  for (int w = 0; w < words; w++) {
+    uint64_t word = 0;
+    for (int k = 0; k < 8; k++) {
+      uint64_t v;
+      memcpy(&v, bytes + 64 * w + 8 * k, 8);
+      word |= (v * 0x0102040810204080ULL) >> 56 << (8 * k);
+    }
+    out[w] = word;
+  }
+}
+
+/*
+ *  Close the run of one direction at `index` that ended on row endRow
+ */
+static void endRun(Band *band, int kind, int *run, int index, int endRow,
+                   int minLine) {
+  int length = run[index];
+  run[index] = 0;
+  if (endRow - length + 1 == band->row0) {
+    if (!pushRun(&band->head[kind], index, length, 0))
+      band->failed = 1;
+  } else
+    addLine(kind ? &band->vert : &band->diag, length, minLine);
+}
+
+/*
+ *  Advance the line runs by one row. A diagonal continues from bit j - 1 of
+ *  the previous row to bit j, a vertical line from bit j to bit j.
+ */
+static void processRow(const RecurrenceJob *job, Band *band, int i,
+                       const uint64_t *prev, const uint64_t *cur,
+                       int *diagRun, int *vertRun) {
+  int minLine = job->config->minLine;
+  for (int k = 0; k < job->words; k++) {
+    uint64_t shifted = prev[k] << 1 | (k ? prev[k - 1] >> 63 : 0);
+    for (uint64_t m = shifted & ~cur[k]; m; m &= m - 1) {
+      int j = 64 * k + __builtin_ctzll(m);
+      endRun(band, 0, diagRun, j - i, i - 1, minLine);
+    }
+    for (uint64_t m = prev[k] & ~cur[k]; m; m &= m - 1) {
+      int j = 64 * k + __builtin_ctzll(m);
+      endRun(band, 1, vertRun, j, i - 1, minLine);
+    }
+  }
+
+  uint64_t *pixels = NULL;
+  if (job->imageSize)
+    pixels = band->pixels +
+             (size_t)(job->pixelOf[i] - band->pixelRow0) * job->imageSize;
+  int last = -2, horizontal = 0;
+  for (int k = 0; k < job->words; k++)
+    for (uint64_t m = cur[k]; m; m &= m - 1) {
+      int j = 64 * k + __builtin_ctzll(m);
+      band->recurrent++;
+      diagRun[j - i]++;
+      vertRun[j]++;
+      if (j != last + 1) {
+        addLine(&band->horiz, horizontal, minLine);
+        horizontal = 0;
+      }
+      horizontal++;
+      last = j;
+      if (pixels)
+        pixels[job->pixelOf[j]]++;
+    }
+  addLine(&band->horiz, horizontal, minLine);
+}
+
+/*
+ *  Tiles of RECURRENCE_ROWS rows by RECURRENCE_COLS columns keep the column
+ *  points in cache while every row of the tile is thresholded against them;
+ *  the rows are then swept in order to follow the lines
+ */
+static void processBand(const RecurrenceJob *job, Band *band) {
+  int n = job->n, W = job->words, theiler = job->config->theiler;
+  uint64_t *bits = malloc((size_t)RECURRENCE_ROWS * W * sizeof(uint64_t));
+  uint64_t *prev = calloc(W, sizeof(uint64_t));
+  int *diagRun = calloc(n + 1, sizeof(int));
+  int *vertRun = calloc(n + 1, sizeof(int));
+  unsigned char *bytes = malloc(RECURRENCE_COLS);
+  if (!bits || !prev || !diagRun || !vertRun || !bytes) {
+    band->failed = 1;
+    goto done;
+  }
+
+  for (int r0 = band->row0; r0 < band->row1; r0 += RECURRENCE_ROWS) {
+    int r1 = r0 + RECURRENCE_ROWS < band->row1 ? r0 + RECURRENCE_ROWS
+                                               : band->row1;
+    int first = r0 + theiler < n ? (r0 + theiler) / 64 : W;
+    for (int c0 = 64 * first; c0 < 64 * W; c0 += RECURRENCE_COLS) {
+      int cols = 64 * W - c0 < RECURRENCE_COLS ? 64 * W - c0 : RECURRENCE_COLS;
+      for (int i = r0; i < r1; i++) {
+        thresholdRow(job->x + c0, job->y + c0, job->z + c0, job->x[i],
+                     job->y[i], job->z[i], job->eps2, cols, bytes);
+        packBits(bytes, cols / 64, bits + (size_t)(i - r0) * W + c0 / 64);
+      }
+    }
+
+    for (int i = r0; i < r1; i++) {
+      uint64_t *cur = bits + (size_t)(i - r0) * W;
+      // Keep only j >= i + theiler
+      int jmin = i + theiler < 64 * W ? i + theiler : 64 * W;
+      for (int k = 0; k < jmin / 64; k++)
+        cur[k] = 0;
+      if (jmin % 64)
+        cur[jmin / 64] &= ~0ULL << (jmin % 64);
+      processRow(job, band, i, prev, cur, diagRun, vertRun);
+      memcpy(prev, cur, W * sizeof(uint64_t));
+    }
+  }
+
+  // Runs reaching the last row stay open for the merge
+  int last = band->row1 - 1;
+  for (int k = 0; k < W; k++)
+    for (uint64_t m = prev[k]; m; m &= m - 1) {
+      int j = 64 * k + __builtin_ctzll(m);
+      int d = diagRun[j - last], v = vertRun[j];
+      int ok = last - d + 1 == band->row0
+                   ? pushRun(&band->head[0], j - last, d, 1)
+                   : pushRun(&band->tail[0], j - last, d, 0);
+      ok &= last - v + 1 == band->row0 ? pushRun(&band->head[1], j, v, 1)
+                                        : pushRun(&band->tail[1], j, v, 0);
+      if (!ok)
+        band->failed = 1;
+    }
+
+done:
+  free(bits);
+  free(prev);
+  free(diagRun);
+  free(vertRun);
+  free(bytes);
+}
+
+static void bandRange(void *ctx, int begin, int end, int thread) {
+  RecurrenceJob *job = ctx;
+  for (int b = begin; b < end; b++)
+    if (job->bands[b].row0 < job->bands[b].row1)
+      processBand(job, &job->bands[b]);
+}
+
+/*
+ *  Join runs of one direction across band boundaries, in band order: a run
+ *  open at the bottom of one band continues into the run touching the top
+ *  of the next at the same index, or else ends at the boundary
+ */
+static int mergeRuns(const Band *bands, int count, int kind, int n,
+                     int minLine, LineStats *stats) {
+  int *carry = calloc(n + 1, sizeof(int));
+  int *active = malloc((n + 1) * sizeof(int)), actives = 0;
+  EdgeRun *through = malloc((n + 1) * sizeof(EdgeRun));
+  int ok = carry && active && through;
+  for (int b = 0; ok && b < count; b++) {
+    const Band *band = &bands[b];
+    if (band->row0 >= band->row1)
+      continue;
+    int throughs = 0;
+    for (int h = 0; h < band->head[kind].count; h++) {
+      const EdgeRun *e = &band->head[kind].runs[h];
+      int total = carry[e->index] + e->length;
+      carry[e->index] = 0;
+      if (e->full)
+        through[throughs++] = (EdgeRun){e->index, total, 1};
+      else
+        addLine(stats, total, minLine);
+    }
+    for (int a = 0; a < actives; a++) {
+      addLine(stats, carry[active[a]], minLine);
+      carry[active[a]] = 0;
+    }
+    actives = 0;
+    for (int t = 0; t < band->tail[kind].count; t++) {
+      const EdgeRun *e = &band->tail[kind].runs[t];
+      carry[e->index] = e->length;
+      active[actives++] = e->index;
+    }
+    for (int t = 0; t < throughs; t++) {
+      carry[through[t].index] = through[t].length;
+      active[actives++] = through[t].index;
+    }
+  }
+  for (int a = 0; ok && a < actives; a++)
+    addLine(stats, carry[active[a]], minLine);
+  free(carry);
+  free(active);
+  free(through);
+  return ok;
+}
+
+static void addStats(LineStats *into, const LineStats *from) {
+  into->lines += from->lines;
+  into->cells += from->cells;
+  if (from->longest > into->longest)
+    into->longest = from->longest;
+}
+
+/*
+ *  Plot density: the bands count the upper triangle, the lower one is its
+ *  mirror. The square root brings out the sparse far-off diagonals.
+ */
+static int renderPlot(const RecurrenceJob *job, int count, Image *img) {
+  int size = job->imageSize;
+  uint64_t *upper = calloc((size_t)size * size, sizeof(uint64_t));
+  if (!upper)
+    return 0;
+  for (int b = 0; b < count; b++) {
+    const Band *band = &job->bands[b];
+    for (size_t k = 0; band->pixels && k < (size_t)band->pixelRows * size; k++)
+      upper[(size_t)band->pixelRow0 * size + k] += band->pixels[k];
+  }
+  uint64_t most = 1;
+  for (int v = 0; v < size; v++)
+    for (int u = v; u < size; u++) {
+      uint64_t c = upper[(size_t)v * size + u] + upper[(size_t)u * size + v];
+      if (c > most)
+        most = c;
+    }
+  for (int v = 0; v < size; v++)
+    for (int u = 0; u < size; u++) {
+      uint64_t c = upper[(size_t)v * size + u] + upper[(size_t)u * size + v];
+      // Time runs up the plot, as in the usual recurrence plot layout
+      unsigned char *rgb = img->rgb + 3 * ((size_t)(size - 1 - v) * size + u);
+      colormap(sqrt((double)c / most), rgb);
+    }
+  free(upper);
+  return 1;
+}
+
+/*
+ *  Recurrence quantification of n points without storing the matrix: row
+ *  bands of the upper triangle are thresholded tile by tile into bitsets and
+ *  swept once for diagonal, vertical and horizontal lines; lines crossing a
+ *  band boundary are joined afterwards. By symmetry horizontal lines of the
+ *  upper triangle are the vertical lines of the lower one. With img set (and
+ *  config->imageSize > 0) a downsampled density plot is also drawn.
+ *  Returns 0 on bad arguments or allocation failure.
+ */
+int recurrenceAnalyze(const Point3D *points, int n,
+                      const RecurrenceConfig *config,
+                      RecurrenceResult *result, Image *img) {
+  memset(result, 0, sizeof(*result));
+  int size = img ? config->imageSize : 0;
+  if (n < 2 || !(config->eps > 0) || config->theiler < 1 ||
+      config->minLine < 1 || size < 0 || size > 65535 ||
+      (size && (img->width != size || img->height != size)))
+    return 0;
+
+  double t0 = wallTime();
+  int W = n / 64 + 1;
+  int count = n < RECURRENCE_BANDS ? n : RECURRENCE_BANDS;
+  float *coords = malloc((size_t)3 * 64 * W * sizeof(float));
+  uint16_t *pixelOf = size ? malloc(n * sizeof(uint16_t)) : NULL;
+  Band *bands = calloc(count, sizeof(Band));
+  int ok = coords && (!size || pixelOf) && bands;
+  if (ok) {
+    float *x = coords, *y = x + 64 * W, *z = y + 64 * W;
+    for (int i = 0; i < 64 * W; i++) {
+      x[i] = i < n ? points[i].x : 1e30f;
+      y[i] = i < n ? points[i].y : 1e30f;
+      z[i] = i < n ? points[i].z : 1e30f;
+    }
+    for (int i = 0; size && i < n; i++)
+      pixelOf[i] = (uint16_t)((long long)i * size / n);
+
+    // Band boundaries giving each band about the same number of pairs
+    double total = 0;
+    for (int i = 0; i < n; i++)
+      total += n - i - config->theiler > 0 ? n - i - config->theiler : 0;
+    double sum = 0;
+    int row = 0;
+    for (int b = 0; b < count; b++) {
+      bands[b].row0 = row;
+      double target = total * (b + 1) / count;
+      while (row < n && (sum < target || b == count - 1)) {
+        sum += n - row - config->theiler > 0 ? n - row - config->theiler : 0;
+        row++;
+      }
+      bands[b].row1 = row;
+      if (size && row > bands[b].row0) {
+        bands[b].pixelRow0 = pixelOf[bands[b].row0];
+        bands[b].pixelRows = pixelOf[row - 1] - bands[b].pixelRow0 + 1;
+        bands[b].pixels =
+            calloc((size_t)bands[b].pixelRows * size, sizeof(uint64_t));
+        ok &= bands[b].pixels != NULL;
+      }
+    }
+  }
+
+  RecurrenceJob job = {NULL, NULL, NULL, n, W, config,
+                       (float)(config->eps * config->eps), size, pixelOf,
+                       bands};
+  if (ok) {
+    job.x = coords;
+    job.y = coords + 64 * W;
+    job.z = coords + 128 * W;
+    parallelFor(count, bandRange, &job);
+  }
+
+  LineStats diag = {0, 0, 0}, vert = {0, 0, 0};
+  long long recurrent = 0;
+  for (int b = 0; ok && b < count; b++) {
+    ok &= !bands[b].failed;
+    recurrent += bands[b].recurrent;
+    addStats(&diag, &bands[b].diag);
+    addStats(&vert, &bands[b].vert);
+    addStats(&vert, &bands[b].horiz);
+  }
+  ok = ok && mergeRuns(bands, count, 0, n, config->minLine, &diag) &&
+       mergeRuns(bands, count, 1, n, config->minLine, &vert);
+  if (ok && size)
+    ok = renderPlot(&job, count, img);
+
+  if (ok) {
+    // Counted pairs: the full matrix less the Theiler band |i - j| < w
+    double m = n - config->theiler > 0 ? n - config->theiler : 0;
+    result->recurrent = 2 * recurrent;
+    result->rate = m > 0 ? 2.0 * recurrent / (m * (m + 1)) : 0.0;
+    result->determinism = recurrent ? (double)diag.cells / recurrent : 0.0;
+    result->laminarity = recurrent ? vert.cells / (2.0 * recurrent) : 0.0;
+    result->meanDiagonal = diag.lines ? (double)diag.cells / diag.lines : 0.0;
+    result->trappingTime = vert.lines ? (double)vert.cells / vert.lines : 0.0;
+    result->longestDiagonal = diag.longest;
+  }
+  result->seconds = wallTime() - t0;
+
+  for (int b = 0; bands && b < count; b++) {
+    for (int k = 0; k < 2; k++) {
+      free(bands[b].head[k].runs);
+      free(bands[b].tail[k].runs);
+    }
+    free(bands[b].pixels);
+  }
+  free(bands);
+  free(pixelOf);
+  free(coords);
+  return ok;
+}
+
+/*
+ *  recurrence [N [eps [file.ppm]]]: quantify N attractor points sampled
+ *  every 0.1 time units and export the downsampled recurrence plot
+ */
+int recurrenceCommand(int argc, char *argv[]) {
+  int n = argc > 1 ? atoi(argv[1]) : 200000;
+  double eps = argc > 2 ? atof(argv[2]) : 2.0;
+  const char *path = argc > 3 ? argv[3] : "recurrence.ppm";
+  if (n < 2 || !(eps > 0)) {
+    fprintf(stderr, "recurrence: need N >= 2 and eps > 0\n");
+    return 1;
+  }
+
+  RecurrenceConfig config = {eps, 1, 2, n < 1024 ? n : 1024};
+  Point3D *points = malloc(n * sizeof(Point3D));
+  Image img;
+  if (!points || !imageInit(&img, config.imageSize, config.imageSize)) {
+    fprintf(stderr, "recurrence: cannot allocate %d points\n", n);
+    free(points);
+    return 1;
+  }
+  double s = 10.0, b = 2.6666, r = 28.0, x = 1, y = 1, z = 1;
+  for (int i = 0; i < 10000; i++)
+    lorenzStep(s, b, r, 0.01, &x, &y, &z);
+  for (int i = 0; i < n; i++) {
+    for (int k = 0; k < 10; k++)
+      lorenzStep(s, b, r, 0.01, &x, &y, &z);
+    points[i] = (Point3D){x, y, z};
+  }
+
+  RecurrenceResult res;
+  int ok = recurrenceAnalyze(points, n, &config, &res, &img);
+  if (ok)
+    ok = imageWritePPM(&img, path);
+  if (ok) {
+    double pairs = (double)(n - 1) * n / 2;
+    printf("Recurrence N=%d eps=%.3g (Theiler %d, lmin %d), threads=%d: "
+           "%.3f s (%.3e pairs/s) -> %s\n",
+           n, eps, config.theiler, config.minLine, parallelThreads(),
+           res.seconds, pairs / res.seconds, path);
+    printf("RR=%.5f DET=%.5f LAM=%.5f L=%.3f Lmax=%d TT=%.3f\n", res.rate,
+           res.determinism, res.laminarity, res.meanDiagonal,
+           res.longestDiagonal, res.trappingTime);
+  } else
+    fprintf(stderr, "recurrence: analysis failed\n");
+  free(points);
+  imageFree(&img);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+#ifndef RECURRENCE_H
+#define RECURRENCE_H
+
+#include "image.h"
+#include "state.h"
+
+// Recurrence plot R_ij = |p_i - p_j| < eps and its quantification
+typedef struct {
+  double eps;    // Recurrence threshold (Euclidean distance)
+  int theiler;   // Pairs with |i - j| < theiler are excluded
+  int minLine;   // Shortest diagonal or vertical line counted
+  int imageSize; // Side of the downsampled plot, 0 for none
+} RecurrenceConfig;
+
+typedef struct {
+  long long recurrent;  // Recurrent pairs in the full matrix
+  double rate;          // RR: recurrent fraction of the counted pairs
+  double determinism;   // DET: recurrent points on diagonal lines
+  double laminarity;    // LAM: recurrent points on vertical lines
+  double meanDiagonal;  // L: mean diagonal line length
+  double trappingTime;  // TT: mean vertical line length
+  int longestDiagonal;  // L_max
+  double seconds;       // Wall time
+} RecurrenceResult;
+
+int recurrenceAnalyze(const Point3D *points, int n,
+                      const RecurrenceConfig *config,
+                      RecurrenceResult *result, Image *img);
+int recurrenceCommand(int argc, char *argv[]);
+
+#endif // RECURRENCE_H
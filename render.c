@@ -0,0 +1,384 @@
+#include "render.h"
+#include "color.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include "trace.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RENDER_BAND 16  // Rows rasterized by one task
+
+// Axes as the viewer draws them, in light gray
+static const Point3D axes[6] = {{-30, 0, 0}, {20, 0, 0},  {0, -20, 0},
+                                {0, 20, 0},  {0, 0, -10}, {0, 0, 40}};
+static const unsigned char axisColor[3] = {204, 204, 204};
+
+// One frame being rasterized
+typedef struct {
+  const Point3D *points;
+  int count;
+  const unsigned char *colors;
+  float *screen;  // x, y in pixels and depth per point, then the axes
+  double m[6];    // First two rows of the view rotation
+  double m2[3];   // Its third row, towards the viewer
+  double sx, sy;  // Pixels per unit
+  Image *img;
+  float *depth;
+} RasterTask;
+
+// Renderer and writer thread with the bounded queue of frames between them
+typedef struct {
+  const RenderConfig *config;
+  Image slots[RENDER_QUEUE];
+  FILE *y4m;              // Y4M stream, or NULL for numbered PPM files
+  const char *path;
+  unsigned char *yuv;     // One 4:2:0 frame for the writer
+  RenderStats *stats;
+
+  // Everything below is guarded by lock
+  pthread_mutex_t lock;
+  pthread_cond_t ready;   // A frame was queued or rendering finished
+  pthread_cond_t freed;   // The writer released a slot
+  int head, count;        // Queued frames: slots head .. head + count - 1
+  int finished;           // No more frames will be queued
+  int ok;
+} Pipeline;
+
+/*
+ *  The viewer's glRotated(ph, 1, 0, 0) then glRotated(th, 0, 1, 0) and
+ *  glOrtho(-asp dim, asp dim, -dim, dim, -100, 100), ending in pixels
+ *  with rows top to bottom and depth growing away from the viewer
+ */
+static void projectPoint(const RasterTask *t, const Point3D *p, float *out) {
+  double x = t->m[0] * p->x + t->m[1] * p->y + t->m[2] * p->z;
+  double y = t->m[3] * p->x + t->m[4] * p->y + t->m[5] * p->z;
+  double z = t->m2[0] * p->x + t->m2[1] * p->y + t->m2[2] * p->z;
+  out[0] = (float)(0.5 * t->img->width + t->sx * x);
+  out[1] = (float)(0.5 * t->img->height - t->sy * y);
+  out[2] = (float)-z;
+}
+
+static void projectBlocks(void *ctx, int begin, int end, int thread) {
+  const RasterTask *t = ctx;
+  int i1 = end * 4096 < t->count ? end * 4096 : t->count;
+  for (int i = begin * 4096; i < i1; i++)
+    projectPoint(t, &t->points[i], t->screen + 3 * (size_t)i);
+}
+
+/*
+ *  DDA line from a to b, keeping only the pixels in rows [y0, y1) that are
+ *  nearer than what is there
+ */
+static void drawSegment(const RasterTask *t, int y0, int y1, const float *a,
+                        const float *b, const unsigned char *rgb) {
+  if (fmaxf(a[1], b[1]) < y0 || fminf(a[1], b[1]) >= y1)
+    return;
+  float dx = b[0] - a[0], dy = b[1] - a[1], dz = b[2] - a[2];
+  int steps = (int)ceilf(fmaxf(fabsf(dx), fabsf(dy)));
+  if (steps < 1)
+    steps = 1;
+  if (steps > 1 << 16) // Off-screen projection of a far point
+    return;
+  int width = t->img->width;
+  for (int s = 0; s <= steps; s++) {
+    float f = (float)s / steps;
+    int px = (int)floorf(a[0] + f * dx), py = (int)floorf(a[1] + f * dy);
+    if (py < y0 || py >= y1 || px < 0 || px >= width)
+      continue;
+    size_t p = (size_t)py * width + px;
+    float d = a[2] + f * dz;
+    if (d < t->depth[p]) {
+      t->depth[p] = d;
+      memcpy(t->img->rgb + 3 * p, rgb, 3);
+    }
+  }
+}
+
+/*
+ *  Clear a band of rows and draw every segment that crosses it; bands are
+ *  disjoint so they need no locking
+ */
+static void rasterBands(void *ctx, int begin, int end, int thread) {
+  const RasterTask *t = ctx;
+  int width = t->img->width, height = t->img->height;
+  for (int band = begin; band < end; band++) {
+    int y0 = band * RENDER_BAND;
+    int y1 = y0 + RENDER_BAND < height ? y0 + RENDER_BAND : height;
+    memset(t->img->rgb + 3 * (size_t)y0 * width, 0,
+           3 * (size_t)(y1 - y0) * width);
+    for (size_t p = (size_t)y0 * width; p < (size_t)y1 * width; p++)
+      t->depth[p] = INFINITY;
+    const float *axis = t->screen + 3 * (size_t)t->count;
+    for (int k = 0; k < 3; k++)
+      drawSegment(t, y0, y1, axis + 6 * k, axis + 6 * k + 3, axisColor);
+    for (int i = 1; i < t->count; i++)
+      drawSegment(t, y0, y1, t->screen + 3 * (size_t)(i - 1),
+                  t->screen + 3 * (size_t)i, t->colors + 3 * (size_t)(i - 1));
+  }
+}
+
+void renderDefaultConfig(RenderConfig *config) {
+  config->width = 1280;
+  config->height = 720;
+  config->frames = 120;
+  config->th = 0;
+  config->ph = 15;
+  config->turn = 360.0 / config->frames;
+  config->tilt = 0;
+  config->dim = 60.0;
+  config->colorMode = COLOR_FADE;
+  config->reveal = 1;
+  config->fps = 30;
+}
+
+/*
+ *  Rasterize the first `count` points as a line strip, with the axes, at
+ *  azimuth th and elevation ph; depth is a width * height scratch buffer
+ */
+void renderFrame(const RenderConfig *config, const Point3D *points, int count,
+                 const unsigned char *colors, double th, double ph,
+                 Image *img, float *depth) {
+  RasterTask t = {points, count, colors, NULL};
+  t.screen = malloc(3 * ((size_t)count + 6) * sizeof(float));
+  if (!t.screen)
+    return;
+  double a = th * M_PI / 180, e = ph * M_PI / 180;
+  double ca = cos(a), sa = sin(a), ce = cos(e), se = sin(e);
+  double rows[9] = {ca, 0, sa, se * sa, ce, -se * ca, -ce * sa, se, ce * ca};
+  memcpy(t.m, rows, sizeof(t.m));
+  memcpy(t.m2, rows + 6, sizeof(t.m2));
+  t.sy = 0.5 * img->height / config->dim;
+  t.sx = t.sy; // Square pixels: the x range grows with the aspect
+  t.img = img;
+  t.depth = depth;
+  parallelFor((count + 4095) / 4096, projectBlocks, &t);
+  for (int k = 0; k < 6; k++)
+    projectPoint(&t, &axes[k], t.screen + 3 * ((size_t)count + k));
+  parallelFor((img->height + RENDER_BAND - 1) / RENDER_BAND, rasterBands, &t);
+  free(t.screen);
+}
+
+/*
+ *  Full-range BT.601 4:2:0, chroma averaged over 2x2 blocks
+ */
+static void toYuv(const Image *img, unsigned char *yuv) {
+  int w = img->width, h = img->height;
+  unsigned char *cb = yuv + (size_t)w * h, *cr = cb + (size_t)w * h / 4;
+  for (size_t p = 0; p < (size_t)w * h; p++) {
+    const unsigned char *c = img->rgb + 3 * p;
+    yuv[p] = (unsigned char)((19595 * c[0] + 38470 * c[1] + 7471 * c[2] +
+                              32768) >> 16);
+  }
+  for (int y = 0; y < h; y += 2)
+    for (int x = 0; x < w; x += 2) {
+      int r = 0, g = 0, b = 0;
+      for (int k = 0; k < 4; k++) {
+        const unsigned char *c =
+            img->rgb + 3 * ((size_t)(y + k / 2) * w + x + k % 2);
+        r += c[0];
+        g += c[1];
+        b += c[2];
+      }
+      size_t q = (size_t)(y / 2) * (w / 2) + x / 2;
+      cb[q] = (unsigned char)((-11059 * r - 21709 * g + 32768 * b +
+                               (128 << 18) + (1 << 17)) >> 18);
+      cr[q] = (unsigned char)((32768 * r - 27439 * g - 5329 * b +
+                               (128 << 18) + (1 << 17)) >> 18);
+    }
+}
+
+static int writeFrame(Pipeline *p, const Image *img, int index) {
+  if (!p->y4m) {
+    const char *dot = strrchr(p->path, '.');
+    int stem = dot ? (int)(dot - p->path) : (int)strlen(p->path);
+    char name[4096];
+    snprintf(name, sizeof(name), "%.*s_%05d%s", stem, p->path, index,
+             dot ? dot : ".ppm");
+    return imageWritePPM(img, name);
+  }
+  size_t size = (size_t)img->width * img->height * 3 / 2;
+  toYuv(img, p->yuv);
+  return fputs("FRAME\n", p->y4m) >= 0 &&
+         fwrite(p->yuv, 1, size, p->y4m) == size;
+}
+
+static void *writerMain(void *arg) {
+  Pipeline *p = arg;
+  pthread_mutex_lock(&p->lock);
+  for (int index = 0;; index++) {
+    double t0 = wallTime();
+    while (p->count == 0 && !p->finished)
+      pthread_cond_wait(&p->ready, &p->lock);
+    p->stats->writeWait += wallTime() - t0;
+    if (p->count == 0)
+      break;
+    const Image *img = &p->slots[p->head];
+    pthread_mutex_unlock(&p->lock);
+    t0 = wallTime();
+    int ok = writeFrame(p, img, index);
+    double busy = wallTime() - t0;
+    if (traceEnabled)
+      traceSpan("write frame", t0, t0 + busy);
+    pthread_mutex_lock(&p->lock);
+    p->stats->write += busy;
+    if (ok)
+      p->stats->frames++;
+    else
+      p->ok = 0;
+    p->head = (p->head + 1) % RENDER_QUEUE;
+    p->count--;
+    pthread_cond_signal(&p->freed);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+/*
+ *  Render config->frames frames of the first `total` points and write them
+ *  as one Y4M stream (path ending in .y4m) or as numbered PPM files,
+ *  rendering each frame while the writer thread stores earlier ones;
+ *  returns 0 on failure
+ */
+int renderSequence(const RenderConfig *config, const Point3D *points,
+                   int total, const char *path, RenderStats *stats) {
+  Pipeline p = {config};
+  memset(stats, 0, sizeof(*stats));
+  p.path = path;
+  p.stats = stats;
+  p.ok = 1;
+  const char *dot = strrchr(path, '.');
+  int y4m = dot && !strcmp(dot, ".y4m");
+  if (config->width < 2 || config->height < 2 || config->width % 2 ||
+      config->height % 2 || config->frames < 1 || total < 1)
+    return 0;
+
+  size_t pixels = (size_t)config->width * config->height;
+  float *depth = malloc(pixels * sizeof(float));
+  unsigned char *colors = malloc(3 * (size_t)total);
+  int ok = depth && colors;
+  for (int k = 0; k < RENDER_QUEUE; k++)
+    ok = imageInit(&p.slots[k], config->width, config->height) && ok;
+  if (ok && y4m) {
+    p.yuv = malloc(pixels * 3 / 2);
+    p.y4m = p.yuv ? fopen(path, "wb") : NULL;
+    ok = p.y4m && fprintf(p.y4m, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+                          config->width, config->height, config->fps) > 0;
+  }
+  pthread_t writer;
+  pthread_mutex_init(&p.lock, NULL);
+  pthread_cond_init(&p.ready, NULL);
+  pthread_cond_init(&p.freed, NULL);
+  ok = ok && !pthread_create(&writer, NULL, writerMain, &p);
+
+  if (ok) {
+    colorFill(config->colorMode, total, colors);
+    double start = wallTime();
+    for (int f = 0; f < config->frames; f++) {
+      pthread_mutex_lock(&p.lock);
+      double t0 = wallTime();
+      while (p.count == RENDER_QUEUE)
+        pthread_cond_wait(&p.freed, &p.lock);
+      stats->renderWait += wallTime() - t0;
+      int slot = (p.head + p.count) % RENDER_QUEUE, writing = p.ok;
+      pthread_mutex_unlock(&p.lock);
+      if (!writing)
+        break;
+
+      // The slot is outside the queued range, so the writer leaves it be
+      t0 = wallTime();
+      long long count = config->reveal
+                            ? (long long)total * (f + 1) / config->frames
+                            : total;
+      renderFrame(config, points, (int)count, colors,
+                  config->th + f * config->turn, config->ph + f * config->tilt,
+                  &p.slots[slot], depth);
+      stats->render += wallTime() - t0;
+      if (traceEnabled)
+        traceSpan("render frame", t0, wallTime());
+
+      pthread_mutex_lock(&p.lock);
+      p.count++;
+      pthread_cond_signal(&p.ready);
+      pthread_mutex_unlock(&p.lock);
+    }
+    pthread_mutex_lock(&p.lock);
+    p.finished = 1;
+    pthread_cond_signal(&p.ready);
+    pthread_mutex_unlock(&p.lock);
+    pthread_join(writer, NULL);
+    stats->seconds = wallTime() - start;
+    ok = p.ok && stats->frames == config->frames;
+  }
+
+  if (p.y4m && fclose(p.y4m) != 0)
+    ok = 0;
+  pthread_cond_destroy(&p.freed);
+  pthread_cond_destroy(&p.ready);
+  pthread_mutex_destroy(&p.lock);
+  for (int k = 0; k < RENDER_QUEUE; k++)
+    imageFree(&p.slots[k]);
+  free(p.yuv);
+  free(colors);
+  free(depth);
+  return ok;
+}
+
+/*
+ *  render file.y4m|file.ppm [frames [width [height [tilt]]]]: a turntable
+ *  of the viewer's default trajectory, drawn in as it turns; its elevation
+ *  changes by tilt degrees overall, a tilt / frames step per frame
+ */
+int renderCommand(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "render: need a .y4m file or a .ppm name pattern\n");
+    return 1;
+  }
+  RenderConfig config;
+  renderDefaultConfig(&config);
+  if (argc > 2)
+    config.frames = atoi(argv[2]);
+  if (argc > 3)
+    config.width = atoi(argv[3]);
+  if (argc > 4)
+    config.height = atoi(argv[4]);
+  double tilt = argc > 5 ? atof(argv[5]) : 0; // Elevation change overall
+  if (config.frames < 1 || config.width < 2 || config.height < 2 ||
+      config.width % 2 || config.height % 2) {
+    fprintf(stderr, "render: need frames >= 1 and even sizes >= 2\n");
+    return 1;
+  }
+  config.turn = 360.0 / config.frames;
+  config.tilt = tilt / config.frames;
+
+  State *state = calloc(1, sizeof(State));
+  if (!state) {
+    fprintf(stderr, "render: cannot allocate the trajectory\n");
+    return 1;
+  }
+  state->s = 10.0;
+  state->b = 2.6666;
+  state->r = 28.0;
+  computeLorenzPoints(state);
+
+  RenderStats stats;
+  int ok = renderSequence(&config, state->points, LORENZ_POINTS, argv[1],
+                          &stats);
+  free(state);
+  if (!ok) {
+    fprintf(stderr, "render: cannot write %s\n", argv[1]);
+    return 1;
+  }
+  printf("Render: %d frames of %dx%d in %.3f s (%.1f fps), threads=%d\n",
+         stats.frames, config.width, config.height, stats.seconds,
+         stats.frames / stats.seconds, parallelThreads());
+  printf("Per frame: render %.2f ms, write %.2f ms; renderer waited %.3f s "
+         "for the writer, writer waited %.3f s for frames\n",
+         1e3 * stats.render / stats.frames, 1e3 * stats.write / stats.frames,
+         stats.renderWait, stats.writeWait);
+  printf("Limited by %s\n",
+         stats.render >= stats.write ? "rendering" : "writing");
+  return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "image.h"
+#include "state.h"
+
+// Finished frames that may wait for the writer thread
+#define RENDER_QUEUE 4
+
+// Offscreen turntable of the trajectory as the viewer draws it: the view
+// turns by `turn` degrees of azimuth and `tilt` degrees of elevation each
+// frame and, with reveal set, the trajectory is drawn in over the sequence
+// like the viewer's animation
+typedef struct {
+  int width, height; // Even, for 4:2:0 chroma in Y4M
+  int frames;
+  double th, ph;     // View angles of the first frame
+  double turn;       // Azimuth step per frame
+  double tilt;       // Elevation step per frame
+  double dim;        // Half height of the view box
+  int colorMode;
+  int reveal;
+  int fps;           // Frame rate recorded in the Y4M header
+} RenderConfig;
+
+// Where a sequence spent its time; the waits show which stage limits it
+typedef struct {
+  double seconds;    // Whole sequence
+  double render;     // Rasterizing
+  double write;      // Converting and writing
+  double renderWait; // Renderer blocked on a full queue
+  double writeWait;  // Writer blocked on an empty queue
+  int frames;        // Frames written
+} RenderStats;
+
+void renderDefaultConfig(RenderConfig *config);
+void renderFrame(const RenderConfig *config, const Point3D *points, int count,
+                 const unsigned char *colors, double th, double ph,
+                 Image *img, float *depth);
+int renderSequence(const RenderConfig *config, const Point3D *points,
+                   int total, const char *path, RenderStats *stats);
+int renderCommand(int argc, char *argv[]);
+
+#endif // RENDER_H
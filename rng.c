@@ -0,0 +1,179 @@
+#include "rng.h"
+#include "simd.h"
+#include <math.h>
+#include <string.h>
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+  uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int round = 0; round < PHILOX_ROUNDS; round++) {
+    uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+    uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+    c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t)p1;
+    c3 = (uint32_t)p0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+/*
+ *  Map 32 random bits to the open interval (0, 1)
+ */
+static inline double toUniform(uint32_t u) {
+  return ((double)(int32_t)(u ^ 0x80000000u) + 2147483648.5) *
+         (1.0 / 4294967296.0);
+}
+
+/*
+ *  ln(v) for v in (0, 1]: exponent split by bit manipulation, then the atanh
+ *  series on a mantissa in [sqrt(1/2), sqrt(2)); branch-free so it vectorizes
+ */
+static inline double fastLog(double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  uint64_t mant = bits & 0x000FFFFFFFFFFFFFull;
+  // 1 when the mantissa is at least sqrt(2), by carry into bit 52
+  uint64_t high = (mant + (0x0010000000000000ull - 0x6A09E667F3BCDull)) >> 52;
+  uint64_t e = (bits >> 52) + high;
+  bits = mant | ((0x3FFull - high) << 52);
+  double m;
+  memcpy(&m, &bits, sizeof(m));
+
+  // Exponent to double via the 2^52 magic constant
+  uint64_t eb = e | 0x4330000000000000ull;
+  double ed;
+  memcpy(&ed, &eb, sizeof(ed));
+  ed -= 4503599627370496.0 + 1023.0;
+
+  double f = (m - 1.0) / (m + 1.0), f2 = f * f;
+  double series =
+      1.0 + f2 * (1.0 / 3 + f2 * (1.0 / 5 + f2 * (1.0 / 7 + f2 * (1.0 / 9 +
+                 f2 * (1.0 / 11 + f2 * (1.0 / 13 + f2 * (1.0 / 15)))))));
+  return 2.0 * f * series + ed * M_LN2;
+}
+
+/*
+ *  sin and cos of 2*pi*u: reduce to an octant around a quadrant multiple,
+ *  evaluate Taylor polynomials on [-pi/4, pi/4] and rotate by the quadrant
+ */
+static inline void fastSinCos2Pi(double u, double *sn, double *cs) {
+  const double magic = 6755399441055744.0; // 1.5 * 2^52, rounds to integer
+  double qd = (4.0 * u + magic) - magic;
+  double q4 = 4.0 * u + magic;
+  uint64_t qbits;
+  memcpy(&qbits, &q4, sizeof(qbits));
+  uint64_t q = qbits & 3;
+  double a = 2.0 * M_PI * (u - 0.25 * qd), a2 = a * a;
+
+  // Taylor coefficients as constant products, so no divisions are emitted
+  double sa = a * (1.0 + a2 * (-1.0 / 6 + a2 * (1.0 / 120 + a2 * (-1.0 / 5040 +
+                  a2 * (1.0 / 362880 + a2 * (-1.0 / 39916800))))));
+  double ca = 1.0 + a2 * (-1.0 / 2 + a2 * (1.0 / 24 + a2 * (-1.0 / 720 +
+                  a2 * (1.0 / 40320 + a2 * (-1.0 / 3628800 +
+                  a2 * (1.0 / 479001600))))));
+
+  // Odd quadrants swap sin and cos, then the signs follow the quadrant
+  uint64_t odd = 0 - (q & 1), sb, cb, sab, cab;
+  memcpy(&sab, &sa, sizeof(sab));
+  memcpy(&cab, &ca, sizeof(cab));
+  sb = ((sab & ~odd) | (cab & odd)) ^ ((q & 2) << 62);
+  cb = ((cab & ~odd) | (sab & odd)) ^ (((q + 1) & 2) << 62);
+  double s, c;
+  memcpy(&s, &sb, sizeof(s));
+  memcpy(&c, &cb, sizeof(c));
+  *sn = s;
+  *cs = c;
+}
+
+/*
+ *  sqrt(v) for v > 0: a bit-trick estimate of 1/sqrt(v), four Newton steps
+ *  to full precision, then times v. libm's sqrt sets errno, which keeps a
+ *  loop calling it from vectorizing.
+ */
+static inline double fastSqrt(double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  bits = 0x5FE6EB50C7B537A9ull - (bits >> 1);
+  double y;
+  memcpy(&y, &bits, sizeof(y));
+  for (int i = 0; i < 4; i++)
+    y *= 1.5 - 0.5 * v * y * y;
+  return v * y;
+}
+
+/*
+ *  Stream j uses key (stream + j, seed low word) and counter (counter + b,
+ *  seed high word, 0) for block b. Each lane keeps its ten rounds in
+ *  registers, so the loop over lanes vectorizes; Box-Muller then turns the
+ *  block's two pairs of uniforms into four normals in a second vectorized
+ *  loop.
+ */
+SIMD_CLONES
+void philoxNormalBlocks(uint64_t seed, uint32_t stream, uint64_t counter,
+                        int blocks, int lanes, double *out) {
+  uint32_t c0[RNG_BATCH], c1[RNG_BATCH], c2[RNG_BATCH], c3[RNG_BATCH];
+
+  for (int b = 0; b < blocks; b++)
+    for (int base = 0; base < lanes; base += RNG_BATCH) {
+      int count = lanes - base < RNG_BATCH ? lanes - base : RNG_BATCH;
+      uint64_t ctr = counter + (uint64_t)b;
+      for (int j = 0; j < count; j++) {
+        uint32_t x0 = (uint32_t)ctr, x1 = (uint32_t)(ctr >> 32);
+        uint32_t x2 = (uint32_t)(seed >> 32), x3 = 0;
+        uint32_t k0 = stream + (uint32_t)(base + j), k1 = (uint32_t)seed;
+        for (int round = 0; round < PHILOX_ROUNDS; round++) {
+          uint64_t p0 = (uint64_t)PHILOX_M0 * x0;
+          uint64_t p1 = (uint64_t)PHILOX_M1 * x2;
+          x0 = (uint32_t)(p1 >> 32) ^ x1 ^ k0;
+          x2 = (uint32_t)(p0 >> 32) ^ x3 ^ k1;
+          x1 = (uint32_t)p1;
+          x3 = (uint32_t)p0;
+          k0 += PHILOX_W0;
+          k1 += PHILOX_W1;
+        }
+        c0[j] = x0;
+        c1[j] = x1;
+        c2[j] = x2;
+        c3[j] = x3;
+      }
+
+      double *o = out + 4 * (size_t)b * lanes + base;
+      for (int j = 0; j < count; j++) {
+        double s0, co0, s1, co1;
+        double r0 = fastSqrt(-2.0 * fastLog(toUniform(c0[j])));
+        double r1 = fastSqrt(-2.0 * fastLog(toUniform(c2[j])));
+        fastSinCos2Pi(toUniform(c1[j]), &s0, &co0);
+        fastSinCos2Pi(toUniform(c3[j]), &s1, &co1);
+        o[j] = r0 * co0;
+        o[lanes + j] = r0 * s0;
+        o[2 * lanes + j] = r1 * co1;
+        o[3 * lanes + j] = r1 * s1;
+      }
+    }
+}
+
+void philoxNormals(uint64_t seed, uint32_t stream, uint64_t counter, int lanes,
+                   double *out) {
+  philoxNormalBlocks(seed, stream, counter, 1, lanes, out);
+}
+
+double philoxUniform(uint64_t seed, uint32_t stream, uint64_t counter) {
+  uint32_t ctr[4] = {(uint32_t)counter, (uint32_t)(counter >> 32),
+                     (uint32_t)(seed >> 32), 0};
+  uint32_t key[2] = {stream, (uint32_t)seed};
+  uint32_t out[4];
+  philox4x32(ctr, key, out);
+  return toUniform(out[0]);
+}
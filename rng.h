@@ -0,0 +1,26 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// Lanes generated together by the batched routines
+#define RNG_BATCH 64
+
+// Counter-based Philox4x32-10: the output depends only on (key, counter),
+// so every stream can be evaluated anywhere without shared state
+void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]);
+
+// Four standard normals for each of `lanes` consecutive streams starting at
+// `stream`, at position `counter`; written as out[k * lanes + lane]
+void philoxNormals(uint64_t seed, uint32_t stream, uint64_t counter, int lanes,
+                   double *out);
+
+// The same for `blocks` consecutive positions from `counter`: normal k of
+// block b goes to out[(4 * b + k) * lanes + lane]
+void philoxNormalBlocks(uint64_t seed, uint32_t stream, uint64_t counter,
+                        int blocks, int lanes, double *out);
+
+// Single uniform in (0, 1) for scalar use
+double philoxUniform(uint64_t seed, uint32_t stream, uint64_t counter);
+
+#endif // RNG_H
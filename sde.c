@@ -0,0 +1,208 @@
+#include "sde.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include "rng.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Members integrated together; fixed so results never depend on threading
+#define SDE_BLOCK RNG_BATCH
+
+// Steps whose noise is drawn at once: 3 normals a step, so 4 steps use
+// every normal of 3 Philox blocks
+#define SDE_GROUP 4
+#define SDE_GROUP_BLOCKS 3
+
+typedef struct {
+  const SdeParams *params;
+  int members;
+  int steps;
+  double *x;
+  double *y;
+  double *z;
+} EnsembleJob;
+
+/*
+ *  Advance `count` lanes by one step given their normals noise[k * count + j]
+ */
+static void stepLanes(const SdeParams *p, int count, double *restrict x,
+                      double *restrict y, double *restrict z,
+                      const double *restrict noise) {
+  double s = p->s, b = p->b, r = p->r, dt = p->dt;
+  double amp = p->sigma * sqrt(dt);
+  const double *nx = noise, *ny = noise + count, *nz = noise + 2 * count;
+
+  if (p->scheme == SDE_HEUN) {
+    for (int j = 0; j < count; j++) {
+      double dx = s * (y[j] - x[j]);
+      double dy = x[j] * (r - z[j]) - y[j];
+      double dz = x[j] * y[j] - b * z[j];
+      double px = x[j] + dt * dx + amp * nx[j];
+      double py = y[j] + dt * dy + amp * ny[j];
+      double pz = z[j] + dt * dz + amp * nz[j];
+      x[j] += 0.5 * dt * (dx + s * (py - px)) + amp * nx[j];
+      y[j] += 0.5 * dt * (dy + px * (r - pz) - py) + amp * ny[j];
+      z[j] += 0.5 * dt * (dz + px * py - b * pz) + amp * nz[j];
+    }
+  } else {
+    for (int j = 0; j < count; j++) {
+      double dx = s * (y[j] - x[j]);
+      double dy = x[j] * (r - z[j]) - y[j];
+      double dz = x[j] * y[j] - b * z[j];
+      x[j] += dt * dx + amp * nx[j];
+      y[j] += dt * dy + amp * ny[j];
+      z[j] += dt * dz + amp * nz[j];
+    }
+  }
+}
+
+/*
+ *  Integrate whole blocks of members; block boundaries are the same for any
+ *  thread count and each member only reads its own Philox stream. Normal
+ *  3k + c of a member's stream drives component c at step k, so steps
+ *  4g..4g+3 take the 12 normals of blocks 3g..3g+2 in order.
+ */
+static void ensembleRange(void *ctx, int begin, int end, int thread) {
+  const EnsembleJob *job = ctx;
+  double bx[SDE_BLOCK], by[SDE_BLOCK], bz[SDE_BLOCK];
+  double noise[4 * SDE_GROUP_BLOCKS * SDE_BLOCK];
+
+  for (int block = begin; block < end; block++) {
+    int first = block * SDE_BLOCK;
+    int count = job->members - first < SDE_BLOCK ? job->members - first
+                                                 : SDE_BLOCK;
+    memcpy(bx, job->x + first, count * sizeof(double));
+    memcpy(by, job->y + first, count * sizeof(double));
+    memcpy(bz, job->z + first, count * sizeof(double));
+    for (int k = 0; k < job->steps; k++) {
+      if (k % SDE_GROUP == 0)
+        philoxNormalBlocks(job->params->seed, (uint32_t)first,
+                           (uint64_t)(k / SDE_GROUP) * SDE_GROUP_BLOCKS,
+                           SDE_GROUP_BLOCKS, count, noise);
+      stepLanes(job->params, count, bx, by, bz,
+                noise + 3 * (k % SDE_GROUP) * count);
+    }
+    memcpy(job->x + first, bx, count * sizeof(double));
+    memcpy(job->y + first, by, count * sizeof(double));
+    memcpy(job->z + first, bz, count * sizeof(double));
+  }
+}
+
+/*
+ *  Advance every member of the ensemble (SoA arrays, updated in place)
+ */
+void sdeEnsemble(const SdeParams *params, int members, int steps, double *x,
+                 double *y, double *z) {
+  EnsembleJob job = {params, members, steps, x, y, z};
+  parallelFor((members + SDE_BLOCK - 1) / SDE_BLOCK, ensembleRange, &job);
+}
+
+/*
+ *  Same start and step as computeLorenzPoints with Euler-Maruyama noise of
+ *  amplitude state->noise; member 0 of seed state->seed is drawn
+ */
+void computeStochasticLorenzPoints(State *state) {
+  if (!state) return;
+
+  SdeParams p = {state->s,  state->b,           state->r,   state->noise,
+                 LORENZ_DT, SDE_EULER_MARUYAMA, state->seed};
+  double x = 1.0, y = 1.0, z = 1.0;
+  double noise[4 * SDE_GROUP_BLOCKS];
+
+  for (int i = 0; i < LORENZ_POINTS; i++) {
+    if (i % SDE_GROUP == 0)
+      philoxNormalBlocks(p.seed, 0,
+                         (uint64_t)(i / SDE_GROUP) * SDE_GROUP_BLOCKS,
+                         SDE_GROUP_BLOCKS, 1, noise);
+    stepLanes(&p, 1, &x, &y, &z, noise + 3 * (i % SDE_GROUP));
+    state->points[i].x = x;
+    state->points[i].y = y;
+    state->points[i].z = z;
+  }
+}
+
+/*
+ *  Run an ensemble from a fixed start and return the wall time
+ */
+static double timeEnsemble(const SdeParams *p, int members, int steps,
+                           double *x, double *y, double *z) {
+  for (int m = 0; m < members; m++) {
+    x[m] = 1.0;
+    y[m] = 1.0;
+    z[m] = 1.0;
+  }
+  double t0 = wallTime();
+  sdeEnsemble(p, members, steps, x, y, z);
+  return wallTime() - t0;
+}
+
+/*
+ *  sde [members [steps [sigma [heun]]]]: ensemble throughput, noise cost and a
+ *  check that the result is bit-identical with a single thread
+ */
+int sdeBenchmark(int argc, char *argv[]) {
+  int members = argc > 1 ? atoi(argv[1]) : 10000;
+  int steps = argc > 2 ? atoi(argv[2]) : 1000;
+  SdeParams p = {10.0,  2.6666, 28.0, argc > 3 ? atof(argv[3]) : 1.0, 0.001,
+                 argc > 4 && !strcmp(argv[4], "heun") ? SDE_HEUN
+                                                      : SDE_EULER_MARUYAMA,
+                 12345};
+  if (members < 1 || steps < 1) {
+    fprintf(stderr, "sde: members and steps must be positive\n");
+    return 1;
+  }
+
+  double *x = malloc(6 * (size_t)members * sizeof(double));
+  if (!x) {
+    fprintf(stderr, "sde: cannot allocate %d members\n", members);
+    return 1;
+  }
+  double *y = x + members, *z = y + members;
+  double *ref = z + members;
+
+  int threads = parallelThreads();
+  double t = timeEnsemble(&p, members, steps, x, y, z);
+  double meanX = 0, meanZ = 0, varX = 0;
+  for (int m = 0; m < members; m++) {
+    meanX += x[m];
+    meanZ += z[m];
+  }
+  meanX /= members;
+  meanZ /= members;
+  for (int m = 0; m < members; m++)
+    varX += (x[m] - meanX) * (x[m] - meanX);
+
+  // Noise alone, drawn as the ensemble draws it, against the full step
+  double noise[4 * SDE_GROUP_BLOCKS * SDE_BLOCK];
+  double t0 = wallTime();
+  for (int first = 0; first < members; first += SDE_BLOCK) {
+    int count = members - first < SDE_BLOCK ? members - first : SDE_BLOCK;
+    for (int k = 0; k < steps; k += SDE_GROUP)
+      philoxNormalBlocks(p.seed, (uint32_t)first,
+                         (uint64_t)(k / SDE_GROUP) * SDE_GROUP_BLOCKS,
+                         SDE_GROUP_BLOCKS, count, noise);
+  }
+  double tNoise = wallTime() - t0;
+
+  parallelSetThreads(1);
+  double tOne =
+      timeEnsemble(&p, members, steps, ref, ref + members, ref + 2 * members);
+  parallelSetThreads(threads);
+  int identical = !memcmp(x, ref, 3 * (size_t)members * sizeof(double));
+
+  printf("SDE %s members=%d steps=%d sigma=%.3g threads=%d\n",
+         p.scheme == SDE_HEUN ? "Heun" : "Euler-Maruyama", members, steps,
+         p.sigma, threads);
+  printf("  ensemble:  %.3f s, %.3e member-steps/s\n", t,
+         (double)members * steps / t);
+  printf("  1 thread:  %.3f s, of which noise %.3f s (%.0f%%) and "
+         "stepping %.3f s\n",
+         tOne, tNoise, 100 * tNoise / tOne, tOne - tNoise);
+  printf("  final mean x=%.4f z=%.4f, std x=%.4f\n", meanX, meanZ,
+         sqrt(varX / members));
+  printf("  bit-identical with 1 thread: %s\n", identical ? "yes" : "NO");
+  free(x);
+  return identical ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#ifndef SDE_H
+#define SDE_H
+
+#include "state.h"
+#include <stdint.h>
+
+// Integration schemes for the stochastic Lorenz equations
+#define SDE_EULER_MARUYAMA 0
+#define SDE_HEUN 1 // Stochastic Heun (SRK, strong order 1 for additive noise)
+
+// Lorenz equations with additive noise sigma dW on every component
+typedef struct {
+  double s;
+  double b;
+  double r;
+  double sigma;  // Noise amplitude
+  double dt;     // Time step
+  int scheme;    // SDE_EULER_MARUYAMA or SDE_HEUN
+  uint64_t seed; // Ensemble seed; member m draws from Philox stream m
+} SdeParams;
+
+void sdeEnsemble(const SdeParams *params, int members, int steps, double *x,
+                 double *y, double *z);
+void computeStochasticLorenzPoints(State *state);
+int sdeBenchmark(int argc, char *argv[]);
+
+#endif // SDE_H
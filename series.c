@@ -0,0 +1,41 @@
+#include "series.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ *  Read the first number of every line; lines that do not start with a
+ *  number (headers, comments) are skipped. Returns NULL on failure
+ */
+double *loadSeries(const char *path, int *count) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return NULL;
+
+  int capacity = 1 << 16, n = 0;
+  double *values = malloc(capacity * sizeof(double));
+  char line[256];
+  while (values && fgets(line, sizeof(line), file)) {
+    char *end;
+    double v = strtod(line, &end);
+    if (end == line)
+      continue;
+    if (n == capacity) {
+      capacity *= 2;
+      double *grown = realloc(values, capacity * sizeof(double));
+      if (!grown) {
+        free(values);
+        values = NULL;
+        break;
+      }
+      values = grown;
+    }
+    values[n++] = v;
+  }
+  fclose(file);
+  if (values && n == 0) {
+    free(values);
+    values = NULL;
+  }
+  *count = n;
+  return values;
+}
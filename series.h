@@ -0,0 +1,7 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+// Scalar time series: the first number on every line of a text file
+double *loadSeries(const char *path, int *count);
+
+#endif // SERIES_H
@@ -0,0 +1,173 @@
+#include "sheet.h"
+#include "chaosmap.h"
+#include "color.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHEET_LABEL (IMAGE_GLYPH_HEIGHT + 4) // Rows above each drawing
+
+typedef struct {
+  const SheetConfig *config;
+  const unsigned char *colors; // Fade along the drawn steps
+  Image *img;
+  float *paths;                // x, z per drawn step, SHEET_STEPS per thread
+} SheetTask;
+
+/*
+ *  DDA line within the clip rectangle [x0, x1) x [y0, y1)
+ */
+static void drawLine(Image *img, int x0, int y0, int x1, int y1, float ax,
+                     float ay, float bx, float by, const unsigned char *rgb) {
+  float dx = bx - ax, dy = by - ay;
+  int steps = (int)ceilf(fmaxf(fabsf(dx), fabsf(dy)));
+  if (steps < 1)
+    steps = 1;
+  for (int s = 0; s <= steps; s++) {
+    int px = (int)(ax + dx * s / steps), py = (int)(ay + dy * s / steps);
+    if (px >= x0 && px < x1 && py >= y0 && py < y1)
+      memcpy(img->rgb + 3 * ((size_t)py * img->width + px), rgb, 3);
+  }
+}
+
+/*
+ *  Integrate one cell and draw it into its own tile; tiles are disjoint, so
+ *  cells need no locking
+ */
+static void drawCell(const SheetTask *t, int cell, float *path) {
+  const SheetConfig *c = t->config;
+  int col = cell % c->cells, row = cell / c->cells;
+  double r = c->rmin + (col + 0.5) * (c->rmax - c->rmin) / c->cells;
+  double s = c->smax - (row + 0.5) * (c->smax - c->smin) / c->cells;
+  int x0 = col * c->tile, y0 = row * c->tile;
+  int x1 = x0 + c->tile - 1, y1 = y0 + c->tile - 1; // Last row/column: grid
+
+  double x = 1.0, y = 1.0, z = 1.0;
+  for (int i = 0; i < SHEET_TRANSIENT; i++)
+    lorenzStep(s, c->b, r, LORENZ_DT, &x, &y, &z);
+  double xmin = INFINITY, xmax = -INFINITY, zmin = INFINITY, zmax = -INFINITY;
+  for (int i = 0; i < SHEET_STEPS; i++) {
+    lorenzStep(s, c->b, r, LORENZ_DT, &x, &y, &z);
+    path[2 * i] = (float)x;
+    path[2 * i + 1] = (float)z;
+    xmin = fmin(xmin, x);
+    xmax = fmax(xmax, x);
+    zmin = fmin(zmin, z);
+    zmax = fmax(zmax, z);
+  }
+
+  static const unsigned char grid[3] = {48, 48, 48}, text[3] = {200, 200, 200},
+                             blowup[3] = {90, 0, 0};
+  for (int i = x0; i <= x1; i++)
+    memcpy(t->img->rgb + 3 * ((size_t)y1 * t->img->width + i), grid, 3);
+  for (int j = y0; j <= y1; j++)
+    memcpy(t->img->rgb + 3 * ((size_t)j * t->img->width + x1), grid, 3);
+  char label[64];
+  snprintf(label, sizeof(label), "r=%.1f s=%.1f", r, s);
+  int fit = (c->tile - 4) / IMAGE_GLYPH_WIDTH; // Stay inside the tile
+  if (fit < (int)sizeof(label))
+    label[fit] = 0;
+  imageText(t->img, x0 + 2, y0 + 2, label, text);
+  if (!isfinite(xmax - xmin + zmax - zmin)) {
+    drawLine(t->img, x0, y0, x1, y1, x0, y0 + SHEET_LABEL, x1, y1, blowup);
+    return;
+  }
+
+  // The x-z side view, fitted to the tile below the label; a trajectory
+  // that settled on a point still gets a small box around it
+  int top = y0 + SHEET_LABEL, margin = 2;
+  double w = x1 - x0 - 2 * margin, h = y1 - top - 2 * margin;
+  double extent = fmax(fmax(xmax - xmin, zmax - zmin), 1.0);
+  double scale = fmin(w, h) / extent;
+  float cx = (float)(x0 + margin + 0.5 * w);
+  float cy = (float)(top + margin + 0.5 * h);
+  float mx = (float)(0.5 * (xmin + xmax)), mz = (float)(0.5 * (zmin + zmax));
+  for (int i = 1; i < SHEET_STEPS; i++)
+    drawLine(t->img, x0, top, x1, y1,
+             cx + (float)scale * (path[2 * i - 2] - mx),
+             cy - (float)scale * (path[2 * i - 1] - mz),
+             cx + (float)scale * (path[2 * i] - mx),
+             cy - (float)scale * (path[2 * i + 1] - mz),
+             t->colors + 3 * (size_t)i);
+}
+
+static void drawCells(void *ctx, int begin, int end, int thread) {
+  const SheetTask *t = ctx;
+  for (int cell = begin; cell < end; cell++)
+    drawCell(t, cell, t->paths + 2 * (size_t)SHEET_STEPS * thread);
+}
+
+void sheetDefaultConfig(SheetConfig *config) {
+  config->cells = 32;
+  config->tile = 128;
+  config->b = 8.0 / 3.0;
+  config->rmin = CHAOS_RMIN;
+  config->rmax = CHAOS_RMAX;
+  config->smin = CHAOS_SMIN;
+  config->smax = CHAOS_SMAX;
+}
+
+/*
+ *  Render the sheet into img, which it allocates; cells are spread over
+ *  the worker threads. Returns 0 on failure.
+ */
+int sheetRender(const SheetConfig *config, Image *img) {
+  int size = config->cells * config->tile;
+  SheetTask t = {config, NULL, img, NULL};
+  unsigned char *colors = malloc(3 * (size_t)SHEET_STEPS);
+  t.paths = malloc(2 * (size_t)SHEET_STEPS * parallelThreads() *
+                   sizeof(float));
+  int ok = colors && t.paths && config->tile > 2 * SHEET_LABEL &&
+           imageInit(img, size, size);
+  if (ok) {
+    colorFill(COLOR_FADE, SHEET_STEPS, colors);
+    t.colors = colors;
+    parallelFor(config->cells * config->cells, drawCells, &t);
+  }
+  free(colors);
+  free(t.paths);
+  return ok;
+}
+
+/*
+ *  sheet [cells [tile [file.ppm]]]: contact sheet of attractors over r and s
+ */
+int sheetCommand(int argc, char *argv[]) {
+  SheetConfig config;
+  sheetDefaultConfig(&config);
+  if (argc > 1)
+    config.cells = atoi(argv[1]);
+  if (argc > 2)
+    config.tile = atoi(argv[2]);
+  const char *path = argc > 3 ? argv[3] : "sheet.ppm";
+  if (config.cells < 1 || config.tile <= 2 * SHEET_LABEL ||
+      (long long)config.cells * config.tile > 32768) {
+    fprintf(stderr, "sheet: need cells >= 1, tile > %d and at most 32768 "
+                    "pixels across\n",
+            2 * SHEET_LABEL);
+    return 1;
+  }
+
+  Image img;
+  double t0 = wallTime();
+  if (!sheetRender(&config, &img)) {
+    fprintf(stderr, "sheet: cannot allocate the sheet\n");
+    return 1;
+  }
+  double seconds = wallTime() - t0;
+  printf("Sheet: %dx%d tiles of %d px (%dx%d), %d steps each, in %.3f s, "
+         "threads=%d\n",
+         config.cells, config.cells, config.tile, img.width, img.height,
+         SHEET_TRANSIENT + SHEET_STEPS, seconds, parallelThreads());
+  int ok = imageWritePPM(&img, path);
+  imageFree(&img);
+  if (!ok) {
+    fprintf(stderr, "sheet: cannot write %s\n", path);
+    return 1;
+  }
+  printf("Wrote %s\n", path);
+  return 0;
+}
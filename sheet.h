@@ -0,0 +1,24 @@
+#ifndef SHEET_H
+#define SHEET_H
+
+#include "image.h"
+
+// Trajectory drawn in each tile: steps skipped to reach the attractor, then
+// steps drawn
+#define SHEET_TRANSIENT 5000
+#define SHEET_STEPS 30000
+
+// Grid of small attractor renders over the (r, s) ranges of the chaos map,
+// r across and s up, each fitted to its own tile with a label
+typedef struct {
+  int cells;  // Tiles across and up
+  int tile;   // Tile size in pixels
+  double b;
+  double rmin, rmax, smin, smax;
+} SheetConfig;
+
+void sheetDefaultConfig(SheetConfig *config);
+int sheetRender(const SheetConfig *config, Image *img);
+int sheetCommand(int argc, char *argv[]);
+
+#endif // SHEET_H
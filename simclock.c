@@ -0,0 +1,109 @@
+#include "simclock.h"
+#include "rng.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void simClockInit(SimClock *clock, double tick, int maxTicks, int replay) {
+  clock->tick = tick;
+  clock->maxTicks = maxTicks > 0 ? maxTicks : 1;
+  clock->replay = replay;
+  simClockReset(clock);
+}
+
+/*
+ *  Forget the time accumulated so far; the next update starts a new run
+ */
+void simClockReset(SimClock *clock) {
+  clock->accumulator = 0.0;
+  clock->last = -1.0;
+  clock->ticks = 0;
+  clock->dropped = 0;
+}
+
+/*
+ *  Add the wall time since the last update and return the number of whole
+ *  ticks to run now, at most maxTicks. A frame over that budget empties the
+ *  accumulator: the excess and any part tick are dropped, so the next frame
+ *  starts with no debt. In replay mode the wall clock is ignored and every
+ *  update is worth the same ticks.
+ */
+int simClockUpdate(SimClock *clock, double now) {
+  if (clock->replay > 0) {
+    clock->ticks += clock->replay;
+    return clock->replay;
+  }
+  if (clock->last >= 0 && now > clock->last)
+    clock->accumulator += now - clock->last;
+  clock->last = now;
+
+  int ticks = (int)(clock->accumulator / clock->tick);
+  if (ticks > clock->maxTicks) {
+    clock->dropped += ticks - clock->maxTicks;
+    clock->accumulator = 0;
+    ticks = clock->maxTicks;
+  }
+  clock->accumulator -= ticks * clock->tick;
+  if (clock->accumulator < 0)
+    clock->accumulator = 0;
+  clock->ticks += ticks;
+  return ticks;
+}
+
+/*
+ *  How far into the next tick the wall clock is, in [0, 1)
+ */
+double simClockAlpha(const SimClock *clock) {
+  if (clock->replay > 0)
+    return 0.0;
+  double alpha = clock->accumulator / clock->tick;
+  return alpha < 1.0 ? alpha : 0.999999;
+}
+
+/*
+ *  clock [frames [fps [hitch]]]: feed the scheduler frame times with
+ *  jitter and a 250 ms hitch every `hitch` frames, and compare the largest
+ *  per-frame jump in animation progress with the elapsed-time method
+ */
+int simClockCommand(int argc, char *argv[]) {
+  int frames = argc > 1 ? atoi(argv[1]) : 10000;
+  double fps = argc > 2 ? atof(argv[2]) : 60.0;
+  int hitch = argc > 3 ? atoi(argv[3]) : 500;
+  if (frames < 1 || !(fps > 0)) {
+    fprintf(stderr, "clock: need frames >= 1 and fps > 0\n");
+    return 1;
+  }
+
+  // Rendered progress in ticks: whole ticks plus the interpolated fraction
+  SimClock clock;
+  simClockInit(&clock, SIM_TICK, SIM_MAX_CATCHUP, 0);
+  double now = 0.0, shown = 0.0, jump = 0.0, naiveJump = 0.0;
+  for (int f = 0; f < frames; f++) {
+    double frame = (0.75 + 0.5 * philoxUniform(7, 0, f)) / fps;
+    if (hitch > 0 && f % hitch == hitch - 1)
+      frame += 0.25;
+    now += frame;
+    simClockUpdate(&clock, now);
+    double next = clock.ticks + simClockAlpha(&clock);
+    if (f > 0) {
+      jump = fmax(jump, (next - shown) * SIM_TICK);
+      naiveJump = fmax(naiveJump, frame);
+    }
+    shown = next;
+  }
+  printf("Clock: %d frames at %.0f fps with jitter and %s: %lld ticks of "
+         "%.4f s, %lld dropped\n",
+         frames, fps, hitch > 0 ? "hitches" : "no hitches", clock.ticks,
+         SIM_TICK, clock.dropped);
+  printf("Largest jump per frame: %.4f s of animation (elapsed time: "
+         "%.4f s); %.1f s simulated over %.1f s of wall time\n",
+         jump, naiveJump, clock.ticks * SIM_TICK, now);
+
+  // Replay: the same number of frames always gives the same ticks
+  simClockInit(&clock, SIM_TICK, SIM_MAX_CATCHUP, 1);
+  for (int f = 0; f < frames; f++)
+    simClockUpdate(&clock, 0.0);
+  printf("Replay at 1 tick per frame: %lld ticks after %d frames\n",
+         clock.ticks, frames);
+  return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef SIMCLOCK_H
+#define SIMCLOCK_H
+
+// Simulation tick of the viewer and the most ticks run to catch up in one
+// frame; time beyond that is dropped, so a long hitch slows the animation
+// down instead of stalling the next frames
+#define SIM_TICK (1.0 / 60.0)
+#define SIM_MAX_CATCHUP 8
+
+// Fixed-timestep scheduler: wall time accumulates and is consumed in whole
+// ticks, so everything driven by ticks advances identically whatever the
+// frame rate; rendering interpolates alpha of the way into the next tick
+typedef struct {
+  double tick;         // Wall seconds per tick
+  int maxTicks;        // Catch-up limit per update
+  int replay;          // If > 0, every update runs exactly this many ticks
+  double accumulator;  // Wall time not yet consumed, under one tick
+  double last;         // Wall time of the last update, < 0 before the first
+  long long ticks;     // Ticks run since the reset
+  long long dropped;   // Ticks discarded by the catch-up limit
+} SimClock;
+
+void simClockInit(SimClock *clock, double tick, int maxTicks, int replay);
+void simClockReset(SimClock *clock);
+int simClockUpdate(SimClock *clock, double now);
+double simClockAlpha(const SimClock *clock);
+int simClockCommand(int argc, char *argv[]);
+
+#endif // SIMCLOCK_H
@@ -0,0 +1,15 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Marks a hot loop's function for a second copy built for AVX2 and FMA
+// (x86-64-v3) beside the baseline one; the loader picks the copy the CPU
+// can run. Only GCC on x86-64 Linux has the loader support, so elsewhere
+// the baseline alone is built.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) &&     \
+    defined(__linux__)
+#define SIMD_CLONES __attribute__((target_clones("arch=x86-64-v3", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+#endif // SIMD_H
@@ -0,0 +1,540 @@
+#include "spectrum.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SPECTRUM_BATCH 64 // Windows buffered before a parallel pass
+#define SPECTRUM_GROUP 8  // Windows per parallel task (even, so pairs align)
+#define SPECTRUM_GROUPS (SPECTRUM_BATCH / SPECTRUM_GROUP)
+
+typedef struct {
+  Spectrum *sp;
+  int windows;
+} SpectrumJob;
+
+/*
+ *  Two butterfly levels on one block of 4 * half points: span half with
+ *  twiddles w, then span 2 * half with v (first half) and u (second half)
+ */
+static void radix4Block(int half, float *restrict r0, float *restrict i0,
+                        float *restrict r1, float *restrict i1,
+                        float *restrict r2, float *restrict i2,
+                        float *restrict r3, float *restrict i3,
+                        const float *restrict wr, const float *restrict wi,
+                        const float *restrict vr, const float *restrict vi,
+                        const float *restrict ur, const float *restrict ui) {
+  for (int k = 0; k < half; k++) {
+    float tr = r1[k] * wr[k] - i1[k] * wi[k];
+    float ti = r1[k] * wi[k] + i1[k] * wr[k];
+    float sr = r3[k] * wr[k] - i3[k] * wi[k];
+    float si = r3[k] * wi[k] + i3[k] * wr[k];
+    float ar = r0[k] + tr, ai = i0[k] + ti;
+    float br = r0[k] - tr, bi = i0[k] - ti;
+    float cr = r2[k] + sr, ci = i2[k] + si;
+    float dr = r2[k] - sr, di = i2[k] - si;
+    float er = cr * vr[k] - ci * vi[k];
+    float ei = cr * vi[k] + ci * vr[k];
+    float fr = dr * ur[k] - di * ui[k];
+    float fi = dr * ui[k] + di * ur[k];
+    r0[k] = ar + er;
+    i0[k] = ai + ei;
+    r2[k] = ar - er;
+    i2[k] = ai - ei;
+    r1[k] = br + fr;
+    i1[k] = bi + fi;
+    r3[k] = br - fr;
+    i3[k] = bi - fi;
+  }
+}
+
+/*
+ *  Radix-2 decimation-in-time FFT on split real/imaginary arrays already in
+ *  bit-reversed order. Spans 1 and 2 need no twiddles and run as one
+ *  radix-4 pass; after that stages go two at a time, so each pass over the
+ *  data does two levels of butterflies. Twiddles for a span are contiguous,
+ *  so the inner loops vectorize.
+ */
+static void fft(const Spectrum *sp, float *restrict re, float *restrict im) {
+  int n = sp->size;
+  for (int i = 0; i < n; i += 4) {
+    float r0 = re[i] + re[i + 1], i0 = im[i] + im[i + 1];
+    float r1 = re[i] - re[i + 1], i1 = im[i] - im[i + 1];
+    float r2 = re[i + 2] + re[i + 3], i2 = im[i + 2] + im[i + 3];
+    float r3 = re[i + 2] - re[i + 3], i3 = im[i + 2] - im[i + 3];
+    // Span 2 twiddles are 1 and -i
+    re[i] = r0 + r2;
+    im[i] = i0 + i2;
+    re[i + 2] = r0 - r2;
+    im[i + 2] = i0 - i2;
+    re[i + 1] = r1 + i3;
+    im[i + 1] = i1 - r3;
+    re[i + 3] = r1 - i3;
+    im[i + 3] = i1 + r3;
+  }
+
+  int half = 4;
+  for (; half * 2 < n; half *= 4) {
+    const float *wr = sp->twr + half, *wi = sp->twi + half;
+    const float *vr = sp->twr + 2 * half, *vi = sp->twi + 2 * half;
+    for (int start = 0; start < n; start += 4 * half) {
+      float *r = re + start, *i = im + start;
+      radix4Block(half, r, i, r + half, i + half, r + 2 * half, i + 2 * half,
+                  r + 3 * half, i + 3 * half, wr, wi, vr, vi, vr + half,
+                  vi + half);
+    }
+  }
+  // An odd number of stages leaves one radix-2 level
+  if (half < n) {
+    const float *restrict wr = sp->twr + half, *restrict wi = sp->twi + half;
+    float *restrict ar = re, *restrict ai = im;
+    float *restrict br = re + half, *restrict bi = im + half;
+    for (int k = 0; k < half; k++) {
+      float tr = br[k] * wr[k] - bi[k] * wi[k];
+      float ti = br[k] * wi[k] + bi[k] * wr[k];
+      br[k] = ar[k] - tr;
+      bi[k] = ai[k] - ti;
+      ar[k] += tr;
+      ai[k] += ti;
+    }
+  }
+}
+
+/*
+ *  Mixed-radix decimation-in-time FFT for sizes that are not a power of
+ *  two, on data already in digit-reversed order. Stage s combines radix[s]
+ *  transforms of span m (the product of the earlier radices) each; its
+ *  twiddles W^(jk) for j = 1..radix-1, k < m follow the previous stage's,
+ *  so like the radix-2 path the inner loops run over contiguous k.
+ */
+// Leg j of every butterfly in a block, multiplied by its twiddles in place
+static void twiddleLeg(int m, float *restrict r, float *restrict i,
+                       const float *restrict wr, const float *restrict wi) {
+  for (int k = 0; k < m; k++) {
+    float tr = r[k] * wr[k] - i[k] * wi[k];
+    i[k] = r[k] * wi[k] + i[k] * wr[k];
+    r[k] = tr;
+  }
+}
+
+static void mixedBlock(int p, int m, float *restrict r, float *restrict i) {
+  float *r0 = r, *r1 = r + m, *r2 = r + 2 * m, *r3 = r + 3 * m;
+  float *r4 = r + 4 * m;
+  float *i0 = i, *i1 = i + m, *i2 = i + 2 * m, *i3 = i + 3 * m;
+  float *i4 = i + 4 * m;
+  if (p == 2)
+    for (int k = 0; k < m; k++) {
+      float ar = r0[k], ai = i0[k];
+      r0[k] = ar + r1[k];
+      i0[k] = ai + i1[k];
+      r1[k] = ar - r1[k];
+      i1[k] = ai - i1[k];
+    }
+  else if (p == 3) {
+    const float c = -0.5f, s = -0.86602540378f; // W_3 = c + i s
+    for (int k = 0; k < m; k++) {
+      float sr = r1[k] + r2[k], si = i1[k] + i2[k];
+      float dr = r1[k] - r2[k], di = i1[k] - i2[k];
+      float mr = r0[k] + c * sr, mi = i0[k] + c * si;
+      r0[k] += sr;
+      i0[k] += si;
+      r1[k] = mr - s * di;
+      i1[k] = mi + s * dr;
+      r2[k] = mr + s * di;
+      i2[k] = mi - s * dr;
+    }
+  } else if (p == 4)
+    for (int k = 0; k < m; k++) {
+      float ar = r0[k] + r2[k], ai = i0[k] + i2[k];
+      float br = r0[k] - r2[k], bi = i0[k] - i2[k];
+      float cr = r1[k] + r3[k], ci = i1[k] + i3[k];
+      float dr = r1[k] - r3[k], di = i1[k] - i3[k];
+      r0[k] = ar + cr;
+      i0[k] = ai + ci;
+      r2[k] = ar - cr;
+      i2[k] = ai - ci;
+      // -i (r1 - r3) for the forward transform
+      r1[k] = br + di;
+      i1[k] = bi - dr;
+      r3[k] = br - di;
+      i3[k] = bi + dr;
+    }
+  else {
+    // W_5 = c1 + i s1, W_5^2 = c2 + i s2
+    const float c1 = 0.30901699437f, s1 = -0.95105651630f;
+    const float c2 = -0.80901699437f, s2 = -0.58778525229f;
+    for (int k = 0; k < m; k++) {
+      float ar = r1[k] + r4[k], ai = i1[k] + i4[k];
+      float br = r1[k] - r4[k], bi = i1[k] - i4[k];
+      float cr = r2[k] + r3[k], ci = i2[k] + i3[k];
+      float dr = r2[k] - r3[k], di = i2[k] - i3[k];
+      float er = r0[k] + c1 * ar + c2 * cr, ei = i0[k] + c1 * ai + c2 * ci;
+      float fr = r0[k] + c2 * ar + c1 * cr, fi = i0[k] + c2 * ai + c1 * ci;
+      float gr = s1 * bi + s2 * di, gi = s1 * br + s2 * dr;
+      float hr = s2 * bi - s1 * di, hi = s2 * br - s1 * dr;
+      r0[k] += ar + cr;
+      i0[k] += ai + ci;
+      r1[k] = er - gr;
+      i1[k] = ei + gi;
+      r4[k] = er + gr;
+      i4[k] = ei - gi;
+      r2[k] = fr - hr;
+      i2[k] = fi + hi;
+      r3[k] = fr + hr;
+      i3[k] = fi - hi;
+    }
+  }
+}
+
+static void mixedFft(const Spectrum *sp, float *restrict re,
+                     float *restrict im) {
+  int n = sp->size, m = 1;
+  const float *twr = sp->twr, *twi = sp->twi;
+  for (int s = 0; s < sp->stages; s++) {
+    int p = sp->radix[s];
+    for (int start = 0; start < n; start += p * m) {
+      if (m > 1)
+        for (int j = 1; j < p; j++)
+          twiddleLeg(m, re + start + j * m, im + start + j * m,
+                     twr + (j - 1) * m, twi + (j - 1) * m);
+      mixedBlock(p, m, re + start, im + start);
+    }
+    twr += (p - 1) * m;
+    twi += (p - 1) * m;
+    m *= p;
+  }
+}
+
+/*
+ *  Transform two windowed real signals at once as a + ib and add both power
+ *  spectra: A_k = (Z_k + conj Z_(n-k)) / 2, B_k = (Z_k - conj Z_(n-k)) / 2i.
+ *  b may be NULL, in which case only a is transformed.
+ */
+static void transformPair(const Spectrum *sp, const float *a, const float *b,
+                          float *restrict re, float *restrict im,
+                          float *restrict pa, float *restrict pb) {
+  int n = sp->size;
+  const float *restrict w = sp->window;
+  const int *restrict rev = sp->bitrev;
+  // Window and scatter into bit-reversed order in one pass
+  if (b)
+    for (int i = 0; i < n; i++) {
+      re[rev[i]] = w[i] * a[i];
+      im[rev[i]] = w[i] * b[i];
+    }
+  else
+    for (int i = 0; i < n; i++) {
+      re[rev[i]] = w[i] * a[i];
+      im[i] = 0.0f;
+    }
+  if (sp->stages)
+    mixedFft(sp, re, im);
+  else
+    fft(sp, re, im);
+  for (int k = 0; k <= n / 2; k++) {
+    int j = k ? n - k : 0;
+    float ar = 0.5f * (re[k] + re[j]), ai = 0.5f * (im[k] - im[j]);
+    pa[k] += ar * ar + ai * ai;
+    if (pb) {
+      float br = 0.5f * (im[k] + im[j]), bi = 0.5f * (re[j] - re[k]);
+      pb[k] += br * br + bi * bi;
+    }
+  }
+}
+
+/*
+ *  One group of consecutive windows into its own partial sums. Windows are
+ *  taken in pairs so the six real signals fill three complex transforms.
+ */
+static void groupRange(void *ctx, int begin, int end, int thread) {
+  SpectrumJob *job = ctx;
+  Spectrum *sp = job->sp;
+  int n = sp->size, bins = n / 2 + 1;
+  for (int g = begin; g < end; g++) {
+    float *p = sp->partial + (size_t)g * 3 * bins;
+    float *px = p, *py = p + bins, *pz = p + 2 * bins;
+    float *re = sp->scratch + (size_t)g * 2 * n, *im = re + n;
+    memset(p, 0, 3 * bins * sizeof(float));
+
+    int w0 = g * SPECTRUM_GROUP, w1 = w0 + SPECTRUM_GROUP;
+    if (w1 > job->windows)
+      w1 = job->windows;
+    for (int w = w0; w < w1; w += 2) {
+      const float *x = sp->pending[0] + (size_t)w * sp->hop;
+      const float *y = sp->pending[1] + (size_t)w * sp->hop;
+      const float *z = sp->pending[2] + (size_t)w * sp->hop;
+      transformPair(sp, x, y, re, im, px, py);
+      if (w + 1 < w1) {
+        transformPair(sp, z, x + sp->hop, re, im, pz, px);
+        transformPair(sp, y + sp->hop, z + sp->hop, re, im, py, pz);
+      } else
+        transformPair(sp, z, NULL, re, im, pz, NULL);
+    }
+  }
+}
+
+/*
+ *  Sum every complete window in the pending buffer, then keep the tail
+ */
+static void processWindows(Spectrum *sp) {
+  if (sp->fill < sp->size)
+    return;
+  int windows = (sp->fill - sp->size) / sp->hop + 1;
+  int groups = (windows + SPECTRUM_GROUP - 1) / SPECTRUM_GROUP;
+  int bins = sp->size / 2 + 1;
+  SpectrumJob job = {sp, windows};
+  parallelFor(groups, groupRange, &job);
+
+  // Fixed group order keeps the sums independent of the thread count
+  for (int g = 0; g < groups; g++)
+    for (int c = 0; c < 3; c++) {
+      const float *p = sp->partial + ((size_t)g * 3 + c) * bins;
+      for (int k = 0; k < bins; k++)
+        sp->power[c][k] += p[k];
+    }
+  sp->windows += windows;
+
+  int used = windows * sp->hop;
+  sp->fill -= used;
+  for (int c = 0; c < 3; c++)
+    memmove(sp->pending[c], sp->pending[c] + used, sp->fill * sizeof(float));
+}
+
+/*
+ *  Split size into radix 4, 2, 3 and 5 stages; returns the twiddles they
+ *  need, or 0 if size has another prime factor
+ */
+static int factorSize(Spectrum *sp, int size) {
+  static const int radices[4] = {4, 2, 3, 5};
+  int rest = size, m = 1, twiddles = 0;
+  sp->stages = 0;
+  for (int f = 0; f < 4; f++)
+    while (rest % radices[f] == 0 && sp->stages < SPECTRUM_MAX_STAGES) {
+      sp->radix[sp->stages++] = radices[f];
+      twiddles += (radices[f] - 1) * m;
+      m *= radices[f];
+      rest /= radices[f];
+    }
+  return rest == 1 ? twiddles : 0;
+}
+
+/*
+ *  size must be 2^a 3^b 5^c, at least 4, and 1 <= hop <= size; powers of
+ *  two take the fused radix-2 path. Returns 0 on bad arguments or
+ *  allocation failure.
+ */
+int spectrumInit(Spectrum *sp, int size, int hop, double dt) {
+  memset(sp, 0, sizeof(*sp));
+  int twiddles = size >= 4 ? factorSize(sp, size) : 0;
+  if (!twiddles || hop < 1 || hop > size)
+    return 0;
+  if (!(size & (size - 1))) {
+    sp->stages = 0;
+    twiddles = size;
+  }
+  sp->size = size;
+  sp->hop = hop;
+  sp->dt = dt;
+  sp->capacity = size + (SPECTRUM_BATCH - 1) * hop;
+  int bins = size / 2 + 1;
+
+  sp->window = malloc(size * sizeof(float));
+  sp->twr = malloc(twiddles * sizeof(float));
+  sp->twi = malloc(twiddles * sizeof(float));
+  sp->bitrev = malloc(size * sizeof(int));
+  sp->partial = malloc((size_t)SPECTRUM_GROUPS * 3 * bins * sizeof(float));
+  sp->scratch = malloc((size_t)SPECTRUM_GROUPS * 2 * size * sizeof(float));
+  int ok = sp->window && sp->twr && sp->twi && sp->bitrev && sp->partial &&
+           sp->scratch;
+  for (int c = 0; c < 3; c++) {
+    sp->pending[c] = malloc((size_t)sp->capacity * sizeof(float));
+    sp->power[c] = calloc(bins, sizeof(double));
+    ok = ok && sp->pending[c] && sp->power[c];
+  }
+  if (!ok) {
+    spectrumFree(sp);
+    return 0;
+  }
+
+  for (int i = 0; i < size; i++)
+    sp->window[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / size));
+  if (sp->stages) {
+    // Input i goes to block i mod p of the last stage's p sub-transforms,
+    // at the place i / p takes in them, and so on down the stages
+    for (int i = 0; i < size; i++) {
+      int pos = 0, len = size, rest = i;
+      for (int s = sp->stages - 1; s >= 0; s--) {
+        len /= sp->radix[s];
+        pos += rest % sp->radix[s] * len;
+        rest /= sp->radix[s];
+      }
+      sp->bitrev[i] = pos;
+    }
+    float *twr = sp->twr, *twi = sp->twi;
+    for (int s = 0, m = 1; s < sp->stages; m *= sp->radix[s++])
+      for (int j = 1; j < sp->radix[s]; j++)
+        for (int k = 0; k < m; k++) {
+          double a = 2 * M_PI * j * k / (sp->radix[s] * m);
+          *twr++ = (float)cos(a);
+          *twi++ = (float)-sin(a);
+        }
+    return 1;
+  }
+
+  int bits = 0;
+  while ((1 << bits) < size)
+    bits++;
+  for (int i = 0; i < size; i++) {
+    int j = 0;
+    for (int k = 0; k < bits; k++)
+      j |= (i >> k & 1) << (bits - 1 - k);
+    sp->bitrev[i] = j;
+  }
+  for (int half = 1; half < size; half *= 2)
+    for (int k = 0; k < half; k++) {
+      sp->twr[half + k] = (float)cos(M_PI * k / half);
+      sp->twi[half + k] = (float)-sin(M_PI * k / half);
+    }
+  return 1;
+}
+
+void spectrumFree(Spectrum *sp) {
+  free(sp->window);
+  free(sp->twr);
+  free(sp->twi);
+  free(sp->bitrev);
+  free(sp->partial);
+  free(sp->scratch);
+  for (int c = 0; c < 3; c++) {
+    free(sp->pending[c]);
+    free(sp->power[c]);
+  }
+  memset(sp, 0, sizeof(*sp));
+}
+
+/*
+ *  Append n samples per channel; full batches of windows are transformed as
+ *  they fill, and whatever complete windows remain at the end of the call
+ */
+void spectrumPush(Spectrum *sp, const float *x, const float *y,
+                  const float *z, int n) {
+  while (n > 0) {
+    int m = sp->capacity - sp->fill < n ? sp->capacity - sp->fill : n;
+    memcpy(sp->pending[0] + sp->fill, x, m * sizeof(float));
+    memcpy(sp->pending[1] + sp->fill, y, m * sizeof(float));
+    memcpy(sp->pending[2] + sp->fill, z, m * sizeof(float));
+    sp->fill += m;
+    x += m;
+    y += m;
+    z += m;
+    n -= m;
+    if (sp->fill == sp->capacity)
+      processWindows(sp);
+  }
+  processWindows(sp);
+}
+
+/*
+ *  Push every stride-th point of a trajectory
+ */
+void spectrumPushPoints(Spectrum *sp, const Point3D *points, int n,
+                        int stride) {
+  float x[1024], y[1024], z[1024];
+  int m = 0;
+  for (int i = 0; i < n; i += stride) {
+    x[m] = (float)points[i].x;
+    y[m] = (float)points[i].y;
+    z[m] = (float)points[i].z;
+    if (++m == 1024) {
+      spectrumPush(sp, x, y, z, m);
+      m = 0;
+    }
+  }
+  spectrumPush(sp, x, y, z, m);
+}
+
+/*
+ *  One-sided power spectral density of a channel, size / 2 + 1 bins at
+ *  frequencies k / (size * dt)
+ */
+void spectrumDensity(const Spectrum *sp, int channel, double *psd) {
+  int bins = sp->size / 2 + 1;
+  double sumW2 = 0;
+  for (int i = 0; i < sp->size; i++)
+    sumW2 += (double)sp->window[i] * sp->window[i];
+  double scale = sp->windows > 0 ? sp->dt / (sumW2 * sp->windows) : 0;
+  for (int k = 0; k < bins; k++)
+    psd[k] = sp->power[channel][k] * scale *
+             (k > 0 && 2 * k < sp->size ? 2 : 1);
+}
+
+/*
+ *  CSV with columns frequency, x, y, z; returns 0 on failure
+ */
+int spectrumWriteCSV(const Spectrum *sp, const char *path) {
+  int bins = sp->size / 2 + 1;
+  double *psd = malloc(3 * bins * sizeof(double));
+  FILE *file = psd ? fopen(path, "w") : NULL;
+  if (!file) {
+    free(psd);
+    return 0;
+  }
+  for (int c = 0; c < 3; c++)
+    spectrumDensity(sp, c, psd + c * bins);
+  fprintf(file, "frequency,x,y,z\n");
+  for (int k = 0; k < bins; k++)
+    fprintf(file, "%.6g,%.6e,%.6e,%.6e\n", k / (sp->size * sp->dt), psd[k],
+            psd[bins + k], psd[2 * bins + k]);
+  free(psd);
+  return fclose(file) == 0;
+}
+
+/*
+ *  spectrum [samples [size [file.csv]]]: Welch spectra of a long Euler
+ *  trajectory sampled every step, timed against the integration itself
+ */
+int spectrumCommand(int argc, char *argv[]) {
+  double total = argc > 1 ? atof(argv[1]) : 1e8;
+  int size = argc > 2 ? atoi(argv[2]) : 4096;
+  const char *path = argc > 3 ? argv[3] : "spectrum.csv";
+  int block = 1 << 16;
+  Spectrum sp;
+  float *x = malloc(3 * block * sizeof(float)), *y = x + block, *z = y + block;
+  if (!x || !spectrumInit(&sp, size, size / 2, LORENZ_DT)) {
+    fprintf(stderr, "spectrum: need a size >= 4 of the form 2^a 3^b 5^c\n");
+    free(x);
+    return 1;
+  }
+
+  double s = 10.0, b = 2.6666, r = 28.0, px = 1, py = 1, pz = 1;
+  for (int i = 0; i < 20000; i++)
+    lorenzStep(s, b, r, LORENZ_DT, &px, &py, &pz);
+  double integrate = 0, analyze = 0;
+  long long samples = 0;
+  while (samples < total) {
+    int n = total - samples < block ? (int)(total - samples) : block;
+    double t0 = wallTime();
+    for (int i = 0; i < n; i++) {
+      lorenzStep(s, b, r, LORENZ_DT, &px, &py, &pz);
+      x[i] = (float)px;
+      y[i] = (float)py;
+      z[i] = (float)pz;
+    }
+    double t1 = wallTime();
+    spectrumPush(&sp, x, y, z, n);
+    analyze += wallTime() - t1;
+    integrate += t1 - t0;
+    samples += n;
+  }
+
+  int ok = spectrumWriteCSV(&sp, path);
+  printf("Welch spectrum, %d-point Hann windows, %ld windows, threads=%d: "
+         "integration %.3e samples/s, analysis %.3e samples/s%s%s\n",
+         size, sp.windows, parallelThreads(), samples / integrate,
+         samples / analyze, ok ? " -> " : "", ok ? path : "");
+  spectrumFree(&sp);
+  free(x);
+  return ok ? 0 : 1;
+}
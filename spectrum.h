@@ -0,0 +1,45 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "state.h"
+
+#define SPECTRUM_MAX_STAGES 32 // Radix 2 to 5 stages of a mixed-radix FFT
+
+// Welch power spectra of x(t), y(t), z(t): Hann windows of `size` samples
+// every `hop` samples, periodograms averaged over all complete windows
+typedef struct {
+  int size;       // FFT length, 2^a 3^b 5^c
+  int hop;        // Samples between window starts
+  double dt;      // Sample interval
+  float *window;  // Hann weights
+  float *twr;     // Twiddles: for a power of two, entry half + k for
+  float *twi;     // butterflies of span half; otherwise stage by stage
+  int *bitrev;    // Where each input lands: bit or digit reversal
+  int radix[SPECTRUM_MAX_STAGES]; // Mixed-radix stages, first to last
+  int stages;                     // 0 for a power of two
+
+  // Samples not yet covered by a complete window, one array per channel
+  float *pending[3];
+  int fill;
+  int capacity;
+
+  double *power[3]; // Summed |X_k|^2, size / 2 + 1 bins per channel
+  long windows;     // Windows summed into power
+
+  // Per-group work space so window groups can run in parallel; a group's
+  // few windows are summed in float before joining the double totals
+  float *partial;
+  float *scratch;
+} Spectrum;
+
+int spectrumInit(Spectrum *sp, int size, int hop, double dt);
+void spectrumFree(Spectrum *sp);
+void spectrumPush(Spectrum *sp, const float *x, const float *y,
+                  const float *z, int n);
+void spectrumPushPoints(Spectrum *sp, const Point3D *points, int n,
+                        int stride);
+void spectrumDensity(const Spectrum *sp, int channel, double *psd);
+int spectrumWriteCSV(const Spectrum *sp, const char *path);
+int spectrumCommand(int argc, char *argv[]);
+
+#endif // SPECTRUM_H
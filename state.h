@@ -1,8 +1,20 @@
 #ifndef STATE_H
 #define STATE_H
 
+#include "chaosmap.h"
+#include "image.h"
+#include "simclock.h"
+#include "trail.h"
+#include <stdint.h>
+
 #define LORENZ_POINTS 50000
 
+// Viewer modes
+#define VIEW_ATTRACTOR 0
+#define VIEW_FTLE 1
+#define VIEW_CHAOS 2
+#define VIEW_COUNT 3
+
 // Simple point struct
 typedef struct {
   double x;
@@ -17,6 +29,16 @@ typedef struct {
   double b;
   double r;
 
+  // Stochastic forcing (Euler-Maruyama, off when noise is 0)
+  double noise;  // Noise amplitude sigma
+  uint64_t seed; // Philox seed of the drawn path
+
+  // Lorenz-96 system, shown through a 3-variable projection
+  int system;  // 0=Lorenz-63, 1=Lorenz-96, 2=coupled network
+  int l96N;    // Number of Lorenz-96 variables
+  int l96Proj; // First projected variable (x_p, x_p+1, x_p+2)
+  double l96F; // Lorenz-96 forcing
+
   // View state
   int th;     // Azimuth of view angle
   int ph;     // Elevation of view angle
@@ -28,7 +50,85 @@ typedef struct {
   int colorMode;         // 0=single, 1=rainbow, 2=fade
   double animSpeed;      // Animation speed in seconds
   int currentPoints;     // Number of points to draw in animation
-  unsigned int lastTime; // Last animation update time
+  double animProgress;   // Points revealed, advanced once per clock tick
+  double drawProgress;   // animProgress interpolated into the next tick
+  SimClock clock;        // Fixed-timestep scheduler of the animation
+
+  // Alternate views
+  int viewMode;       // VIEW_ATTRACTOR, VIEW_FTLE or VIEW_CHAOS
+  int ftlePlane;      // Slice of the FTLE map (FTLE_XY/XZ/YZ)
+  Image ftleImage;    // Colored FTLE map for the FTLE view
+  ChaosMap *chaosMap; // Background (r, s) chaos map, created on first view
+  double chaosB;      // b the chaos map was started with
+  Image chaosImage;   // Colored chaos map for the chaos view
+
+  // Unstable periodic orbit overlay
+  int upoShow;        // Search and draw orbits for the current parameters
+  int upoFound;       // Distinct orbits in the last search
+  int upoCandidates;  // Seeds refined in the last search
+  int upoCount;       // Orbits traced into upoPaths
+  Point3D *upoPaths;  // UPO_VIEW_POINTS samples per traced orbit
+
+  // Power spectrum panel
+  int spectrumShow;     // Show the Welch spectrum of the trajectory
+  int spectrumBins;     // Bins per channel in spectrumPsd
+  double *spectrumPsd;  // x, y and z densities, spectrumBins each
+
+  // Delay embedding of x(t), or of a series loaded from $LORENZ_SERIES
+  int embedShow;         // Draw the reconstruction instead of the trajectory
+  int embedLag;          // Lag in samples, 0 = first mutual information minimum
+  int embedUsedLag;      // Lag of the reconstruction in embedPoints
+  int embedDim;          // Dimension suggested by false nearest neighbours
+  int embedCount;        // Points in embedPoints
+  double *embedSeries;   // Loaded series, NULL to embed x(t)
+  int embedLength;       // Samples in embedSeries
+  Point3D *embedPoints;  // (s_i, s_i+lag, s_i+2lag)
+
+  // Ulam transfer operator overlay
+  int ulamShow;          // 0=off, 1=invariant density, 2=almost-invariant sets
+  int ulamBoxes;         // Boxes in the arrays below
+  Point3D *ulamCenters;  // Box centers
+  float *ulamDensity;    // Invariant density of each box
+  float *ulamSecond;     // Second eigenvector, its sign picks the set
+  double ulamLambda2;    // Second eigenvalue
+
+  // Coupled Lorenz network (system 2)
+  int netN;              // Units
+  int *netRowStart;      // Graph in compressed sparse rows
+  int *netCol;
+  double netCoupling;    // Diffusive x coupling k
+  Point3D *netPaths;     // NETWORK_VIEW_STEPS samples per drawn unit
+  double *netError;      // Sync error after each step
+
+  // Butterfly-effect ensemble: a reference and copies displaced by 1e-6
+  int butterflyShow;             // Draw the ensemble instead of the trajectory
+  Point3D *butterflyPaths;       // Sampled states, member 0 is the reference
+  double *butterflySeparation;   // Mean log10 distance from the reference
+  double *butterflyDivergence;   // Time each copy is 1 away, -1 if never
+  struct ButterflyStats *butterflyStats; // Background divergence histogram
+
+  // Particle cloud advected every frame
+  int particleShow;                  // Draw the cloud instead of the trajectory
+  int particleCount;                 // Particles in the cloud when created
+  struct ParticleCloud *particles;   // Created on first show
+  double particleMillis;             // Time of the last per-frame advance
+  double particleStep;               // RK4 step it took, by the ticks run
+
+  // Live comet trail, integrated a few steps per frame
+  int trailShow;  // Draw the comet instead of the trajectory
+  Trail trail;    // Ring of recent positions, allocated on first show
+
+  // Tube swept around the trajectory, updated chunk by chunk
+  int tubeShow;           // Draw the tube instead of the line strip
+  struct TubeMesh *tube;  // Created on first show
+  double tubeMillis;      // Time of the last update
+
+  // Export with x
+  const char *exportPath;   // File written, format by extension
+  char exportMessage[160];  // Result of the last export, shown on the HUD
+  char traceMessage[160];   // Result of the last trace write with T
+
+  int instrumentShow;  // Frame timing overlay
 
   // The calculated points for the attractor
   Point3D points[LORENZ_POINTS];
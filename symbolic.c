@@ -0,0 +1,293 @@
+#include "symbolic.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYMBOLIC_CHUNKS 16 // Independent trajectories, fixed for determinism
+
+typedef struct {
+  SymbolStream *streams;
+  double s, b, r;
+  uint64_t steps; // Per trajectory
+} SymbolicJob;
+
+static double cLogC(uint64_t c) { return c > 1 ? c * log2((double)c) : 0.0; }
+
+/*
+ *  Frequency tables for words of 1..maxWord symbols (2^n counters each);
+ *  with keepBits the full sequence is also packed. Returns 0 on failure.
+ */
+int symbolStreamInit(SymbolStream *stream, int maxWord, int keepBits) {
+  memset(stream, 0, sizeof(*stream));
+  if (maxWord < 1 || maxWord > SYMBOL_MAX_WORD)
+    return 0;
+  stream->maxWord = maxWord;
+  for (int n = 1; n <= maxWord; n++) {
+    stream->counts[n] = calloc((size_t)1 << n, sizeof(uint64_t));
+    if (!stream->counts[n]) {
+      symbolStreamFree(stream);
+      return 0;
+    }
+  }
+  if (keepBits) {
+    stream->capacity = 4096;
+    stream->bits = calloc(stream->capacity / 64, sizeof(uint64_t));
+    if (!stream->bits) {
+      symbolStreamFree(stream);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void symbolStreamFree(SymbolStream *stream) {
+  for (int n = 1; n <= SYMBOL_MAX_WORD; n++) {
+    free(stream->counts[n]);
+    stream->counts[n] = NULL;
+  }
+  free(stream->bits);
+  stream->bits = NULL;
+  stream->capacity = 0;
+}
+
+/*
+ *  A stream with a window of its own that counts into another stream's
+ *  tables, so concurrent trajectories share one set; the counters are
+ *  only added to, and symbolStreamTally brings the totals up to date
+ *  once the sharing streams are done
+ */
+void symbolStreamShare(SymbolStream *stream, SymbolStream *tables) {
+  memset(stream, 0, sizeof(*stream));
+  stream->maxWord = tables->maxWord;
+  stream->tables = tables;
+}
+
+/*
+ *  Count the words of length 1..top ending at the newest symbol of window
+ */
+static void countWords(SymbolStream *stream, uint64_t window, int top) {
+  if (stream->tables) {
+    for (int n = 1; n <= top; n++)
+      atomic_fetch_add_explicit(
+          (_Atomic uint64_t *)&stream->tables
+              ->counts[n][window & (((uint64_t)1 << n) - 1)],
+          1, memory_order_relaxed);
+    return;
+  }
+  for (int n = 1; n <= top; n++) {
+    uint64_t *c = &stream->counts[n][window & (((uint64_t)1 << n) - 1)];
+    stream->distinct[n] += *c == 0;
+    stream->sumClogC[n] += cLogC(*c + 1) - cLogC(*c);
+    (*c)++;
+    stream->total[n]++;
+  }
+}
+
+/*
+ *  Append one symbol (0 = L, 1 = R). The last n symbols of the window are
+ *  the index of the length-n word, so each table updates in O(1) and a
+ *  symbol costs O(maxWord). Returns 0 if the packed copy could not grow;
+ *  counting carries on regardless.
+ */
+int symbolPush(SymbolStream *stream, int symbol) {
+  stream->window = stream->window << 1 | (uint64_t)(symbol != 0);
+  stream->symbols++;
+  int ok = 1;
+  if (stream->capacity) {
+    uint64_t i = stream->symbols - 1;
+    if (i >= stream->capacity) {
+      uint64_t *bits =
+          realloc(stream->bits, stream->capacity * 2 / 64 * sizeof(uint64_t));
+      if (bits) {
+        memset(bits + stream->capacity / 64, 0,
+               stream->capacity / 64 * sizeof(uint64_t));
+        stream->bits = bits;
+        stream->capacity *= 2;
+      } else
+        ok = 0;
+    }
+    if (i < stream->capacity && symbol)
+      stream->bits[i / 64] |= (uint64_t)1 << (i % 64);
+  }
+
+  int top = stream->symbols < (uint64_t)stream->maxWord ? (int)stream->symbols
+                                                        : stream->maxWord;
+  countWords(stream, stream->window, top);
+  return ok;
+}
+
+/*
+ *  Symbol at a position of the packed copy, or -1 if it was not kept
+ */
+int symbolAt(const SymbolStream *stream, uint64_t index) {
+  if (index >= stream->symbols || index >= stream->capacity)
+    return -1;
+  return (int)(stream->bits[index / 64] >> (index % 64) & 1);
+}
+
+/*
+ *  Euler-integrate `steps` steps of `lanes` (at most SYMBOL_LANES)
+ *  trajectories from (x[j], y[j], z[j]), pushing the sign of x at each
+ *  maximum of z into streams[j]; nothing but the streams and the current
+ *  points is kept. The trajectories share one loop because a single Euler
+ *  chain is latency bound and independent ones fill the pipeline. Returns
+ *  the number of symbols pushed.
+ */
+uint64_t symbolicIntegrate(SymbolStream *streams, int lanes, double s,
+                           double b, double r, double *x, double *y,
+                           double *z, uint64_t steps) {
+  double px[SYMBOL_LANES], py[SYMBOL_LANES], pz[SYMBOL_LANES];
+  double dzPrev[SYMBOL_LANES];
+  uint64_t before = 0;
+  lanes = lanes < SYMBOL_LANES ? lanes : SYMBOL_LANES;
+  for (int j = 0; j < lanes; j++) {
+    px[j] = x[j];
+    py[j] = y[j];
+    pz[j] = z[j];
+    dzPrev[j] = streams[j].dzPrev;
+    before += streams[j].symbols;
+  }
+  for (uint64_t i = 0; i < steps; i++)
+    for (int j = 0; j < lanes; j++) {
+      lorenzStep(s, b, r, LORENZ_DT, &px[j], &py[j], &pz[j]);
+      double dz = px[j] * py[j] - b * pz[j];
+      if (dzPrev[j] > 0 && dz <= 0)
+        symbolPush(&streams[j], px[j] >= 0);
+      dzPrev[j] = dz;
+    }
+  uint64_t after = 0;
+  for (int j = 0; j < lanes; j++) {
+    x[j] = px[j];
+    y[j] = py[j];
+    z[j] = pz[j];
+    streams[j].dzPrev = dzPrev[j];
+    after += streams[j].symbols;
+  }
+  return after - before;
+}
+
+/*
+ *  Totals, distinct words and c log2 c sums from the counters, after
+ *  streams sharing the tables have counted into them; the pass over the
+ *  tables runs in a fixed order, so results do not depend on how the
+ *  sharing streams interleaved
+ */
+void symbolStreamTally(SymbolStream *tables) {
+  for (int n = 1; n <= tables->maxWord; n++) {
+    uint64_t total = 0, distinct = 0;
+    double sum = 0;
+    for (size_t w = 0; w < (size_t)1 << n; w++) {
+      uint64_t c = tables->counts[n][w];
+      total += c;
+      distinct += c > 0;
+      sum += cLogC(c);
+    }
+    tables->total[n] = total;
+    tables->distinct[n] = distinct;
+    tables->sumClogC[n] = sum;
+  }
+}
+
+/*
+ *  Block entropy from the running sum: H_n = log2 N - (sum c log2 c) / N
+ */
+static double blockEntropy(const SymbolStream *stream, int n) {
+  if (n < 1 || stream->total[n] == 0)
+    return 0.0;
+  double total = (double)stream->total[n];
+  return log2(total) - stream->sumClogC[n] / total;
+}
+
+void symbolStats(const SymbolStream *stream, int length, SymbolStats *stats) {
+  stats->length = length;
+  stats->words = stream->total[length];
+  stats->distinct = stream->distinct[length];
+  stats->blockEntropy = blockEntropy(stream, length);
+  stats->entropyRate = stats->blockEntropy - blockEntropy(stream, length - 1);
+  uint64_t shorter = length > 1 ? stream->distinct[length - 1] : 1;
+  stats->topological = stats->distinct > 0 && shorter > 0
+                           ? log2((double)stats->distinct / shorter)
+                           : 0.0;
+}
+
+/*
+ *  Encode trajectories into the tables their streams share, SYMBOL_LANES
+ *  at a time
+ */
+static void chunkRange(void *ctx, int begin, int end, int thread) {
+  SymbolicJob *job = ctx;
+  double s = job->s, b = job->b, r = job->r;
+  for (int k0 = begin; k0 < end; k0 += SYMBOL_LANES) {
+    int lanes = end - k0 < SYMBOL_LANES ? end - k0 : SYMBOL_LANES;
+    double x[SYMBOL_LANES], y[SYMBOL_LANES], z[SYMBOL_LANES];
+    for (int j = 0; j < lanes; j++) {
+      // Distinct starting points, then a transient onto the attractor
+      x[j] = 1.0 + 0.01 * (k0 + j);
+      y[j] = z[j] = 1.0;
+      for (int i = 0; i < 20000; i++)
+        lorenzStep(s, b, r, LORENZ_DT, &x[j], &y[j], &z[j]);
+      job->streams[k0 + j].dzPrev = x[j] * y[j] - b * z[j];
+    }
+    symbolicIntegrate(&job->streams[k0], lanes, s, b, r, x, y, z,
+                      job->steps);
+  }
+}
+
+/*
+ *  symbolic [steps [maxWord]]: itinerary statistics over many Euler steps
+ */
+int symbolicCommand(int argc, char *argv[]) {
+  double total = argc > 1 ? atof(argv[1]) : 1e9;
+  int maxWord = argc > 2 ? atoi(argv[2]) : 16;
+  if (total < SYMBOLIC_CHUNKS || maxWord < 1 || maxWord > SYMBOL_MAX_WORD) {
+    fprintf(stderr, "symbolic: need steps >= %d and 1 <= maxWord <= %d\n",
+            SYMBOLIC_CHUNKS, SYMBOL_MAX_WORD);
+    return 1;
+  }
+
+  // Every chunk keeps only its own window and counts as it goes into the
+  // one set of word tables (2^(maxWord+1) counters), so memory does not
+  // grow with the number of steps or chunks
+  SymbolicJob job = {NULL, 10.0, 2.6666, 28.0, 0};
+  job.steps = (uint64_t)(total / SYMBOLIC_CHUNKS);
+  job.streams = calloc(SYMBOLIC_CHUNKS, sizeof(SymbolStream));
+  SymbolStream words = {0};
+  if (!job.streams || !symbolStreamInit(&words, maxWord, 0)) {
+    fprintf(stderr, "symbolic: cannot allocate word tables\n");
+    free(job.streams);
+    symbolStreamFree(&words);
+    return 1;
+  }
+  for (int k = 0; k < SYMBOLIC_CHUNKS; k++)
+    symbolStreamShare(&job.streams[k], &words);
+
+  double t0 = wallTime();
+  parallelFor(SYMBOLIC_CHUNKS, chunkRange, &job);
+  symbolStreamTally(&words);
+  for (int k = 0; k < SYMBOLIC_CHUNKS; k++)
+    words.symbols += job.streams[k].symbols;
+  double t = wallTime() - t0;
+
+  const SymbolStream *all = &words;
+  uint64_t steps = job.steps * SYMBOLIC_CHUNKS;
+  printf("Symbolic dynamics: %llu steps in %.3f s (%.3e steps/s, threads=%d), "
+         "%llu symbols (%.1f steps each)\n",
+         (unsigned long long)steps, t, steps / t, parallelThreads(),
+         (unsigned long long)all->symbols, (double)steps / all->symbols);
+  printf("%4s %14s %10s %10s %10s %10s\n", "n", "words", "distinct", "H_n",
+         "h_n", "topo");
+  for (int n = 1; n <= maxWord; n++) {
+    SymbolStats stats;
+    symbolStats(all, n, &stats);
+    printf("%4d %14llu %10llu %10.5f %10.5f %10.5f\n", n,
+           (unsigned long long)stats.words, (unsigned long long)stats.distinct,
+           stats.blockEntropy, stats.entropyRate, stats.topological);
+  }
+  free(job.streams);
+  symbolStreamFree(&words);
+  return 0;
+}
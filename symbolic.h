@@ -0,0 +1,55 @@
+#ifndef SYMBOLIC_H
+#define SYMBOLIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYMBOL_MAX_WORD 24 // Longest word length with a frequency table
+#define SYMBOL_LANES 4     // Trajectories symbolicIntegrate steps together
+
+// Streaming L/R itinerary of a Lorenz-63 trajectory: one symbol per maximum
+// of z (L when x < 0, R otherwise), with word counts kept up to date
+typedef struct SymbolStream {
+  int maxWord;
+  uint64_t window;  // Last 64 symbols, newest in bit 0, R = 1
+  uint64_t symbols; // Symbols pushed so far
+  uint64_t *counts[SYMBOL_MAX_WORD + 1];  // Occurrences of each word
+  uint64_t total[SYMBOL_MAX_WORD + 1];    // Windows counted per length
+  uint64_t distinct[SYMBOL_MAX_WORD + 1]; // Words seen at least once
+  double sumClogC[SYMBOL_MAX_WORD + 1];   // Sum of c log2 c over words
+
+  // Stream whose tables this one counts into, atomically, instead of its
+  // own; NULL when the tables are its own
+  struct SymbolStream *tables;
+
+  // Optional packed copy of the whole sequence, 1 bit per symbol
+  uint64_t *bits;
+  size_t capacity; // Bits allocated, 0 when not kept
+
+  // Maximum detector
+  double dzPrev;
+} SymbolStream;
+
+// Block statistics for words of one length
+typedef struct {
+  int length;
+  uint64_t words;      // Windows of this length seen
+  uint64_t distinct;   // Distinct words among them
+  double blockEntropy; // H_n in bits
+  double entropyRate;  // H_n - H_(n-1), bits per symbol
+  double topological;  // log2(distinct_n / distinct_(n-1))
+} SymbolStats;
+
+int symbolStreamInit(SymbolStream *stream, int maxWord, int keepBits);
+void symbolStreamFree(SymbolStream *stream);
+int symbolPush(SymbolStream *stream, int symbol);
+int symbolAt(const SymbolStream *stream, uint64_t index);
+uint64_t symbolicIntegrate(SymbolStream *streams, int lanes, double s,
+                           double b, double r, double *x, double *y,
+                           double *z, uint64_t steps);
+void symbolStreamShare(SymbolStream *stream, SymbolStream *tables);
+void symbolStreamTally(SymbolStream *tables);
+void symbolStats(const SymbolStream *stream, int length, SymbolStats *stats);
+int symbolicCommand(int argc, char *argv[]);
+
+#endif // SYMBOLIC_H
@@ -0,0 +1,190 @@
+#include "trace.h"
+#include "lorenz.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_THREADS 64 // Threads that get a ring; spans of others are lost
+
+typedef struct {
+  const char *name;
+  double begin, end;
+} TraceEvent;
+
+// One thread's spans. Only the owner writes; the flusher copies entries
+// out and drops any the owner may have overwritten meanwhile.
+typedef struct {
+  _Alignas(64) atomic_llong head; // Spans ever recorded
+  TraceEvent *events;             // TRACE_RING of them, oldest overwritten
+  atomic_int ready;               // events is allocated
+} TraceRing;
+
+int traceEnabled;
+static const char *path;
+static double origin;
+static TraceRing rings[TRACE_THREADS];
+static atomic_int ringCount;
+static atomic_llong lost; // Spans of threads without a ring
+static _Thread_local TraceRing *myRing;
+static _Thread_local int noRing;
+
+static TraceRing *threadRing(void) {
+  if (!myRing && !noRing) {
+    int k = atomic_fetch_add_explicit(&ringCount, 1, memory_order_relaxed);
+    TraceEvent *events =
+        k < TRACE_THREADS ? malloc(TRACE_RING * sizeof(TraceEvent)) : NULL;
+    if (events) {
+      myRing = &rings[k];
+      myRing->events = events;
+      atomic_store_explicit(&myRing->ready, 1, memory_order_release);
+    } else
+      noRing = 1;
+  }
+  return myRing;
+}
+
+/*
+ *  Record a span of the calling thread, without locking
+ */
+void traceSpan(const char *name, double begin, double end) {
+  TraceRing *ring = threadRing();
+  if (!ring) {
+    atomic_fetch_add_explicit(&lost, 1, memory_order_relaxed);
+    return;
+  }
+  long long h = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  ring->events[h % TRACE_RING] = (TraceEvent){name, begin, end};
+  atomic_store_explicit(&ring->head, h + 1, memory_order_release);
+}
+
+static void flushAtExit(void) { traceFlush(); }
+
+/*
+ *  Turn tracing on, writing to `file` at exit and on traceFlush; returns 0
+ *  if the file cannot be written
+ */
+int traceStart(const char *file) {
+  FILE *probe = fopen(file, "w");
+  if (!probe)
+    return 0;
+  fclose(probe);
+  path = file;
+  origin = wallTime();
+  traceEnabled = 1;
+  atexit(flushAtExit);
+  return 1;
+}
+
+const char *tracePath(void) { return path; }
+
+/*
+ *  Write every ring's spans as Chrome trace JSON (complete events, one
+ *  track per thread), readable by chrome://tracing and Perfetto; returns
+ *  the spans written, -1 on failure
+ */
+long long traceFlush(void) {
+  if (!traceEnabled)
+    return -1;
+  double t0 = wallTime();
+  FILE *file = fopen(path, "w");
+  TraceEvent *copy = malloc(TRACE_RING * sizeof(TraceEvent));
+  if (!file || !copy) {
+    if (file)
+      fclose(file);
+    free(copy);
+    return -1;
+  }
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"args\":{\"name\":\"lorenz\"}}");
+  long long written = 0;
+  int count = atomic_load_explicit(&ringCount, memory_order_relaxed);
+  for (int k = 0; k < count && k < TRACE_THREADS; k++) {
+    TraceRing *ring = &rings[k];
+    if (!atomic_load_explicit(&ring->ready, memory_order_acquire))
+      continue;
+    long long h = atomic_load_explicit(&ring->head, memory_order_acquire);
+    long long first = h > TRACE_RING ? h - TRACE_RING : 0;
+    for (long long i = first; i < h; i++)
+      copy[i - first] = ring->events[i % TRACE_RING];
+    // Entries the owner reached while we copied may be torn
+    long long now = atomic_load_explicit(&ring->head, memory_order_acquire);
+    long long valid = now - TRACE_RING + 1 > first ? now - TRACE_RING + 1
+                                                   : first;
+    fprintf(file,
+            ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+            k, k);
+    for (long long i = valid; i < h; i++) {
+      const TraceEvent *e = &copy[i - first];
+      fprintf(file,
+              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              e->name, k, 1e6 * (e->begin - origin),
+              1e6 * (e->end - e->begin));
+      written++;
+    }
+  }
+  fprintf(file,
+          ",\n{\"name\":\"trace flush\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+          "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"lost\":%lld}}\n]}\n",
+          TRACE_THREADS, 1e6 * (t0 - origin), 1e6 * (wallTime() - t0),
+          atomic_load(&lost));
+  free(copy);
+  return fclose(file) == 0 ? written : -1;
+}
+
+/*
+ *  trace [runs]: time computeLorenzPoints, which records a span per call,
+ *  with tracing off and on, and the bare cost of a span
+ */
+int traceCommand(int argc, char *argv[]) {
+  int runs = argc > 1 ? atoi(argv[1]) : 200;
+  State *state = calloc(1, sizeof(State));
+  if (runs < 1 || !state) {
+    fprintf(stderr, "trace: need runs >= 1\n");
+    free(state);
+    return 1;
+  }
+  state->s = 10.0;
+  state->b = 8.0 / 3.0;
+  state->r = 28.0;
+
+  // computeLorenzPoints records one span per call while tracing
+  int enabled = traceEnabled;
+  double seconds[2];
+  for (int on = 0; on < 2; on++) {
+    traceEnabled = on && path;
+    double t0 = wallTime();
+    for (int i = 0; i < runs; i++)
+      computeLorenzPoints(state);
+    seconds[on] = wallTime() - t0;
+  }
+  // Probe spans share the ring with the ones above; as many as fit leave
+  // those in the trace (a flush keeps at most TRACE_RING - 1)
+  int spans = TRACE_RING - 1 - runs > 4096 ? TRACE_RING - 1 - runs : 4096;
+  double t0 = wallTime();
+  traceEnabled = path != NULL;
+  for (int i = 0; i < spans; i++)
+    traceEnd("trace probe", traceBegin());
+  double perSpan = (wallTime() - t0) / spans;
+  traceEnabled = 0;
+  t0 = wallTime();
+  for (int i = 0; i < spans; i++)
+    traceEnd("trace probe", traceBegin());
+  double perOff = (wallTime() - t0) / spans;
+  traceEnabled = enabled;
+  free(state);
+
+  if (!path)
+    printf("Tracing is off (set LORENZ_TRACE=file.json); both runs are "
+           "untraced\n");
+  printf("computeLorenzPoints x %d: %.3f s untraced, %.3f s traced "
+         "(%+.2f%%)\n",
+         runs, seconds[0], seconds[1],
+         100 * (seconds[1] - seconds[0]) / seconds[0]);
+  printf("Span: %.1f ns recorded, %.2f ns with tracing off\n", 1e9 * perSpan,
+         1e9 * perOff);
+  return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "parallel.h"
+
+// Most recent spans kept per thread
+#define TRACE_RING 65536
+
+// Set by traceStart; spans cost one branch while it is 0
+extern int traceEnabled;
+
+void traceSpan(const char *name, double begin, double end);
+int traceStart(const char *path);
+long long traceFlush(void);
+const char *tracePath(void);
+int traceCommand(int argc, char *argv[]);
+
+/*
+ *  Start a span: returns its start time, or 0 when tracing is off
+ */
+static inline double traceBegin(void) {
+  return traceEnabled ? wallTime() : 0.0;
+}
+
+/*
+ *  End a span started by traceBegin; `name` must outlive the trace
+ */
+static inline void traceEnd(const char *name, double begin) {
+  if (begin > 0)
+    traceSpan(name, begin, wallTime());
+}
+
+#endif // TRACE_H
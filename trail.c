@@ -0,0 +1,112 @@
+#include "trail.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ *  Allocate the ring and start the live state at (x, y, z); returns 0 on
+ *  allocation failure
+ */
+int trailInit(Trail *trail, int capacity, double x, double y, double z) {
+  trail->capacity = capacity > 2 ? capacity : 2;
+  trail->head = trail->count = 0;
+  trail->x = x;
+  trail->y = y;
+  trail->z = z;
+  trail->steps = 0;
+  trail->vertex = malloc(6 * (size_t)trail->capacity * sizeof(float));
+  return trail->vertex != NULL;
+}
+
+void trailFree(Trail *trail) {
+  free(trail->vertex);
+  trail->vertex = NULL;
+  trail->count = 0;
+}
+
+/*
+ *  Integrate `steps` RK4 steps, pushing every new position into the ring;
+ *  the work is O(steps) however long the trail has been running
+ */
+void trailAdvance(Trail *trail, double s, double b, double r, double dt,
+                  int steps) {
+  double x = trail->x, y = trail->y, z = trail->z, h = dt;
+  int cap = trail->capacity;
+  for (int k = 0; k < steps; k++) {
+    double ax = s * (y - x), ay = x * (r - z) - y, az = x * y - b * z;
+    double x1 = x + 0.5 * h * ax, y1 = y + 0.5 * h * ay, z1 = z + 0.5 * h * az;
+    double bx = s * (y1 - x1), by = x1 * (r - z1) - y1, bz = x1 * y1 - b * z1;
+    double x2 = x + 0.5 * h * bx, y2 = y + 0.5 * h * by, z2 = z + 0.5 * h * bz;
+    double cx = s * (y2 - x2), cy = x2 * (r - z2) - y2, cz = x2 * y2 - b * z2;
+    double x3 = x + h * cx, y3 = y + h * cy, z3 = z + h * cz;
+    double dx = s * (y3 - x3), dy = x3 * (r - z3) - y3, dz = x3 * y3 - b * z3;
+    x += h / 6 * (ax + 2 * (bx + cx) + dx);
+    y += h / 6 * (ay + 2 * (by + cy) + dy);
+    z += h / 6 * (az + 2 * (bz + cz) + dz);
+
+    float *v = trail->vertex + 3 * (size_t)trail->head;
+    float *mirror = v + 3 * (size_t)cap;
+    v[0] = mirror[0] = (float)x;
+    v[1] = mirror[1] = (float)y;
+    v[2] = mirror[2] = (float)z;
+    trail->head = trail->head + 1 == cap ? 0 : trail->head + 1;
+    if (trail->count < cap)
+      trail->count++;
+  }
+  trail->x = x;
+  trail->y = y;
+  trail->z = z;
+  trail->steps += steps;
+}
+
+/*
+ *  The tail, oldest position first, as `count` consecutive x, y, z triples
+ */
+const float *trailPoints(const Trail *trail, int *count) {
+  *count = trail->count;
+  int first = trail->count < trail->capacity ? 0 : trail->head;
+  return trail->vertex + 3 * (size_t)first;
+}
+
+/*
+ *  trail [points [steps [frames]]]: run the live integrator for many frames
+ *  and compare the frame time early and late, which should not grow
+ */
+int trailCommand(int argc, char *argv[]) {
+  int points = argc > 1 ? atoi(argv[1]) : TRAIL_VIEW_POINTS;
+  int steps = argc > 2 ? atoi(argv[2]) : TRAIL_VIEW_STEPS;
+  int frames = argc > 3 ? atoi(argv[3]) : 1000000;
+  if (points < 2 || steps < 1 || frames < 20) {
+    fprintf(stderr, "trail: need points >= 2, steps >= 1, frames >= 20\n");
+    return 1;
+  }
+
+  Trail trail;
+  if (!trailInit(&trail, points, 1.0, 1.0, 1.0)) {
+    fprintf(stderr, "trail: cannot allocate %d points\n", points);
+    return 1;
+  }
+  // Each frame also reads the tail once, as drawing it would
+  int tenth = frames / 10, count;
+  double early = 0, late = 0, sum = 0;
+  for (int f = 0; f < frames; f++) {
+    double t0 = wallTime();
+    trailAdvance(&trail, 10.0, 8.0 / 3.0, 28.0, TRAIL_VIEW_DT, steps);
+    const float *v = trailPoints(&trail, &count);
+    for (int i = 0; i < count; i++)
+      sum += v[3 * i + 2];
+    double t = wallTime() - t0;
+    if (f < tenth)
+      early += t;
+    else if (f >= frames - tenth)
+      late += t;
+  }
+  printf("Trail: %d points, %d steps per frame, %d frames (t = %.0f): "
+         "%.2f us/frame in the first tenth, %.2f us/frame in the last "
+         "(mean z %.2f)\n",
+         points, steps, frames, trail.steps * TRAIL_VIEW_DT,
+         1e6 * early / tenth, 1e6 * late / tenth,
+         sum / ((double)frames * count));
+  trailFree(&trail);
+  return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef TRAIL_H
+#define TRAIL_H
+
+// Viewer comet: tail length in points and RK4 steps of TRAIL_VIEW_DT
+// integrated per frame
+#define TRAIL_VIEW_POINTS 4000
+#define TRAIL_VIEW_STEPS 8
+#define TRAIL_VIEW_DT 0.002
+
+// Live Lorenz-63 state with its last `capacity` positions in a ring. Each
+// position is stored twice, at slot i and i + capacity, so the tail is
+// always one contiguous run of vertex[] ending at the newest point.
+typedef struct {
+  int capacity;    // Tail length K
+  int head;        // Slot the next position goes to
+  int count;       // Positions held, at most capacity
+  double x, y, z;  // Live state
+  long long steps; // Steps integrated since the start
+  float *vertex;   // 2 * capacity positions, x, y, z each
+} Trail;
+
+int trailInit(Trail *trail, int capacity, double x, double y, double z);
+void trailFree(Trail *trail);
+void trailAdvance(Trail *trail, double s, double b, double r, double dt,
+                  int steps);
+const float *trailPoints(const Trail *trail, int *count);
+int trailCommand(int argc, char *argv[]);
+
+#endif // TRAIL_H
@@ -0,0 +1,341 @@
+#include "tube.h"
+#include "lorenz.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TUBE_CHUNK 4096 // Points whose frames are transported by one task
+
+// One update: chunks first..chunks-1 of points are regenerated
+typedef struct {
+  TubeMesh *mesh;
+  const Point3D *points;
+  int n;
+  int first;
+  Point3D *frame;  // Normals transported from each chunk's own seed
+  Point3D *seed;   // Seed normal at the first point of each chunk
+  Point3D *last;   // Transported normal at the last point of each chunk
+  double *angle;   // Turn about the tangent that joins each chunk on
+  uint64_t *hash;  // New hash of every chunk
+  double *ring;    // cos and sin of each side's angle around the ring
+} TubeTask;
+
+static inline Point3D vsub(Point3D a, Point3D b) {
+  return (Point3D){a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static inline Point3D vmad(Point3D a, double f, Point3D b) {
+  return (Point3D){a.x + f * b.x, a.y + f * b.y, a.z + f * b.z};
+}
+
+static inline double vdot(Point3D a, Point3D b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline Point3D vcross(Point3D a, Point3D b) {
+  return (Point3D){a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+                   a.x * b.y - a.y * b.x};
+}
+
+static inline Point3D vunit(Point3D a) {
+  double len = sqrt(vdot(a, a));
+  return len > 0 ? (Point3D){a.x / len, a.y / len, a.z / len}
+                 : (Point3D){0, 0, 1};
+}
+
+/*
+ *  Unit tangent by central differences, one-sided at the ends
+ */
+static Point3D tangentAt(const Point3D *p, int n, int i) {
+  return vunit(vsub(p[i < n - 1 ? i + 1 : i], p[i > 0 ? i - 1 : i]));
+}
+
+/*
+ *  Carry normal r from point p0 with tangent t0 to p1 with tangent t1 by
+ *  the double reflection method; as a rotation it commutes with turning r
+ *  about the tangent, which is what lets chunks be joined afterwards
+ */
+static Point3D transport(Point3D r, Point3D p0, Point3D t0, Point3D p1,
+                         Point3D t1) {
+  Point3D v1 = vsub(p1, p0);
+  double c1 = vdot(v1, v1);
+  if (c1 > 1e-300) {
+    r = vmad(r, -2 * vdot(v1, r) / c1, v1);
+    t0 = vmad(t0, -2 * vdot(v1, t0) / c1, v1);
+  }
+  Point3D v2 = vsub(t1, t0);
+  double c2 = vdot(v2, v2);
+  if (c2 > 1e-300)
+    r = vmad(r, -2 * vdot(v2, r) / c2, v2);
+  // Remove the rounding drift out of the normal plane
+  return vunit(vmad(r, -vdot(r, t1), t1));
+}
+
+/*
+ *  Turn v, perpendicular to the unit axis t, by angle a about t
+ */
+static inline Point3D turn(Point3D v, Point3D t, double c, double s) {
+  Point3D w = vcross(t, v);
+  return (Point3D){c * v.x + s * w.x, c * v.y + s * w.y, c * v.z + s * w.z};
+}
+
+/*
+ *  FNV-1a over the coordinates, a whole 64-bit word at a time
+ */
+static uint64_t hashPoints(const Point3D *p, int count) {
+  uint64_t h = 1469598103934665603ULL;
+  for (int i = 0; i < count; i++) {
+    uint64_t w[3];
+    memcpy(w, &p[i], sizeof(w));
+    for (int k = 0; k < 3; k++)
+      h = (h ^ w[k]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+static void chunkRange(const TubeTask *t, int c, int *begin, int *end) {
+  *begin = c * TUBE_CHUNK;
+  *end = *begin + TUBE_CHUNK < t->n ? *begin + TUBE_CHUNK : t->n;
+}
+
+static void hashChunks(void *ctx, int begin, int end, int thread) {
+  const TubeTask *t = ctx;
+  for (int c = begin; c < end; c++) {
+    int i0, i1;
+    chunkRange(t, c, &i0, &i1);
+    t->hash[c] = hashPoints(t->points + i0, i1 - i0);
+  }
+}
+
+/*
+ *  Transport frames through chunks, each from an arbitrary normal at its
+ *  first point; the chunks are independent so they run in parallel
+ */
+static void transportChunks(void *ctx, int begin, int end, int thread) {
+  const TubeTask *t = ctx;
+  const Point3D *p = t->points;
+  for (int c = begin + t->first; c < end + t->first; c++) {
+    int i0, i1;
+    chunkRange(t, c, &i0, &i1);
+    Point3D tan = tangentAt(p, t->n, i0);
+    Point3D axis = fabs(tan.x) < 0.5 ? (Point3D){1, 0, 0} : (Point3D){0, 1, 0};
+    Point3D r = vunit(vcross(tan, axis));
+    t->seed[c] = t->frame[i0] = r;
+    for (int i = i0 + 1; i < i1; i++) {
+      Point3D next = tangentAt(p, t->n, i);
+      r = transport(r, p[i - 1], tan, p[i], next);
+      t->frame[i] = r;
+      tan = next;
+    }
+    t->last[c] = r;
+  }
+}
+
+/*
+ *  Turn each chunk's frames into place and write its rings
+ */
+static void ringChunks(void *ctx, int begin, int end, int thread) {
+  const TubeTask *t = ctx;
+  TubeMesh *m = t->mesh;
+  const Point3D *p = t->points;
+  int sides = m->sides;
+  for (int c = begin + t->first; c < end + t->first; c++) {
+    int i0, i1;
+    chunkRange(t, c, &i0, &i1);
+    double ca = cos(t->angle[c]), sa = sin(t->angle[c]);
+    for (int i = i0; i < i1; i++) {
+      Point3D tan = tangentAt(p, t->n, i);
+      Point3D nrm = turn(t->frame[i], tan, ca, sa);
+      Point3D bin = vcross(tan, nrm);
+      float *v = m->vertex + 3 * (size_t)i * sides;
+      float *nv = m->normal + 3 * (size_t)i * sides;
+      for (int j = 0; j < sides; j++) {
+        Point3D d = vmad((Point3D){0, 0, 0}, t->ring[2 * j], nrm);
+        d = vmad(d, t->ring[2 * j + 1], bin);
+        nv[3 * j] = (float)d.x;
+        nv[3 * j + 1] = (float)d.y;
+        nv[3 * j + 2] = (float)d.z;
+        v[3 * j] = (float)(p[i].x + m->radius * d.x);
+        v[3 * j + 1] = (float)(p[i].y + m->radius * d.y);
+        v[3 * j + 2] = (float)(p[i].z + m->radius * d.z);
+      }
+    }
+  }
+}
+
+void tubeInit(TubeMesh *mesh, int sides, double radius) {
+  memset(mesh, 0, sizeof(*mesh));
+  mesh->sides = sides >= 3 ? sides : 3;
+  mesh->radius = radius;
+}
+
+void tubeFree(TubeMesh *mesh) {
+  free(mesh->vertex);
+  free(mesh->normal);
+  free(mesh->index);
+  free(mesh->hash);
+  free(mesh->endNormal);
+  tubeInit(mesh, mesh->sides, mesh->radius);
+}
+
+/*
+ *  Resize the mesh for n points and rebuild the strip indices
+ */
+static int resize(TubeMesh *m, int n) {
+  int sides = m->sides, chunks = (n + TUBE_CHUNK - 1) / TUBE_CHUNK;
+  tubeFree(m);
+  m->vertex = malloc(3 * (size_t)n * sides * sizeof(float));
+  m->normal = malloc(3 * (size_t)n * sides * sizeof(float));
+  m->index = malloc(2 * (size_t)n * sides * sizeof(unsigned int));
+  m->hash = calloc(chunks, sizeof(uint64_t));
+  m->endNormal = malloc(3 * (size_t)chunks * sizeof(double));
+  if (!m->vertex || !m->normal || !m->index || !m->hash || !m->endNormal) {
+    tubeFree(m);
+    return 0;
+  }
+  for (int j = 0; j < sides; j++) {
+    unsigned int *strip = m->index + 2 * (size_t)n * j;
+    for (int i = 0; i < n; i++) {
+      strip[2 * i] = (unsigned int)(i * sides + j);
+      strip[2 * i + 1] = (unsigned int)(i * sides + (j + 1) % sides);
+    }
+  }
+  m->points = n;
+  m->chunks = chunks;
+  return 1;
+}
+
+/*
+ *  Bring the mesh up to date with points[0..n). Only the chunks from the
+ *  first one whose points changed are regenerated (and the one before,
+ *  whose last tangent looks ahead); returns how many, or -1 on failure.
+ */
+int tubeUpdate(TubeMesh *mesh, const Point3D *points, int n) {
+  if (n < 2)
+    return -1;
+  int full = n != mesh->points || !mesh->vertex;
+  if (full && !resize(mesh, n))
+    return -1;
+
+  int chunks = mesh->chunks;
+  TubeTask t = {mesh, points, n, 0};
+  t.hash = malloc(chunks * sizeof(uint64_t));
+  if (!t.hash)
+    return -1;
+  parallelFor(chunks, hashChunks, &t);
+  int first = 0;
+  while (!full && first < chunks && t.hash[first] == mesh->hash[first])
+    first++;
+  if (first == chunks) {
+    free(t.hash);
+    mesh->rebuilt = 0;
+    return 0;
+  }
+  t.first = first > 0 ? first - 1 : 0;
+
+  t.frame = malloc((size_t)n * sizeof(Point3D));
+  t.seed = malloc(chunks * sizeof(Point3D));
+  t.last = malloc(chunks * sizeof(Point3D));
+  t.angle = malloc(chunks * sizeof(double));
+  t.ring = malloc(2 * mesh->sides * sizeof(double));
+  int ok = t.frame && t.seed && t.last && t.angle && t.ring;
+  if (ok) {
+    for (int j = 0; j < mesh->sides; j++) {
+      t.ring[2 * j] = cos(2 * M_PI * j / mesh->sides);
+      t.ring[2 * j + 1] = sin(2 * M_PI * j / mesh->sides);
+    }
+    int dirty = chunks - t.first;
+    parallelFor(dirty, transportChunks, &t);
+
+    // Join the chunks in order: carry the end frame of the previous one
+    // across the boundary and turn this chunk's seed onto it
+    for (int c = t.first; c < chunks; c++) {
+      int i0, i1;
+      chunkRange(&t, c, &i0, &i1);
+      Point3D tan = tangentAt(points, n, i0);
+      double a = 0.0;
+      if (c > 0) {
+        double *e = mesh->endNormal + 3 * (c - 1);
+        Point3D prev = {e[0], e[1], e[2]};
+        Point3D target = transport(prev, points[i0 - 1],
+                                   tangentAt(points, n, i0 - 1), points[i0],
+                                   tan);
+        a = atan2(vdot(vcross(t.seed[c], target), tan),
+                  vdot(t.seed[c], target));
+      }
+      t.angle[c] = a;
+      Point3D end = turn(t.last[c], tangentAt(points, n, i1 - 1), cos(a),
+                         sin(a));
+      mesh->endNormal[3 * c] = end.x;
+      mesh->endNormal[3 * c + 1] = end.y;
+      mesh->endNormal[3 * c + 2] = end.z;
+    }
+    parallelFor(dirty, ringChunks, &t);
+    memcpy(mesh->hash, t.hash, chunks * sizeof(uint64_t));
+    mesh->rebuilt = dirty;
+  }
+  free(t.frame);
+  free(t.seed);
+  free(t.last);
+  free(t.angle);
+  free(t.ring);
+  free(t.hash);
+  return ok ? mesh->rebuilt : -1;
+}
+
+/*
+ *  tube [points [sides]]: build a tube around a long Lorenz-63 trajectory,
+ *  then update it unchanged and with its last tenth changed
+ */
+int tubeCommand(int argc, char *argv[]) {
+  int n = argc > 1 ? atoi(argv[1]) : 1000000;
+  int sides = argc > 2 ? atoi(argv[2]) : TUBE_VIEW_SIDES;
+  if (n < 2 || sides < 3) {
+    fprintf(stderr, "tube: need points >= 2 and sides >= 3\n");
+    return 1;
+  }
+  Point3D *points = malloc((size_t)n * sizeof(Point3D));
+  if (!points) {
+    fprintf(stderr, "tube: cannot allocate %d points\n", n);
+    return 1;
+  }
+  double x = 1.0, y = 1.0, z = 1.0;
+  for (int i = 0; i < n; i++) {
+    lorenzStep(10.0, 8.0 / 3.0, 28.0, LORENZ_DT, &x, &y, &z);
+    points[i] = (Point3D){x, y, z};
+  }
+
+  TubeMesh mesh;
+  tubeInit(&mesh, sides, 0.25);
+  double t0 = wallTime();
+  int built = tubeUpdate(&mesh, points, n);
+  double full = wallTime() - t0;
+  if (built < 0) {
+    fprintf(stderr, "tube: cannot allocate the mesh\n");
+    free(points);
+    return 1;
+  }
+  t0 = wallTime();
+  int same = tubeUpdate(&mesh, points, n);
+  double unchanged = wallTime() - t0;
+  for (int i = n - n / 10; i < n; i++)
+    points[i].z += 1e-3;
+  t0 = wallTime();
+  int tail = tubeUpdate(&mesh, points, n);
+  double partial = wallTime() - t0;
+
+  double mb = (double)n * sides * (6 * sizeof(float) + 2 * sizeof(int)) /
+              1048576.0;
+  printf("Tube: %d points x %d sides = %lld vertices, %lld triangles, "
+         "%.1f MB, threads=%d\n",
+         n, sides, (long long)n * sides, 2LL * (n - 1) * sides, mb,
+         parallelThreads());
+  printf("Full build %.3f s (%d chunks); unchanged update %.3f s (%d); "
+         "last tenth changed %.3f s (%d)\n",
+         full, built, unchanged, same, partial, tail);
+  tubeFree(&mesh);
+  free(points);
+  return 0;
+}
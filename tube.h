@@ -0,0 +1,35 @@
+#ifndef TUBE_H
+#define TUBE_H
+
+#include "state.h"
+#include <stdint.h>
+
+// Viewer tube: sides around each ring and radius as a fraction of the
+// view box
+#define TUBE_VIEW_SIDES 8
+#define TUBE_VIEW_RADIUS 0.004
+
+// Trajectory swept into a tube: one ring of `sides` vertices per point,
+// oriented by parallel-transport (rotation minimizing) frames so it does
+// not twist. Side j is one indexed triangle strip along the whole tube,
+// 2 * points indices starting at index + j * 2 * points; drawing the first
+// 2 * k of them shows the tube up to point k.
+typedef struct TubeMesh {
+  int sides;
+  double radius;
+  int points;             // Rings in the mesh
+  float *vertex;          // points * sides positions, x, y, z each
+  float *normal;          // Unit normal per vertex
+  unsigned int *index;    // sides strips of 2 * points indices
+  int chunks;             // Frames are transported chunk by chunk
+  uint64_t *hash;         // Hash of each chunk's points at the last update
+  double *endNormal;      // Frame normal at the last point of each chunk
+  int rebuilt;            // Chunks regenerated by the last update
+} TubeMesh;
+
+void tubeInit(TubeMesh *mesh, int sides, double radius);
+int tubeUpdate(TubeMesh *mesh, const Point3D *points, int n);
+void tubeFree(TubeMesh *mesh);
+int tubeCommand(int argc, char *argv[]);
+
+#endif // TUBE_H
@@ -0,0 +1,848 @@
+#include "ulam.h"
+#include "parallel.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ULAM_DT 0.01        // RK4 step
+#define ULAM_LANES 64       // Test points integrated together
+#define ULAM_BLOCK 256      // Boxes mapped per parallel task
+#define ULAM_BATCH 65536    // Boxes mapped between updates of the box table
+#define ULAM_SPMV_ROWS 4096 // Matrix rows per parallel SpMV task
+#define ULAM_BIAS (1 << 20) // Offset making cell coordinates non-negative
+#define ULAM_KRYLOV 32      // Lanczos basis size that triggers a restart
+#define ULAM_KEEP 12        // Ritz vectors kept through a restart
+
+// Open-addressing table from packed cell coordinates to box numbers
+typedef struct {
+  uint64_t *keys; // Packed cell + 1, 0 for an empty slot
+  int *boxes;
+  size_t capacity; // A power of two, kept at most half full
+} BoxTable;
+
+typedef struct {
+  const UlamConfig *config;
+  const int *cell;
+  int first;            // First box of the batch
+  int count;            // Boxes in the batch
+  const double *offset; // Test point positions in the unit cube, 3 each
+  uint64_t *dest;       // Packed cell each test point lands in, 0 if lost
+} MapJob;
+
+typedef struct {
+  const int *start;
+  const int *col;
+  const float *val;
+  const double *x;
+  double *y;
+  int rows;
+} SpmvJob;
+
+typedef struct {
+  const double *const *vectors; // Orthonormal vectors to project out
+  int count;
+  double *v;
+  int rows;
+  double *partial; // Dot products per row block, count each
+  const double *coef;
+} OrthoJob;
+
+typedef struct {
+  double *basis;   // steps vectors, the first keep replaced by Ritz vectors
+  int steps;
+  int keep;
+  int rows;
+  const double *y; // Coordinates of the Ritz vectors, keep per basis vector
+} RitzJob;
+
+/*
+ *  Default transition time and test points for boxes of side h
+ */
+void ulamDefaultConfig(UlamConfig *config, double s, double b, double r,
+                       double h) {
+  config->s = s;
+  config->b = b;
+  config->r = r;
+  config->h = h;
+  config->tau = 0.2;
+  config->points = 16;
+  config->maxBoxes = 4000000;
+}
+
+/*
+ *  Packed cell containing (x, y, z), or 0 if it is out of range
+ */
+static uint64_t cellKey(double x, double y, double z, double h) {
+  double c[3] = {floor(x / h), floor(y / h), floor(z / h)};
+  uint64_t key = 0;
+  for (int k = 0; k < 3; k++) {
+    if (!(fabs(c[k]) < ULAM_BIAS))
+      return 0;
+    key = key << 21 | (uint64_t)((int)c[k] + ULAM_BIAS);
+  }
+  return key + 1;
+}
+
+static uint64_t mixKey(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  return k ^ k >> 33;
+}
+
+static int tableGrow(BoxTable *table) {
+  size_t capacity = table->capacity ? 2 * table->capacity : 1 << 16;
+  uint64_t *keys = calloc(capacity, sizeof(uint64_t));
+  int *boxes = malloc(capacity * sizeof(int));
+  if (!keys || !boxes) {
+    free(keys);
+    free(boxes);
+    return 0;
+  }
+  for (size_t i = 0; i < table->capacity; i++)
+    if (table->keys[i]) {
+      size_t slot = mixKey(table->keys[i]) & (capacity - 1);
+      while (keys[slot])
+        slot = (slot + 1) & (capacity - 1);
+      keys[slot] = table->keys[i];
+      boxes[slot] = table->boxes[i];
+    }
+  free(table->keys);
+  free(table->boxes);
+  table->keys = keys;
+  table->boxes = boxes;
+  table->capacity = capacity;
+  return 1;
+}
+
+/*
+ *  Box number of a cell, appending a new box the first time the cell is
+ *  seen. Returns -1 if memory runs out.
+ */
+static int boxOf(UlamOperator *op, BoxTable *table, int *capacity,
+                 uint64_t key) {
+  if (2 * (size_t)op->boxes >= table->capacity && !tableGrow(table))
+    return -1;
+  size_t slot = mixKey(key) & (table->capacity - 1);
+  while (table->keys[slot]) {
+    if (table->keys[slot] == key)
+      return table->boxes[slot];
+    slot = (slot + 1) & (table->capacity - 1);
+  }
+  if (op->boxes == *capacity) {
+    int grown = *capacity ? 2 * *capacity : 1 << 16;
+    int *cell = realloc(op->cell, 3 * (size_t)grown * sizeof(int));
+    if (cell)
+      op->cell = cell;
+    int *rowStart = realloc(op->rowStart, ((size_t)grown + 1) * sizeof(int));
+    if (rowStart)
+      op->rowStart = rowStart;
+    if (!cell || !rowStart)
+      return -1;
+    *capacity = grown;
+  }
+  int box = op->boxes++;
+  table->keys[slot] = key;
+  table->boxes[slot] = box;
+  uint64_t packed = key - 1;
+  for (int k = 2; k >= 0; k--, packed >>= 21)
+    op->cell[3 * box + k] = (int)(packed & ((1 << 21) - 1)) - ULAM_BIAS;
+  return box;
+}
+
+Point3D ulamBoxCenter(const UlamOperator *op, int box) {
+  const int *c = op->cell + 3 * box;
+  return (Point3D){(c[0] + 0.5) * op->h, (c[1] + 0.5) * op->h,
+                   (c[2] + 0.5) * op->h};
+}
+
+/*
+ *  Carry the test points of a run of boxes along the flow for time tau with
+ *  RK4, ULAM_LANES at a time so the step loop vectorizes
+ */
+static void mapRange(void *ctx, int begin, int end, int thread) {
+  MapJob *job = ctx;
+  const UlamConfig *c = job->config;
+  int points = c->points, steps = (int)ceil(c->tau / ULAM_DT);
+  double s = c->s, b = c->b, r = c->r, side = c->h, h = c->tau / steps;
+  double x[ULAM_LANES], y[ULAM_LANES], z[ULAM_LANES];
+  int last = end * ULAM_BLOCK < job->count ? end * ULAM_BLOCK : job->count;
+  size_t p1 = (size_t)last * points;
+  for (size_t p0 = (size_t)begin * ULAM_BLOCK * points; p0 < p1;
+       p0 += ULAM_LANES) {
+    int n = p1 - p0 < ULAM_LANES ? (int)(p1 - p0) : ULAM_LANES;
+    for (int j = 0; j < n; j++) {
+      int box = job->first + (int)((p0 + j) / points);
+      const double *o = job->offset + 3 * ((p0 + j) % points);
+      const int *cell = job->cell + 3 * (size_t)box;
+      x[j] = (cell[0] + o[0]) * side;
+      y[j] = (cell[1] + o[1]) * side;
+      z[j] = (cell[2] + o[2]) * side;
+    }
+    for (int k = 0; k < steps; k++)
+      for (int j = 0; j < n; j++) {
+        double x0 = x[j], y0 = y[j], z0 = z[j];
+        double ax = s * (y0 - x0), ay = x0 * (r - z0) - y0, az = x0 * y0 - b * z0;
+        double x1 = x0 + 0.5 * h * ax, y1 = y0 + 0.5 * h * ay,
+               z1 = z0 + 0.5 * h * az;
+        double bx = s * (y1 - x1), by = x1 * (r - z1) - y1, bz = x1 * y1 - b * z1;
+        double x2 = x0 + 0.5 * h * bx, y2 = y0 + 0.5 * h * by,
+               z2 = z0 + 0.5 * h * bz;
+        double cx = s * (y2 - x2), cy = x2 * (r - z2) - y2, cz = x2 * y2 - b * z2;
+        double x3 = x0 + h * cx, y3 = y0 + h * cy, z3 = z0 + h * cz;
+        double dx = s * (y3 - x3), dy = x3 * (r - z3) - y3, dz = x3 * y3 - b * z3;
+        x[j] = x0 + h / 6 * (ax + 2 * (bx + cx) + dx);
+        y[j] = y0 + h / 6 * (ay + 2 * (by + cy) + dy);
+        z[j] = z0 + h / 6 * (az + 2 * (bz + cz) + dz);
+      }
+    for (int j = 0; j < n; j++)
+      job->dest[p0 + j] = cellKey(x[j], y[j], z[j], side);
+  }
+}
+
+/*
+ *  Counting-sort transpose of P, so both P x and P^T x are row-parallel
+ */
+static int transpose(UlamOperator *op) {
+  int n = op->boxes;
+  op->tStart = calloc((size_t)n + 1, sizeof(int));
+  op->tCol = malloc(op->nonzeros * sizeof(int));
+  op->tVal = malloc(op->nonzeros * sizeof(float));
+  if (!op->tStart || !op->tCol || !op->tVal)
+    return 0;
+  for (long long k = 0; k < op->nonzeros; k++)
+    op->tStart[op->col[k] + 1]++;
+  for (int i = 0; i < n; i++)
+    op->tStart[i + 1] += op->tStart[i];
+  int *fill = malloc(n * sizeof(int));
+  if (!fill)
+    return 0;
+  memcpy(fill, op->tStart, n * sizeof(int));
+  for (int i = 0; i < n; i++)
+    for (int k = op->rowStart[i]; k < op->rowStart[i + 1]; k++) {
+      int slot = fill[op->col[k]]++;
+      op->tCol[slot] = i;
+      op->tVal[slot] = op->val[k];
+    }
+  free(fill);
+  return 1;
+}
+
+/*
+ *  Cover the attractor with boxes and fill in their transitions. Boxes
+ *  along a trajectory seed the covering; every box is then mapped once, in
+ *  parallel batches, and any new box its test points reach joins the queue,
+ *  so the covering closes up under the flow. Rows are appended in box
+ *  order, so the result does not depend on the thread count. Returns 0 on
+ *  bad arguments, allocation failure or more than maxBoxes boxes.
+ */
+int ulamBuild(const UlamConfig *config, UlamOperator *op) {
+  memset(op, 0, sizeof(*op));
+  op->h = config->h;
+  int points = config->points;
+  if (!(config->h > 0) || !(config->tau > 0) || points < 1 ||
+      config->maxBoxes < 1)
+    return 0;
+
+  BoxTable table = {NULL, NULL, 0};
+  int capacity = 0;
+  long long nzCapacity = 0;
+  double *offset = malloc(3 * points * sizeof(double));
+  uint64_t *dest = malloc((size_t)ULAM_BATCH * points * sizeof(uint64_t));
+  int *ids = malloc(points * sizeof(int));
+  int ok = offset && dest && ids;
+
+  // Test points from the additive R3 sequence, well spread in the cube
+  const double g = 1.22074408460575947536;
+  for (int k = 0; ok && k < points; k++)
+    for (int d = 0; d < 3; d++) {
+      double v = 0.5 + (k + 1) / pow(g, d + 1);
+      offset[3 * k + d] = v - floor(v);
+    }
+
+  // Seed boxes along a midpoint-rule trajectory past its transient
+  double x = 1, y = 1, z = 1, h = ULAM_DT;
+  for (int i = 0; ok && i < 22000; i++) {
+    double dx = config->s * (y - x), dy = x * (config->r - z) - y,
+           dz = x * y - config->b * z;
+    double x1 = x + 0.5 * h * dx, y1 = y + 0.5 * h * dy, z1 = z + 0.5 * h * dz;
+    double ex = config->s * (y1 - x1), ey = x1 * (config->r - z1) - y1,
+           ez = x1 * y1 - config->b * z1;
+    x += h * ex;
+    y += h * ey;
+    z += h * ez;
+    uint64_t key = cellKey(x, y, z, config->h);
+    if (i >= 2000 && key)
+      ok = boxOf(op, &table, &capacity, key) >= 0;
+  }
+  ok = ok && op->boxes > 0;
+  if (ok)
+    op->rowStart[0] = 0;
+
+  for (int done = 0, count = 0; ok && done < op->boxes; done += count) {
+    count = op->boxes - done < ULAM_BATCH ? op->boxes - done : ULAM_BATCH;
+    MapJob job = {config, op->cell, done, count, offset, dest};
+    parallelFor((count + ULAM_BLOCK - 1) / ULAM_BLOCK, mapRange, &job);
+
+    for (int i = 0; ok && i < count; i++) {
+      int kept = 0;
+      for (int k = 0; ok && k < points; k++) {
+        uint64_t key = dest[(size_t)i * points + k];
+        if (!key)
+          continue;
+        int id = boxOf(op, &table, &capacity, key);
+        ok = id >= 0 && op->boxes <= config->maxBoxes;
+        // Insertion sort, so equal destinations sit together
+        int at = kept++;
+        for (; at > 0 && ids[at - 1] > id; at--)
+          ids[at] = ids[at - 1];
+        ids[at] = id;
+      }
+      if (ok && op->nonzeros + kept > nzCapacity) {
+        long long grown = nzCapacity ? 2 * nzCapacity : 1 << 20;
+        int *col = realloc(op->col, grown * sizeof(int));
+        if (col)
+          op->col = col;
+        float *val = realloc(op->val, grown * sizeof(float));
+        if (val)
+          op->val = val;
+        ok = col && val && grown < INT32_MAX;
+        nzCapacity = grown;
+      }
+      for (int k = 0; ok && k < kept;) {
+        int run = 1;
+        while (k + run < kept && ids[k + run] == ids[k])
+          run++;
+        op->col[op->nonzeros] = ids[k];
+        op->val[op->nonzeros++] = (float)run / kept;
+        k += run;
+      }
+      if (ok)
+        op->rowStart[done + i + 1] = (int)op->nonzeros;
+    }
+  }
+  ok = ok && transpose(op);
+
+  free(table.keys);
+  free(table.boxes);
+  free(offset);
+  free(dest);
+  free(ids);
+  return ok;
+}
+
+void ulamFree(UlamOperator *op) {
+  free(op->cell);
+  free(op->rowStart);
+  free(op->col);
+  free(op->val);
+  free(op->tStart);
+  free(op->tCol);
+  free(op->tVal);
+  memset(op, 0, sizeof(*op));
+}
+
+static void spmvRange(void *ctx, int begin, int end, int thread) {
+  SpmvJob *job = ctx;
+  int last = end * ULAM_SPMV_ROWS < job->rows ? end * ULAM_SPMV_ROWS
+                                              : job->rows;
+  for (int i = begin * ULAM_SPMV_ROWS; i < last; i++) {
+    double sum = 0;
+    for (int k = job->start[i]; k < job->start[i + 1]; k++)
+      sum += job->val[k] * job->x[job->col[k]];
+    job->y[i] = sum;
+  }
+}
+
+/*
+ *  y = A x for a matrix in compressed sparse rows, rows spread across
+ *  threads; each row is summed by one thread so the result is exact
+ *  regardless of the thread count
+ */
+static void spmv(const int *start, const int *col, const float *val, int rows,
+                 const double *x, double *y) {
+  SpmvJob job = {start, col, val, x, y, rows};
+  parallelFor((rows + ULAM_SPMV_ROWS - 1) / ULAM_SPMV_ROWS, spmvRange, &job);
+}
+
+/*
+ *  Eigen-decomposition of a small symmetric matrix by cyclic Jacobi
+ *  rotations; a is destroyed, its diagonal left holding the eigenvalues,
+ *  and the columns of v are the eigenvectors
+ */
+static void jacobiEigen(double *a, double *v, int m) {
+  for (int i = 0; i < m * m; i++)
+    v[i] = i % (m + 1) == 0;
+  for (int sweep = 0; sweep < 50; sweep++) {
+    double off = 0;
+    for (int p = 0; p < m; p++)
+      for (int q = p + 1; q < m; q++)
+        off += a[p * m + q] * a[p * m + q];
+    if (off < 1e-30)
+      break;
+    for (int p = 0; p < m; p++)
+      for (int q = p + 1; q < m; q++) {
+        if (a[p * m + q] == 0)
+          continue;
+        double theta = (a[q * m + q] - a[p * m + p]) / (2 * a[p * m + q]);
+        double t = (theta >= 0 ? 1 : -1) /
+                   (fabs(theta) + sqrt(theta * theta + 1));
+        double c = 1 / sqrt(t * t + 1), s = t * c;
+        for (int k = 0; k < m; k++) {
+          double akp = a[k * m + p], akq = a[k * m + q];
+          a[k * m + p] = c * akp - s * akq;
+          a[k * m + q] = s * akp + c * akq;
+        }
+        for (int k = 0; k < m; k++) {
+          double apk = a[p * m + k], aqk = a[q * m + k];
+          a[p * m + k] = c * apk - s * aqk;
+          a[q * m + k] = s * apk + c * aqk;
+        }
+        for (int k = 0; k < m; k++) {
+          double vkp = v[k * m + p], vkq = v[k * m + q];
+          v[k * m + p] = c * vkp - s * vkq;
+          v[k * m + q] = s * vkp + c * vkq;
+        }
+      }
+  }
+}
+
+static void dotRange(void *ctx, int begin, int end, int thread) {
+  OrthoJob *job = ctx;
+  for (int block = begin; block < end; block++) {
+    int i0 = block * ULAM_SPMV_ROWS;
+    int i1 = i0 + ULAM_SPMV_ROWS < job->rows ? i0 + ULAM_SPMV_ROWS : job->rows;
+    for (int k = 0; k < job->count; k++) {
+      const double *q = job->vectors[k];
+      double sum = 0;
+      for (int i = i0; i < i1; i++)
+        sum += job->v[i] * q[i];
+      job->partial[block * job->count + k] = sum;
+    }
+  }
+}
+
+static void projectRange(void *ctx, int begin, int end, int thread) {
+  OrthoJob *job = ctx;
+  for (int block = begin; block < end; block++) {
+    int i0 = block * ULAM_SPMV_ROWS;
+    int i1 = i0 + ULAM_SPMV_ROWS < job->rows ? i0 + ULAM_SPMV_ROWS : job->rows;
+    for (int k = 0; k < job->count; k++) {
+      const double *q = job->vectors[k];
+      double c = job->coef[k];
+      for (int i = i0; i < i1; i++)
+        job->v[i] -= c * q[i];
+    }
+  }
+}
+
+static double norm2(const double *v, int n) {
+  double sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += v[i] * v[i];
+  return sqrt(sum);
+}
+
+/*
+ *  Remove the components of v along `count` orthonormal vectors by
+ *  classical Gram-Schmidt, repeated once if cancellation lost more than
+ *  a third of the norm, and return the norm left. The removed coefficients
+ *  go to coef. Dot products are summed per row block and then in block
+ *  order, so the result does not depend on the thread count.
+ */
+static double orthogonalize(const double *const *vectors, int count,
+                            double *v, int n, double *coef, double *partial) {
+  int blocks = (n + ULAM_SPMV_ROWS - 1) / ULAM_SPMV_ROWS;
+  double pass[ULAM_KRYLOV + 2];
+  OrthoJob job = {vectors, count, v, n, partial, pass};
+  double before = norm2(v, n), after = before;
+  for (int k = 0; k < count; k++)
+    coef[k] = 0;
+  for (int repeat = 0; repeat < 2 && after > 0; repeat++) {
+    parallelFor(blocks, dotRange, &job);
+    for (int k = 0; k < count; k++) {
+      pass[k] = 0;
+      for (int b = 0; b < blocks; b++)
+        pass[k] += partial[b * count + k];
+      coef[k] += pass[k];
+    }
+    parallelFor(blocks, projectRange, &job);
+    after = norm2(v, n);
+    if (after > M_SQRT1_2 * before)
+      break;
+    before = after;
+  }
+  return after;
+}
+
+/*
+ *  w = S u for S = D^1/2 R D^-1/2, where R = (P + P*) / 2 and P* is the time
+ *  reversal of P under the density (D = diag(density)); S is symmetric
+ */
+static void applySymmetric(const UlamOperator *op, const double *sq,
+                           const double *isq, const double *u, double *w,
+                           double *t, double *c) {
+  int n = op->boxes;
+  for (int i = 0; i < n; i++)
+    t[i] = isq[i] * u[i];
+  spmv(op->rowStart, op->col, op->val, n, t, w);
+  for (int i = 0; i < n; i++)
+    t[i] = sq[i] * u[i];
+  spmv(op->tStart, op->tCol, op->tVal, n, t, c);
+  for (int i = 0; i < n; i++)
+    w[i] = 0.5 * (sq[i] * w[i] + isq[i] * c[i]);
+}
+
+static void ritzRange(void *ctx, int begin, int end, int thread) {
+  RitzJob *job = ctx;
+  double sum[ULAM_KEEP];
+  int last = end * ULAM_SPMV_ROWS < job->rows ? end * ULAM_SPMV_ROWS
+                                              : job->rows;
+  for (int i = begin * ULAM_SPMV_ROWS; i < last; i++) {
+    for (int l = 0; l < job->keep; l++)
+      sum[l] = 0;
+    for (int j = 0; j < job->steps; j++) {
+      double q = job->basis[(size_t)j * job->rows + i];
+      for (int l = 0; l < job->keep; l++)
+        sum[l] += job->y[j * job->keep + l] * q;
+    }
+    for (int l = 0; l < job->keep; l++)
+      job->basis[(size_t)l * job->rows + i] = sum[l];
+  }
+}
+
+/*
+ *  Replace the first `keep` of `steps` basis vectors by the Ritz vectors
+ *  with coordinates y, in place: each row only mixes its own entries
+ */
+static void ritzVectors(double *basis, int steps, int keep, int rows,
+                        const double *y) {
+  RitzJob job = {basis, steps, keep, rows, y};
+  parallelFor((rows + ULAM_SPMV_ROWS - 1) / ULAM_SPMV_ROWS, ritzRange, &job);
+}
+
+/*
+ *  Invariant density by power iteration on P^T, then the second eigenvector
+ *  of the reversible part of P. That operator is self-adjoint, so after the
+ *  symmetric similarity transform thick-restart Lanczos applies. The basis
+ *  is kept orthogonal to the known top eigenvector sqrt(density) and grows
+ *  to ULAM_KRYLOV vectors. It then shrinks to the ULAM_KEEP leading Ritz
+ *  vectors plus the residual, whose projected matrix is an arrowhead. Each
+ *  step reorthogonalizes only against the vectors T couples it to and the
+ *  converged Ritz vectors; Simon's recurrence estimates the orthogonality
+ *  lost to the others, and past sqrt(eps) the next two vectors get a full
+ *  pass. The sign of the second eigenvector splits the boxes into two
+ *  almost-invariant sets. maxIterations bounds each stage's operator
+ *  applications. Returns 1 when both stages reach tol, -1 when one runs out
+ *  of iterations first (spec then holds the last estimates and must still
+ *  be freed), and 0 on allocation failure.
+ */
+int ulamEigen(const UlamOperator *op, int maxIterations, double tol,
+              UlamSpectrum *spec) {
+  int n = op->boxes, m = n - 1 < ULAM_KRYLOV ? n - 1 : ULAM_KRYLOV;
+  int keep = m / 2 < ULAM_KEEP ? m / 2 : ULAM_KEEP;
+  memset(spec, 0, sizeof(*spec));
+  double t0 = wallTime();
+  spec->density = malloc(n * sizeof(double));
+  spec->second = malloc(n * sizeof(double));
+  double *work = malloc((5 + (size_t)m + 1) * n * sizeof(double));
+  double *small = malloc(2 * (size_t)m * m * sizeof(double));
+  int blocks = (n + ULAM_SPMV_ROWS - 1) / ULAM_SPMV_ROWS;
+  double *partial = malloc((size_t)blocks * (ULAM_KRYLOV + 2) * sizeof(double));
+  if (!spec->density || !spec->second || !work || !small || !partial ||
+      n < 3) {
+    free(work);
+    free(small);
+    free(partial);
+    ulamSpectrumFree(spec);
+    return 0;
+  }
+  double *pi = spec->density, *u = spec->second;
+  double *w = work, *c = w + n, *t = c + n, *sq = t + n, *isq = sq + n;
+  double *basis = isq + n;
+  // T: alpha on the diagonal, beta below it from the first Lanczos vector
+  // on, couple joining each kept Ritz vector to the residual after them
+  double alpha[ULAM_KRYLOV], beta[ULAM_KRYLOV], couple[ULAM_KEEP];
+  double coef[ULAM_KRYLOV + 2], y[ULAM_KRYLOV * ULAM_KEEP];
+  // Estimated overlap of the last two Lanczos vectors with earlier ones
+  double omega[2][ULAM_KRYLOV + 1], *prev = omega[0], *cur = omega[1];
+  int order[ULAM_KRYLOV];
+  // Projection lists: sqrt(density) then every basis vector, and
+  // sqrt(density), the kept Ritz vectors and the last two Lanczos vectors
+  const double *vectors[ULAM_KRYLOV + 2] = {sq}, *local[ULAM_KEEP + 3];
+  for (int k = 0; k <= m; k++)
+    vectors[k + 1] = basis + (size_t)k * n;
+
+  for (int i = 0; i < n; i++)
+    pi[i] = 1.0 / n;
+  int it = 0;
+  double diff = INFINITY;
+  for (; it < maxIterations && diff > tol; it++) {
+    spmv(op->tStart, op->tCol, op->tVal, n, pi, w);
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+      sum += w[i];
+    diff = 0;
+    for (int i = 0; i < n; i++) {
+      diff += fabs(w[i] / sum - pi[i]);
+      pi[i] = w[i] / sum;
+    }
+  }
+  spec->iterations[0] = it;
+  spec->residual[0] = diff;
+  spec->seconds[0] = wallTime() - t0;
+  t0 = wallTime();
+
+  // Any start outside the top eigenvector will do; x breaks the symmetry
+  for (int i = 0; i < n; i++) {
+    sq[i] = sqrt(pi[i]);
+    isq[i] = pi[i] > 0 ? 1 / sq[i] : 0.0;
+    u[i] = (op->cell[3 * i] + 0.5) * sq[i];
+  }
+  memcpy(basis, u, n * sizeof(double));
+  double norm = orthogonalize(vectors, 1, basis, n, coef, partial);
+  double theta = 0, residual = INFINITY;
+  for (int i = 0; i < n && norm > 0; i++)
+    basis[i] /= norm;
+  // Basis vectors 0..j exist, the first kept of them Ritz vectors. T stays
+  // accurate while overlaps stay below semi, and a Ritz vector whose
+  // residual is below it is converged
+  int kept = 0, j = 0, full = 0;
+  double semi = sqrt(DBL_EPSILON);
+  cur[0] = 1;
+  it = 0;
+  while (norm > 0) {
+    // q_j+1 from S q_j, made orthogonal to sqrt(density) and to the basis
+    // vectors T couples q_j to, or to all of them on a full pass
+    double *q = basis + (size_t)j * n, *next = q + n;
+    applySymmetric(op, sq, isq, q, next, t, c);
+    it++;
+    int count = 0;
+    local[count++] = sq;
+    for (int k = 0; k < kept; k++)
+      if (j == kept || fabs(couple[k]) < semi)
+        local[count++] = vectors[k + 1];
+    if (j > kept)
+      local[count++] = vectors[j];
+    local[count++] = q;
+    if (full) {
+      norm = orthogonalize(vectors, j + 2, next, n, coef, partial);
+      alpha[j] = coef[j + 1];
+    } else {
+      norm = orthogonalize(local, count, next, n, coef, partial);
+      alpha[j] = coef[count - 1];
+    }
+    beta[j] = norm;
+
+    // Simon's recurrence for the overlap of q_j+1 with q_0..q_j-1, read
+    // off T: S q_i is theta_i q_i + couple_i q_kept for a kept Ritz vector
+    double worst = 0;
+    for (int i = 0; i < j && !full && norm > 0; i++) {
+      double o;
+      if (i < kept && (j == kept || fabs(couple[i]) < semi)) {
+        prev[i] = DBL_EPSILON;
+        continue;
+      } else if (i < kept)
+        o = (alpha[i] - alpha[j]) * cur[i] + couple[i] * cur[kept];
+      else {
+        o = beta[i] * cur[i + 1] + (alpha[i] - alpha[j]) * cur[i];
+        if (i > kept)
+          o += beta[i - 1] * cur[i - 1];
+        for (int l = 0; l < kept && i == kept; l++)
+          o += couple[l] * cur[l];
+      }
+      if (j > kept)
+        o -= beta[j - 1] * prev[i];
+      prev[i] = (o + copysign(2 * DBL_EPSILON, o)) / norm;
+      worst = fmax(worst, fabs(prev[i]));
+    }
+    if (full || worst > semi) {
+      if (!full)
+        beta[j] = norm = orthogonalize(vectors, j + 2, next, n, coef,
+                                       partial);
+      for (int i = 0; i < j; i++)
+        prev[i] = DBL_EPSILON;
+      full = !full;
+    }
+    prev[j] = DBL_EPSILON;
+    prev[j + 1] = 1;
+    double *swap = prev;
+    prev = cur;
+    cur = swap;
+    int steps = ++j;
+    if (norm < 1e-14)
+      norm = 0;
+    else
+      for (int i = 0; i < n; i++)
+        next[i] /= norm;
+    if (steps < m && it < maxIterations && norm > 0)
+      continue;
+
+    // Ritz pairs of T, largest first
+    double *tri = small, *vec = small + (size_t)m * m;
+    memset(tri, 0, (size_t)steps * steps * sizeof(double));
+    for (int i = 0; i < steps; i++) {
+      tri[i * steps + i] = alpha[i];
+      if (i < kept)
+        tri[i * steps + kept] = tri[kept * steps + i] = couple[i];
+      else if (i + 1 < steps)
+        tri[i * steps + i + 1] = tri[(i + 1) * steps + i] = beta[i];
+    }
+    jacobiEigen(tri, vec, steps);
+    for (int i = 0; i < steps; i++) {
+      int k = i;
+      double value = tri[i * steps + i];
+      for (; k > 0 && tri[order[k - 1] * (steps + 1)] < value; k--)
+        order[k] = order[k - 1];
+      order[k] = i;
+    }
+    theta = tri[order[0] * steps + order[0]];
+    residual = fabs(beta[steps - 1] * vec[(steps - 1) * steps + order[0]]);
+    if (residual <= tol || it >= maxIterations || norm == 0) {
+      for (int i = 0; i < steps; i++)
+        y[i] = vec[i * steps + order[0]];
+      ritzVectors(basis, steps, 1, n, y);
+      memcpy(u, basis, n * sizeof(double));
+      break;
+    }
+
+    // Restart from the leading Ritz vectors and the residual q_steps
+    for (int i = 0; i < steps; i++)
+      for (int l = 0; l < keep; l++)
+        y[i * keep + l] = vec[i * steps + order[l]];
+    ritzVectors(basis, steps, keep, n, y);
+    for (int l = 0; l < keep; l++) {
+      alpha[l] = tri[order[l] * steps + order[l]];
+      couple[l] = beta[steps - 1] * vec[(steps - 1) * steps + order[l]];
+    }
+    // The residual is only as orthogonal to the Ritz vectors as the basis
+    // was, so the new cycle starts from a full pass
+    q = basis + (size_t)keep * n;
+    memcpy(q, next, n * sizeof(double));
+    norm = orthogonalize(vectors, keep + 1, q, n, coef, partial);
+    for (int i = 0; i < n; i++)
+      q[i] /= norm;
+    kept = j = keep;
+    for (int l = 0; l < keep; l++)
+      cur[l] = DBL_EPSILON;
+    cur[j] = 1;
+    full = 0;
+  }
+  spec->iterations[1] = it;
+  spec->residual[1] = residual;
+  spec->lambda2 = theta;
+  for (int i = 0; i < n; i++)
+    u[i] *= isq[i];
+  free(work);
+  free(small);
+  free(partial);
+  spec->seconds[1] = wallTime() - t0;
+  return diff <= tol && residual <= tol ? 1 : -1;
+}
+
+void ulamSpectrumFree(UlamSpectrum *spec) {
+  free(spec->density);
+  free(spec->second);
+  spec->density = spec->second = NULL;
+}
+
+/*
+ *  ulam [h [tau [points [file.csv]]]]: build the transfer operator on boxes
+ *  of side h, report its leading spectrum and the almost-invariant split,
+ *  and optionally write box centers with density and second eigenvector
+ */
+int ulamCommand(int argc, char *argv[]) {
+  UlamConfig config;
+  ulamDefaultConfig(&config, 10.0, 8.0 / 3.0, 28.0,
+                    argc > 1 ? atof(argv[1]) : 0.5);
+  if (argc > 2)
+    config.tau = atof(argv[2]);
+  if (argc > 3)
+    config.points = atoi(argv[3]);
+  const char *path = argc > 4 ? argv[4] : NULL;
+
+  UlamOperator op;
+  double t0 = wallTime();
+  int ok = ulamBuild(&config, &op);
+  double t = wallTime() - t0;
+  if (!ok) {
+    fprintf(stderr,
+            "ulam: need h > 0, tau > 0, points >= 1 and at most %d boxes "
+            "(reached %d)\n",
+            config.maxBoxes, op.boxes);
+    ulamFree(&op);
+    return 1;
+  }
+  double bytes = op.boxes * (3.0 + 2.0) * sizeof(int) +
+                 2.0 * op.nonzeros * (sizeof(int) + sizeof(float));
+  printf("Ulam operator h=%g tau=%g, %d points/box, threads=%d: %d boxes, "
+         "%lld nonzeros (%.1f per row, %.1f MB), %.3f s (%.3e test "
+         "points/s)\n",
+         config.h, config.tau, config.points, parallelThreads(), op.boxes,
+         op.nonzeros, (double)op.nonzeros / op.boxes, bytes / 1048576, t,
+         (double)op.boxes * config.points / t);
+
+  UlamSpectrum spec;
+  int maxIterations = 20000;
+  double tol = 1e-7;
+  int solved = ulamEigen(&op, maxIterations, tol, &spec);
+  if (!solved) {
+    fprintf(stderr, "ulam: out of memory\n");
+    ulamFree(&op);
+    return 1;
+  }
+  double seconds = spec.seconds[0] + spec.seconds[1];
+  int spmvs = spec.iterations[0] + 2 * spec.iterations[1];
+  printf("Eigenvectors: %d + %d iterations, %.3f + %.3f s (%.3e "
+         "nonzeros/s), lambda2 = %.6f\n",
+         spec.iterations[0], spec.iterations[1], spec.seconds[0],
+         spec.seconds[1], spmvs * (double)op.nonzeros / seconds,
+         spec.lambda2);
+  if (solved < 0) {
+    fprintf(stderr,
+            "ulam: not converged to %g in %d iterations (density change "
+            "%.1e, Ritz residual %.1e)\n",
+            tol, maxIterations, spec.residual[0], spec.residual[1]);
+    ok = 0;
+  }
+
+  // Mass, mean x and probability of staying for each sign of the second
+  // eigenvector
+  double mass[2] = {0, 0}, meanX[2] = {0, 0}, stay[2] = {0, 0};
+  for (int i = 0; i < op.boxes; i++) {
+    int side = spec.second[i] > 0;
+    mass[side] += spec.density[i];
+    meanX[side] += spec.density[i] * ulamBoxCenter(&op, i).x;
+    for (int k = op.rowStart[i]; k < op.rowStart[i + 1]; k++)
+      if ((spec.second[op.col[k]] > 0) == side)
+        stay[side] += spec.density[i] * op.val[k];
+  }
+  for (int side = 1; side >= 0; side--)
+    printf("  set %c: mass %.4f, mean x %+.3f, stays over tau with "
+           "probability %.4f\n",
+           side ? '+' : '-', mass[side],
+           mass[side] > 0 ? meanX[side] / mass[side] : 0.0,
+           mass[side] > 0 ? stay[side] / mass[side] : 0.0);
+
+  if (path) {
+    FILE *file = fopen(path, "w");
+    if (file) {
+      fprintf(file, "x,y,z,density,second\n");
+      for (int i = 0; i < op.boxes; i++) {
+        Point3D p = ulamBoxCenter(&op, i);
+        fprintf(file, "%g,%g,%g,%.6e,%.6e\n", p.x, p.y, p.z, spec.density[i],
+                spec.second[i]);
+      }
+      fclose(file);
+      printf("Wrote %s\n", path);
+    } else
+      ok = 0;
+  }
+  ulamSpectrumFree(&spec);
+  ulamFree(&op);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+#ifndef ULAM_H
+#define ULAM_H
+
+#include "state.h"
+
+// Ulam approximation of the Lorenz transfer operator: phase space is cut
+// into cubes of side h and P_ij is the fraction of test points of box i
+// that the flow carries into box j in time tau
+typedef struct {
+  double s, b, r;
+  double h;     // Box side
+  double tau;   // Flow time of one transition
+  int points;   // Test points per box
+  int maxBoxes; // Give up if the covering grows past this
+} UlamConfig;
+
+// Boxes reached from a trajectory and P in compressed sparse rows, along
+// with its transpose; memory grows with the nonzeros
+typedef struct {
+  int boxes;
+  long long nonzeros;
+  double h;
+  int *cell;      // Integer coordinates of each box, 3 per box
+  int *rowStart;  // P: row i in [rowStart[i], rowStart[i + 1])
+  int *col;
+  float *val;
+  int *tStart;    // Transpose of P
+  int *tCol;
+  float *tVal;
+} UlamOperator;
+
+typedef struct {
+  double *density;    // Invariant density over the boxes, summing to 1
+  double *second;     // Second eigenvector of the reversible part of P
+  double lambda2;     // Its eigenvalue; near 1 for almost-invariant sets
+  int iterations[2];  // SpMV iterations for density and second
+  double residual[2]; // Last change in density, Ritz residual of second
+  double seconds[2];  // Time for density and second
+} UlamSpectrum;
+
+void ulamDefaultConfig(UlamConfig *config, double s, double b, double r,
+                       double h);
+int ulamBuild(const UlamConfig *config, UlamOperator *op);
+void ulamFree(UlamOperator *op);
+Point3D ulamBoxCenter(const UlamOperator *op, int box);
+int ulamEigen(const UlamOperator *op, int maxIterations, double tol,
+              UlamSpectrum *spec);
+void ulamSpectrumFree(UlamSpectrum *spec);
+int ulamCommand(int argc, char *argv[]);
+
+#endif // ULAM_H
@@ -0,0 +1,417 @@
+#include "upo.h"
+#include "lorenz.h"
+#include "mat3.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UPO_DT 0.005        // Largest RK4 step along a candidate orbit
+#define UPO_MAX_ITER 40     // Newton iterations per candidate
+#define UPO_TOL 1e-8        // Converged once |phi_T(x) - x| is below this
+#define UPO_MAX_PERIOD 40.0 // Candidates drifting past this are dropped
+
+// Close return on the section: start point and return time
+typedef struct {
+  double x[3];
+  double T;
+} Seed;
+
+typedef struct {
+  const UpoConfig *config;
+  const Seed *seeds;
+  PeriodicOrbit *found;
+  char *ok;
+} SearchJob;
+
+static void field(const UpoConfig *c, const double x[3], double f[3]) {
+  f[0] = c->s * (x[1] - x[0]);
+  f[1] = x[0] * (c->r - x[2]) - x[1];
+  f[2] = x[0] * x[1] - c->b * x[2];
+}
+
+static void jacobian(const UpoConfig *c, const double x[3], double J[3][3]) {
+  J[0][0] = -c->s;
+  J[0][1] = c->s;
+  J[0][2] = 0;
+  J[1][0] = c->r - x[2];
+  J[1][1] = -1;
+  J[1][2] = -x[0];
+  J[2][0] = x[1];
+  J[2][1] = x[0];
+  J[2][2] = -c->b;
+}
+
+/*
+ *  RK4 flow of x0 for time T together with the monodromy matrix
+ *  M = d(end)/d(x0); f is the vector field at the end point
+ */
+static void flowMap(const UpoConfig *c, const double x0[3], double T,
+                    double end[3], double M[3][3], double f[3]) {
+  int n = (int)ceil(T / UPO_DT);
+  double h = T / n;
+  double x[3] = {x0[0], x0[1], x0[2]};
+  double P[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+  for (int step = 0; step < n; step++) {
+    double k[4][3], K[4][3][3], xs[3], Ps[3][3], J[3][3];
+    for (int st = 0; st < 4; st++) {
+      double a = st == 0 ? 0 : st == 3 ? h : 0.5 * h;
+      for (int i = 0; i < 3; i++) {
+        xs[i] = st ? x[i] + a * k[st - 1][i] : x[i];
+        for (int j = 0; j < 3; j++)
+          Ps[i][j] = st ? P[i][j] + a * K[st - 1][i][j] : P[i][j];
+      }
+      field(c, xs, k[st]);
+      jacobian(c, xs, J);
+      mat3Mul(J, Ps, K[st]);
+    }
+    for (int i = 0; i < 3; i++) {
+      x[i] += h / 6 * (k[0][i] + 2 * (k[1][i] + k[2][i]) + k[3][i]);
+      for (int j = 0; j < 3; j++)
+        P[i][j] +=
+            h / 6 * (K[0][i][j] + 2 * (K[1][i][j] + K[2][i][j]) + K[3][i][j]);
+    }
+  }
+  memcpy(end, x, sizeof(x));
+  memcpy(M, P, sizeof(P));
+  field(c, end, f);
+}
+
+static void rk4Step(const UpoConfig *c, double x[3], double h) {
+  double k1[3], k2[3], k3[3], k4[3], t[3];
+  field(c, x, k1);
+  for (int i = 0; i < 3; i++)
+    t[i] = x[i] + 0.5 * h * k1[i];
+  field(c, t, k2);
+  for (int i = 0; i < 3; i++)
+    t[i] = x[i] + 0.5 * h * k2[i];
+  field(c, t, k3);
+  for (int i = 0; i < 3; i++)
+    t[i] = x[i] + h * k3[i];
+  field(c, t, k4);
+  for (int i = 0; i < 3; i++)
+    x[i] += h / 6 * (k1[i] + 2 * (k2[i] + k3[i]) + k4[i]);
+}
+
+static double residual(const double x[3], const double end[3]) {
+  double dx = end[0] - x[0], dy = end[1] - x[1], dz = end[2] - x[2];
+  return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+/*
+ *  Sign of x at each maximum of z over one period; returns the number of
+ *  symbols, or -1 if there are more than UPO_MAX_SYMBOLS
+ */
+static int itinerary(const UpoConfig *c, const double x0[3], double T,
+                     char *word) {
+  int n = (int)ceil(T / UPO_DT), len = 0;
+  double h = T / n, x[3] = {x0[0], x0[1], x0[2]}, f[3];
+  field(c, x, f);
+  double dzPrev = f[2];
+  for (int step = 0; step < n; step++) {
+    rk4Step(c, x, h);
+    field(c, x, f);
+    if (dzPrev > 0 && f[2] <= 0) {
+      if (len == UPO_MAX_SYMBOLS)
+        return -1;
+      word[len++] = x[0] < 0 ? 'L' : 'R';
+    }
+    dzPrev = f[2];
+  }
+  word[len] = 0;
+  return len;
+}
+
+/*
+ *  Rotate word to its lexicographically smallest rotation; returns 0 if
+ *  the word repeats a shorter one (the orbit was traversed several times)
+ */
+static int canonicalWord(char *word, int len) {
+  for (int p = 1; p < len; p++)
+    if (len % p == 0 && !memcmp(word, word + p, len - p))
+      return 0;
+  int best = 0;
+  for (int k = 1; k < len; k++)
+    for (int i = 0; i < len; i++) {
+      char a = word[(k + i) % len], b = word[(best + i) % len];
+      if (a != b) {
+        if (a < b)
+          best = k;
+        break;
+      }
+    }
+  char rotated[UPO_MAX_SYMBOLS + 1];
+  for (int i = 0; i < len; i++)
+    rotated[i] = word[(best + i) % len];
+  memcpy(word, rotated, len);
+  return 1;
+}
+
+/*
+ *  Damped Newton on phi_T(x) = x with x held on the section z = r - 1:
+ *  unknowns (x, y, T), halving the step until the residual drops
+ */
+static int refine(const UpoConfig *c, const Seed *seed, PeriodicOrbit *orbit) {
+  double x[3] = {seed->x[0], seed->x[1], c->r - 1}, T = seed->T;
+  double end[3], M[3][3], f[3];
+  flowMap(c, x, T, end, M, f);
+  double res = residual(x, end);
+
+  for (int it = 0; it < UPO_MAX_ITER && !(res < UPO_TOL); it++) {
+    double A[3][3], Ai[3][3], R[3], d[3];
+    for (int i = 0; i < 3; i++) {
+      A[i][0] = M[i][0] - (i == 0);
+      A[i][1] = M[i][1] - (i == 1);
+      A[i][2] = f[i];
+      R[i] = x[i] - end[i];
+    }
+    if (!mat3Invert(A, Ai))
+      return 0;
+    mat3Vec(Ai, R, d);
+
+    int accepted = 0;
+    for (double alpha = 1; alpha > 1.0 / 1024 && !accepted; alpha *= 0.5) {
+      double xt[3] = {x[0] + alpha * d[0], x[1] + alpha * d[1], x[2]};
+      double Tt = T + alpha * d[2], endT[3], MT[3][3], fT[3];
+      if (!(Tt > 0 && Tt < UPO_MAX_PERIOD && fabs(xt[0]) < 1e3 &&
+            fabs(xt[1]) < 1e3))
+        continue;
+      flowMap(c, xt, Tt, endT, MT, fT);
+      double resT = residual(xt, endT);
+      if (resT < res) {
+        memcpy(x, xt, sizeof(x));
+        memcpy(end, endT, sizeof(end));
+        memcpy(M, MT, sizeof(M));
+        memcpy(f, fT, sizeof(f));
+        T = Tt;
+        res = resT;
+        accepted = 1;
+      }
+    }
+    if (!accepted)
+      return 0;
+  }
+  // Points next to C+ or C- satisfy the equations for any T; drop them
+  if (!(res < UPO_TOL) || sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]) < 1e-2)
+    return 0;
+
+  int len = itinerary(c, x, T, orbit->itinerary);
+  if (len < 1 || !canonicalWord(orbit->itinerary, len))
+    return 0;
+  memcpy(orbit->x, x, sizeof(x));
+  orbit->period = T;
+
+  // One multiplier is 1 (along the flow) and the product of all three is
+  // exp(-(s + 1 + b) T), so the unstable one comes from the trace and the
+  // stable one from that product
+  double sum = M[0][0] + M[1][1] + M[2][2] - 1;
+  double prod = exp(-(c->s + 1 + c->b) * T);
+  double disc = sum * sum - 4 * prod;
+  if (disc >= 0) {
+    double big = 0.5 * (sum + (sum >= 0 ? 1 : -1) * sqrt(disc));
+    orbit->multipliers[0] = big;
+    orbit->multipliers[1] = prod / big;
+  } else
+    orbit->multipliers[0] = orbit->multipliers[1] = sqrt(prod);
+  return 1;
+}
+
+static void searchRange(void *ctx, int begin, int end, int thread) {
+  SearchJob *job = ctx;
+  for (int i = begin; i < end; i++)
+    job->ok[i] = (char)refine(job->config, &job->seeds[i], &job->found[i]);
+}
+
+static int compareOrbits(const void *a, const void *b) {
+  const PeriodicOrbit *p = a, *q = b;
+  size_t lp = strlen(p->itinerary), lq = strlen(q->itinerary);
+  if (lp != lq)
+    return lp < lq ? -1 : 1;
+  int cmp = strcmp(p->itinerary, q->itinerary);
+  if (cmp)
+    return cmp;
+  return (p->period > q->period) - (p->period < q->period);
+}
+
+static int sameOrbit(const PeriodicOrbit *p, const PeriodicOrbit *q) {
+  return !strcmp(p->itinerary, q->itinerary) &&
+         fabs(p->period - q->period) < 1e-6 * p->period;
+}
+
+/*
+ *  Close returns to z = r - 1 (crossed going up) within config->eps after
+ *  at most maxLoops returns; returns the number of seeds written, or -1 on
+ *  allocation failure
+ */
+static int findSeeds(const UpoConfig *c, const Point3D *points, int count,
+                     double dt, Seed *seeds, int maxSeeds) {
+  double level = c->r - 1;
+  int crossings = 0, n = 0;
+  Seed *hits = malloc((size_t)count * sizeof(Seed));
+  if (!hits)
+    return -1;
+  for (int i = 0; i + 1 < count; i++)
+    if (points[i].z < level && points[i + 1].z >= level) {
+      double a = (level - points[i].z) / (points[i + 1].z - points[i].z);
+      Seed *h = &hits[crossings++];
+      h->x[0] = points[i].x + a * (points[i + 1].x - points[i].x);
+      h->x[1] = points[i].y + a * (points[i + 1].y - points[i].y);
+      h->x[2] = level;
+      h->T = (i + a) * dt;
+    }
+  for (int k = 0; k < crossings && n < maxSeeds; k++)
+    for (int l = 1; l <= c->maxLoops && k + l < crossings && n < maxSeeds;
+         l++) {
+      double dx = hits[k + l].x[0] - hits[k].x[0];
+      double dy = hits[k + l].x[1] - hits[k].x[1];
+      if (dx * dx + dy * dy < c->eps * c->eps) {
+        seeds[n] = hits[k];
+        seeds[n++].T = hits[k + l].T - hits[k].T;
+      }
+    }
+  free(hits);
+  return n;
+}
+
+/*
+ *  Classic parameters for seeding: orbits up to 8 loops from returns
+ *  within 1 unit
+ */
+void upoDefaultConfig(UpoConfig *config, double s, double b, double r) {
+  config->s = s;
+  config->b = b;
+  config->r = r;
+  config->eps = 1.0;
+  config->maxLoops = 8;
+  config->maxCandidates = 20000;
+}
+
+/*
+ *  Seed from close returns of a sampled trajectory (time step dt), refine
+ *  the seeds concurrently and merge new orbits into the catalogue. Returns
+ *  the number of candidates refined, or -1 on allocation failure.
+ */
+int upoSearch(const UpoConfig *config, const Point3D *points, int count,
+              double dt, UpoCatalogue *catalogue) {
+  Seed *seeds = malloc((size_t)config->maxCandidates * sizeof(Seed));
+  if (!seeds)
+    return -1;
+  int n = findSeeds(config, points, count, dt, seeds, config->maxCandidates);
+  if (n < 0) {
+    free(seeds);
+    return -1;
+  }
+  size_t total = (size_t)catalogue->count + n;
+  PeriodicOrbit *found = malloc((total > 0 ? total : 1) * sizeof(PeriodicOrbit));
+  char *ok = malloc(n > 0 ? n : 1);
+  if (!found || !ok) {
+    free(seeds);
+    free(found);
+    free(ok);
+    return -1;
+  }
+
+  SearchJob job = {config, seeds, found + catalogue->count, ok};
+  parallelFor(n, searchRange, &job);
+
+  // Existing orbits first, then the new ones, then sort and drop repeats
+  memcpy(found, catalogue->orbits, catalogue->count * sizeof(PeriodicOrbit));
+  int m = catalogue->count;
+  for (int i = 0; i < n; i++)
+    if (ok[i])
+      found[m++] = found[catalogue->count + i];
+  qsort(found, m, sizeof(PeriodicOrbit), compareOrbits);
+  int unique = 0;
+  for (int i = 0; i < m; i++)
+    if (unique == 0 || !sameOrbit(&found[unique - 1], &found[i]))
+      found[unique++] = found[i];
+
+  free(catalogue->orbits);
+  catalogue->orbits = found;
+  catalogue->count = unique;
+  catalogue->capacity = (int)(total > 0 ? total : 1);
+  free(seeds);
+  free(ok);
+  return n;
+}
+
+void upoFree(UpoCatalogue *catalogue) {
+  free(catalogue->orbits);
+  catalogue->orbits = NULL;
+  catalogue->count = catalogue->capacity = 0;
+}
+
+/*
+ *  Sample n points evenly in time around one period of the orbit
+ */
+void upoTrace(const UpoConfig *config, const PeriodicOrbit *orbit,
+              Point3D *path, int n) {
+  int sub = (int)ceil(orbit->period / (n * UPO_DT));
+  double h = orbit->period / ((double)n * sub);
+  double x[3] = {orbit->x[0], orbit->x[1], orbit->x[2]};
+  for (int i = 0; i < n; i++) {
+    path[i] = (Point3D){x[0], x[1], x[2]};
+    for (int k = 0; k < sub; k++)
+      rk4Step(config, x, h);
+  }
+}
+
+/*
+ *  upo [time [eps [loops]]]: search a long trajectory for periodic orbits
+ */
+int upoCommand(int argc, char *argv[]) {
+  double time = argc > 1 ? atof(argv[1]) : 2000.0;
+  UpoConfig config;
+  upoDefaultConfig(&config, 10.0, 2.6666, 28.0);
+  if (argc > 2)
+    config.eps = atof(argv[2]);
+  if (argc > 3)
+    config.maxLoops = atoi(argv[3]);
+
+  // Every tenth Euler step after a transient is plenty for seeding
+  int stride = 10, count = (int)(time / (stride * LORENZ_DT));
+  if (count < 2 || config.eps <= 0 || config.maxLoops < 1) {
+    fprintf(stderr, "upo: need time > 0.02, eps > 0 and loops >= 1\n");
+    return 1;
+  }
+  Point3D *points = malloc((size_t)count * sizeof(Point3D));
+  if (!points) {
+    fprintf(stderr, "upo: cannot allocate %d points\n", count);
+    return 1;
+  }
+  double x = 1, y = 1, z = 1;
+  for (int i = 0; i < 10000; i++)
+    lorenzStep(config.s, config.b, config.r, LORENZ_DT, &x, &y, &z);
+  for (int i = 0; i < count; i++) {
+    for (int k = 0; k < stride; k++)
+      lorenzStep(config.s, config.b, config.r, LORENZ_DT, &x, &y, &z);
+    points[i] = (Point3D){x, y, z};
+  }
+
+  UpoCatalogue catalogue = {0, 0, NULL};
+  double t0 = wallTime();
+  int tried = upoSearch(&config, points, count, stride * LORENZ_DT, &catalogue);
+  double t = wallTime() - t0;
+  free(points);
+  if (tried < 0) {
+    fprintf(stderr, "upo: out of memory\n");
+    return 1;
+  }
+
+  printf("UPO search over %.0f time units, eps=%g, loops<=%d, threads=%d: "
+         "%d candidates in %.3f s (%.0f/s), %d distinct orbits\n",
+         time, config.eps, config.maxLoops, parallelThreads(), tried, t,
+         tried / t, catalogue.count);
+  printf("%-*s %10s %12s %12s %10s\n", UPO_MAX_SYMBOLS, "itinerary", "period",
+         "unstable", "stable", "lambda");
+  for (int i = 0; i < catalogue.count; i++) {
+    const PeriodicOrbit *o = &catalogue.orbits[i];
+    printf("%-*s %10.6f %12.5g %12.5g %10.5f\n", UPO_MAX_SYMBOLS, o->itinerary,
+           o->period, o->multipliers[0], o->multipliers[1],
+           log(fabs(o->multipliers[0])) / o->period);
+  }
+  upoFree(&catalogue);
+  return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef UPO_H
+#define UPO_H
+
+#include "state.h"
+
+#define UPO_MAX_SYMBOLS 24 // Longest itinerary kept in the catalogue
+
+// Search settings for unstable periodic orbits of the Lorenz-63 flow
+typedef struct {
+  double s;
+  double b;
+  double r;
+  double eps;        // Close-return distance on the section z = r - 1
+  int maxLoops;      // Longest seed, in returns to the section
+  int maxCandidates; // Cap on seeds refined per search
+} UpoConfig;
+
+// One periodic orbit, anchored where it crosses z = r - 1 going up
+typedef struct {
+  double x[3];
+  double period;
+  double multipliers[2]; // Nontrivial Floquet multipliers, unstable first
+                         // (both the modulus when complex)
+  char itinerary[UPO_MAX_SYMBOLS + 1]; // L/R at each maximum of z,
+                                       // smallest rotation
+} PeriodicOrbit;
+
+typedef struct {
+  int count;
+  int capacity;
+  PeriodicOrbit *orbits; // Sorted by itinerary length, then itinerary
+} UpoCatalogue;
+
+void upoDefaultConfig(UpoConfig *config, double s, double b, double r);
+int upoSearch(const UpoConfig *config, const Point3D *points, int count,
+              double dt, UpoCatalogue *catalogue);
+void upoFree(UpoCatalogue *catalogue);
+void upoTrace(const UpoConfig *config, const PeriodicOrbit *orbit,
+              Point3D *path, int n);
+int upoCommand(int argc, char *argv[]);
+
+#endif // UPO_H